@@ -23,6 +23,7 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 #include "../CayenneUtils/CayenneDefines.h"
 #include "../CayenneUtils/CayenneUtils.h"
 #include "../CayenneUtils/CayenneDataArray.h"
+#include "CayenneStaticChannel.h"
 
 namespace CayenneMQTT
 {
@@ -53,7 +54,199 @@ namespace CayenneMQTT
 		*/
 		const char* getUnit(size_t index = 0) const { return values[index].unit; }
 	} MessageData;
-	
+
+	/**
+	* A channel to publish data to, with its topic and type/unit prefix serialized once by MQTTClient::initChannel.
+	* Publishing to it only appends the value and writes the packet's fixed header, rather than rebuilding the topic
+	* and payload each time. The value is written into the channel, so a channel must not be published to from two
+	* threads at once.
+	* @class Channel
+	*/
+	class Channel
+	{
+	public:
+		/**
+		* Create a channel, which must be initialized with MQTTClient::initChannel before it is published to.
+		*/
+		Channel() : _prefixLength(0), _length(0), _precision(CAYENNE_DEFAULT_PRECISION), _retained(false) {
+		};
+
+		/**
+		* Build the topic and payload prefix of the channel.
+		* @param[in] username Cayenne username
+		* @param[in] clientID Cayennne client ID
+		* @param[in] topic Cayenne topic
+		* @param[in] channel The channel to send data to, or CAYENNE_NO_CHANNEL if there is none
+		* @param[in] type Type to use for a type=value pair, can be NULL if sending to a topic that doesn't require type
+		* @param[in] unit Optional unit to use for a type,unit=value payload, can be NULL
+		* @return success code
+		*/
+		int init(const char* username, const char* clientID, CayenneTopic topic, unsigned int channel, const char* type, const char* unit) {
+			// an empty value gives the topic followed by the "type,unit=" prefix
+			CayenneValuePair valuePair[1];
+			size_t size = sizeof(_packet);
+			valuePair[0].unit = unit;
+			valuePair[0].value = "";
+			int result = CayenneBuildDataPublish(_packet, &size, username, clientID, topic, channel, type, valuePair, 1);
+			_prefixLength = _length = (result == CAYENNE_SUCCESS) ? static_cast<int>(size) : 0;
+			_retained = (topic != COMMAND_TOPIC);
+			return result;
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(const char* value) {
+			size_t length = strlen(value);
+			if (_prefixLength == 0)
+				return CAYENNE_FAILURE;
+			if (length > static_cast<size_t>(CAYENNE_MAX_MESSAGE_SIZE - _prefixLength))
+				return CAYENNE_BUFFER_OVERFLOW;
+			memcpy(&_packet[_prefixLength], value, length);
+			_length = _prefixLength + static_cast<int>(length);
+			return CAYENNE_SUCCESS;
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(int value) {
+			return setValue(static_cast<long>(value));
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(unsigned int value) {
+			return setValue(static_cast<unsigned long>(value));
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(long value) {
+			size_t length = valueSize();
+			int result = CayenneFormatLong(valueStart(), &length, value);
+			return setLength(result, length);
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(unsigned long value) {
+			size_t length = valueSize();
+			int result = CayenneFormatULong(valueStart(), &length, value);
+			return setLength(result, length);
+		};
+
+		/**
+		* Set the value sent by the next publish, with the channel's precision.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(double value) {
+			return setValue(value, _precision);
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @param[in] precision The most decimal places to send, or CAYENNE_PRECISION_SHORTEST
+		* @return success code
+		*/
+		int setValue(double value, int precision) {
+			size_t length = valueSize();
+			int result = CayenneFormatDouble(valueStart(), &length, value, precision);
+			return setLength(result, length);
+		};
+
+		/**
+		* Set the value sent by the next publish, with the channel's precision.
+		* @param[in] value Data value
+		* @return success code
+		*/
+		int setValue(float value) {
+			return setValue(value, _precision);
+		};
+
+		/**
+		* Set the value sent by the next publish.
+		* @param[in] value Data value
+		* @param[in] precision The most decimal places to send, or CAYENNE_PRECISION_SHORTEST
+		* @return success code
+		*/
+		int setValue(float value, int precision) {
+			size_t length = valueSize();
+			int result = CayenneFormatFloat(valueStart(), &length, value, precision);
+			return setLength(result, length);
+		};
+
+		/**
+		* Set the most decimal places floating point values are sent with.
+		* @param[in] precision The most decimal places, or CAYENNE_PRECISION_SHORTEST, CAYENNE_DEFAULT_PRECISION by default
+		*/
+		void setPrecision(int precision) { _precision = precision; }
+
+		/**
+		* Get the packet, from the topic length to the end of the value.
+		* @return The packet
+		*/
+		const unsigned char* packet() const { return _packet; }
+
+		/**
+		* Get the length of the packet.
+		* @return The length, 0 if the channel hasn't been initialized
+		*/
+		int length() const { return _length; }
+
+		/**
+		* Check if publishes to the channel are retained.
+		* @return true if they are retained
+		*/
+		bool retained() const { return _retained; }
+
+	private:
+		/**
+		* Get where the value is written, after the prefix.
+		*/
+		char* valueStart() { return reinterpret_cast<char*>(&_packet[_prefixLength]); }
+
+		/**
+		* Get the space for the value, with its terminating null, 0 if the channel hasn't been initialized.
+		*/
+		size_t valueSize() const { return _prefixLength ? sizeof(_packet) - _prefixLength : 0; }
+
+		/**
+		* Set the length of the packet after a number has been written as the value.
+		* @param[in] result The result of formatting the number
+		* @param[in] length The length of the number
+		* @return success code
+		*/
+		int setLength(int result, size_t length) {
+			if (_prefixLength == 0)
+				return CAYENNE_FAILURE;
+			if (result == CAYENNE_SUCCESS)
+				_length = _prefixLength + static_cast<int>(length);
+			return result;
+		};
+
+		unsigned char _packet[CAYENNE_MAX_MESSAGE_SIZE + 1]; // room for the null that ends a number value
+		int _prefixLength;
+		int _length;
+		int _precision;
+		bool _retained;
+	};
+
 	/**
 	* Client class for connecting to Cayenne via MQTT.
 	* @class MQTTClient
@@ -61,12 +254,17 @@ namespace CayenneMQTT
 	* @param Timer A timer class with the methods: countdown_ms, countdown, left_ms, expired. See TimerInterface.h for function definitions.
 	* @param MAX_MQTT_PACKET_SIZE Maximum size of an MQTT message, in bytes.
 	* @param MAX_MESSAGE_HANDLERS Maximum number of message handlers.
+	* @param Transport The protocol client, MQTT::Client by default. See MQTTSNClient for MQTT-SN over UDP.
+	* The methods return CAYENNE_SUCCESS, which is MQTT::SUCCESS, or the error of the topic or payload building or of the MQTT
+	* call that failed.
 	*/
-	template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = CAYENNE_MAX_MESSAGE_SIZE, int MAX_MESSAGE_HANDLERS = 5>
-	class MQTTClient : private MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, 1>
+	template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = CAYENNE_MAX_MESSAGE_SIZE, int MAX_MESSAGE_HANDLERS = 5,
+		class Transport = MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, 1> >
+	class MQTTClient : private Transport
 	{
 	public:
-		typedef MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, 1> Base;
+		typedef Transport Base;
+		typedef Network NetworkType;
 		typedef void(*CayenneMessageHandler)(MessageData&);
 
 		/**
@@ -78,7 +276,7 @@ namespace CayenneMQTT
 		* @param[in] command_timeout_ms Timeout for commands in milliseconds.
 		*/
 		MQTTClient(Network& network, const char* username = NULL, const char* password = NULL, const char* clientID = NULL, unsigned int command_timeout_ms = 30000) : 
-			Base(network, command_timeout_ms), _username(username), _password(password), _clientID(clientID)
+			Base(network, command_timeout_ms), _username(username), _password(password), _clientID(clientID), _mqttVersion(3)
 		{
 			Base::setDefaultMessageHandler(this, &MQTTClient::mqttMessageArrived);
 		};
@@ -94,6 +292,25 @@ namespace CayenneMQTT
 			_username = username;
 			_password = password;
 			_clientID = clientID;
+			Base::clearConnectCache();
+		};
+
+		/**
+		* Set the MQTT protocol version used by the next connect.
+		* @param[in] version 3 for MQTT 3.1, the default, 4 for MQTT 3.1.1 or 5 for MQTT 5.0. With MQTT 5.0 each topic is sent in full once per connection and as a 2 byte alias after that.
+		*/
+		void setMQTTVersion(unsigned char version)
+		{
+			_mqttVersion = version;
+			Base::clearConnectCache();
+		};
+
+		/**
+		* Get the MQTT 5 reason code of the last failure reported by the server.
+		* @return The reason code, 0 if nothing has failed since connecting
+		*/
+		int getReasonCode() {
+			return Base::getReasonCode();
 		};
 
 		/**
@@ -121,17 +338,46 @@ namespace CayenneMQTT
 		* @param[in] username Cayenne username
 		* @param[in] password Cayenne password
 		* @param[in] clientID Cayennne client ID
+		* @param[in] resume Ask the server to keep the session, so after a reconnect the subscriptions are still in place, see isSessionPresent
 		* @return success code
 		*/
-		int connect() {
+		int connect(bool resume = false) {
 			MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
-			data.MQTTVersion = 3;
+			data.MQTTVersion = _mqttVersion;
+			data.cleansession = resume ? 0 : 1;
 			data.username.cstring = const_cast<char*>(_username);
 			data.password.cstring = const_cast<char*>(_password);
 			data.clientID.cstring = const_cast<char*>(_clientID);
 			return Base::connect(data);
 		};
 
+		/**
+		* Start connecting to the Cayenne server without waiting for a reply. Subscriptions and publishes made before finishConnect
+		* are sent in the same write as the connect packet, and finishConnect checks all the replies together, so a reconnect
+		* takes about one round trip. The connect packet is built by the first call and reused after that, until resume changes.
+		* @param[in] resume Ask the server to keep the session, as connect does
+		* @return success code
+		*/
+		int beginConnect(bool resume = false) {
+			if (Base::isConnectCached() && Base::isConnectCleanSession() == !resume)
+				return Base::beginConnect();
+			MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+			data.MQTTVersion = _mqttVersion;
+			data.cleansession = resume ? 0 : 1;
+			data.username.cstring = const_cast<char*>(_username);
+			data.password.cstring = const_cast<char*>(_password);
+			data.clientID.cstring = const_cast<char*>(_clientID);
+			return Base::beginConnect(data);
+		};
+
+		/**
+		* Send everything queued since beginConnect and wait for the replies.
+		* @return success code
+		*/
+		int finishConnect() {
+			return Base::finishConnect();
+		};
+
 		/**
 		* Yield to allow MQTT message processing.
 		* @param[in] timeout_ms The time in milliseconds to yield for
@@ -157,6 +403,126 @@ namespace CayenneMQTT
 			return Base::disconnect();
 		};
 
+		/**
+		* Gather outgoing packets and write them together, so bursts of small publishes go out in fewer segments.
+		* @param[in] threshold The number of bytes that triggers a write, 0 to write every packet straight away
+		* @param[in] deadline_ms The longest time a packet can wait to be written, in milliseconds
+		*/
+		void setCoalescing(int threshold, int deadline_ms) {
+			Base::setCoalescing(threshold, deadline_ms);
+		};
+
+		/**
+		* Write any gathered packets now.
+		* @return success code
+		*/
+		int flush() {
+			return Base::flush();
+		};
+
+		/**
+		* Did the server keep the session from the last connection? If so, the subscriptions and handlers are still in place.
+		* @return true if the session was resumed
+		*/
+		bool isSessionPresent() {
+			return Base::isSessionPresent();
+		};
+
+		enum { SESSION_SIZE = Base::SESSION_SIZE };
+
+		/**
+		* Write a snapshot of the session, so a restarted process can resume it. See MQTT::Client::saveSession.
+		* @param[out] buffer The buffer for the snapshot
+		* @param[in] length The length of the buffer, SESSION_SIZE is always enough
+		* @return the length of the snapshot, or a negative value on failure
+		*/
+		int saveSession(unsigned char* buffer, int length) {
+			return Base::saveSession(buffer, length);
+		};
+
+		/**
+		* Read a snapshot written by saveSession, before connecting with resume.
+		* @param[in] buffer The snapshot
+		* @param[in] length The length of the snapshot
+		* @return success code
+		*/
+		int restoreSession(unsigned char* buffer, int length) {
+			return Base::restoreSession(buffer, length);
+		};
+
+		/**
+		* Set how many QoS 1 publishes, such as command responses, can be sent before their acknowledgements arrive.
+		* @param[in] window The number of unacknowledged publishes, 1 to wait for each acknowledgement
+		*/
+		void setPublishWindow(int window) {
+			Base::setPublishWindow(window);
+		};
+
+		/**
+		* Wait until every QoS 1 publish has been acknowledged.
+		* @param[in] timeout_ms The time to wait, in milliseconds
+		* @return success code
+		*/
+		int waitForAcks(unsigned long timeout_ms) {
+			return Base::waitForAcks(timeout_ms);
+		};
+
+		/**
+		* Switch between blocking and non-blocking mode, for driving the client from an event loop.
+		* @param[in] nonblocking True to return from calls without waiting for acknowledgements
+		*/
+		void setNonBlocking(bool nonblocking) {
+			Base::setNonBlocking(nonblocking);
+		};
+
+		/**
+		* Get the socket of the connection, for registering with an event loop.
+		* @return The socket file descriptor
+		*/
+		int getSocket() {
+			return Base::getSocket();
+		};
+
+		/**
+		* Check if there is queued data to send when the socket becomes writable.
+		* @return true if onWritable should be called when the socket is writable
+		*/
+		bool isWritePending() {
+			return Base::isWritePending();
+		};
+
+		/**
+		* Get the time until onTimer should next be called.
+		* @return The time in milliseconds, or -1 if no timer is running
+		*/
+		int nextTimeout_ms() {
+			return Base::nextTimeout_ms();
+		};
+
+		/**
+		* Process the data available on the socket. Call this when the socket is readable.
+		* @return success code
+		*/
+		int onReadable() {
+			return Base::onReadable();
+		};
+
+		/**
+		* Send queued data. Call this when the socket is writable and isWritePending is true.
+		* @return success code
+		*/
+		int onWritable() {
+			return Base::onWritable();
+		};
+
+		/**
+		* Handle connect timeouts and keep alive pings. Call this when nextTimeout_ms has elapsed.
+		* @return success code
+		*/
+		int onTimer() {
+			return Base::onTimer();
+		};
+
 		/**
 		* Send data to Cayenne.
 		* @param[in] topic Cayenne topic
@@ -185,12 +551,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, int value, const char* clientID = NULL) {
-			char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			itoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%d", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -205,12 +568,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, unsigned int value, const char* clientID = NULL) {
-			char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			utoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%u", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -225,12 +585,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, long value, const char* clientID = NULL) {
-			char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			ltoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%ld", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -245,12 +602,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, unsigned long value, const char* clientID = NULL) {
-			char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			ultoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%lu", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -265,12 +619,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, double value, const char* clientID = NULL) {
-			char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			dtostrf(value, 5, 3, str);
-#else
-			snprintf(str, 33, "%2.3f", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatDouble(str, &length, value, CAYENNE_DEFAULT_PRECISION);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -285,12 +636,9 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, float value, const char* clientID = NULL) {
-			char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			dtostrf(value, 5, 3, str);
-#else
-			snprintf(str, 33, "%2.3f", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatFloat(str, &length, value, CAYENNE_DEFAULT_PRECISION);
 			return publishData(topic, channel, type, unit, str, clientID);
 		};
 
@@ -305,19 +653,101 @@ namespace CayenneMQTT
 		* @return success code
 		*/
 		int publishData(CayenneTopic topic, unsigned int channel, const char* type, const CayenneValuePair* values, size_t valueCount, const char* clientID = NULL) {
-			char buffer[MAX_MQTT_PACKET_SIZE + 1] = { 0 };
-			int result = CayenneBuildTopic(buffer, sizeof(buffer), _username, clientID ? clientID : _clientID, topic, channel);
+			// the topic and payload are written once, as they appear in the packet
+			unsigned char buffer[MAX_MQTT_PACKET_SIZE];
+			size_t size = sizeof(buffer);
+			int result = CayenneBuildDataPublish(buffer, &size, _username, clientID ? clientID : _clientID, topic, channel, type, values, valueCount);
 			if (result == CAYENNE_SUCCESS) {
-				size_t size = strlen(buffer);
-				char* payload = &buffer[size + 1];
-				size = sizeof(buffer) - (size + 1);
-				result = CayenneBuildDataPayload(payload, &size, type, values, valueCount);
-				if (result == CAYENNE_SUCCESS) {
-					result = Base::publish(buffer, payload, size, MQTT::QOS0, (topic != COMMAND_TOPIC) ? true : false);
-				}
+				result = Base::publishPrepared(buffer, static_cast<int>(size), (topic != COMMAND_TOPIC) ? true : false);
+			}
+			return result;
+		};
+
+		/**
+		* Send typed data to Cayenne, formatting the values directly into the packet.
+		* @param[in] topic Cayenne topic
+		* @param[in] channel The channel to send data to, or CAYENNE_NO_CHANNEL if there is none
+		* @param[in] type Type to use for a type=value pair, NO_TYPE if sending to a topic that doesn't require type
+		* @param[in] values Typed unit/value array, see TypedDataArray
+		* @param[in] valueCount Number of values
+		* @param[in] clientID The client ID to use in the topic, NULL to use the clientID the client was initialized with
+		* @return success code
+		*/
+		int publishData(CayenneTopic topic, unsigned int channel, CayenneDataType type, const CayenneTypedValue* values, size_t valueCount, const char* clientID = NULL) {
+			unsigned char buffer[MAX_MQTT_PACKET_SIZE];
+			size_t size = sizeof(buffer);
+			int result = CayenneBuildTypedDataPublish(buffer, &size, _username, clientID ? clientID : _clientID, topic, channel, type, values, valueCount);
+			if (result == CAYENNE_SUCCESS) {
+				result = Base::publishPrepared(buffer, static_cast<int>(size), (topic != COMMAND_TOPIC) ? true : false);
+			}
+			return result;
+		};
+
+		/**
+		* Initialize a channel for publishing the same topic, type and unit repeatedly.
+		* @param[out] channelData The channel to initialize
+		* @param[in] topic Cayenne topic
+		* @param[in] channel The channel to send data to, or CAYENNE_NO_CHANNEL if there is none
+		* @param[in] type Type to use for a type=value pair, can be NULL if sending to a topic that doesn't require type
+		* @param[in] unit Optional unit to use for a type,unit=value payload, can be NULL
+		* @param[in] clientID The client ID to use in the topic, NULL to use the clientID the client was initialized with
+		* @return success code
+		*/
+		int initChannel(Channel& channelData, CayenneTopic topic, unsigned int channel, const char* type, const char* unit, const char* clientID = NULL) {
+			return channelData.init(_username, clientID ? clientID : _clientID, topic, channel, type, unit);
+		};
+
+		/**
+		* Send data to a channel initialized with initChannel.
+		* @param[in] channel The channel
+		* @param[in] value Data value, a string or any number type Channel::setValue takes
+		* @return success code
+		*/
+		template<class T>
+		int publishData(Channel& channel, T value) {
+			int result = channel.setValue(value);
+			if (result == CAYENNE_SUCCESS) {
+				result = Base::publishPrepared(channel.packet(), channel.length(), channel.retained());
+			}
+			return result;
+		};
+
+		/**
+		* Send a floating point value to a channel initialized with initChannel.
+		* @param[in] channel The channel
+		* @param[in] value Data value, a double or float
+		* @param[in] precision The most decimal places to send, or CAYENNE_PRECISION_SHORTEST
+		* @return success code
+		*/
+		template<class T>
+		int publishData(Channel& channel, T value, int precision) {
+			int result = channel.setValue(value, precision);
+			if (result == CAYENNE_SUCCESS) {
+				result = Base::publishPrepared(channel.packet(), channel.length(), channel.retained());
+			}
+			return result;
+		};
+
+#ifdef CAYENNE_STATIC_CHANNELS
+		/**
+		* Send data to a channel whose topic and payload prefix were built by the compiler.
+		* @param[in] channel The channel
+		* @param[in] value Data value, a string or any number type
+		* @param[in] precision The most decimal places of a floating point value, or CAYENNE_PRECISION_SHORTEST
+		* @return success code
+		*/
+		template<class Username, class ClientID, CayenneTopic TOPIC, unsigned int CHANNEL, CayenneDataType TYPE, CayenneUnit UNIT, class T>
+		int publishData(const StaticChannel<Username, ClientID, TOPIC, CHANNEL, TYPE, UNIT>& channel, T value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			static_assert(StaticChannel<Username, ClientID, TOPIC, CHANNEL, TYPE, UNIT>::prefixLength < MAX_MQTT_PACKET_SIZE, "The topic doesn't fit in a packet");
+			unsigned char buffer[MAX_MQTT_PACKET_SIZE + 1]; // room for the null that ends a number value
+			size_t size = sizeof(buffer);
+			int result = channel.build(buffer, &size, value, precision);
+			if (result == CAYENNE_SUCCESS) {
+				result = Base::publishPrepared(buffer, static_cast<int>(size), channel.retained);
 			}
 			return result;
 		};
+#endif
 
 		/**
 		* Send a response to a channel.
@@ -341,6 +771,24 @@ namespace CayenneMQTT
 			return result;
 		}
 
+		/**
+		* Register a topic with an MQTT-SN gateway, so publishes to it carry a 2 byte topic id rather than the topic. Topics are
+		* registered the first time they are published to anyway, this registers them up front. Only available with MQTTSNClient.
+		* @param[in] topic Cayenne topic
+		* @param[in] channel The channel, or CAYENNE_NO_CHANNEL if there is none
+		* @param[in] clientID The client ID to use in the topic, NULL to use the clientID the client was initialized with
+		* @return success code
+		*/
+		int registerTopic(CayenneTopic topic, unsigned int channel, const char* clientID = NULL) {
+			char topicName[MAX_MQTT_PACKET_SIZE] = { 0 };
+			unsigned short topicId = 0;
+			int result = CayenneBuildTopic(topicName, sizeof(topicName), _username, clientID ? clientID : _clientID, topic, channel);
+			if (result == CAYENNE_SUCCESS) {
+				result = Base::registerTopic(topicName, topicId);
+			}
+			return result;
+		}
+
 		/**
 		* Subscribe to a topic.
 		* @param[in] topic Cayenne topic
@@ -353,8 +801,10 @@ namespace CayenneMQTT
 			char topicName[MAX_MQTT_PACKET_SIZE] = { 0 };
 			int result = CayenneBuildTopic(topicName, sizeof(topicName), _username, clientID ? clientID : _clientID, topic, channel);
 			if (result == CAYENNE_SUCCESS) {
-				result = Base::subscribe(topicName, MQTT::QOS0, NULL);
-				if (handler && result == MQTT::QOS0) {
+				// the topic name is on the stack, so it isn't registered with a handler in Base, messages reach mqttMessageArrived through the default handler
+				const char* filter = topicName;
+				result = Base::subscribeMany(1, &filter, MQTT::QOS0);
+				if (handler && result == MQTT::SUCCESS) {
 					for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i) {
 						if (!_messageHandlers[i].fp.attached())	{
 							_messageHandlers[i].clientID = clientID ? clientID : _clientID;
@@ -396,6 +846,77 @@ namespace CayenneMQTT
 			return result;
 		}
 
+		/**
+		* Subscribe to several topics, packing as many as fit into each subscribe packet and sending the packets before waiting for the acknowledgements.
+		* @param[in] count Number of topics
+		* @param[in] topics Cayenne topics
+		* @param[in] channels The channel for each topic, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
+		* @param[in] clientIDs The client ID for each topic, NULL to use the clientID the client was initialized with for all of them. These strings are not copied, so they must remain available for the life of the subscriptions.
+		* @param[in] handler The message handler for all the topics, NULL to use default handler
+		* @return success code
+		*/
+		int subscribeMany(int count, const CayenneTopic topics[], const unsigned int channels[], const char* clientIDs[] = NULL, CayenneMessageHandler handler = NULL) {
+			char topicNames[MAX_MQTT_PACKET_SIZE];
+			const char* filters[MQTTCLIENT_MAX_FILTERS];
+			int result = MQTT::SUCCESS;
+			// the topic names are built a batch at a time, as many as fit in one packet, so each batch costs one round trip
+			for (int done = 0; done < count && result == MQTT::SUCCESS; ) {
+				int n = 0;
+				result = buildTopicNames(topicNames, count - done, &topics[done], &channels[done], clientIDs ? &clientIDs[done] : NULL, filters, &n);
+				if (result != CAYENNE_SUCCESS)
+					break;
+				result = Base::subscribeMany(n, filters, MQTT::QOS0);
+				for (int i = 0; handler && result == MQTT::SUCCESS && i < n; ++i) {
+					for (int j = 0; j < MAX_MESSAGE_HANDLERS; ++j) {
+						if (!_messageHandlers[j].fp.attached()) {
+							_messageHandlers[j].clientID = clientIDs ? clientIDs[done + i] : _clientID;
+							_messageHandlers[j].topic = topics[done + i];
+							_messageHandlers[j].channel = channels[done + i];
+							_messageHandlers[j].fp.attach(handler);
+							break;
+						}
+					}
+				}
+				done += n;
+			}
+			return result;
+		}
+
+		/**
+		* Unsubscribe from several topics, packing as many as fit into each unsubscribe packet.
+		* @param[in] count Number of topics
+		* @param[in] topics Cayenne topics
+		* @param[in] channels The channel for each topic, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
+		* @param[in] clientIDs The client ID for each topic, NULL to use the clientID the client was initialized with for all of them
+		* @return success code
+		*/
+		int unsubscribeMany(int count, const CayenneTopic topics[], const unsigned int channels[], const char* clientIDs[] = NULL) {
+			char topicNames[MAX_MQTT_PACKET_SIZE];
+			const char* filters[MQTTCLIENT_MAX_FILTERS];
+			int result = MQTT::SUCCESS;
+			for (int done = 0; done < count && result == MQTT::SUCCESS; ) {
+				int n = 0;
+				result = buildTopicNames(topicNames, count - done, &topics[done], &channels[done], clientIDs ? &clientIDs[done] : NULL, filters, &n);
+				if (result != CAYENNE_SUCCESS)
+					break;
+				result = Base::unsubscribeMany(n, filters);
+				for (int i = 0; result == MQTT::SUCCESS && i < n; ++i) {
+					const char* clientID = clientIDs ? clientIDs[done + i] : _clientID;
+					for (int j = 0; j < MAX_MESSAGE_HANDLERS; ++j) {
+						if ((_messageHandlers[j].topic == topics[done + i] && _messageHandlers[j].channel == channels[done + i]) &&
+							(strcmp(clientID, _messageHandlers[j].clientID) == 0)) {
+							_messageHandlers[j].clientID = NULL;
+							_messageHandlers[j].topic = UNDEFINED_TOPIC;
+							_messageHandlers[j].channel = CAYENNE_NO_CHANNEL;
+							_messageHandlers[j].fp.detach();
+						}
+					}
+				}
+				done += n;
+			}
+			return result;
+		}
+
 		/**
 		* Handler for incoming MQTT::Client messages.
 		* @param[in] md Message data
@@ -405,6 +926,8 @@ namespace CayenneMQTT
 			int result = MQTT::FAILURE;
 			MessageData message;
 
+			if (md.totallen != md.message.payloadlen)
+				return; // a fragment of a publish too big for the read buffer, which can't be parsed on its own
 			result = CayenneParseTopic(&message.topic, &message.channel, &message.clientID, _username, md.topicName.lenstring.data, md.topicName.lenstring.len);
 			if (result != CAYENNE_SUCCESS)
 				return;
@@ -432,9 +955,40 @@ namespace CayenneMQTT
 		}
 
 	private:
+		/**
+		* Build the topic names for the start of a list of topics, one after another in a buffer of a packet's size. The
+		* names that fit in the buffer also fit in one subscribe or unsubscribe packet, as each filter there also has a 2
+		* byte length, so a batch needs no more stack than a single topic.
+		* @param[out] buffer The buffer for the names
+		* @param[in] count Number of topics
+		* @param[in] topics Cayenne topics
+		* @param[in] channels The channel for each topic
+		* @param[in] clientIDs The client ID for each topic, NULL to use the clientID the client was initialized with
+		* @param[out] names Returned start of each name, room for MQTTCLIENT_MAX_FILTERS
+		* @param[out] built Returned number of names built, at least 1 on success
+		* @return success code, an error if the first name doesn't fit
+		*/
+		int buildTopicNames(char (&buffer)[MAX_MQTT_PACKET_SIZE], int count, const CayenneTopic topics[], const unsigned int channels[], const char* clientIDs[], const char* names[], int* built) {
+			size_t used = 0;
+			int result = CAYENNE_SUCCESS;
+			*built = 0;
+			while (*built < count && *built < MQTTCLIENT_MAX_FILTERS && used < sizeof(buffer)) {
+				int n = *built;
+				result = CayenneBuildTopic(&buffer[used], sizeof(buffer) - used, _username, clientIDs ? clientIDs[n] : _clientID, topics[n], channels[n]);
+				if (result != CAYENNE_SUCCESS)
+					break;
+				names[n] = &buffer[used];
+				used += strlen(&buffer[used]) + 1;
+				++*built;
+			}
+			// a name that doesn't fit after others starts the next batch
+			return (result == CAYENNE_BUFFER_OVERFLOW && *built > 0) ? CAYENNE_SUCCESS : result;
+		}
+
 		const char* _username;
 		const char* _password;
 		const char* _clientID;
+		unsigned char _mqttVersion;
 		struct CayenneMessageHandlers
 		{
 			const char* clientID;
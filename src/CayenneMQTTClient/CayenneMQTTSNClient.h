@@ -0,0 +1,58 @@
+/*
+The MIT License(MIT)
+
+Cayenne MQTT Client Library
+Copyright (c) 2016 myDevices
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+documentation files(the "Software"), to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _CAYENNEMQTTSNCLIENT_h
+#define _CAYENNEMQTTSNCLIENT_h
+
+#include "CayenneMQTTClient.h"
+#include "MQTTSNClient.h"
+
+namespace CayenneMQTT
+{
+	/**
+	* Client class for connecting to Cayenne through an MQTT-SN gateway, for links where every byte counts. Each Cayenne topic
+	* is registered with the gateway the first time it is used, and after that a publish carries its 2 byte topic id in place
+	* of the topic. The gateway supplies the Cayenne username and password to the broker, MQTT-SN has no way to send them.
+	* The calls are those of MQTTClient, except beginConnect, sessions, coalescing and non-blocking mode, which aren't available.
+	* @class MQTTSNClient
+	* @param Network A datagram network class with the methods: read, write, such as MQTTUDPNetwork. Each read returns one datagram.
+	* @param Timer A timer class with the methods: countdown_ms, countdown, left_ms, expired. See TimerInterface.h for function definitions.
+	* @param MAX_MQTT_PACKET_SIZE Maximum size of an MQTT-SN message, in bytes.
+	* @param MAX_MESSAGE_HANDLERS Maximum number of message handlers.
+	*/
+	template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = CAYENNE_MAX_MESSAGE_SIZE, int MAX_MESSAGE_HANDLERS = 5>
+	class MQTTSNClient : public MQTTClient<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MQTTSN::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, 1> >
+	{
+	public:
+		typedef MQTTClient<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MQTTSN::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, 1> > CayenneClient;
+
+		/**
+		* Create a Cayenne MQTT-SN client object.
+		* @param[in] network Pointer to an instance of the Network class. Must be connected to the gateway before calling MQTTSNClient connect.
+		* @param[in] username Cayenne username, used to build the topics
+		* @param[in] password Cayenne password, not sent, the gateway supplies it
+		* @param[in] clientID Cayennne client ID
+		* @param[in] command_timeout_ms Timeout for commands in milliseconds, including the retries of lost requests.
+		*/
+		MQTTSNClient(Network& network, const char* username = NULL, const char* password = NULL, const char* clientID = NULL, unsigned int command_timeout_ms = 30000) :
+			CayenneClient(network, username, password, clientID, command_timeout_ms)
+		{
+		};
+	};
+}
+
+#endif
@@ -0,0 +1,261 @@
+/*
+The MIT License(MIT)
+
+Cayenne MQTT Client Library
+Copyright (c) 2016 myDevices
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+documentation files(the "Software"), to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef _CAYENNESTATICCHANNEL_h
+#define _CAYENNESTATICCHANNEL_h
+
+#include <string.h>
+#include "../CayenneUtils/CayenneDefines.h"
+#include "../CayenneUtils/CayenneUtils.h"
+
+// Channels whose topic and payload prefix are built by the compiler. This needs C++11.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+
+#define CAYENNE_STATIC_CHANNELS
+
+/**
+* Define a string known at compile time, such as the username or client ID, for use with StaticChannel.
+* @param name The name of the type to define
+* @param string A string literal
+*/
+#define CAYENNE_STATIC_STRING(name, string) struct name { \
+	static constexpr char at(size_t i) { return (string)[i]; } \
+	static constexpr size_t length = sizeof(string) - 1; \
+}
+
+namespace CayenneMQTT
+{
+	namespace StaticString
+	{
+		/**
+		* A string as a character pack, with the characters in a null terminated array.
+		*/
+		template<char... C>
+		struct Chars
+		{
+			static const char value[sizeof...(C) + 1];
+			static constexpr size_t length = sizeof...(C);
+		};
+
+		template<char... C>
+		const char Chars<C...>::value[sizeof...(C) + 1] = { C..., '\0' };
+
+		/**
+		* Join strings.
+		*/
+		template<class... S>
+		struct Concat;
+
+		template<>
+		struct Concat<> { typedef Chars<> type; };
+
+		template<char... C>
+		struct Concat<Chars<C...> > { typedef Chars<C...> type; };
+
+		template<char... A, char... B, class... Rest>
+		struct Concat<Chars<A...>, Chars<B...>, Rest...> { typedef typename Concat<Chars<A..., B...>, Rest...>::type type; };
+
+		/**
+		* Choose a string.
+		*/
+		template<bool FIRST, class A, class B>
+		struct Select { typedef A type; };
+
+		template<class A, class B>
+		struct Select<false, A, B> { typedef B type; };
+
+		template<size_t... I>
+		struct Indices {};
+
+		template<size_t N, size_t... I>
+		struct MakeIndices { typedef typename MakeIndices<N - 1, N - 1, I...>::type type; };
+
+		template<size_t... I>
+		struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+		/**
+		* Get the characters of a string defined with CAYENNE_STATIC_STRING, or a type like it.
+		*/
+		template<class S, class I = typename MakeIndices<S::length>::type>
+		struct ToChars;
+
+		template<class S, size_t... I>
+		struct ToChars<S, Indices<I...> > { typedef Chars<S::at(I)...> type; };
+
+		/**
+		* Write a number in decimal.
+		*/
+		template<unsigned int N, char... C>
+		struct Digits { typedef typename Digits<N / 10, static_cast<char>('0' + N % 10), C...>::type type; };
+
+		template<char... C>
+		struct Digits<0, C...> { typedef Chars<C...> type; };
+
+		template<unsigned int N>
+		struct Decimal { typedef typename Digits<N / 10, static_cast<char>('0' + N % 10)>::type type; };
+
+		/**
+		* Get the length of a string.
+		*/
+		constexpr size_t length(const char* string) {
+			return *string ? 1 + length(string + 1) : 0;
+		}
+
+		/**
+		* Get the string for a topic, the same as the topic strings in CayenneTopics.h, which can't be read by the compiler.
+		*/
+		constexpr const char* topicString(CayenneTopic topic) {
+			return (topic == DATA_TOPIC) ? "data" : (topic == COMMAND_TOPIC) ? "cmd" : (topic == CONFIG_TOPIC) ? "conf" :
+				(topic == RESPONSE_TOPIC) ? "response" : (topic == SYS_MODEL_TOPIC) ? "sys/model" : (topic == SYS_VERSION_TOPIC) ? "sys/version" :
+				(topic == SYS_CPU_MODEL_TOPIC) ? "sys/cpu/model" : (topic == SYS_CPU_SPEED_TOPIC) ? "sys/cpu/speed" : "";
+		}
+
+		/**
+		* Get the string for a data type, empty for NO_TYPE.
+		*/
+		constexpr const char* typeString(CayenneDataType type) {
+			return (type == BAROMETRIC_PRESSURE_TYPE) ? TYPE_BAROMETRIC_PRESSURE : (type == BATTERY_TYPE) ? TYPE_BATTERY :
+				(type == LUMINOSITY_TYPE) ? TYPE_LUMINOSITY : (type == PROXIMITY_TYPE) ? TYPE_PROXIMITY :
+				(type == RELATIVE_HUMIDITY_TYPE) ? TYPE_RELATIVE_HUMIDITY : (type == TEMPERATURE_TYPE) ? TYPE_TEMPERATURE :
+				(type == VOLTAGE_TYPE) ? TYPE_VOLTAGE : "";
+		}
+
+		/**
+		* Get the string for a unit, empty for NO_UNIT.
+		*/
+		constexpr const char* unitString(CayenneUnit unit) {
+			return (unit == UNDEFINED_UNIT) ? UNIT_UNDEFINED : (unit == PASCAL_UNIT) ? UNIT_PASCAL : (unit == HECTOPASCAL_UNIT) ? UNIT_HECTOPASCAL :
+				(unit == PERCENT_UNIT) ? UNIT_PERCENT : (unit == RATIO_UNIT) ? UNIT_RATIO : (unit == VOLTS_UNIT) ? UNIT_VOLTS :
+				(unit == LUX_UNIT) ? UNIT_LUX : (unit == CENTIMETER_UNIT) ? UNIT_CENTIMETER : (unit == METER_UNIT) ? UNIT_METER :
+				(unit == DIGITAL_UNIT) ? UNIT_DIGITAL : (unit == FAHRENHEIT_UNIT) ? UNIT_FAHRENHEIT : (unit == CELSIUS_UNIT) ? UNIT_CELSIUS :
+				(unit == KELVIN_UNIT) ? UNIT_KELVIN : (unit == MILLIVOLTS_UNIT) ? UNIT_MILLIVOLTS : "";
+		}
+
+		template<CayenneTopic TOPIC>
+		struct TopicName {
+			static constexpr char at(size_t i) { return topicString(TOPIC)[i]; }
+			static constexpr size_t length = StaticString::length(topicString(TOPIC));
+		};
+
+		template<CayenneDataType TYPE>
+		struct TypeName {
+			static constexpr char at(size_t i) { return typeString(TYPE)[i]; }
+			static constexpr size_t length = StaticString::length(typeString(TYPE));
+		};
+
+		template<CayenneUnit UNIT>
+		struct UnitName {
+			static constexpr char at(size_t i) { return unitString(UNIT)[i]; }
+			static constexpr size_t length = StaticString::length(unitString(UNIT));
+		};
+
+		CAYENNE_STATIC_STRING(VersionPrefix, CAYENNE_VERSION "/");
+		CAYENNE_STATIC_STRING(Things, "/things/");
+	}
+
+	/**
+	* Format a data value after the payload prefix.
+	* @param[out] str Returned value string
+	* @param[in,out] length Buffer length, returns the length of the value
+	* @param[in] value Data value
+	* @param[in] precision The most decimal places of a floating point value
+	* @return success code
+	*/
+	inline int formatValue(char* str, size_t* length, const char* value, int) {
+		size_t valueLength = strlen(value);
+		if (valueLength + 1 > *length)
+			return CAYENNE_BUFFER_OVERFLOW;
+		memcpy(str, value, valueLength + 1);
+		*length = valueLength;
+		return CAYENNE_SUCCESS;
+	}
+
+	inline int formatValue(char* str, size_t* length, int value, int) { return CayenneFormatLong(str, length, value); }
+	inline int formatValue(char* str, size_t* length, unsigned int value, int) { return CayenneFormatULong(str, length, value); }
+	inline int formatValue(char* str, size_t* length, long value, int) { return CayenneFormatLong(str, length, value); }
+	inline int formatValue(char* str, size_t* length, unsigned long value, int) { return CayenneFormatULong(str, length, value); }
+	inline int formatValue(char* str, size_t* length, double value, int precision) { return CayenneFormatDouble(str, length, value, precision); }
+	inline int formatValue(char* str, size_t* length, float value, int precision) { return CayenneFormatFloat(str, length, value, precision); }
+
+	/**
+	* A channel to publish data to whose topic and payload prefix are built by the compiler, laid out as they are in the
+	* packet with the topic length in front. Publishing to it copies the prefix and formats the value after it, and
+	* it takes no memory. The username and client ID must be the ones the client connects with.
+	* @class StaticChannel
+	* @param Username Cayenne username, a type defined with CAYENNE_STATIC_STRING
+	* @param ClientID Cayenne client ID, a type defined with CAYENNE_STATIC_STRING
+	* @param TOPIC Cayenne topic
+	* @param CHANNEL The channel to send data to, or CAYENNE_NO_CHANNEL if there is none
+	* @param TYPE Type to use for a type=value pair, NO_TYPE if sending to a topic that doesn't require type
+	* @param UNIT Optional unit to use for a type,unit=value payload, NO_UNIT for none
+	*/
+	template<class Username, class ClientID, CayenneTopic TOPIC, unsigned int CHANNEL = CAYENNE_NO_CHANNEL, CayenneDataType TYPE = NO_TYPE, CayenneUnit UNIT = NO_UNIT>
+	class StaticChannel
+	{
+		typedef StaticString::Chars<'/'> Slash;
+		typedef typename StaticString::Select<CHANNEL == CAYENNE_NO_CHANNEL, StaticString::Chars<>,
+			typename StaticString::Concat<Slash, typename StaticString::Decimal<CHANNEL>::type>::type>::type Suffix;
+		typedef typename StaticString::Concat<typename StaticString::ToChars<StaticString::VersionPrefix>::type, typename StaticString::ToChars<Username>::type,
+			typename StaticString::ToChars<StaticString::Things>::type, typename StaticString::ToChars<ClientID>::type, Slash,
+			typename StaticString::ToChars<StaticString::TopicName<TOPIC> >::type, Suffix>::type Topic;
+		// "type,unit=", with UNIT_UNDEFINED for the unit if there is only a type, or "unit=" if there is only a unit
+		typedef typename StaticString::ToChars<StaticString::TypeName<TYPE> >::type Type;
+		typedef typename StaticString::ToChars<StaticString::UnitName<(TYPE != NO_TYPE && UNIT == NO_UNIT) ? UNDEFINED_UNIT : UNIT> >::type Unit;
+		typedef typename StaticString::Select<TYPE != NO_TYPE, typename StaticString::Concat<Type, StaticString::Chars<','>, Unit, StaticString::Chars<'='> >::type,
+			typename StaticString::Select<UNIT != NO_UNIT, typename StaticString::Concat<Unit, StaticString::Chars<'='> >::type, StaticString::Chars<> >::type>::type Payload;
+		typedef typename StaticString::Concat<StaticString::Chars<static_cast<char>(Topic::length >> 8), static_cast<char>(Topic::length & 0xFF)>, Topic, Payload>::type Packet;
+
+		static_assert(StaticString::TopicName<TOPIC>::length > 0, "Unknown topic");
+		static_assert(CHANNEL != CAYENNE_ALL_CHANNELS, "Data can't be published to all channels");
+
+	public:
+		/**
+		* Get the prefix of the packet, from the topic length to the end of the payload prefix.
+		* @return The prefix
+		*/
+		static const unsigned char* prefix() { return reinterpret_cast<const unsigned char*>(Packet::value); }
+
+		static constexpr int prefixLength = static_cast<int>(Packet::length); /**< The length of the prefix. */
+		static constexpr bool retained = (TOPIC != COMMAND_TOPIC); /**< Whether publishes to the channel are retained. */
+
+		/**
+		* Build the packet with a value.
+		* @param[out] buffer Returned packet, from the topic length to the end of the value, followed by a null
+		* @param[in,out] length Buffer length, returns the length of the packet
+		* @param[in] value Data value, a string or any number type
+		* @param[in] precision The most decimal places of a floating point value, or CAYENNE_PRECISION_SHORTEST
+		* @return success code
+		*/
+		template<class T>
+		static int build(unsigned char* buffer, size_t* length, T value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			size_t valueLength = 0;
+			int result = CAYENNE_BUFFER_OVERFLOW;
+			if (*length < static_cast<size_t>(prefixLength))
+				return result;
+			valueLength = *length - prefixLength;
+			memcpy(buffer, prefix(), prefixLength);
+			result = formatValue(reinterpret_cast<char*>(buffer + prefixLength), &valueLength, value, precision);
+			if (result == CAYENNE_SUCCESS)
+				*length = prefixLength + valueLength;
+			return result;
+		}
+	};
+}
+
+#endif
+
+#endif
@@ -26,6 +26,7 @@
 #include "FP.h"
 #include "MQTTPacket.h"
 #include "stdio.h"
+#include "string.h"
 #include "MQTTLogging.h"
 
 #if !defined(MQTTCLIENT_QOS1)
@@ -34,6 +35,58 @@
 #if !defined(MQTTCLIENT_QOS2)
     #define MQTTCLIENT_QOS2 0
 #endif
+#if !defined(MQTTCLIENT_WRITEV)
+    #define MQTTCLIENT_WRITEV 0 // set to 1 to send publish topics and payloads in place, requires Network::writev
+#endif
+#if !defined(MQTTCLIENT_CORK)
+    #define MQTTCLIENT_CORK 0 // set to 1 to cork the connection while a packet takes several writes, requires Network::setCork
+#endif
+/*
+ * Memory budget. Every buffer below is part of the client object. By default each store holds one packet of
+ * MAX_MQTT_PACKET_SIZE bytes, and the receive buffer and send queue hold 512 bytes each, so on Linux with the Cayenne
+ * packet size of 134 bytes a CayenneMQTT::MQTTClient is 2.6 KB. reactorbench checks it stays within 3 KB. With
+ * MQTTCLIENT_EMBEDDED, the default for AVR and Arduino, the receive buffer and send queue also hold one packet and the
+ * publish window and filter count shrink, 1.6 KB on Linux and less with the 2 byte pointers of AVR. Larger stores,
+ * topic aliases and MQTTCLIENT_QOS2, which adds 8 KB of packet ids, are opt-in.
+ */
+#if !defined(MQTTCLIENT_EMBEDDED)
+    #if defined(__AVR__) || defined(ARDUINO)
+        #define MQTTCLIENT_EMBEDDED 1 // smallest buffers by default, for boards with a few kilobytes of RAM
+    #else
+        #define MQTTCLIENT_EMBEDDED 0
+    #endif
+#endif
+#if !defined(MQTTCLIENT_RECVBUF_SIZE)
+    #define MQTTCLIENT_RECVBUF_SIZE (MQTTCLIENT_EMBEDDED ? 0 : 512) // bytes requested from the network per read, rounded up to the packet size
+#endif
+#if !defined(MQTTCLIENT_SENDQUEUE_SIZE)
+    #define MQTTCLIENT_SENDQUEUE_SIZE (MQTTCLIENT_EMBEDDED ? 0 : 512) // bytes that can wait for the network in non-blocking mode, rounded up to the packet size
+#endif
+#if !defined(MQTTCLIENT_MAX_INFLIGHT)
+    #define MQTTCLIENT_MAX_INFLIGHT (MQTTCLIENT_EMBEDDED ? 2 : 16) // largest QoS 1 publish window, see setPublishWindow
+#endif
+#if !defined(MQTTCLIENT_MAX_FILTERS)
+    #define MQTTCLIENT_MAX_FILTERS (MQTTCLIENT_EMBEDDED ? 4 : 16) // most topic filters in one subscribe or unsubscribe packet, see subscribeMany
+#endif
+#if !defined(MQTTCLIENT_INFLIGHT_STORE_SIZE)
+    #define MQTTCLIENT_INFLIGHT_STORE_SIZE 0 // bytes of unacknowledged publishes kept for resending on reconnect, rounded up to the packet size
+#endif
+#if !defined(MQTTCLIENT_SUBSCRIPTION_STORE_SIZE)
+    #define MQTTCLIENT_SUBSCRIPTION_STORE_SIZE 0 // bytes of topic filters kept for a session the server keeps, rounded up to the packet size
+#endif
+#if !defined(MQTTCLIENT_ACK_DEADLINE_MS)
+    #define MQTTCLIENT_ACK_DEADLINE_MS 5 // longest time an acknowledgement waits while more received packets are handled
+#endif
+#if !defined(MQTTCLIENT_MQTT5)
+    #define MQTTCLIENT_MQTT5 1 // set to 0 to leave out MQTT 5, connecting with MQTTVersion 5 then fails
+#endif
+#if !defined(MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE) || !MQTTCLIENT_MQTT5
+    #undef MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE
+    #define MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE 0 // bytes of topic names kept for MQTT 5 topic aliases, 0 to send every topic in full
+#endif
+#if !defined(MQTTCLIENT_SESSION_EXPIRY)
+    #define MQTTCLIENT_SESSION_EXPIRY 86400 // seconds an MQTT 5 server keeps a session that isn't clean once the connection closes
+#endif
 
 namespace MQTT
 {
@@ -58,11 +111,25 @@ struct Message
 
 struct MessageData
 {
-    MessageData(MQTTString &aTopicName, struct Message &aMessage)  : message(aMessage), topicName(aTopicName)
+    MessageData(MQTTString &aTopicName, struct Message &aMessage)  : message(aMessage), topicName(aTopicName),
+        offset(0), totallen(aMessage.payloadlen)
     { }
 
     struct Message &message;
     MQTTString &topicName;
+    size_t offset;      // of message.payload in the whole payload, which is more than 0 for the later fragments of a large publish
+    size_t totallen;    // of the whole payload, more than message.payloadlen if the publish is delivered in fragments
+};
+
+
+/**
+ * A chunk of payload for publishStream to fill.
+ */
+struct PayloadChunk
+{
+    unsigned char* data;    // the buffer to fill
+    int len;                // the length of the buffer, which is no more than what is left of the payload
+    size_t offset;          // of the chunk in the payload
 };
 
 
@@ -79,6 +146,16 @@ public:
         return next = (next == MAX_PACKET_ID) ? 1 : next + 1;
     }
 
+    int getLast()
+    {
+        return next;
+    }
+
+    void setLast(int id)
+    {
+        next = (id < 0 || id > MAX_PACKET_ID) ? 0 : id;
+    }
+
 private:
     static const int MAX_PACKET_ID = 65535;
     int next;
@@ -91,6 +168,16 @@ private:
  *
  * This version of the API blocks on all method calls, until they are complete.  This means that only one
  * MQTT request can be in process at any one time.
+ *
+ * The client can also be switched to non-blocking mode with setNonBlocking, so it can be driven from an
+ * application's own event loop. In this mode connect, subscribe, unsubscribe and publish queue their packet
+ * and return without waiting for the acknowledgement, and the application calls onReadable, onWritable and
+ * onTimer when the socket is readable, when it is writable while isWritePending is true, and when
+ * nextTimeout_ms has elapsed.
+ *
+ * Connecting with MQTTVersion 5 uses MQTT 5.0, unless MQTTCLIENT_MQTT5 is 0. The client then sends each topic name in full only once per
+ * connection and a 2 byte topic alias after that, keeps to the receive maximum and maximum packet size the server
+ * sets in its connack, and keeps the reason code of the last refusal, see getReasonCode.
  * @param Network a network class with the methods: read, write. See NetworkInterface.h for function definitions.
  * @param Timer a timer class with the methods: countdown_ms, countdown, left_ms, expired. See TimerInterface.h for function definitions.
  */
@@ -100,6 +187,7 @@ class Client
 
 public:
 
+    typedef Network NetworkType;
     typedef void (*messageHandler)(MessageData&);
 
     /** Construct the client
@@ -141,6 +229,49 @@ public:
      */
     int connect(MQTTPacket_connectData& options);
 
+    /** MQTT Connect without waiting for the connack. The connect packet is held in the send queue, and the subscribe,
+     *  unsubscribe and publish calls made before finishConnect queue their packets behind it without waiting for
+     *  acknowledgements, so everything goes out in one write and the acknowledgements come back together, about one
+     *  round trip in all. The connect packet is serialized once and kept, for beginConnect without options to reuse
+     *  on reconnect. QoS 1 and 2 publishes are limited by the publish window. Not used in non-blocking mode.
+     *  @param options - connect options
+     *  @return success code -
+     */
+    int beginConnect(MQTTPacket_connectData& options);
+
+    /** MQTT Connect without waiting for the connack, reusing the connect packet from the last beginConnect with options
+     *  @return success code - FAILURE if there is no connect packet
+     */
+    int beginConnect();
+
+    /** Send the packets queued since beginConnect, then wait for the connack and all their acknowledgements
+     *  @return success code - the connack return code if the connection was refused, 0x80 if a subscription was refused
+     */
+    int finishConnect();
+
+    /** Is there a connect packet kept from beginConnect?
+     *  @return flag - true if beginConnect can be called without options
+     */
+    bool isConnectCached()
+    {
+        return connectlen > 0;
+    }
+
+    /** Does the kept connect packet ask for a clean session?
+     *  @return flag - the cleansession option of the last beginConnect with options
+     */
+    bool isConnectCleanSession()
+    {
+        return connectCleansession;
+    }
+
+    /** Forget the kept connect packet, for instance when the credentials change
+     */
+    void clearConnectCache()
+    {
+        connectlen = 0;
+    }
+
     /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
      *  @param topic - the topic to publish to
      *  @param message - the message to send
@@ -169,6 +300,66 @@ public:
      */
     int publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false);
 
+    /** MQTT Publish a QoS 0 packet that was serialized ahead of time, apart from the fixed header. Only the fixed
+     *  header is written, the rest is sent from the caller's buffer when writev is available. With MQTT 5 the topic
+     *  is taken out and published as usual, so it can still be sent as an alias.
+     *  @param packet - the topic as a 2 byte length and the topic name, followed by the payload
+     *  @param packetlen - the length of packet
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publishPrepared(const unsigned char* packet, int packetlen, bool retained = false);
+
+    typedef int (*payloadSource)(PayloadChunk&);
+
+    /** MQTT Publish a payload that is too big for the send buffer or isn't in memory. The packet header is written
+     *  first, then the payload a chunk at a time as the source fills sendbuf, so the payload can be any length the
+     *  server accepts. The publish is never kept for resending on reconnect. Not used in non-blocking mode.
+     *  @param topicName - the topic to publish to
+     *  @param payloadlen - the length of the whole payload
+     *  @param source - called to fill each chunk, returning the number of bytes filled or a negative value to give up.
+     *      Giving up on the first chunk fails the publish before anything is sent, and the connection is kept. Giving
+     *      up later disconnects the network, as the packet can't be finished.
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publishStream(const char* topicName, size_t payloadlen, payloadSource source, enum QoS qos = QOS0, bool retained = false)
+    {
+        FP<int, PayloadChunk&> fp;
+        fp.attach(source);
+        unsigned short id = 0;
+        return publishStream(topicName, payloadlen, fp, id, qos, retained);
+    }
+
+    /** MQTT Publish a payload that is too big for the send buffer or isn't in memory, see above
+     *  @param topicName - the topic to publish to
+     *  @param payloadlen - the length of the whole payload
+     *  @param item - address of initialized object
+     *  @param source - called to fill each chunk
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    template<class T>
+    int publishStream(const char* topicName, size_t payloadlen, T *item, int (T::*source)(PayloadChunk&), enum QoS qos = QOS0, bool retained = false)
+    {
+        FP<int, PayloadChunk&> fp;
+        fp.attach(item, source);
+        unsigned short id = 0;
+        return publishStream(topicName, payloadlen, fp, id, qos, retained);
+    }
+
+    /** Deliver incoming publishes that are too big for the read buffer to the message handlers in fragments, each
+     *  with its offset in the payload and the length of the whole payload in the MessageData. Otherwise, the default,
+     *  they are read and skipped. Either way they are acknowledged once the last byte has been read.
+     *  @param enabled - true to deliver fragments, false to skip large publishes
+     */
+    void setFragmentDelivery(bool enabled)
+    {
+        fragmentDelivery = enabled;
+    }
+
     /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
      *  @param topicFilter - a topic pattern which can include wildcards
      *  @param qos - the MQTT QoS to subscribe at
@@ -183,6 +374,25 @@ public:
      */
     int unsubscribe(const char* topicFilter);
 
+    /** MQTT Subscribe to several topic filters - pack as many filters as fit into each subscribe packet, send all
+     *  the packets and then wait for the subacks, so the filters cost one round trip rather than one each
+     *  @param count - the number of topic filters
+     *  @param topicFilters - topic patterns which can include wildcards. The strings are not copied.
+     *  @param qos - the MQTT QoS to subscribe at
+     *  @param mhs - the callback function for each filter, or NULL. Filters without one use the default handler.
+     *  @param grantedQoSs - returns the QoS granted for each filter, 0x80 if it was refused, or NULL
+     *  @return success code - 0x80 if any filter was refused
+     */
+    int subscribeMany(int count, const char* topicFilters[], enum QoS qos, messageHandler mhs[] = NULL, int grantedQoSs[] = NULL);
+
+    /** MQTT Unsubscribe from several topic filters - pack as many filters as fit into each unsubscribe packet, send
+     *  all the packets and then wait for the unsubacks
+     *  @param count - the number of topic filters
+     *  @param topicFilters - topic patterns which can include wildcards
+     *  @return success code -
+     */
+    int unsubscribeMany(int count, const char* topicFilters[]);
+
     /** MQTT Disconnect - send an MQTT disconnect packet, and clean up any state
      *  @return success code -
      */
@@ -204,18 +414,220 @@ public:
         return isconnected;
     }
 
+    /** Did the server keep the session from an earlier connection? With cleansession 0, the topic filters subscribed
+     *  to are remembered along with the session. When the server reports the session present, the message handlers
+     *  are kept and subscribing to one of those filters again only registers its handler, without a round trip. When
+     *  it doesn't, the client subscribes to them again itself before the connect completes.
+     *  @return flag - true if the last connack reported the session present
+     */
+    bool isSessionPresent()
+    {
+        return sessionPresent;
+    }
+
+    /** Get the MQTT 5 reason code of the last failure reported by the server, in a connack, suback, puback, pubrec or
+     *  disconnect packet. Requests that fail this way return FAILURE, or the code itself from connect.
+     *  @return the reason code, 0 if nothing has failed since connecting
+     */
+    int getReasonCode()
+    {
+        return reasonCode;
+    }
+
+    enum
+    {
+        INFLIGHTSTORE_SIZE = (MQTTCLIENT_INFLIGHT_STORE_SIZE > MAX_MQTT_PACKET_SIZE) ? MQTTCLIENT_INFLIGHT_STORE_SIZE : MAX_MQTT_PACKET_SIZE,
+        SUBSCRIPTIONSTORE_SIZE = (MQTTCLIENT_SUBSCRIPTION_STORE_SIZE > MAX_MQTT_PACKET_SIZE) ? MQTTCLIENT_SUBSCRIPTION_STORE_SIZE : MAX_MQTT_PACKET_SIZE,
+        // the largest publish resendInflight can send, only writev sends it from the store without copying it to sendbuf
+        STORED_PACKET_SIZE = MQTTCLIENT_WRITEV ? INFLIGHTSTORE_SIZE : MAX_MQTT_PACKET_SIZE,
+        QOS2IDS_SIZE = 65536 / 8,   // a bit for each packet id
+        // the largest snapshot written by saveSession
+        SESSION_SIZE = 7 + MQTTCLIENT_MAX_INFLIGHT * 6 + INFLIGHTSTORE_SIZE + 2 + SUBSCRIPTIONSTORE_SIZE + 2 + (MQTTCLIENT_QOS2 ? QOS2IDS_SIZE : 0)
+    };
+
+    /** Write a snapshot of the session state, so a restarted process can reconnect with cleansession 0 and carry on:
+     *  the packet id counter, the unacknowledged publishes, the ids of incoming QoS 2 publishes not yet released and
+     *  the topic filters subscribed to. Message handlers are not included, they are registered again by subscribing.
+     *  @param buf - the buffer for the snapshot
+     *  @param buflen - the length of the buffer, SESSION_SIZE is always enough
+     *  @return the length of the snapshot, or BUFFER_OVERFLOW
+     */
+    int saveSession(unsigned char* buf, int buflen);
+
+    /** Read a snapshot written by saveSession, before connecting with cleansession 0
+     *  @param buf - the snapshot
+     *  @param len - the length of the snapshot
+     *  @return success code - FAILURE if the client is connected or the snapshot is not valid
+     */
+    int restoreSession(unsigned char* buf, int len);
+
+    /** Gather outgoing packets in the send queue and write them together, so a burst of small publishes goes out
+     *  in fewer segments. The queue is written when it holds threshold bytes, when the deadline after the first
+     *  queued packet has passed, when flush is called, and before the client waits for incoming data. With
+     *  MQTTCLIENT_CORK, the connection is corked while a queue the network doesn't take in one write is written.
+     *  @param threshold - the number of bytes that triggers a write, 0 to write every packet straight away
+     *  @param deadline_ms - the longest time a packet can wait in the queue, in milliseconds
+     */
+    void setCoalescing(int threshold, int deadline_ms)
+    {
+        coalesceThreshold = (threshold > SENDQUEUE_SIZE) ? SENDQUEUE_SIZE : threshold;
+        coalesceDeadline_ms = deadline_ms;
+    }
+
+    /** Write any packets gathered in the send queue.
+     *  @return success code
+     */
+    int flush();
+
+    /** Set how many QoS 1 publishes can be waiting for their acknowledgement. With a window of 1, the default,
+     *  publish waits for each acknowledgement, so there is one message per round trip to the server. With a larger
+     *  window publish returns once the message is sent and the window has room, and the acknowledgements are matched
+     *  to the publishes by packet id as they arrive. In non-blocking mode publish fails while the window is full.
+     *  @param window - the number of unacknowledged publishes, from 1 to MQTTCLIENT_MAX_INFLIGHT
+     */
+    void setPublishWindow(int window)
+    {
+        publishWindow = (window < 1) ? 1 : (window > MQTTCLIENT_MAX_INFLIGHT) ? MQTTCLIENT_MAX_INFLIGHT : window;
+    }
+
+    /** Set the callback invoked with the packet id of each QoS 1 or 2 publish that is acknowledged
+     *  @param handler - pointer to the callback function
+     */
+    void setPublishAckHandler(void (*handler)(unsigned short))
+    {
+        publishAckHandler.attach(handler);
+    }
+
+    /** Set the callback invoked with the packet id of each QoS 1 or 2 publish that is acknowledged
+     *  @param item - address of initialized object
+     *  @param handler - pointer to the callback function
+     */
+    template<class T>
+    void setPublishAckHandler(T *item, void (T::*handler)(unsigned short))
+    {
+        publishAckHandler.attach(item, handler);
+    }
+
+    /** Get the number of QoS 1 and 2 publishes waiting for their acknowledgement
+     *  @return the number of unacknowledged publishes
+     */
+    int getInflightCount()
+    {
+        return inflightCount;
+    }
+
+    /** Wait until every QoS 1 and 2 publish has been acknowledged. Not used in non-blocking mode.
+     *  @param timeout_ms the time to wait, in milliseconds
+     *  @return success code - on failure, the acknowledgements did not all arrive in time
+     */
+    int waitForAcks(unsigned long timeout_ms);
+
+    /** Switch between blocking and non-blocking mode. This should only be changed while the client is not connected.
+     *  @param nonblocking - true to return from calls without waiting for acknowledgements, false to block
+     */
+    void setNonBlocking(bool nonblocking)
+    {
+        this->nonblocking = nonblocking;
+    }
+
+    /** Get the socket of the network connection, for registering with the application's event loop
+     *  Requires a Network class with a getSocket method.
+     *  @return the socket file descriptor
+     */
+    int getSocket()
+    {
+        return ipstack.getSocket();
+    }
+
+    /** Is there queued data waiting for the socket to become writable? Only used in non-blocking mode.
+     *  @return flag - true if onWritable should be called when the socket is writable
+     */
+    bool isWritePending()
+    {
+        return sendqueuelen > 0;
+    }
+
+    /** Get the time until onTimer should next be called. Only used in non-blocking mode.
+     *  @return the time in milliseconds, or -1 if no timer is running
+     */
+    int nextTimeout_ms();
+
+    /** Read and process all the data available on the socket. Only used in non-blocking mode.
+     *  @return success code - on failure, the connection should be closed
+     */
+    int onReadable();
+
+    /** Send as much queued data as the socket will accept. Only used in non-blocking mode.
+     *  @return success code - on failure, the connection should be closed
+     */
+    int onWritable();
+
+    /** Handle connect timeouts and keep alive pings. Only used in non-blocking mode.
+     *  @return success code - on failure, the connection should be closed
+     */
+    int onTimer();
+
 private:
 
 	void cleanSession();
+    void forgetSession();
     int cycle(Timer& timer);
+    int processPacket(int packet_type, Timer& timer);
+    int resendInflight(Timer& timer);
+    int resubscribe(Timer& timer);
+    int findSubscription(const char* topicFilter);
+    void addSubscription(const char* topicFilter, int qos);
+    void removeSubscription(const char* topicFilter);
+    bool attachHandler(const char* topicFilter, messageHandler mh);
     int waitfor(int packet_type, Timer& timer);
     int keepalive();
-    int publish(int len, Timer& timer, enum QoS qos);
+    int publish(int len, Timer& timer, enum QoS qos, unsigned short id);
+    int publishStream(const char* topicName, size_t payloadlen, FP<int, PayloadChunk&>& source, unsigned short& id, enum QoS qos, bool retained);
+    int copyPayload(PayloadChunk& chunk);
+    int writeAll(unsigned char* buf, int len, Timer& timer);
+    int waitforPublish(Timer& timer, enum QoS qos, unsigned short id);
+    int packFilters(int count, const char* topicFilters[], bool subscribe);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    int reserveInflight(int len, Timer& timer);
+    void addInflight(unsigned short id, enum QoS qos, int len);
+    int findInflight(unsigned short id);
+    void releaseInflight(int index);
+    void removeInflight(int index);
+    void ackPublish(unsigned short id);
+    bool isStoredPublish(unsigned char* packet, int len, int qos);
+#endif
 
-    int decodePacket(int* value, int timeout);
+    int serializeConnect(unsigned char* buf, MQTTPacket_connectData& options);
+    int deserializeConnack(unsigned char* connack_rc);
+    int deserializeAck(unsigned short* id);
+    int deserializeSuback(unsigned short* id, int maxcount, int* count, int grantedQoSs[]);
+    int serializeSubscribe(unsigned short id, int count, MQTTString topicFilters[], int qoss[]);
+    int serializeUnsubscribe(unsigned short id, int count, MQTTString topicFilters[]);
+    int findTopicAlias(const char* topicName, bool* known);
+    void addTopicAlias(const char* topicName);
+    int inflightLimit();
+
+    int framePacket(int* packet_len);
+    bool isPacketBuffered();
     int readPacket(Timer& timer);
+    int beginFragments(int packet_len);
+    int readFragment(Timer& timer);
+    int processFragment(Timer& timer);
     int sendPacket(int length, Timer& timer);
-    int deliverMessage(MQTTString& topicName, Message& message);
+    int sendAck(unsigned char type, unsigned short id, Timer& timer);
+#if MQTTCLIENT_WRITEV
+    int sendPacket(unsigned char** buffers, int* lengths, int count, Timer& timer);
+#endif
+    int queuePacket(unsigned char** buffers, int* lengths, int count);
+    int coalescePacket(unsigned char** buffers, int* lengths, int count, Timer& timer);
+    int flushQueue(Timer& timer);
+    void cork(bool on)
+    {
+#if MQTTCLIENT_CORK
+        ipstack.setCork(on);
+#endif
+    }
+    int deliverMessage(MQTTString& topicName, Message& message, size_t offset, size_t totallen);
     bool isTopicMatched(char* topicFilter, MQTTString& topicName);
 
     Network& ipstack;
@@ -224,10 +636,65 @@ private:
     unsigned char sendbuf[MAX_MQTT_PACKET_SIZE];
     unsigned char readbuf[MAX_MQTT_PACKET_SIZE];
 
+    // Incoming bytes are buffered here and split into packets, so one network read can supply several packets.
+    enum { RECVBUF_SIZE = (MQTTCLIENT_RECVBUF_SIZE > MAX_MQTT_PACKET_SIZE) ? MQTTCLIENT_RECVBUF_SIZE : MAX_MQTT_PACKET_SIZE };
+    unsigned char recvbuf[RECVBUF_SIZE];
+    int recvhead;   // start of the first unprocessed byte
+    int recvtail;   // end of the buffered data
+
+    // An incoming packet too big for readbuf, read a fragment at a time. The start of the packet stays in readbuf
+    // until the last fragment, so the topic name of a publish is there for every fragment.
+    struct
+    {
+        long remaining;         // bytes of the packet still to be read, 0 when there is no such packet
+        bool ready;             // a fragment has been read and not yet processed
+        bool publish;           // the packet is a publish that could be read, otherwise it is skipped
+        bool deliver;           // the fragments go to the message handlers
+        MQTTString topicName;
+        Message message;        // the current fragment
+        size_t offset;          // of the current fragment in the payload
+        size_t totallen;        // of the payload
+    } fragment;
+    bool fragmentDelivery;
+    unsigned char* streamPayload;   // the payload publish copies from when it is streamed, see copyPayload
+
+    // Outgoing data that the network could not accept yet in non-blocking mode, or that is being coalesced.
+    enum { SENDQUEUE_SIZE = (MQTTCLIENT_SENDQUEUE_SIZE > MAX_MQTT_PACKET_SIZE) ? MQTTCLIENT_SENDQUEUE_SIZE : MAX_MQTT_PACKET_SIZE };
+    unsigned char sendqueue[SENDQUEUE_SIZE];
+    int sendqueuelen;
+    int coalesceThreshold;
+    int coalesceDeadline_ms;
+    Timer flush_timer;          // started when the first packet is coalesced
+    bool ackQueued;             // an acknowledgement is waiting in the send queue
+
+    int inflightCount;
+    int publishWindow;
+    FP<void, unsigned short> publishAckHandler;
+
     Timer last_sent, last_received, ping_response;
     unsigned int keepAliveInterval;
     bool ping_outstanding;
     bool cleansession;
+    bool sessionPresent;    // reported by the last connack
+
+    // MQTT 5, the protocol version and what the server set in its connack
+    unsigned char mqttVersion;
+    int reasonCode;                 // of the last failure reported by the server
+    int receiveMaximum;             // QoS 1 and 2 publishes the server accepts at once
+    unsigned int maximumPacketSize; // 0 for no limit
+    int topicAliasMaximum;
+
+#if MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE > 0
+    // The topic names given an alias on this connection, each null terminated, alias 1 first
+    char topicAliases[MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE + 1];
+#endif
+    int topicAliasesLen;
+    int topicAliasCount;
+
+    // The topic filters of a session the server keeps, each as its QoS byte and the null terminated filter, for
+    // subscribing again when the server has lost the session, and for saveSession.
+    unsigned char subscriptions[SUBSCRIPTIONSTORE_SIZE];
+    int subscriptionsLen;
 
     PacketId packetid;
 
@@ -240,6 +707,19 @@ private:
     FP<void, MessageData&> defaultMessageHandler;
 
     bool isconnected;
+    bool nonblocking;
+    bool connectPending;    // a connect packet was sent in non-blocking mode and is waiting for the connack
+    Timer connack_timer;
+
+    // Between beginConnect and finishConnect, packets wait in the send queue and acknowledgements aren't waited for.
+    bool pipelining;
+    int pendingAcks;            // subacks and unsubacks for packets sent while pipelining
+    bool subscribeRefused;      // one of those subacks refused a filter
+    unsigned char connectbuf[MAX_MQTT_PACKET_SIZE];
+    int connectlen;
+    unsigned char connectVersion;
+    unsigned int connectKeepAlive;
+    bool connectCleansession;
     
 	bool connAckReceived;
 	bool subAckReceived;
@@ -248,21 +728,28 @@ private:
    	bool pubCompReceived;
 
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    unsigned char pubbuf[MAX_MQTT_PACKET_SIZE];  // store the last publish for sending on reconnect
-    int inflightLen;
-    unsigned short inflightMsgid;
-    enum QoS inflightQoS;
+    // The QoS 1 and 2 publishes waiting for their acknowledgements, oldest first. When the session is kept on
+    // the server, the packets are also kept in inflightStore, in the same order, to be resent on reconnect.
+    struct Inflight
+    {
+        unsigned short id;
+        unsigned char qos;
+        bool stored;    // the publish is resent on reconnect
+        bool pubrel;    // the PUBREC has arrived, so a PUBREL is resent instead of the publish
+        int offset;     // of the packet in inflightStore
+        int len;        // of the packet, 0 once it is no longer needed
+    } inflight[MQTTCLIENT_MAX_INFLIGHT];
+    unsigned char inflightStore[INFLIGHTSTORE_SIZE];
+    int inflightStoreLen;
 #endif
 
 #if MQTTCLIENT_QOS2
-    bool pubrel;
-    #if !defined(MAX_INCOMING_QOS2_MESSAGES)
-        #define MAX_INCOMING_QOS2_MESSAGES 10
-    #endif
-    unsigned short incomingQoS2messages[MAX_INCOMING_QOS2_MESSAGES];
+    // The incoming QoS 2 publishes that have been delivered and are waiting for their PUBREL, a bit for each packet id
+    unsigned char incomingQoS2ids[QOS2IDS_SIZE];
     bool isQoS2msgidFree(unsigned short id);
-    bool useQoS2msgid(unsigned short id);
+    void useQoS2msgid(unsigned short id);
 	void freeQoS2msgid(unsigned short id);
+    int incomingQoS2idsLen();
 #endif
 
 };
@@ -274,25 +761,40 @@ template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
 void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::cleanSession() 
 {
     ping_outstanding = false;
-    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        messageHandlers[i].topicFilter = 0;
+    if (cleansession) // otherwise the server keeps the session, and the handlers stay with its subscriptions
+    {
+        for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+            messageHandlers[i].topicFilter = 0;
+        forgetSession();
+    }
     isconnected = false;
+    connectPending = false;
+    pipelining = false;
+    pendingAcks = 0;
+    fragment.remaining = 0; // the rest of a large packet won't arrive on a new connection
+    fragment.ready = false;
 
 	connAckReceived = false;
 	subAckReceived = false;
 	unsubAckReceived = false;
 	pubAckReceived = false;
    	pubCompReceived = false;
-   	
+}
+
+
+/**
+ * Drop the state of a session the server no longer keeps: the publishes to resend, the topic filters to subscribe
+ * to again and the incoming QoS 2 publishes waiting for their PUBREL.
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::forgetSession()
+{
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    inflightMsgid = 0;
-    inflightQoS = QOS0;
+    inflightCount = inflightStoreLen = 0;
 #endif
-
+    subscriptionsLen = 0;
 #if MQTTCLIENT_QOS2
-    pubrel = false;
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-        incomingQoS2messages[i] = 0;
+    memset(incomingQoS2ids, 0, sizeof(incomingQoS2ids));
 #endif
 }
 
@@ -301,6 +803,27 @@ template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
 MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
 {
     this->command_timeout_ms = command_timeout_ms;
+    recvhead = recvtail = 0;
+    sendqueuelen = 0;
+    ackQueued = false;
+    coalesceThreshold = 0;
+    coalesceDeadline_ms = 0;
+    publishWindow = 1;
+    nonblocking = false;
+    pipelining = false;
+    connectlen = 0;
+    connectCleansession = true;
+    cleansession = true;
+    sessionPresent = false;
+    mqttVersion = 4;
+    reasonCode = 0;
+    receiveMaximum = 65535;
+    maximumPacketSize = 0;
+    topicAliasMaximum = topicAliasesLen = topicAliasCount = 0;
+    subscriptionsLen = 0;
+    inflightCount = 0;
+    fragmentDelivery = false;
+    streamPayload = 0;
 	cleanSession();
 }
 
@@ -309,41 +832,34 @@ MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network,
 template<class Network, class Timer, int a, int b>
 bool MQTT::Client<Network, Timer, a, b>::isQoS2msgidFree(unsigned short id)
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == id)
-            return false;
-    }
-    return true;
+    return (incomingQoS2ids[id >> 3] & (1 << (id & 7))) == 0;
 }
 
 
 template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::useQoS2msgid(unsigned short id)
+void MQTT::Client<Network, Timer, a, b>::useQoS2msgid(unsigned short id)
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == 0)
-        {
-            incomingQoS2messages[i] = id;
-            return true;
-        }
-    }
-    return false;
+    incomingQoS2ids[id >> 3] |= (1 << (id & 7));
 }
 
 
 template<class Network, class Timer, int a, int b>
 void MQTT::Client<Network, Timer, a, b>::freeQoS2msgid(unsigned short id)
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == id)
-        {
-            incomingQoS2messages[i] = 0;
-            return;
-        }
-    }
+    incomingQoS2ids[id >> 3] &= ~(1 << (id & 7));
+}
+
+
+/**
+ * Get the length of incomingQoS2ids up to its last non-zero byte, which is all saveSession needs to keep.
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::incomingQoS2idsLen()
+{
+    int len = QOS2IDS_SIZE;
+    while (len > 0 && incomingQoS2ids[len - 1] == 0)
+        --len;
+    return len;
 }
 #endif
 
@@ -354,6 +870,18 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
     int rc = FAILURE,
         sent = 0;
 
+    if (nonblocking || coalesceThreshold > 0 || pipelining || sendqueuelen > 0) // queued acknowledgements go first
+    {
+        unsigned char* buffer = sendbuf;
+        if (nonblocking)
+            rc = queuePacket(&buffer, &length, 1);
+        else
+            rc = coalescePacket(&buffer, &length, 1, timer);
+        if (rc == SUCCESS)
+            sent = length;
+        else if (rc == FAILURE)
+            goto exit;
+    }
     while (sent < length && !timer.expired())
     {
         rc = ipstack.write(&sendbuf[sent], length - sent, timer.left_ms());
@@ -361,6 +889,7 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
             break;
         sent += rc;
     }
+exit:
     if (sent == length)
     {
         if (this->keepAliveInterval > 0)
@@ -378,73 +907,482 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
 }
 
 
+#if MQTTCLIENT_WRITEV
 template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::decodePacket(int* value, int timeout)
+int MQTT::Client<Network, Timer, a, b>::sendPacket(unsigned char** buffers, int* lengths, int count, Timer& timer)
 {
-    unsigned char c;
-    int multiplier = 1;
-    int len = 0;
-    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    int rc = FAILURE,
+        length = 0,
+        sent = 0;
 
-    *value = 0;
-    do
+    for (int i = 0; i < count; ++i)
+        length += lengths[i];
+    if (nonblocking || coalesceThreshold > 0 || pipelining || sendqueuelen > 0) // queued acknowledgements go first
     {
-        int rc = MQTTPACKET_READ_ERROR;
-
-        if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
-        {
-            rc = MQTTPACKET_READ_ERROR; /* bad data */
+        if (nonblocking)
+            rc = queuePacket(buffers, lengths, count);
+        else
+            rc = coalescePacket(buffers, lengths, count, timer);
+        if (rc == SUCCESS)
+            sent = length;
+        else if (rc == FAILURE)
             goto exit;
+    }
+    while (sent < length && !timer.expired())
+    {
+        rc = ipstack.writev(buffers, lengths, count, timer.left_ms());
+        if (rc < 0)  // there was an error writing the data
+            break;
+        sent += rc;
+        // skip past the data that has been written, leaving the remainder of a partly written buffer
+        while (count > 0 && rc >= lengths[0])
+        {
+            rc -= lengths[0];
+            ++buffers;
+            ++lengths;
+            --count;
         }
-        rc = ipstack.read(&c, 1, timeout);
-        if (rc != 1)
-            goto exit;
-        *value += (c & 127) * multiplier;
-        multiplier *= 128;
-    } while ((c & 128) != 0);
+        if (count > 0)
+        {
+            buffers[0] += rc;
+            lengths[0] -= rc;
+        }
+    }
 exit:
-    return len;
+    if (sent == length)
+    {
+        if (this->keepAliveInterval > 0)
+            last_sent.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet
+        rc = SUCCESS;
+    }
+    else
+        rc = FAILURE;
+
+#if defined(MQTT_DEBUG)
+    DEBUG("Rc %d from sending packet of %d bytes\n", rc, length);
+#endif
+    return rc;
 }
+#endif
 
 
 /**
- * If any read fails in this method, then we should disconnect from the network, as on reconnect
- * the packets can be retried.
- * @param timeout the max time to wait for the packet read to complete, in milliseconds
- * @return the MQTT packet type, or -1 if none
+ * Send a packet without blocking. Whatever the network doesn't accept straight away is kept in the send queue
+ * and sent by onWritable.
+ * @return SUCCESS, or FAILURE if there was a network error or the send queue is full
  */
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& timer)
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::queuePacket(unsigned char** buffers, int* lengths, int count)
 {
-    int rc = FAILURE;
-    MQTTHeader header = {0};
-    int len = 0;
-    int rem_len = 0;
+    int length = 0,
+        written = 0;
 
-    /* 1. read the header byte.  This has the packet type in it */
-    if (ipstack.read(readbuf, 1, timer.left_ms()) != 1)
-        goto exit;
+    for (int i = 0; i < count; ++i)
+        length += lengths[i];
+    if (sendqueuelen == 0 && length >= coalesceThreshold) // nothing is waiting, so the packet can go straight to the network
+    {
+#if MQTTCLIENT_WRITEV
+        if (count > 1)
+            written = ipstack.writev(buffers, lengths, count, 0);
+        else
+#endif
+            written = ipstack.write(buffers[0], lengths[0], 0);
+        if (written < 0)
+            return FAILURE;
+    }
+    if (length - written > SENDQUEUE_SIZE - sendqueuelen)
+        return FAILURE;
+    if (coalesceThreshold > 0 && sendqueuelen == 0 && written < length)
+        flush_timer.countdown_ms(coalesceDeadline_ms);
 
-    len = 1;
-    /* 2. read the remaining length.  This is variable in itself */
-    decodePacket(&rem_len, timer.left_ms());
-    len += MQTTPacket_encode(readbuf + 1, rem_len); /* put the original remaining length into the buffer */
+    for (int i = 0; i < count; ++i)
+    {
+        if (written >= lengths[i])
+        {
+            written -= lengths[i];
+            continue;
+        }
+        memcpy(sendqueue + sendqueuelen, buffers[i] + written, lengths[i] - written);
+        sendqueuelen += lengths[i] - written;
+        written = 0;
+    }
+    if (coalesceThreshold > 0 && sendqueuelen >= coalesceThreshold)
+        return onWritable();
+    return SUCCESS;
+}
 
-	if (rem_len > (MAX_MQTT_PACKET_SIZE - len))
-	{
-		rc = BUFFER_OVERFLOW;
-		goto exit;
-	}
 
-    /* 3. read the rest of the buffer using a callback to supply the rest of the data */
-    if (rem_len > 0 && (ipstack.read(readbuf + len, rem_len, timer.left_ms()) != rem_len))
-        goto exit;
+/**
+ * Add a packet to the send queue in blocking mode, writing the queue if it has reached the threshold or deadline.
+ * @return SUCCESS if the packet was queued or sent, BUFFER_OVERFLOW if it is too big for the queue and must be
+ * written directly, or FAILURE if the queue could not be written
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::coalescePacket(unsigned char** buffers, int* lengths, int count, Timer& timer)
+{
+    int length = 0;
+
+    for (int i = 0; i < count; ++i)
+        length += lengths[i];
+    if (length > SENDQUEUE_SIZE - sendqueuelen && flushQueue(timer) != SUCCESS)
+        return FAILURE;
+    if (length > SENDQUEUE_SIZE)
+        return BUFFER_OVERFLOW; // the queue is empty now, so the packet can be written without reordering
+
+    if (sendqueuelen == 0)
+        flush_timer.countdown_ms(coalesceDeadline_ms);
+    for (int i = 0; i < count; ++i)
+    {
+        memcpy(sendqueue + sendqueuelen, buffers[i], lengths[i]);
+        sendqueuelen += lengths[i];
+    }
+    if (!pipelining && (sendqueuelen >= coalesceThreshold || flush_timer.expired()))
+        return flushQueue(timer);
+    return SUCCESS;
+}
 
-    header.byte = readbuf[0];
-    rc = header.bits.type;
-    if (this->keepAliveInterval > 0)
-        last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
-exit:
+
+/**
+ * Queue the acknowledgement of an incoming packet. The acknowledgements of a burst of packets are written together,
+ * once the packets that have already been received are handled or after MQTTCLIENT_ACK_DEADLINE_MS.
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::sendAck(unsigned char type, unsigned short id, Timer& timer)
+{
+    int len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, type, 0, id);
+
+    if (len <= 0)
+        return FAILURE;
+    if (len > SENDQUEUE_SIZE - sendqueuelen) // write what is waiting to make room
+    {
+        if ((nonblocking ? onWritable() : flushQueue(timer)) != SUCCESS || len > SENDQUEUE_SIZE - sendqueuelen)
+            return FAILURE;
+    }
+    if (sendqueuelen == 0)
+        flush_timer.countdown_ms(MQTTCLIENT_ACK_DEADLINE_MS);
+    memcpy(sendqueue + sendqueuelen, sendbuf, len);
+    sendqueuelen += len;
+    ackQueued = true;
+    return SUCCESS;
+}
+
+
+/**
+ * Write the send queue in blocking mode. One write is tried even if the timer has expired. If the network takes
+ * only part of the queue, the connection is corked until the rest is written, so it still goes out in full segments.
+ * @return success code
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::flushQueue(Timer& timer)
+{
+    int sent = 0;
+    bool corked = false;
+
+    while (sent < sendqueuelen)
+    {
+        int rc = ipstack.write(&sendqueue[sent], sendqueuelen - sent, timer.left_ms());
+        if (rc < 0)  // there was an error writing the data
+            break;
+        sent += rc;
+        if (sent == sendqueuelen || timer.expired())
+            break;
+        if (!corked)
+        {
+            cork(true);
+            corked = true;
+        }
+    }
+    if (corked)
+        cork(false);
+    sendqueuelen -= sent;
+    memmove(sendqueue, sendqueue + sent, sendqueuelen);
+    if (sent > 0 && this->keepAliveInterval > 0)
+        last_sent.countdown(this->keepAliveInterval);
+    if (sendqueuelen == 0)
+        ackQueued = false;
+    return (sendqueuelen == 0) ? SUCCESS : FAILURE;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::flush()
+{
+    if (nonblocking)
+        return onWritable();
+    Timer timer(command_timeout_ms);
+    return flushQueue(timer);
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::waitForAcks(unsigned long timeout_ms)
+{
+    int rc = SUCCESS;
+    Timer timer(timeout_ms);
+
+    while (inflightCount > 0)
+    {
+        if (!isconnected || timer.expired() || cycle(timer) < 0)
+        {
+            rc = FAILURE;
+            break;
+        }
+    }
+    return rc;
+}
+
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+/**
+ * Wait until there is room for another publish in the window and, if it is stored, in the in-flight store.
+ * @param len the length of the packet to store, 0 if it isn't stored
+ * @return success code - FAILURE if there is no room in time, or straight away in non-blocking mode
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::reserveInflight(int len, Timer& timer)
+{
+    if (len > (int)sizeof(inflightStore))
+        return FAILURE;
+    while (inflightCount >= inflightLimit() || inflightStoreLen + len > (int)sizeof(inflightStore))
+    {
+        if (nonblocking || pipelining || timer.expired() || cycle(timer) < 0)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/**
+ * Add a publish to the end of the window. A stored publish must already be serialized at the end of the store.
+ * @param id the packet id of the publish
+ * @param qos the QoS of the publish
+ * @param len the length of the stored packet, 0 if it isn't stored
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::addInflight(unsigned short id, enum QoS qos, int len)
+{
+    Inflight& entry = inflight[inflightCount++];
+    entry.id = id;
+    entry.qos = (unsigned char)qos;
+    entry.stored = (len > 0);
+    entry.pubrel = false;
+    entry.offset = inflightStoreLen;
+    entry.len = len;
+    inflightStoreLen += len;
+}
+
+
+/**
+ * Find a publish in the window.
+ * @param id the packet id of the publish
+ * @return the index of the publish, or -1 if it isn't in the window
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::findInflight(unsigned short id)
+{
+    for (int i = 0; i < inflightCount; ++i)
+    {
+        if (inflight[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+
+/**
+ * Free the space a publish takes in the in-flight store. The packets after it move down, so the store
+ * stays in send order with no gaps, and it is only a few packets long so this is cheap.
+ * @param index the index of the publish in the window
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::releaseInflight(int index)
+{
+    int len = inflight[index].len;
+
+    if (len == 0)
+        return;
+    int end = inflight[index].offset + len;
+    memmove(&inflightStore[inflight[index].offset], &inflightStore[end], inflightStoreLen - end);
+    inflightStoreLen -= len;
+    inflight[index].len = 0;
+    for (int i = index + 1; i < inflightCount; ++i)
+        inflight[i].offset -= len;
+}
+
+
+/**
+ * Remove a publish from the window, keeping the rest in send order.
+ * @param index the index of the publish in the window
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::removeInflight(int index)
+{
+    releaseInflight(index);
+    memmove(&inflight[index], &inflight[index + 1], (inflightCount - index - 1) * sizeof(inflight[0]));
+    --inflightCount;
+}
+
+
+/**
+ * Check a packet from a session snapshot is a whole publish, with the QoS of its entry in the window.
+ * @param packet the stored packet
+ * @param len the length of the entry
+ * @param qos the QoS of the entry
+ * @return true if the packet can be resent
+ */
+template<class Network, class Timer, int a, int b>
+bool MQTT::Client<Network, Timer, a, b>::isStoredPublish(unsigned char* packet, int len, int qos)
+{
+    MQTTHeader header = {0};
+    int rem_len = 0, multiplier = 1, i = 1;
+
+    if (len < 2)
+        return false;
+    header.byte = packet[0];
+    if (header.bits.type != PUBLISH_MSG || header.bits.qos != qos)
+        return false;
+    do
+    {
+        if (i >= len || i > 4)
+            return false;
+        rem_len += (packet[i] & 127) * multiplier;
+        multiplier *= 128;
+    } while ((packet[i++] & 128) != 0);
+    return i + rem_len == len;
+}
+
+
+/**
+ * Remove a publish that has been acknowledged, with a PUBACK or PUBCOMP, and tell the application.
+ * @param id the packet id from the acknowledgement
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::ackPublish(unsigned short id)
+{
+    int i = findInflight(id);
+
+    if (i >= 0)
+    {
+        removeInflight(i);
+        publishAckHandler(id);
+    }
+}
+#endif
+
+
+/**
+ * Check whether a complete packet is available at the start of the receive buffer.
+ * @param packet_len returns the total length of the packet, including the fixed header
+ * @return 1 if a complete packet is buffered, 0 if more data is needed, BUFFER_OVERFLOW if the packet
+ *      can't fit in readbuf and enough of it is buffered to fill readbuf, or FAILURE if the remaining length is malformed
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::framePacket(int* packet_len)
+{
+    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    int available = recvtail - recvhead;
+    int multiplier = 1;
+    int rem_len = 0;
+    int len = 1;
+    unsigned char c;
+
+    do
+    {
+        if (len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
+            return FAILURE; /* bad data */
+        if (len >= available)
+            return 0;
+        c = recvbuf[recvhead + len++];
+        rem_len += (c & 127) * multiplier;
+        multiplier *= 128;
+    } while ((c & 128) != 0);
+
+    if (rem_len > (MAX_MQTT_PACKET_SIZE - len))
+    {
+        *packet_len = len + rem_len;
+        return (available >= MAX_MQTT_PACKET_SIZE) ? BUFFER_OVERFLOW : 0;
+    }
+    if (len + rem_len > available)
+        return 0;
+    *packet_len = len + rem_len;
+    return 1;
+}
+
+
+/**
+ * Check whether a whole packet is waiting in the receive buffer, so the next read won't wait for the network.
+ * While a packet is read a fragment at a time, the buffered bytes are the rest of its payload rather than a
+ * packet, so they aren't framed.
+ */
+template<class Network, class Timer, int a, int b>
+bool MQTT::Client<Network, Timer, a, b>::isPacketBuffered()
+{
+    int len = 0;
+    return fragment.remaining == 0 && framePacket(&len) == 1;
+}
+
+
+/**
+ * If any read fails in this method, then we should disconnect from the network, as on reconnect
+ * the packets can be retried.
+ * Data is read from the network in chunks of up to RECVBUF_SIZE bytes. Packets that are already
+ * buffered are returned without reading from the network again. A packet too big for readbuf is
+ * returned a fragment at a time, as PUBLISH_MSG, see beginFragments.
+ * @param timeout the max time to wait for the packet read to complete, in milliseconds
+ * @return the MQTT packet type, 0 if no packet arrived before the timeout, or a negative value on error
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& timer)
+{
+    int rc = FAILURE;
+    MQTTHeader header = {0};
+    int len = 0;
+
+    if (fragment.remaining > 0)
+        return readFragment(timer);
+    while ((rc = framePacket(&len)) == 0)
+    {
+        /* move the partial packet to the front of the buffer so the rest of it fits */
+        if (recvhead > 0)
+        {
+            memmove(recvbuf, recvbuf + recvhead, recvtail - recvhead);
+            recvtail -= recvhead;
+            recvhead = 0;
+        }
+        int bytes = ipstack.read(recvbuf + recvtail, RECVBUF_SIZE - recvtail, timer.left_ms());
+        if (bytes < 0)
+        {
+            rc = FAILURE;
+            goto exit;
+        }
+        if (bytes == 0 && timer.expired())
+            goto exit; // no packet before the timeout, rc is 0
+        recvtail += bytes;
+    }
+    if (rc == BUFFER_OVERFLOW)
+    {
+        rc = beginFragments(len);
+        len = MAX_MQTT_PACKET_SIZE;
+        goto exit;
+    }
+    if (rc < 0)
+    {
+        /* the rest of the stream can't be framed, so discard what has been buffered */
+        recvhead = recvtail = 0;
+        goto exit;
+    }
+
+    memcpy(readbuf, recvbuf + recvhead, len);
+    recvhead += len;
+    if (recvhead == recvtail)
+        recvhead = recvtail = 0;
+
+    header.byte = readbuf[0];
+    rc = header.bits.type;
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
+exit:
         
 #if defined(MQTT_DEBUG)
 	if (rc >= 0)
@@ -457,6 +1395,130 @@ exit:
 }
 
 
+/**
+ * Start reading a packet too big for readbuf, once framePacket has found enough of it buffered to fill readbuf.
+ * The start of the packet is copied to readbuf with its remaining length cut down to what readbuf holds, so a
+ * publish can be deserialized as usual and the payload that follows is its first fragment. The rest of the
+ * payload is read by readFragment. Any other packet that big, or a publish whose topic name and properties
+ * don't fit in readbuf, is skipped, which keeps the stream in step.
+ * @param packet_len the total length of the packet, including the fixed header
+ * @return PUBLISH_MSG, as the first fragment is ready to process
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::beginFragments(int packet_len)
+{
+    unsigned char* packet = recvbuf + recvhead;
+    MQTTHeader header = {0};
+    MQTTString topicName = MQTTString_initializer;
+    int rem_len = 0,
+        intQoS = 0,
+        rc = 0;
+    int headerlen = 1 + MQTTPacket_decodeBuf(packet + 1, &rem_len);
+    int len = 1 + MQTTPacket_encode(readbuf + 1, MAX_MQTT_PACKET_SIZE - headerlen); // no longer than the original
+
+    readbuf[0] = packet[0];
+    memcpy(readbuf + len, packet + headerlen, MAX_MQTT_PACKET_SIZE - headerlen);
+    recvhead += MAX_MQTT_PACKET_SIZE;
+    if (recvhead == recvtail)
+        recvhead = recvtail = 0;
+
+    header.byte = readbuf[0];
+    Message& msg = fragment.message;
+    fragment.remaining = packet_len - MAX_MQTT_PACKET_SIZE;
+    fragment.ready = true;
+    fragment.deliver = false;
+    fragment.topicName = topicName;
+    if (header.bits.type == PUBLISH_MSG)
+    {
+        if (mqttVersion == 5)
+            rc = MQTTV5Deserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id,
+                     &fragment.topicName, NULL, (unsigned char**)&msg.payload, &msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE);
+        else
+            rc = MQTTDeserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id,
+                     &fragment.topicName, (unsigned char**)&msg.payload, &msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE);
+    }
+    fragment.publish = (rc == 1);
+    if (fragment.publish)
+    {
+        msg.qos = (enum QoS)intQoS;
+        fragment.offset = 0;
+        fragment.totallen = msg.payloadlen + fragment.remaining;
+        fragment.deliver = fragmentDelivery;
+#if MQTTCLIENT_QOS2
+        if (msg.qos == QOS2 && !isQoS2msgidFree(msg.id)) // a duplicate of a publish already delivered
+            fragment.deliver = false;
+#endif
+    }
+    else
+        WARN("Skipping a packet of %d bytes, too big for the read buffer", packet_len);
+    return PUBLISH_MSG;
+}
+
+
+/**
+ * Read the next fragment of a packet too big for readbuf. The fragment is left in recvbuf, where processFragment
+ * finds it.
+ * @return PUBLISH_MSG, 0 if no data arrived before the timeout, or FAILURE
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::readFragment(Timer& timer)
+{
+    if (recvhead == recvtail)
+    {
+        int bytes = ipstack.read(recvbuf, RECVBUF_SIZE, timer.left_ms());
+        if (bytes <= 0)
+            return (bytes < 0) ? FAILURE : 0;
+        recvhead = 0;
+        recvtail = bytes;
+    }
+    int len = recvtail - recvhead;
+    if (len > fragment.remaining)
+        len = (int)fragment.remaining;
+    fragment.offset = fragment.totallen - fragment.remaining;
+    fragment.message.payload = recvbuf + recvhead;
+    fragment.message.payloadlen = len;
+    fragment.remaining -= len;
+    fragment.ready = true;
+    recvhead += len;
+    if (recvhead == recvtail)
+        recvhead = recvtail = 0;
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval);
+    return PUBLISH_MSG;
+}
+
+
+/**
+ * Deliver the fragment that has just been read, and acknowledge the publish after its last fragment.
+ * @return success code
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::processFragment(Timer& timer)
+{
+    int rc = SUCCESS;
+    // copied, as a handler that waits for an acknowledgement reads the following fragments before it returns
+    Message msg = fragment.message;
+    bool last = (fragment.remaining == 0);
+
+    fragment.ready = false;
+    if (!fragment.publish)
+        return rc;
+    if (fragment.deliver)
+        deliverMessage(fragment.topicName, msg, fragment.offset, fragment.totallen);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (last && msg.qos != QOS0)
+    {
+#if MQTTCLIENT_QOS2
+        if (msg.qos == QOS2 && fragment.deliver)
+            useQoS2msgid(msg.id);
+#endif
+        rc = sendAck((msg.qos == QOS1) ? PUBACK_MSG : PUBREC_MSG, msg.id, timer);
+    }
+#endif
+    return rc;
+}
+
+
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
@@ -491,9 +1553,13 @@ bool MQTT::Client<Network, Timer, a, b>::isTopicMatched(char* topicFilter, MQTTS
 
 
 template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTString& topicName, Message& message)
+int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTString& topicName, Message& message, size_t offset, size_t totallen)
 {
     int rc = FAILURE;
+    MessageData md(topicName, message);
+
+    md.offset = offset;
+    md.totallen = totallen;
     // we have to find the right message handler - indexed by topic
     for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
@@ -502,7 +1568,6 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
         {
             if (messageHandlers[i].fp.attached())
             {
-                MessageData md(topicName, message);
                 messageHandlers[i].fp(md);
                 rc = SUCCESS;
             }
@@ -511,7 +1576,6 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
 
     if (rc == FAILURE && defaultMessageHandler.attached())
     {
-        MessageData md(topicName, message);
         defaultMessageHandler(md);
         rc = SUCCESS;
     }
@@ -546,63 +1610,126 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
 {
     /* get one piece of work off the wire and one pass through */
 
+    int packet_type = 0;
+    int rc = SUCCESS;
+
+    // don't leave coalesced packets waiting while we wait for data, what the caller has no time left for is written next time
+    if (sendqueuelen > 0 && !nonblocking && !isPacketBuffered() && flushQueue(timer) != SUCCESS && !timer.expired())
+        return FAILURE;
     // read the socket, see what work is due
-    int packet_type = readPacket(timer);
+    packet_type = readPacket(timer);
+    if (packet_type == FAILURE || packet_type == BUFFER_OVERFLOW)
+        rc = packet_type;
+    else if ((rc = processPacket(packet_type, timer)) != SUCCESS)
+        goto exit; // there was a problem
+    keepalive();
+    // acknowledgements wait while more received packets are ready, so a burst is acknowledged in one write
+    if (ackQueued && !nonblocking && (!isPacketBuffered() || flush_timer.expired()) && flushQueue(timer) != SUCCESS && !timer.expired())
+        rc = FAILURE;
+exit:
+    if (rc == SUCCESS)
+        rc = packet_type;
+    return rc;
+}
 
-	int len = 0,
-        rc = SUCCESS;
+
+/**
+ * Act on a packet that has been read into readbuf.
+ * @param packet_type the type of the packet, 0 if there is none
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::processPacket(int packet_type, Timer& timer)
+{
+	int rc = SUCCESS;
 
 	switch (packet_type)
     {
-		case FAILURE:
-		case BUFFER_OVERFLOW:
-			rc = packet_type;
-			break;
         case CONNACK_MSG:
         	connAckReceived = true;
+            if (connectPending) // non-blocking connect
+            {
+                unsigned char connack_rc = 255;
+                connectPending = false;
+                if (deserializeConnack(&connack_rc) == 1 && connack_rc == 0)
+                {
+                    isconnected = true;
+                    rc = resendInflight(timer);
+                    if (rc == SUCCESS && !sessionPresent)
+                        rc = resubscribe(timer);
+                }
+                else
+                    rc = FAILURE;
+            }
             break;
         case PUBACK_MSG:
         	pubAckReceived = true;
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+            {
+                // acknowledgements can arrive for any publish in the window, so they are matched by packet id here
+                unsigned short mypacketid;
+                if (deserializeAck(&mypacketid) >= 0)
+                    ackPublish(mypacketid);
+            }
+#endif
             break;
         case SUBACK_MSG:
         	subAckReceived = true;
+            if (pendingAcks > 0) // sent behind a pipelined connect, so no one is waiting for it
+            {
+                int count = 0, grantedQoSs[MQTTCLIENT_MAX_FILTERS];
+                unsigned short mypacketid;
+                --pendingAcks;
+                if (deserializeSuback(&mypacketid, MQTTCLIENT_MAX_FILTERS, &count, grantedQoSs) != 1)
+                    subscribeRefused = true;
+                for (int i = 0; i < count; ++i)
+                {
+                    if (grantedQoSs[i] == 0x80)
+                        subscribeRefused = true;
+                }
+            }
             break;
         case UNSUBACK_MSG:
         	unsubAckReceived = true;
+            if (pendingAcks > 0)
+                --pendingAcks;
             break;
         case PUBLISH_MSG:
+            if (fragment.ready) // part of a packet too big for readbuf
+            {
+                rc = processFragment(timer);
+                break;
+            }
 		{
 			MQTTString topicName = MQTTString_initializer;
             Message msg;
             int intQoS;
-            if (MQTTDeserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
+            if (mqttVersion == 5)
+            {
+                // no topic alias maximum is sent in the connect, so the server always sends the topic name
+                if (MQTTV5Deserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
+                                     NULL, (unsigned char**)&msg.payload, &msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+                    goto exit;
+            }
+            else if (MQTTDeserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
                                  (unsigned char**)&msg.payload, &msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 goto exit;
             msg.qos = (enum QoS)intQoS;
 #if MQTTCLIENT_QOS2
             if (msg.qos != QOS2)
 #endif
-                deliverMessage(topicName, msg);
+                deliverMessage(topicName, msg, 0, msg.payloadlen);
 #if MQTTCLIENT_QOS2
-            else if (isQoS2msgidFree(msg.id))
+            else if (isQoS2msgidFree(msg.id)) // otherwise it is a duplicate of a publish already delivered
             {
-                if (useQoS2msgid(msg.id))
-                    deliverMessage(topicName, msg);
-                else
-                    WARN("Maximum number of incoming QoS2 messages exceeded");
+                useQoS2msgid(msg.id);
+                deliverMessage(topicName, msg, 0, msg.payloadlen);
             }
 #endif
 #if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
             if (msg.qos != QOS0)
             {
-                if (msg.qos == QOS1)
-                    len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBACK_MSG, 0, msg.id);
-                else if (msg.qos == QOS2)
-                    len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREC_MSG, 0, msg.id);
-                if (len <= 0)
-                    rc = FAILURE;
-                else
-                    rc = sendPacket(len, timer);
+                rc = sendAck((msg.qos == QOS1) ? PUBACK_MSG : PUBREC_MSG, msg.id, timer);
                 if (rc == FAILURE)
                     goto exit; // there was a problem
             }
@@ -613,32 +1740,57 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
         case PUBREC_MSG:
 		case PUBREL_MSG:
             unsigned short mypacketid;
-            unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
-                rc = FAILURE;
-            else if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, 
-						(packet_type == PUBREC_MSG) ? PUBREL_MSG : PUBCOMP_MSG, 0, mypacketid)) <= 0)
+            int ackrc;
+            if ((ackrc = deserializeAck(&mypacketid)) < 0)
                 rc = FAILURE;
-            else if ((rc = sendPacket(len, timer)) != SUCCESS) // send the PUBREL_MSG packet
+            else if (ackrc >= 0x80) // an MQTT 5 server refused the publish, which ends the exchange
+            {
+                if (packet_type == PUBREC_MSG)
+                    ackPublish(mypacketid);
+                break;
+            }
+            else if ((rc = sendAck((packet_type == PUBREC_MSG) ? PUBREL_MSG : PUBCOMP_MSG, mypacketid, timer)) != SUCCESS)
                 rc = FAILURE; // there was a problem
             if (rc == FAILURE)
                 goto exit; // there was a problem
 			if (packet_type == PUBREL_MSG)
 				freeQoS2msgid(mypacketid);
+            else
+            {
+                // only the PUBREL is resent from now on, so the publish itself can leave the store
+                int i = findInflight(mypacketid);
+                if (i >= 0)
+                {
+                    releaseInflight(i);
+                    inflight[i].pubrel = true;
+                }
+            }
             break;
 			
         case PUBCOMP_MSG:
         	pubCompReceived = true;
+            {
+                unsigned short mypacketid;
+                if (deserializeAck(&mypacketid) >= 0)
+                    ackPublish(mypacketid);
+            }
             break;
 #endif
         case PINGRESP_MSG:
             ping_outstanding = false;
             break;
+        case DISCONNECT_MSG: // an MQTT 5 server says why it is closing the connection
+            {
+                unsigned char disconnect_rc = 0;
+                if (MQTTV5Deserialize_disconnect(NULL, &disconnect_rc, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
+                    reasonCode = disconnect_rc;
+                WARN("Disconnected by the server, reason code %d", reasonCode);
+                isconnected = false;
+                rc = FAILURE;
+            }
+            break;
     }
-    keepalive();
 exit:
-    if (rc == SUCCESS)
-        rc = packet_type;
     return rc;
 }
 
@@ -751,266 +1903,1458 @@ int MQTT::Client<Network, Timer, a, b>::waitfor(int packet_type, Timer& timer)
 }
 
 
+/**
+ * Serialize a connect packet. For MQTT 5 it asks the server to keep a session that isn't clean for
+ * MQTTCLIENT_SESSION_EXPIRY seconds, and not to send packets that are too big for readbuf.
+ * @return the length of the packet, <= 0 on failure
+ */
 template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options)
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::serializeConnect(unsigned char* buf, MQTTPacket_connectData& options)
 {
-    Timer connect_timer(command_timeout_ms);
-    int rc = FAILURE;
-    int len = 0;
+    MQTTProperty array[2];
+    MQTTProperties props = MQTTProperties_initializer;
+    MQTTProperty prop;
+
+    if (options.MQTTVersion != 5)
+        return MQTTSerialize_connect(buf, MAX_MQTT_PACKET_SIZE, &options);
+    if (!MQTTCLIENT_MQTT5)
+        return FAILURE; // MQTT 5 is left out of this build
+    props.array = array;
+    props.max_count = 2;
+    if (!options.cleansession)
+    {
+        prop.identifier = MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL;
+        prop.value.integer4 = MQTTCLIENT_SESSION_EXPIRY;
+        MQTTProperties_add(&props, &prop);
+    }
+    prop.identifier = MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE;
+    prop.value.integer4 = MAX_MQTT_PACKET_SIZE;
+    MQTTProperties_add(&props, &prop);
+    return MQTTV5Serialize_connect(buf, MAX_MQTT_PACKET_SIZE, &options, &props, NULL);
+}
 
-    if (isconnected) // don't send connect packet again if we are already connected
-        goto exit;
 
-    this->keepAliveInterval = options.keepAliveInterval;
-    this->cleansession = (options.cleansession != 0);
-    if ((len = MQTTSerialize_connect(sendbuf, MAX_MQTT_PACKET_SIZE, &options)) <= 0)
-        goto exit;
-    if ((rc = sendPacket(len, connect_timer)) != SUCCESS)  // send the connect packet
-        goto exit; // there was a problem
+/**
+ * Read the connack in readbuf. For MQTT 5 this also takes the limits the server sets for the connection.
+ * @param connack_rc returns the connack return code, or the reason code for MQTT 5
+ * @return 1 if successful, 0 if the packet is malformed
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::deserializeConnack(unsigned char* connack_rc)
+{
+    MQTTProperty array[8];
+    MQTTProperties props = {0, 8, 0, array};
+    MQTTProperty* prop;
+    int rc;
 
-    if (this->keepAliveInterval > 0)
-        last_received.countdown(this->keepAliveInterval);
-    // this will be a blocking call, wait for the connack
-    if (waitfor(CONNACK_MSG, connect_timer) == CONNACK_MSG)
+    receiveMaximum = 65535;
+    maximumPacketSize = 0;
+    topicAliasMaximum = 0;
+    if (mqttVersion != 5)
+        return MQTTDeserialize_connack((unsigned char*)&sessionPresent, connack_rc, readbuf, MAX_MQTT_PACKET_SIZE);
+    if ((rc = MQTTV5Deserialize_connack(&props, (unsigned char*)&sessionPresent, connack_rc, readbuf, MAX_MQTT_PACKET_SIZE)) != 1)
+        return rc;
+    if (*connack_rc >= 0x80)
+        reasonCode = *connack_rc;
+    if ((prop = MQTTProperties_get(&props, MQTTPROPERTY_CODE_RECEIVE_MAXIMUM)) != NULL && prop->value.integer2 > 0)
+        receiveMaximum = prop->value.integer2;
+    if ((prop = MQTTProperties_get(&props, MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE)) != NULL)
+        maximumPacketSize = prop->value.integer4;
+    if ((prop = MQTTProperties_get(&props, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM)) != NULL)
+        topicAliasMaximum = prop->value.integer2;
+    if ((prop = MQTTProperties_get(&props, MQTTPROPERTY_CODE_SERVER_KEEP_ALIVE)) != NULL)
     {
-        unsigned char connack_rc = 255;
-        bool sessionPresent = false;
-        if (MQTTDeserialize_connack((unsigned char*)&sessionPresent, &connack_rc, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
-            rc = connack_rc;
-        else
-            rc = FAILURE;
+        keepAliveInterval = prop->value.integer2;
+        if (keepAliveInterval > 0)
+        {
+            last_sent.countdown(keepAliveInterval);
+            last_received.countdown(keepAliveInterval);
+        }
     }
-    else
-        rc = FAILURE;
+    return rc;
+}
 
-#if MQTTCLIENT_QOS2
-    // resend any inflight publish
-    if (inflightMsgid > 0 && inflightQoS == QOS2 && pubrel)
-    {
-        if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREL_MSG, 0, inflightMsgid)) <= 0)
-            rc = FAILURE;
-        else
-            rc = publish(len, connect_timer, inflightQoS);
-    }
-    else
-#endif
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    if (inflightMsgid > 0)
+
+/**
+ * Read the ack in readbuf, keeping the reason code of an MQTT 5 ack that reports a failure.
+ * @param id returns the packet id
+ * @return the reason code, 0 for success, or -1 if the packet is malformed
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::deserializeAck(unsigned short* id)
+{
+    unsigned char dup, type, rc = 0;
+
+    if (mqttVersion != 5)
+        return (MQTTDeserialize_ack(&type, &dup, id, readbuf, MAX_MQTT_PACKET_SIZE) == 1) ? 0 : -1;
+    if (MQTTV5Deserialize_ack(&type, &dup, id, &rc, NULL, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+        return -1;
+    if (rc >= 0x80)
+        reasonCode = rc;
+    return rc;
+}
+
+
+/**
+ * Read the suback in readbuf. The MQTT 5 failure reason codes are all returned as 0x80, as in MQTT 3.1.1, and the
+ * first of them is kept for getReasonCode.
+ * @return 1 if successful, 0 or less if the packet is malformed
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::deserializeSuback(unsigned short* id, int maxcount, int* count, int grantedQoSs[])
+{
+    int rc;
+
+    if (mqttVersion != 5)
+        return MQTTDeserialize_suback(id, maxcount, count, grantedQoSs, readbuf, MAX_MQTT_PACKET_SIZE);
+    if ((rc = MQTTV5Deserialize_suback(id, NULL, maxcount, count, grantedQoSs, readbuf, MAX_MQTT_PACKET_SIZE)) != 1)
+        return rc;
+    for (int i = 0; i < *count; ++i)
     {
-        memcpy(sendbuf, pubbuf, MAX_MQTT_PACKET_SIZE);
-        rc = publish(inflightLen, connect_timer, inflightQoS);
+        if (grantedQoSs[i] >= 0x80)
+        {
+            if (reasonCode == 0)
+                reasonCode = grantedQoSs[i];
+            grantedQoSs[i] = 0x80;
+        }
     }
-#endif
-
-exit:
-    if (rc == SUCCESS)
-        isconnected = true;
     return rc;
 }
 
 
 template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect()
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::serializeSubscribe(unsigned short id, int count, MQTTString topicFilters[], int qoss[])
 {
-    MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
-    return connect(default_options);
+    if (mqttVersion == 5)
+        return MQTTV5Serialize_subscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, id, NULL, count, topicFilters, qoss);
+    return MQTTSerialize_subscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, id, count, topicFilters, qoss);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter, enum QoS qos, messageHandler messageHandler)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::serializeUnsubscribe(unsigned short id, int count, MQTTString topicFilters[])
 {
-    int rc = FAILURE;
-    Timer timer(command_timeout_ms);
-    int len = 0;
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    if (mqttVersion == 5)
+        return MQTTV5Serialize_unsubscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, id, NULL, count, topicFilters);
+    return MQTTSerialize_unsubscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, id, count, topicFilters);
+}
 
-    if (!isconnected)
-        goto exit;
 
-    len = MQTTSerialize_subscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic, (int*)&qos);
-    if (len <= 0)
-        goto exit;
-    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the subscribe packet
-        goto exit;             // there was a problem
+/**
+ * Find the MQTT 5 topic alias for a topic name.
+ * @param known returns true if the server already has the alias, so the topic name can be left out
+ * @return the alias, the alias addTopicAlias would give the topic name if it doesn't have one, or 0 if there is no room
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::findTopicAlias(const char* topicName, bool* known)
+{
+    *known = false;
+#if MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE > 0
+    int offset = 0, alias = 1;
 
-    if (waitfor(SUBACK_MSG, timer) == SUBACK_MSG)      // wait for suback
+    while (offset < topicAliasesLen)
     {
-        int count = 0, grantedQoS = -1;
-        unsigned short mypacketid;
-        if (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
-            rc = grantedQoS; // 0, 1, 2 or 0x80
-        if (rc != 0x80)
+        if (strcmp(&topicAliases[offset], topicName) == 0)
         {
-            for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-            {
-                if (messageHandlers[i].topicFilter == 0)
-                {
-                    messageHandlers[i].topicFilter = topicFilter;
-                    messageHandlers[i].fp.attach(messageHandler);
-                    rc = 0;
-                    break;
-                }
-            }
+            *known = true;
+            return alias;
         }
+        offset += strlen(&topicAliases[offset]) + 1;
+        ++alias;
     }
-    else
-        rc = FAILURE;
+    if (topicAliasCount >= topicAliasMaximum || topicAliasesLen + (int)strlen(topicName) + 1 > MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE)
+        return 0;
+    return alias;
+#else
+    return 0; // there is no store for the topic names
+#endif
+}
 
-exit:
-    if (rc != SUCCESS)
-		cleanSession();
-    return rc;
+
+/**
+ * Give a topic name the next alias, once it is being sent with it. findTopicAlias has checked there is room.
+ */
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::addTopicAlias(const char* topicName)
+{
+#if MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE > 0
+    int len = strlen(topicName) + 1;
+
+    memcpy(&topicAliases[topicAliasesLen], topicName, len);
+    topicAliasesLen += len;
+    ++topicAliasCount;
+#endif
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribe(const char* topicFilter)
+/**
+ * Get the number of QoS 1 and 2 publishes that can wait for their acknowledgements, the publish window or the
+ * receive maximum of an MQTT 5 server if that is lower.
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::inflightLimit()
+{
+    return (receiveMaximum < publishWindow) ? receiveMaximum : publishWindow;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options)
 {
+    Timer connect_timer(command_timeout_ms);
     int rc = FAILURE;
-    Timer timer(command_timeout_ms);
-    MQTTString topic = {(char*)topicFilter, {0, 0}};
     int len = 0;
 
-    if (!isconnected)
+    if (isconnected) // don't send connect packet again if we are already connected
         goto exit;
 
-    if ((len = MQTTSerialize_unsubscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic)) <= 0)
+    this->keepAliveInterval = options.keepAliveInterval;
+    this->cleansession = (options.cleansession != 0);
+    mqttVersion = options.MQTTVersion;
+    reasonCode = 0;
+    receiveMaximum = 65535;   // until the connack sets the limits of this connection
+    maximumPacketSize = 0;
+    topicAliasMaximum = topicAliasesLen = topicAliasCount = 0; // aliases only last for a connection
+    recvhead = recvtail = sendqueuelen = 0; // anything left over is from the previous connection
+    sessionPresent = false;
+    pendingAcks = 0;
+    subscribeRefused = false;
+    if (this->cleansession)  // the server starts a new session, so there is nothing to resend or subscribe to again
+        forgetSession();
+    if ((len = serializeConnect(sendbuf, options)) <= 0)
         goto exit;
-    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the unsubscribe packet
+    if ((rc = sendPacket(len, connect_timer)) != SUCCESS)  // send the connect packet
         goto exit; // there was a problem
 
-    if (waitfor(UNSUBACK_MSG, timer) == UNSUBACK_MSG)
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval);
+    if (nonblocking) // the connack is handled by onReadable
     {
-        unsigned short mypacketid;  // should be the same as the packetid above
-        if (MQTTDeserialize_unsuback(&mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
-		{
-            rc = 0;
-
-			// remove the subscription message handler associated with this topic, if there is one
-			for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-            {
-                if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
-                {
-                    messageHandlers[i].topicFilter = 0;
-                    break;
-                }
-            }
-		}
+        connectPending = true;
+        connack_timer.countdown_ms(command_timeout_ms);
+        return rc;
+    }
+    // this will be a blocking call, wait for the connack
+    if (waitfor(CONNACK_MSG, connect_timer) == CONNACK_MSG)
+    {
+        unsigned char connack_rc = 255;
+        if (deserializeConnack(&connack_rc) == 1)
+            rc = connack_rc;
+        else
+            rc = FAILURE;
     }
     else
         rc = FAILURE;
 
+    if (rc == SUCCESS)
+        rc = resendInflight(connect_timer);
+    if (rc == SUCCESS && !sessionPresent)
+        rc = resubscribe(connect_timer);
+
 exit:
-    if (rc != SUCCESS)
-		cleanSession();
+    if (rc == SUCCESS)
+        isconnected = true;
     return rc;
 }
 
 
+/**
+ * Resend, in their original order, the publishes that were in flight when the previous connection was lost.
+ * The acknowledgements are handled as they arrive, like those of any other publish in the window.
+ * @return success code
+ */
 template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(int len, Timer& timer, enum QoS qos)
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::resendInflight(Timer& timer)
 {
-    int rc;
-
-    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the publish packet
-        goto exit; // there was a problem
+    int rc = SUCCESS;
 
-#if MQTTCLIENT_QOS1
-    if (qos == QOS1)
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    int i = 0;
+    while (i < inflightCount && rc == SUCCESS)
     {
-        if (waitfor(PUBACK_MSG, timer) == PUBACK_MSG)
+        Inflight& entry = inflight[i];
+        int len = 0;
+
+        if (!entry.stored) // sent in a clean session, so the server has forgotten it
         {
-            unsigned short mypacketid;
-            unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
-                rc = FAILURE;
-            else if (inflightMsgid == mypacketid)
-                inflightMsgid = 0;
+            removeInflight(i);
+            continue;
         }
+#if MQTTCLIENT_QOS2
+        if (entry.pubrel)
+            len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREL_MSG, 0, entry.id);
         else
-            rc = FAILURE;
-    }
 #endif
-#if MQTTCLIENT_QOS2
-    if (qos == QOS2)
-    {
-        if (waitfor(PUBCOMP_MSG, timer) == PUBCOMP_MSG)
         {
-            unsigned short mypacketid;
-            unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
-                rc = FAILURE;
-            else if (inflightMsgid == mypacketid)
-                inflightMsgid = 0;
+            MQTTHeader header = {0};
+            header.byte = inflightStore[entry.offset];
+            header.bits.dup = 1; // the server may have received it already
+            inflightStore[entry.offset] = header.byte;
+#if MQTTCLIENT_WRITEV
+            // the packet can be bigger than sendbuf, so it is sent from the store where it is
+            unsigned char* buffer = &inflightStore[entry.offset];
+            int length = entry.len;
+            rc = sendPacket(&buffer, &length, 1, timer);
+            ++i;
+            continue;
+#else
+            memcpy(sendbuf, &inflightStore[entry.offset], len = entry.len);
+#endif
         }
-        else
-            rc = FAILURE;
+        rc = (len > 0) ? sendPacket(len, timer) : FAILURE;
+        ++i;
     }
 #endif
-
-exit:
-    if (rc != SUCCESS)
-		cleanSession();
     return rc;
 }
 
 
-
+/**
+ * Subscribe again to the topic filters of the session, when the server has not kept it. Only a blocking client
+ * waits for the subacks here, otherwise they are counted off by processPacket as they arrive.
+ * @return success code
+ */
 template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::resubscribe(Timer& timer)
 {
-    int rc = FAILURE;
-    Timer timer(command_timeout_ms);
-    MQTTString topicString = MQTTString_initializer;
-    int len = 0;
-
-    if (!isconnected)
-        goto exit;
-
-    topicString.cstring = (char*)topicName;
-
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    if (qos == QOS1 || qos == QOS2)
-        id = packetid.getNext();
-#endif
-
-    len = MQTTSerialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id,
-              topicString, (unsigned char*)payload, payloadlen);
-    if (len <= 0)
-        goto exit;
+    const char* filters[MQTTCLIENT_MAX_FILTERS];
+    MQTTString topics[MQTTCLIENT_MAX_FILTERS];
+    int qoss[MQTTCLIENT_MAX_FILTERS];
+    int offset = 0, rc = SUCCESS;
 
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    if (!cleansession)
+    while (offset < subscriptionsLen && rc == SUCCESS)
     {
-        memcpy(pubbuf, sendbuf, len);
-        inflightMsgid = id;
-        inflightLen = len;
-        inflightQoS = qos;
-#if MQTTCLIENT_QOS2
-        pubrel = false;
-#endif
+        int count = 0;
+        for (int next = offset; next < subscriptionsLen && count < MQTTCLIENT_MAX_FILTERS; ++count)
+        {
+            filters[count] = (const char*)&subscriptions[next + 1];
+            next += 2 + strlen(filters[count]);
+        }
+        int n = packFilters(count, filters, true);
+        for (int i = 0; i < n; ++i)
+        {
+            MQTTString topic = {(char*)filters[i], {0, 0}};
+            topics[i] = topic;
+            qoss[i] = subscriptions[offset];
+            offset += 2 + strlen(filters[i]);
+        }
+        int len = serializeSubscribe(packetid.getNext(), n, topics, qoss);
+        if (len <= 0 || sendPacket(len, timer) != SUCCESS)
+            rc = FAILURE;
+        else
+            ++pendingAcks;
     }
-#endif
-
-    rc = publish(len, timer, qos);
-exit:
+    while (rc == SUCCESS && !nonblocking && pendingAcks > 0)
+    {
+        if (timer.expired() || cycle(timer) < 0)
+            rc = FAILURE;
+    }
+    if (rc == SUCCESS && subscribeRefused)
+        WARN("A topic filter of the session was refused");
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+/**
+ * Find a topic filter of the session.
+ * @return the offset of its entry in subscriptions, or -1
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::findSubscription(const char* topicFilter)
 {
-    unsigned short id = 0;  // dummy - not used for anything
-    return publish(topicName, payload, payloadlen, id, qos, retained);
+    int offset = 0;
+    while (offset < subscriptionsLen)
+    {
+        const char* filter = (const char*)&subscriptions[offset + 1];
+        if (strcmp(filter, topicFilter) == 0)
+            return offset;
+        offset += 2 + strlen(filter);
+    }
+    return -1;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, Message& message)
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::addSubscription(const char* topicFilter, int qos)
 {
-    return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
+    int offset = findSubscription(topicFilter);
+    int len = strlen(topicFilter) + 2;
+
+    if (offset >= 0)
+        subscriptions[offset] = qos;
+    else if (subscriptionsLen + len > SUBSCRIPTIONSTORE_SIZE)
+    {
+        WARN("No room to keep topic filter %s with the session", topicFilter);
+    }
+    else
+    {
+        subscriptions[subscriptionsLen] = qos;
+        memcpy(&subscriptions[subscriptionsLen + 1], topicFilter, len - 1);
+        subscriptionsLen += len;
+    }
+}
+
+
+template<class Network, class Timer, int a, int b>
+void MQTT::Client<Network, Timer, a, b>::removeSubscription(const char* topicFilter)
+{
+    int offset = findSubscription(topicFilter);
+    if (offset >= 0)
+    {
+        int len = strlen((const char*)&subscriptions[offset + 1]) + 2;
+        memmove(&subscriptions[offset], &subscriptions[offset + len], subscriptionsLen - offset - len);
+        subscriptionsLen -= len;
+    }
+}
+
+
+/**
+ * Register the handler for a topic filter, replacing the one already registered for it, as the server does with
+ * the subscription.
+ * @return flag - false if there is no free handler
+ */
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
+bool MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::attachHandler(const char* topicFilter, messageHandler mh)
+{
+    int index = -1;
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+        {
+            index = i;
+            break;
+        }
+        if (messageHandlers[i].topicFilter == 0 && index == -1)
+            index = i;
+    }
+    if (index == -1)
+        return false;
+    messageHandlers[index].topicFilter = topicFilter;
+    messageHandlers[index].fp.attach(mh);
+    return true;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::saveSession(unsigned char* buf, int buflen)
+{
+    unsigned char* ptr = buf;
+    int count = 0, len = 7 + subscriptionsLen + 2 + 2, qos2len = 0;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < inflightCount; ++i)
+    {
+        if (inflight[i].stored)
+        {
+            ++count;
+            len += 6 + inflight[i].len;
+        }
+    }
+#endif
+#if MQTTCLIENT_QOS2
+    len += (qos2len = incomingQoS2idsLen());
+#endif
+    if (len > buflen)
+        return BUFFER_OVERFLOW;
+
+    // a version, the packet id counter, the publishes to resend then the bytes of those publishes, oldest first
+    writeChar(&ptr, 'M');
+    writeChar(&ptr, 'Q');
+    writeChar(&ptr, 'S');
+    writeChar(&ptr, 2);
+    writeInt(&ptr, packetid.getLast());
+    writeChar(&ptr, count);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < inflightCount; ++i)
+    {
+        if (inflight[i].stored)
+        {
+            writeInt(&ptr, inflight[i].id);
+            writeChar(&ptr, inflight[i].qos);
+            writeChar(&ptr, inflight[i].pubrel);
+            writeInt(&ptr, inflight[i].len);
+        }
+    }
+    for (int i = 0; i < inflightCount; ++i)
+    {
+        if (inflight[i].stored)
+        {
+            memcpy(ptr, &inflightStore[inflight[i].offset], inflight[i].len);
+            ptr += inflight[i].len;
+        }
+    }
+#endif
+    // the topic filters, as they are kept in subscriptions
+    writeInt(&ptr, subscriptionsLen);
+    memcpy(ptr, subscriptions, subscriptionsLen);
+    ptr += subscriptionsLen;
+    // the incoming QoS 2 publishes waiting for their PUBREL, as the start of the bitset that has any ids
+    writeInt(&ptr, qos2len);
+#if MQTTCLIENT_QOS2
+    memcpy(ptr, incomingQoS2ids, qos2len);
+    ptr += qos2len;
+#endif
+    return ptr - buf;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::restoreSession(unsigned char* buf, int len)
+{
+    unsigned char* ptr = buf;
+    unsigned char* enddata = buf + len;
+    unsigned char* entries = 0;
+    int count = 0, storeLen = 0, subsLen = 0;
+
+    if (isconnected || len < 7 || memcmp(buf, "MQS\2", 4) != 0)
+        return FAILURE;
+    ptr += 4;
+    int lastid = readInt(&ptr);
+    count = (unsigned char)readChar(&ptr);
+    if (count > MQTTCLIENT_MAX_INFLIGHT || enddata - ptr < count * 6)
+        return FAILURE;
+    entries = ptr;
+    for (int i = 0; i < count; ++i)
+    {
+        ptr += 4;
+        storeLen += readInt(&ptr);
+    }
+    if (storeLen > INFLIGHTSTORE_SIZE || enddata - ptr < storeLen + 2)
+        return FAILURE;
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    // each entry must be a whole publish that resendInflight can send, or a PUBREL with nothing stored
+    unsigned char* entry = entries;
+    for (int i = 0, offset = 0; i < count; ++i)
+    {
+        entry += 2; // the packet id
+        int qos = readChar(&entry);
+        bool pubrel = (readChar(&entry) != 0);
+        int entrylen = readInt(&entry);
+        if (qos != QOS1 && (qos != QOS2 || !MQTTCLIENT_QOS2))
+            return FAILURE;
+        if (offset + entrylen > storeLen || entrylen > STORED_PACKET_SIZE)
+            return FAILURE;
+        if (pubrel ? (qos != QOS2 || entrylen != 0) : !isStoredPublish(ptr + offset, entrylen, qos))
+            return FAILURE;
+        offset += entrylen;
+    }
+#endif
+    ptr += storeLen;
+    subsLen = readInt(&ptr);
+    if (subsLen > SUBSCRIPTIONSTORE_SIZE || enddata - ptr < subsLen + 2 || (subsLen > 0 && ptr[subsLen - 1] != 0))
+        return FAILURE;
+    ptr += subsLen;
+    int qos2len = readInt(&ptr);
+    if (qos2len > QOS2IDS_SIZE || enddata - ptr < qos2len)
+        return FAILURE;
+
+    // the snapshot is complete, so the state can be replaced
+    packetid.setLast(lastid);
+    ptr = entries;
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    inflightCount = inflightStoreLen = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Inflight& entry = inflight[inflightCount++];
+        entry.id = readInt(&ptr);
+        entry.qos = readChar(&ptr);
+        entry.pubrel = (readChar(&ptr) != 0);
+        entry.len = readInt(&ptr);
+        entry.stored = true;
+        entry.offset = inflightStoreLen;
+        inflightStoreLen += entry.len;
+    }
+    memcpy(inflightStore, ptr, storeLen);
+#endif
+    ptr = entries + count * 6 + storeLen + 2;
+    memcpy(subscriptions, ptr, subscriptionsLen = subsLen);
+    ptr += subsLen + 2;
+#if MQTTCLIENT_QOS2
+    memcpy(incomingQoS2ids, ptr, qos2len);
+    memset(incomingQoS2ids + qos2len, 0, QOS2IDS_SIZE - qos2len);
+#endif
+    return SUCCESS;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect()
+{
+    MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
+    return connect(default_options);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::beginConnect(MQTTPacket_connectData& options)
+{
+    if (isconnected)
+        return FAILURE;
+    if ((connectlen = serializeConnect(connectbuf, options)) <= 0)
+    {
+        connectlen = 0;
+        return FAILURE;
+    }
+    connectVersion = options.MQTTVersion;
+    connectKeepAlive = options.keepAliveInterval;
+    connectCleansession = (options.cleansession != 0);
+    return beginConnect();
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::beginConnect()
+{
+    Timer timer(command_timeout_ms);
+    int rc = FAILURE;
+
+    if (isconnected || nonblocking || connectlen == 0)
+        return rc;
+
+    this->keepAliveInterval = connectKeepAlive;
+    this->cleansession = connectCleansession;
+    mqttVersion = connectVersion;
+    reasonCode = 0;
+    receiveMaximum = 65535;
+    maximumPacketSize = 0;
+    topicAliasMaximum = topicAliasesLen = topicAliasCount = 0;
+    recvhead = recvtail = sendqueuelen = 0; // anything left over is from the previous connection
+    sessionPresent = false;
+    if (this->cleansession)  // the server starts a new session, so there is nothing to resend or subscribe to again
+        forgetSession();
+    pipelining = true;
+    pendingAcks = 0;
+    subscribeRefused = false;
+    memcpy(sendbuf, connectbuf, connectlen);
+    if ((rc = sendPacket(connectlen, timer)) == SUCCESS)
+    {
+        // the connection is treated as open from here, so the calls until finishConnect can queue their packets
+        isconnected = true;
+        rc = resendInflight(timer);
+    }
+    if (rc != SUCCESS)
+    {
+        pipelining = false;
+        sendqueuelen = 0;
+        isconnected = false;
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::finishConnect()
+{
+    Timer timer(command_timeout_ms);
+    int rc = FAILURE;
+
+    if (!pipelining)
+        return rc;
+    pipelining = false;
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval);
+    if (flushQueue(timer) != SUCCESS) // everything since beginConnect goes out in one write
+        goto exit;
+
+    if (waitfor(CONNACK_MSG, timer) == CONNACK_MSG)
+    {
+        unsigned char connack_rc = 255;
+        if (deserializeConnack(&connack_rc) == 1)
+            rc = connack_rc;
+    }
+    if (rc == SUCCESS && !sessionPresent)
+        rc = resubscribe(timer);
+    // then the acknowledgements of the packets that followed the connect
+    while (rc == SUCCESS && (pendingAcks > 0 || inflightCount > 0))
+    {
+        if (timer.expired() || cycle(timer) < 0)
+            rc = FAILURE;
+    }
+    if (rc == SUCCESS && subscribeRefused)
+        rc = 0x80;
+
+exit:
+    pendingAcks = 0;
+    if (rc != SUCCESS)
+        cleanSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter, enum QoS qos, messageHandler messageHandler)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    int len = 0;
+    MQTTString topic = {(char*)topicFilter, {0, 0}};
+
+    int offset;
+
+    if (!isconnected)
+        goto exit;
+
+    // already subscribed in the session the server kept, so only the handler is needed
+    if (!cleansession && (offset = findSubscription(topicFilter)) >= 0 && subscriptions[offset] == qos)
+    {
+        rc = attachHandler(topicFilter, messageHandler) ? SUCCESS : FAILURE;
+        goto exit;
+    }
+
+    len = serializeSubscribe(packetid.getNext(), 1, &topic, (int*)&qos);
+    if (len <= 0)
+        goto exit;
+    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the subscribe packet
+        goto exit;             // there was a problem
+
+    if (nonblocking || pipelining) // don't wait for the suback, register the handler straight away
+    {
+        if (pipelining)
+            ++pendingAcks;
+        rc = attachHandler(topicFilter, messageHandler) ? SUCCESS : FAILURE;
+    }
+    else if (waitfor(SUBACK_MSG, timer) == SUBACK_MSG)      // wait for suback
+    {
+        int count = 0, grantedQoS = -1;
+        unsigned short mypacketid;
+        if (deserializeSuback(&mypacketid, 1, &count, &grantedQoS) == 1)
+            rc = grantedQoS; // 0, 1, 2 or 0x80
+        if (rc != 0x80 && attachHandler(topicFilter, messageHandler))
+            rc = 0;
+    }
+    else
+        rc = FAILURE;
+    if (rc == SUCCESS && !cleansession)
+        addSubscription(topicFilter, qos);
+
+exit:
+    if (rc != SUCCESS)
+		cleanSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribe(const char* topicFilter)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    int len = 0;
+
+    if (!isconnected)
+        goto exit;
+
+    if ((len = serializeUnsubscribe(packetid.getNext(), 1, &topic)) <= 0)
+        goto exit;
+    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the unsubscribe packet
+        goto exit; // there was a problem
+
+    if (pipelining)
+        ++pendingAcks;
+    if (nonblocking || pipelining || waitfor(UNSUBACK_MSG, timer) == UNSUBACK_MSG)
+    {
+        unsigned short mypacketid;  // should be the same as the packetid above
+        if (nonblocking || pipelining || MQTTDeserialize_unsuback(&mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
+		{
+            rc = 0;
+
+			// remove the subscription message handler associated with this topic, if there is one
+			for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+            {
+                if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+                {
+                    messageHandlers[i].topicFilter = 0;
+                    break;
+                }
+            }
+            removeSubscription(topicFilter);
+		}
+    }
+    else
+        rc = FAILURE;
+
+exit:
+    if (rc != SUCCESS)
+		cleanSession();
+    return rc;
+}
+
+
+/**
+ * Work out how many topic filters, from the start of the array, fit into one subscribe or unsubscribe packet.
+ * @param subscribe true for a subscribe packet, which has a QoS byte after each filter
+ * @return the number of filters, at least 1 so a filter that can never fit fails when it is serialized
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::packFilters(int count, const char* topicFilters[], bool subscribe)
+{
+    size_t rem_len = (mqttVersion == 5) ? 3 : 2; // packet id, and no properties for MQTT 5
+    int n = 1;
+
+    rem_len += 2 + strlen(topicFilters[0]) + (subscribe ? 1 : 0);
+    while (n < count && n < MQTTCLIENT_MAX_FILTERS)
+    {
+        rem_len += 2 + strlen(topicFilters[n]) + (subscribe ? 1 : 0);
+        if (MQTTPacket_len(rem_len) > (size_t)MAX_MQTT_PACKET_SIZE)
+            break;
+        ++n;
+    }
+    return n;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribeMany(int count, const char* topicFilters[], enum QoS qos, messageHandler mhs[], int grantedQoSs[])
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topics[MQTTCLIENT_MAX_FILTERS];
+    int qoss[MQTTCLIENT_MAX_FILTERS];
+    unsigned short firstid = 0;
+    int sent = 0, acked = 0;
+
+    if (!isconnected || count <= 0)
+        goto exit;
+
+    // when the server kept the session with all these filters, only the handlers are needed
+    if (!cleansession)
+    {
+        int offset = 0;
+        while (sent < count && (offset = findSubscription(topicFilters[sent])) >= 0 && subscriptions[offset] == qos)
+            ++sent;
+        if (sent == count)
+        {
+            rc = SUCCESS;
+            for (int i = 0; i < count; ++i)
+            {
+                if (grantedQoSs)
+                    grantedQoSs[i] = qos;
+                if (mhs && mhs[i])
+                    attachHandler(topicFilters[i], mhs[i]);
+            }
+            goto exit;
+        }
+        sent = 0;
+    }
+
+    // send every packet before waiting for any suback
+    while (sent < count)
+    {
+        int n = packFilters(count - sent, &topicFilters[sent], true);
+        unsigned short id = packetid.getNext();
+        if (sent == 0)
+            firstid = id;
+        for (int i = 0; i < n; ++i)
+        {
+            MQTTString topic = {(char*)topicFilters[sent + i], {0, 0}};
+            topics[i] = topic;
+            qoss[i] = qos;
+        }
+        int len = serializeSubscribe(id, n, topics, qoss);
+        if (len <= 0 || sendPacket(len, timer) != SUCCESS)
+        {
+            rc = FAILURE;
+            goto exit;
+        }
+        sent += n;
+    }
+
+    // the subacks come back in the order the packets were sent, so the filters are packed again to match them up
+    rc = SUCCESS;
+    while (acked < count)
+    {
+        int n = packFilters(count - acked, &topicFilters[acked], true);
+        int granted[MQTTCLIENT_MAX_FILTERS];
+        if (nonblocking || pipelining) // don't wait for the suback, register the handlers straight away
+        {
+            if (pipelining)
+                ++pendingAcks;
+            for (int i = 0; i < n; ++i)
+                granted[i] = qos;
+        }
+        else
+        {
+            int grantedCount = 0;
+            unsigned short mypacketid;
+            if (waitfor(SUBACK_MSG, timer) != SUBACK_MSG ||
+                    deserializeSuback(&mypacketid, MQTTCLIENT_MAX_FILTERS, &grantedCount, granted) != 1 ||
+                    mypacketid != firstid || grantedCount != n)
+            {
+                rc = FAILURE;
+                goto exit;
+            }
+        }
+        firstid = (firstid == 65535) ? 1 : firstid + 1;
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (grantedQoSs)
+                grantedQoSs[acked + i] = granted[i];
+            if (granted[i] == 0x80)
+            {
+                rc = 0x80;
+                continue;
+            }
+            if (mhs && mhs[acked + i])
+                attachHandler(topicFilters[acked + i], mhs[acked + i]);
+            if (!cleansession)
+                addSubscription(topicFilters[acked + i], qos);
+        }
+        acked += n;
+    }
+
+exit:
+    if (rc != SUCCESS)
+		cleanSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribeMany(int count, const char* topicFilters[])
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topics[MQTTCLIENT_MAX_FILTERS];
+    unsigned short firstid = 0;
+    int sent = 0, acked = 0;
+
+    if (!isconnected || count <= 0)
+        goto exit;
+
+    // send every packet before waiting for any unsuback
+    while (sent < count)
+    {
+        int n = packFilters(count - sent, &topicFilters[sent], false);
+        unsigned short id = packetid.getNext();
+        if (sent == 0)
+            firstid = id;
+        for (int i = 0; i < n; ++i)
+        {
+            MQTTString topic = {(char*)topicFilters[sent + i], {0, 0}};
+            topics[i] = topic;
+        }
+        int len = serializeUnsubscribe(id, n, topics);
+        if (len <= 0 || sendPacket(len, timer) != SUCCESS)
+            goto exit;
+        sent += n;
+    }
+
+    while (acked < count)
+    {
+        int n = packFilters(count - acked, &topicFilters[acked], false);
+        if (pipelining)
+            ++pendingAcks;
+        else if (!nonblocking)
+        {
+            unsigned short mypacketid;
+            if (waitfor(UNSUBACK_MSG, timer) != UNSUBACK_MSG ||
+                    MQTTDeserialize_unsuback(&mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1 || mypacketid != firstid)
+                goto exit;
+        }
+        firstid = (firstid == 65535) ? 1 : firstid + 1;
+
+        // remove the subscription message handlers associated with these topics
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j < MAX_MESSAGE_HANDLERS; ++j)
+            {
+                if (messageHandlers[j].topicFilter != 0 && strcmp(messageHandlers[j].topicFilter, topicFilters[acked + i]) == 0)
+                {
+                    messageHandlers[j].topicFilter = 0;
+                    break;
+                }
+            }
+            removeSubscription(topicFilters[acked + i]);
+        }
+        acked += n;
+    }
+    rc = SUCCESS;
+
+exit:
+    if (rc != SUCCESS)
+		cleanSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(int len, Timer& timer, enum QoS qos, unsigned short id)
+{
+    int rc;
+
+    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the publish packet
+        goto exit; // there was a problem
+
+    rc = waitforPublish(timer, qos, id);
+
+exit:
+    if (rc != SUCCESS)
+		cleanSession();
+    return rc;
+}
+
+
+/**
+ * Wait for a publish that has been sent to complete. A QoS 1 publish only waits until the window has room,
+ * so with a window of 1 until the publish itself is acknowledged. A QoS 2 publish waits for its PUBCOMP.
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::waitforPublish(Timer& timer, enum QoS qos, unsigned short id)
+{
+    int rc = SUCCESS;
+
+    if (nonblocking || pipelining) // the ack is handled by onReadable or finishConnect
+        return rc;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    while ((qos == QOS1 && inflightCount >= inflightLimit()) || (qos == QOS2 && findInflight(id) >= 0))
+    {
+        if (timer.expired() || cycle(timer) < 0)
+        {
+            rc = FAILURE;
+            break;
+        }
+    }
+#endif
+
+    return rc;
+}
+
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topicString = MQTTString_initializer;
+    MQTTProperty aliasProperty;
+    MQTTProperties props = {0, 1, 0, &aliasProperty};
+    MQTTProperties* properties = NULL; // only sent with MQTT 5
+    int len = 0, packetlen = 0, alias = 0;
+    bool stored = false, aliasKnown = false;
+#if MQTTCLIENT_WRITEV
+    unsigned char* buffers[4];
+    int lengths[4];
+    int count = 0;
+#endif
+
+    if (!isconnected)
+        goto exit;
+
+    topicString.cstring = (char*)topicName;
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    // when the session is kept, the whole packet is stored for resending on reconnect
+    stored = (qos == QOS1 || qos == QOS2) && !cleansession;
+#endif
+    if (mqttVersion == 5)
+    {
+        properties = &props;
+        // a stored packet can be resent on another connection, where the alias would mean nothing
+        if (!stored && (alias = findTopicAlias(topicName, &aliasKnown)) > 0)
+        {
+            aliasProperty.identifier = MQTTPROPERTY_CODE_TOPIC_ALIAS;
+            aliasProperty.value.integer2 = alias;
+            MQTTProperties_add(&props, &aliasProperty);
+            if (aliasKnown)
+                topicString.cstring = (char*)"";
+        }
+    }
+    packetlen = (int)MQTTPacket_len(properties ? MQTTV5Serialize_publishLength(qos, topicString, properties, payloadlen)
+                                               : MQTTSerialize_publishLength(qos, topicString, payloadlen));
+    if (maximumPacketSize > 0 && (unsigned int)packetlen > maximumPacketSize)
+    {
+        reasonCode = MQTTREASONCODE_PACKET_TOO_LARGE;
+        goto exit; // the server would close the connection
+    }
+#if !MQTTCLIENT_WRITEV
+    if (!stored && packetlen > MAX_MQTT_PACKET_SIZE)
+    {
+        // too big for sendbuf, so the payload is copied in behind the header a chunk at a time
+        FP<int, PayloadChunk&> fp;
+        fp.attach(this, &Client::copyPayload);
+        streamPayload = (unsigned char*)payload;
+        return publishStream(topicName, payloadlen, fp, id, qos, retained);
+    }
+#endif
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos == QOS1 || qos == QOS2)
+    {
+        if (reserveInflight(stored ? packetlen : 0, timer) != SUCCESS)
+            goto exit; // the window or the store is full
+        id = packetid.getNext();
+    }
+#endif
+
+#if MQTTCLIENT_WRITEV
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (stored)
+    {
+        // serialize the packet into the store and send it from there
+        unsigned char* packet = &inflightStore[inflightStoreLen];
+        if (properties)
+            len = MQTTV5Serialize_publish(packet, sizeof(inflightStore) - inflightStoreLen, 0, qos, retained, id,
+                      topicString, properties, (unsigned char*)payload, payloadlen);
+        else
+            len = MQTTSerialize_publish(packet, sizeof(inflightStore) - inflightStoreLen, 0, qos, retained, id,
+                      topicString, (unsigned char*)payload, payloadlen);
+        if (len <= 0)
+            goto exit;
+        buffers[count] = packet;
+        lengths[count++] = len;
+    }
+    else
+#endif
+    {
+        // only the header is serialized, the topic and payload are sent from the caller's buffers
+        if (properties)
+            len = MQTTV5Serialize_publishHeader(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id, topicString, properties, payloadlen);
+        else
+            len = MQTTSerialize_publishHeader(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id, topicString, payloadlen);
+        if (len <= 0)
+            goto exit;
+        buffers[count] = sendbuf;
+        lengths[count++] = len;
+        if (topicString.cstring[0] != '\0')
+        {
+            buffers[count] = (unsigned char*)topicName;
+            lengths[count++] = (int)strlen(topicName);
+        }
+        // then the packet id and properties, which follow the header in sendbuf
+        int trailer = ((qos != QOS0) ? 2 : 0) + (properties ? MQTTProperties_len(properties) : 0);
+        if (trailer > 0)
+        {
+            buffers[count] = sendbuf + len;
+            lengths[count++] = trailer;
+        }
+        buffers[count] = (unsigned char*)payload;
+        lengths[count++] = (int)payloadlen;
+    }
+    if (alias > 0 && !aliasKnown)
+        addTopicAlias(topicName);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos != QOS0)
+        addInflight(id, qos, stored ? len : 0);
+#endif
+
+    if ((rc = sendPacket(buffers, lengths, count, timer)) == SUCCESS)
+        rc = waitforPublish(timer, qos, id);
+    if (rc != SUCCESS)
+        cleanSession();
+#else
+    if (properties)
+        len = MQTTV5Serialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id,
+                  topicString, properties, (unsigned char*)payload, payloadlen);
+    else
+        len = MQTTSerialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id,
+                  topicString, (unsigned char*)payload, payloadlen);
+    if (len <= 0)
+        goto exit;
+    if (alias > 0 && !aliasKnown)
+        addTopicAlias(topicName);
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos != QOS0)
+    {
+        if (stored)
+            memcpy(&inflightStore[inflightStoreLen], sendbuf, len);
+        addInflight(id, qos, stored ? len : 0);
+    }
+#endif
+
+    rc = publish(len, timer, qos, id);
+#endif
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+{
+    unsigned short id = 0;  // dummy - not used for anything
+    return publish(topicName, payload, payloadlen, id, qos, retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, Message& message)
+{
+    return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publishPrepared(const unsigned char* packet, int packetlen, bool retained)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTHeader header = {0};
+    int len = 0;
+    int topiclen = 0;
+
+    if (!isconnected || packetlen < 2)
+        goto exit;
+    topiclen = (packet[0] << 8) + packet[1];
+    if (2 + topiclen > packetlen)
+        goto exit;
+    if (mqttVersion == 5)
+    {
+        // the properties go between the topic and the payload, and the topic may be sent as an alias
+        char topicName[MAX_MQTT_PACKET_SIZE + 1];
+        if (topiclen > MAX_MQTT_PACKET_SIZE)
+            return BUFFER_OVERFLOW;
+        memcpy(topicName, &packet[2], topiclen);
+        topicName[topiclen] = '\0';
+        return publish(topicName, (void*)&packet[2 + topiclen], packetlen - 2 - topiclen, QOS0, retained);
+    }
+    if (maximumPacketSize > 0 && MQTTPacket_len(packetlen) > maximumPacketSize)
+    {
+        reasonCode = MQTTREASONCODE_PACKET_TOO_LARGE;
+        goto exit;
+    }
+
+    header.bits.type = PUBLISH_MSG;
+    header.bits.retain = retained;
+    sendbuf[0] = header.byte;
+    len = 1 + MQTTPacket_encode(&sendbuf[1], packetlen);
+#if MQTTCLIENT_WRITEV
+    {
+        unsigned char* buffers[2] = {sendbuf, (unsigned char*)packet};
+        int lengths[2] = {len, packetlen};
+        if ((rc = sendPacket(buffers, lengths, 2, timer)) != SUCCESS)
+            cleanSession();
+    }
+#else
+    if (len + packetlen > MAX_MQTT_PACKET_SIZE)
+    {
+        rc = BUFFER_OVERFLOW;
+        goto exit;
+    }
+    memcpy(&sendbuf[len], packet, packetlen);
+    rc = publish(len + packetlen, timer, QOS0, 0);
+#endif
+
+exit:
+    return rc;
+}
+
+
+/**
+ * Publish a payload a chunk at a time. The header, topic name, packet id and properties are serialized into
+ * sendbuf ahead of the first chunk, and each chunk is written as soon as the source has filled the rest of sendbuf.
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publishStream(const char* topicName, size_t payloadlen,
+        FP<int, PayloadChunk&>& source, unsigned short& id, enum QoS qos, bool retained)
+{
+    int rc = FAILURE;
+    Timer timer(command_timeout_ms);
+    MQTTString topicString = MQTTString_initializer;
+    MQTTProperties props = MQTTProperties_initializer;
+    MQTTProperties* properties = (mqttVersion == 5) ? &props : NULL; // no topic alias, the header is written once
+    PayloadChunk chunk = {0, 0, 0};
+    int len = 0, topiclen = 0, trailer = 0;
+    size_t packetlen = 0;
+    bool started = false;
+
+    if (!isconnected || nonblocking || pipelining)
+        goto exit;
+
+    topicString.cstring = (char*)topicName;
+    packetlen = MQTTPacket_len(properties ? MQTTV5Serialize_publishLength(qos, topicString, properties, payloadlen)
+                                          : MQTTSerialize_publishLength(qos, topicString, payloadlen));
+    if (maximumPacketSize > 0 && packetlen > maximumPacketSize)
+    {
+        reasonCode = MQTTREASONCODE_PACKET_TOO_LARGE;
+        goto exit; // the server would close the connection
+    }
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos == QOS1 || qos == QOS2)
+    {
+        if (reserveInflight(0, timer) != SUCCESS)
+            goto exit; // the window is full
+        id = packetid.getNext();
+    }
+#endif
+
+    if (properties)
+        len = MQTTV5Serialize_publishHeader(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id, topicString, properties, payloadlen);
+    else
+        len = MQTTSerialize_publishHeader(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id, topicString, payloadlen);
+    topiclen = (int)strlen(topicName);
+    trailer = ((qos != QOS0) ? 2 : 0) + (properties ? MQTTProperties_len(properties) : 0);
+    if (len <= 0 || len + topiclen + trailer > MAX_MQTT_PACKET_SIZE)
+        goto exit;
+    memmove(sendbuf + len + topiclen, sendbuf + len, trailer);
+    memcpy(sendbuf + len, topicName, topiclen);
+    len += topiclen + trailer;
+
+    // packets already in the send queue go first
+    if (sendqueuelen > 0 && flushQueue(timer) != SUCCESS)
+        goto exit;
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos != QOS0)
+        addInflight(id, qos, 0);
+#endif
+
+    cork(true); // the chunks go out in full segments, not a segment each
+    do
+    {
+        int room = MAX_MQTT_PACKET_SIZE - len,
+            filled = 0;
+        chunk.data = sendbuf + len;
+        chunk.len = (payloadlen - chunk.offset < (size_t)room) ? (int)(payloadlen - chunk.offset) : room;
+        if (chunk.len > 0 && ((filled = source(chunk)) <= 0 || filled > chunk.len))
+            break; // the packet can't be finished
+        started = true;
+        if (writeAll(sendbuf, len + filled, timer) != SUCCESS)
+            break;
+        chunk.offset += filled;
+        len = 0;
+    } while (chunk.offset < payloadlen);
+    cork(false);
+
+    if (len == 0 && chunk.offset == payloadlen)
+    {
+        if (this->keepAliveInterval > 0)
+            last_sent.countdown(this->keepAliveInterval);
+        if ((rc = waitforPublish(timer, qos, id)) != SUCCESS)
+            cleanSession();
+    }
+    else if (!started)
+    {
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+        if (qos != QOS0)
+            removeInflight(findInflight(id)); // nothing was sent, so the connection can still be used
+#endif
+    }
+    else
+    {
+        ipstack.disconnect(); // the server would read whatever is sent next as the rest of the payload
+        cleanSession();
+    }
+exit:
+#if defined(MQTT_DEBUG)
+    DEBUG("Rc %d from streaming a publish of %d bytes\n", rc, (int)packetlen);
+#endif
+    return rc;
+}
+
+
+/**
+ * Fill a chunk from streamPayload, for publishing a payload in memory that is too big for sendbuf.
+ * @return the length of the chunk
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::copyPayload(PayloadChunk& chunk)
+{
+    memcpy(chunk.data, streamPayload + chunk.offset, chunk.len);
+    return chunk.len;
+}
+
+
+/**
+ * Write a buffer to the network in blocking mode, bypassing the send queue.
+ * @return success code
+ */
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::writeAll(unsigned char* buf, int len, Timer& timer)
+{
+    int sent = 0;
+
+    while (sent < len && !timer.expired())
+    {
+        int rc = ipstack.write(&buf[sent], len - sent, timer.left_ms());
+        if (rc < 0)  // there was an error writing the data
+            break;
+        sent += rc;
+    }
+    return (sent == len) ? SUCCESS : FAILURE;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::nextTimeout_ms()
+{
+    int timeout = -1;
+
+    if (connectPending)
+        timeout = connack_timer.left_ms();
+    if (isconnected && keepAliveInterval > 0)
+    {
+        int keepalive_ms = ping_outstanding ? ping_response.left_ms() : last_sent.left_ms();
+        if (!ping_outstanding && last_received.left_ms() < keepalive_ms)
+            keepalive_ms = last_received.left_ms();
+        if (timeout == -1 || keepalive_ms < timeout)
+            timeout = keepalive_ms;
+    }
+    if (sendqueuelen > 0 && coalesceThreshold > 0 && (timeout == -1 || flush_timer.left_ms() < timeout))
+        timeout = flush_timer.left_ms();
+    return timeout;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::onReadable()
+{
+    Timer timer(0); // already expired, so only data that has arrived is read
+    int rc = SUCCESS,
+        packet_type;
+
+    while ((packet_type = readPacket(timer)) > 0)
+    {
+        if ((rc = processPacket(packet_type, timer)) != SUCCESS)
+            goto exit;
+        if (ackQueued && flush_timer.expired() && (rc = onWritable()) != SUCCESS)
+            goto exit;
+    }
+    if (packet_type < 0)
+        rc = packet_type;
+    else if (ackQueued) // the acknowledgements of everything read go out together
+        rc = onWritable();
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::onWritable()
+{
+    int rc = ipstack.write(sendqueue, sendqueuelen, 0);
+
+    if (rc < 0)
+        return FAILURE;
+    sendqueuelen -= rc;
+    memmove(sendqueue, sendqueue + rc, sendqueuelen);
+    if (rc > 0 && keepAliveInterval > 0)
+        last_sent.countdown(keepAliveInterval);
+    if (sendqueuelen == 0)
+        ackQueued = false;
+    return SUCCESS;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTT::Client<Network, Timer, a, b>::onTimer()
+{
+    if (connectPending)
+    {
+        if (!connack_timer.expired())
+            return SUCCESS;
+        connectPending = false; // no connack in time
+        return FAILURE;
+    }
+    if (sendqueuelen > 0 && coalesceThreshold > 0 && flush_timer.expired() && onWritable() != SUCCESS)
+        return FAILURE;
+    keepalive();
+    return isconnected ? SUCCESS : FAILURE;
 }
 
 
@@ -1022,6 +3366,8 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::disconnect()
     int len = MQTTSerialize_disconnect(sendbuf, MAX_MQTT_PACKET_SIZE);
     if (len > 0)
         rc = sendPacket(len, timer);            // send the disconnect packet
+    if (rc == SUCCESS && !nonblocking && sendqueuelen > 0)
+        rc = flushQueue(timer);
 
     if (cleansession)
         cleanSession();
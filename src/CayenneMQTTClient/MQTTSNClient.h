@@ -0,0 +1,1037 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+#if !defined(MQTTSNCLIENT_H)
+#define MQTTSNCLIENT_H
+
+#include "MQTTClient.h"
+#include "MQTTSNPacket.h"
+
+#if !defined(MQTTSNCLIENT_MAX_TOPICS)
+    #define MQTTSNCLIENT_MAX_TOPICS 16 // topic ids remembered, the oldest is forgotten to make room for a new one
+#endif
+#if !defined(MQTTSNCLIENT_TOPIC_STORE_SIZE)
+    #define MQTTSNCLIENT_TOPIC_STORE_SIZE 1536 // bytes of topic names kept with their topic ids, Cayenne topics are about 95 bytes
+#endif
+#if !defined(MQTTSNCLIENT_RETRY_MS)
+    #define MQTTSNCLIENT_RETRY_MS 2000 // time to wait for a reply before sending a request again, as UDP can lose either
+#endif
+
+namespace MQTTSN
+{
+
+
+/**
+ * @class Client
+ * @brief blocking, non-threaded MQTT-SN client API
+ *
+ * An MQTT-SN 1.2 client for a gateway reached over a datagram network such as MQTTUDPNetwork. Each call blocks until
+ * it is complete, and requests are sent again every MQTTSNCLIENT_RETRY_MS until the gateway replies or the command
+ * timeout expires.
+ *
+ * Publishing to a topic name registers the name with the gateway the first time it is used, and after that only the
+ * 2 byte topic id goes out with each publish. Names of two characters are sent as short topics with no registration.
+ * Topic ids given by the gateway in a register or suback are kept the same way, so incoming publishes are delivered
+ * with their topic name, as MQTT::Client does.
+ *
+ * The calls match those of MQTT::Client, so CayenneMQTT::MQTTClient can use this client in its place. QoS 0 and 1
+ * are supported. MQTT-SN has no user name or password; the gateway supplies them to the broker.
+ * @param Network a network class with the methods: read, write. Each read must return one whole datagram.
+ * @param Timer a timer class with the methods: countdown_ms, countdown, left_ms, expired. See TimerInterface.h for function definitions.
+ */
+template<class Network, class Timer, int MAX_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5>
+class Client
+{
+
+public:
+
+    typedef void (*messageHandler)(MQTT::MessageData&);
+
+    /** Construct the client
+     *  @param network - pointer to an instance of the Network class - must be connected to the gateway address
+     *      before calling MQTT-SN connect
+     *  @param command_timeout_ms - the time allowed for each request, retries included
+     */
+    Client(Network& network, unsigned int command_timeout_ms = 30000);
+
+    /** Set the default message handling callback - used for any message which does not match a subscription message handler
+     *  @param mh - pointer to the callback function
+     */
+    void setDefaultMessageHandler(messageHandler mh)
+    {
+        defaultMessageHandler.attach(mh);
+    }
+
+    /** Set the default message handling callback - used for any message which does not match a subscription message handler
+     *  @param item - address of initialized object
+     *  @param mh - pointer to the callback function
+     */
+    template<class T>
+    void setDefaultMessageHandler(T *item, void (T::*method)(MQTT::MessageData&))
+    {
+        defaultMessageHandler.attach(item, method);
+    }
+
+    /** MQTT-SN Connect - send a connect packet and wait for the connack, with default options
+     *  @return success code -
+     */
+    int connect();
+
+    /** MQTT-SN Connect - send a connect packet and wait for the connack
+     *  @param options - connect options
+     *  @return success code - the connack return code if the gateway refused the connection
+     */
+    int connect(MQTTSNPacket_connectData& options);
+
+    /** MQTT-SN Connect using MQTT connect options. The client id, keep alive interval and clean session flag are
+     *  used, the other options don't exist in MQTT-SN.
+     *  @param options - MQTT connect options
+     *  @return success code - the connack return code if the gateway refused the connection
+     */
+    int connect(MQTTPacket_connectData& options);
+
+    /** There is no connect packet kept between connects, so this does nothing. It lets code written for MQTT::Client
+     *  clear the cache when credentials change.
+     */
+    void clearConnectCache()
+    {
+    }
+
+    /** Sessions can't be saved over MQTT-SN, the gateway keeps them. */
+    enum { SESSION_SIZE = 0 };
+
+    /** Register a topic name with the gateway, unless it already has a topic id. Publishing registers topic names
+     *  itself, this lets them be registered up front.
+     *  @param topicName - the topic name, without wildcards
+     *  @param topicId - returns the topic id
+     *  @return success code - the regack return code if the gateway refused the topic name
+     */
+    int registerTopic(const char* topicName, unsigned short& topicId);
+
+    /** MQTT-SN Publish - send a publish packet and, for QoS 1, wait for the puback
+     *  @param topicName - the topic to publish to, registered first if it has no topic id yet
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param qos - the QoS to send the publish at, QOS0 or QOS1
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(const char* topicName, void* payload, size_t payloadlen, enum MQTT::QoS qos = MQTT::QOS0, bool retained = false);
+
+    /** MQTT-SN Publish to a registered topic id - send a publish packet and, for QoS 1, wait for the puback
+     *  @param topicId - the topic id from registerTopic
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param qos - the QoS to send the publish at, QOS0 or QOS1
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(unsigned short topicId, void* payload, size_t payloadlen, enum MQTT::QoS qos = MQTT::QOS0, bool retained = false);
+
+    /** MQTT-SN Publish a QoS 0 packet that was serialized ahead of time for MQTT, see MQTT::Client::publishPrepared.
+     *  The topic name is looked up like any other, so the publish carries its topic id.
+     *  @param packet - the topic as a 2 byte length and the topic name, followed by the payload
+     *  @param packetlen - the length of packet
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publishPrepared(const unsigned char* packet, int packetlen, bool retained = false);
+
+    /** MQTT-SN Subscribe - send a subscribe packet and wait for the suback
+     *  @param topicFilter - a topic pattern which can include wildcards. The string is not copied.
+     *  @param qos - the QoS to subscribe at
+     *  @param mh - the callback function to be invoked when a message is received for this subscription, or NULL
+     *  @return success code - 0x80 if the gateway refused the subscription
+     */
+    int subscribe(const char* topicFilter, enum MQTT::QoS qos, messageHandler mh);
+
+    /** MQTT-SN Subscribe to several topic filters. MQTT-SN has one topic filter per subscribe packet, so each one
+     *  is a round trip.
+     *  @param count - the number of topic filters
+     *  @param topicFilters - topic patterns which can include wildcards. The strings are not copied.
+     *  @param qos - the QoS to subscribe at
+     *  @param mhs - the callback function for each filter, or NULL. Filters without one use the default handler.
+     *  @param grantedQoSs - returns the QoS granted for each filter, 0x80 if it was refused, or NULL
+     *  @return success code - 0x80 if any filter was refused
+     */
+    int subscribeMany(int count, const char* topicFilters[], enum MQTT::QoS qos, messageHandler mhs[] = NULL, int grantedQoSs[] = NULL);
+
+    /** MQTT-SN Unsubscribe - send an unsubscribe packet and wait for the unsuback
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @return success code -
+     */
+    int unsubscribe(const char* topicFilter);
+
+    /** MQTT-SN Unsubscribe from several topic filters, one round trip each
+     *  @param count - the number of topic filters
+     *  @param topicFilters - topic patterns which can include wildcards
+     *  @return success code -
+     */
+    int unsubscribeMany(int count, const char* topicFilters[]);
+
+    /** MQTT-SN Disconnect - send a disconnect packet, and clean up any state
+     *  @return success code -
+     */
+    int disconnect();
+
+    /** A call to this API must be made within the keepAlive interval to keep the connection alive.
+     *  yield can be called if no other MQTT-SN operation is needed.  This will also allow messages to be
+     *  received.
+     *  @param timeout_ms the time to wait, in milliseconds
+     *  @return success code - on failure, this means the client has disconnected
+     */
+    int yield(unsigned long timeout_ms = 1000L);
+
+    /** Is the client connected?
+     *  @return flag - is the client connected or not?
+     */
+    bool isConnected()
+    {
+        return isconnected;
+    }
+
+    /** Get the MQTT-SN return code of the last refusal from the gateway, in a connack, regack, puback or suback.
+     *  @return the return code, 0 if nothing has been refused since connecting
+     */
+    int getReasonCode()
+    {
+        return returnCode;
+    }
+
+private:
+
+    int cycle(Timer& timer);
+    int readPacket(Timer& timer);
+    int processPacket(int packet_type);
+    int sendPacket(unsigned char* buf, int length, Timer& timer);
+    int request(int length, int packet_type, unsigned short id, Timer& timer);
+    int keepalive();
+    int publish(MQTTSN_topicid& topic, void* payload, size_t payloadlen, enum MQTT::QoS qos, bool retained, Timer& timer);
+    int findTopic(const char* topicName);
+    int findTopic(unsigned short topicId);
+    void addTopic(unsigned short topicId, const char* topicName, int len);
+    void removeTopic(int index);
+    bool isShortTopic(const char* topicName);
+    void setTopicFilter(MQTTSN_topicid& topic, const char* topicFilter);
+    int deliverMessage(MQTTString& topicName, MQTT::Message& message);
+    bool isTopicMatched(const char* topicFilter, MQTTString& topicName);
+
+    Network& ipstack;
+    unsigned long command_timeout_ms;
+
+    unsigned char sendbuf[MAX_PACKET_SIZE];
+    unsigned char readbuf[MAX_PACKET_SIZE + 1]; // room to null terminate a payload that fills the packet
+    int readlen;
+
+    Timer last_sent, last_received, ping_response, ping_retry;
+    unsigned int keepAliveInterval;
+    bool ping_outstanding;
+    bool isconnected;
+    int returnCode;     // of the last refusal from the gateway
+
+    // The reply waited for by request, and what it carried
+    int replyType;
+    unsigned short replyId;
+    bool replyReceived;
+    unsigned short replyTopicId;
+    int replyQoS;
+    unsigned char replyCode;
+
+    // The topic names with a topic id for this session, oldest first, each null terminated in topicStore
+    struct Topic
+    {
+        unsigned short id;
+        short offset;
+        short len;
+    } topics[MQTTSNCLIENT_MAX_TOPICS];
+    int topicCount;
+    char topicStore[MQTTSNCLIENT_TOPIC_STORE_SIZE];
+    int topicStoreLen;
+
+    MQTT::PacketId packetid;
+
+    struct MessageHandlers
+    {
+        const char* topicFilter;
+        FP<void, MQTT::MessageData&> fp;
+    } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
+
+    FP<void, MQTT::MessageData&> defaultMessageHandler;
+};
+
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
+MQTTSN::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
+{
+    this->command_timeout_ms = command_timeout_ms;
+    readlen = 0;
+    keepAliveInterval = 0;
+    ping_outstanding = false;
+    isconnected = false;
+    returnCode = 0;
+    replyType = -1;
+    replyReceived = false;
+    topicCount = topicStoreLen = 0;
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+        messageHandlers[i].topicFilter = 0;
+}
+
+
+/**
+ * Find the topic id of a topic name.
+ * @return the index in topics, or -1 if the name has no topic id
+ */
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::findTopic(const char* topicName)
+{
+    for (int i = 0; i < topicCount; ++i)
+    {
+        if (strcmp(topicStore + topics[i].offset, topicName) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+/**
+ * Find the topic name of a topic id.
+ * @return the index in topics, or -1 if the id is unknown
+ */
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::findTopic(unsigned short topicId)
+{
+    for (int i = 0; i < topicCount; ++i)
+    {
+        if (topics[i].id == topicId)
+            return i;
+    }
+    return -1;
+}
+
+
+/**
+ * Remember the topic id of a topic name, forgetting the oldest topics if there is no room. A name too long for
+ * topicStore isn't remembered, so it is registered each time it is used.
+ */
+template<class Network, class Timer, int a, int b>
+void MQTTSN::Client<Network, Timer, a, b>::addTopic(unsigned short topicId, const char* topicName, int len)
+{
+    int i = findTopic(topicId);
+    if (i >= 0)
+        removeTopic(i); // the gateway has reused the id
+    if (len + 1 > MQTTSNCLIENT_TOPIC_STORE_SIZE)
+        return;
+    while (topicCount == MQTTSNCLIENT_MAX_TOPICS || topicStoreLen + len + 1 > MQTTSNCLIENT_TOPIC_STORE_SIZE)
+        removeTopic(0);
+    topics[topicCount].id = topicId;
+    topics[topicCount].offset = topicStoreLen;
+    topics[topicCount].len = len;
+    memcpy(topicStore + topicStoreLen, topicName, len);
+    topicStore[topicStoreLen + len] = '\0';
+    topicStoreLen += len + 1;
+    topicCount++;
+}
+
+
+template<class Network, class Timer, int a, int b>
+void MQTTSN::Client<Network, Timer, a, b>::removeTopic(int index)
+{
+    int offset = topics[index].offset;
+    int len = topics[index].len + 1;
+
+    memmove(topicStore + offset, topicStore + offset + len, topicStoreLen - offset - len);
+    topicStoreLen -= len;
+    for (int i = index + 1; i < topicCount; ++i)
+    {
+        topics[i - 1] = topics[i];
+        if (topics[i - 1].offset > offset)
+            topics[i - 1].offset -= len;
+    }
+    topicCount--;
+}
+
+
+/**
+ * Is the topic name two characters without wildcards, so it can be sent in place of a topic id?
+ */
+template<class Network, class Timer, int a, int b>
+bool MQTTSN::Client<Network, Timer, a, b>::isShortTopic(const char* topicName)
+{
+    return topicName[0] && topicName[1] && !topicName[2] && strpbrk(topicName, "+#") == NULL;
+}
+
+
+/**
+ * Set the topic of a subscribe or unsubscribe packet, as a short topic name if it can be one.
+ */
+template<class Network, class Timer, int a, int b>
+void MQTTSN::Client<Network, Timer, a, b>::setTopicFilter(MQTTSN_topicid& topic, const char* topicFilter)
+{
+    if (isShortTopic(topicFilter))
+    {
+        topic.type = MQTTSN_TOPIC_TYPE_SHORT;
+        memcpy(topic.data.short_name, topicFilter, 2);
+    }
+    else
+    {
+        topic.type = MQTTSN_TOPIC_TYPE_NORMAL;
+        topic.data.long_.name = (char*)topicFilter;
+        topic.data.long_.len = (int)strlen(topicFilter);
+    }
+}
+
+
+// assume topic filter and name is in correct format
+// # can only be at end
+// + and # can only be next to separator
+template<class Network, class Timer, int a, int b>
+bool MQTTSN::Client<Network, Timer, a, b>::isTopicMatched(const char* topicFilter, MQTTString& topicName)
+{
+    const char* curf = topicFilter;
+    char* curn = topicName.lenstring.data;
+    char* curn_end = curn + topicName.lenstring.len;
+
+    while (*curf && curn < curn_end)
+    {
+        if (*curn == '/' && *curf != '/')
+            break;
+        if (*curf != '+' && *curf != '#' && *curf != *curn)
+            break;
+        if (*curf == '+')
+        {   // skip until we meet the next separator, or end of string
+            char* nextpos = curn + 1;
+            while (nextpos < curn_end && *nextpos != '/')
+                nextpos = ++curn + 1;
+        }
+        else if (*curf == '#')
+            curn = curn_end - 1;    // skip until end of string
+        curf++;
+        curn++;
+    };
+
+    return (curn == curn_end) && (*curf == '\0');
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
+int MQTTSN::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTString& topicName, MQTT::Message& message)
+{
+    int rc = MQTT::FAILURE;
+
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter != 0 && messageHandlers[i].fp.attached() &&
+            (MQTTPacket_equals(&topicName, (char*)messageHandlers[i].topicFilter) || isTopicMatched(messageHandlers[i].topicFilter, topicName)))
+        {
+            MQTT::MessageData md(topicName, message);
+            messageHandlers[i].fp(md);
+            rc = MQTT::SUCCESS;
+        }
+    }
+
+    if (rc == MQTT::FAILURE && defaultMessageHandler.attached())
+    {
+        MQTT::MessageData md(topicName, message);
+        defaultMessageHandler(md);
+        rc = MQTT::SUCCESS;
+    }
+
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::sendPacket(unsigned char* buf, int length, Timer& timer)
+{
+    int rc = MQTT::FAILURE;
+
+    if (ipstack.write(buf, length, timer.left_ms()) == length)
+    {
+        if (this->keepAliveInterval > 0)
+            last_sent.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet
+        rc = MQTT::SUCCESS;
+    }
+    return rc;
+}
+
+
+/**
+ * Read one datagram into readbuf.
+ * @return the MQTT-SN packet type, 0 if no packet arrived before the timeout or the datagram was malformed, or FAILURE
+ *      if the network failed. A gateway advertisement, type 0, is ignored the same way.
+ */
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::readPacket(Timer& timer)
+{
+    int rc = ipstack.read(readbuf, MAX_PACKET_SIZE, timer.left_ms());
+
+    if (rc <= 0)
+        return (rc < 0) ? MQTT::FAILURE : 0;
+    readlen = rc;
+    if ((rc = MQTTSNPacket_type(readbuf, readlen)) < 0)
+        return 0; // truncated or malformed, anything that matters is sent again
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::yield(unsigned long timeout_ms)
+{
+    int rc = MQTT::SUCCESS;
+    Timer timer;
+
+    timer.countdown_ms(timeout_ms);
+    while (!timer.expired())
+    {
+        if (cycle(timer) < 0)
+        {
+            rc = MQTT::FAILURE;
+            break;
+        }
+    }
+
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::cycle(Timer& timer)
+{
+    int packet_type = readPacket(timer);
+    int rc = packet_type;
+
+    if (packet_type > 0)
+        rc = processPacket(packet_type);
+    if (rc >= 0)
+    {
+        keepalive();
+        rc = isconnected ? packet_type : MQTT::FAILURE;
+    }
+    return rc;
+}
+
+
+/**
+ * Act on a packet that has been read into readbuf. Replies to a request are recorded for request, packets from the
+ * gateway are acknowledged straight away.
+ * @param packet_type the type of the packet
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::processPacket(int packet_type)
+{
+    int rc = MQTT::SUCCESS;
+    unsigned char ackbuf[8];
+    int len = 0;
+    Timer timer(1000);
+    unsigned short topicid = 0, id = 0;
+    unsigned char code = 0;
+
+    switch (packet_type)
+    {
+        case MQTTSN_CONNACK:
+        {
+            int connack_rc = 0;
+            if (replyType == MQTTSN_CONNACK && MQTTSNDeserialize_connack(&connack_rc, readbuf, readlen) == 1)
+            {
+                replyCode = (unsigned char)connack_rc;
+                replyReceived = true;
+            }
+            break;
+        }
+        case MQTTSN_REGACK:
+            if (MQTTSNDeserialize_regack(&topicid, &id, &code, readbuf, readlen) == 1 && replyType == packet_type && id == replyId)
+            {
+                replyTopicId = topicid;
+                replyCode = code;
+                replyReceived = true;
+            }
+            break;
+        case MQTTSN_PUBACK:
+            if (MQTTSNDeserialize_puback(&topicid, &id, &code, readbuf, readlen) != 1)
+                break;
+            if (code == MQTTSN_RC_REJECTED_INVALID_TOPIC_ID)
+            {
+                // the gateway has lost the registration, also reported for QoS 0, so register again on the next publish
+                int i = findTopic(topicid);
+                if (i >= 0)
+                    removeTopic(i);
+            }
+            if (replyType == packet_type && id == replyId)
+            {
+                replyCode = code;
+                replyReceived = true;
+            }
+            break;
+        case MQTTSN_SUBACK:
+        {
+            int qos = 0;
+            if (MQTTSNDeserialize_suback(&qos, &topicid, &id, &code, readbuf, readlen) == 1 && replyType == packet_type && id == replyId)
+            {
+                replyTopicId = topicid;
+                replyQoS = qos;
+                replyCode = code;
+                replyReceived = true;
+            }
+            break;
+        }
+        case MQTTSN_UNSUBACK:
+            if (MQTTSNDeserialize_unsuback(&id, readbuf, readlen) == 1 && replyType == packet_type && id == replyId)
+                replyReceived = true;
+            break;
+        case MQTTSN_REGISTER:
+        {
+            MQTTString topicName = MQTTString_initializer;
+            if (MQTTSNDeserialize_register(&topicid, &id, &topicName, readbuf, readlen) != 1)
+                break;
+            addTopic(topicid, topicName.lenstring.data, (int)topicName.lenstring.len);
+            if ((len = MQTTSNSerialize_regack(ackbuf, sizeof(ackbuf), topicid, id, MQTTSN_RC_ACCEPTED)) <= 0)
+                rc = MQTT::FAILURE;
+            else
+                rc = sendPacket(ackbuf, len, timer);
+            break;
+        }
+        case MQTTSN_PUBLISH:
+        {
+            MQTTSN_topicid topic;
+            MQTT::Message msg;
+            MQTTString topicName = MQTTString_initializer;
+            unsigned char dup = 0, retained = 0;
+            unsigned char* payload = NULL;
+            int qos = 0, payloadlen = 0;
+            if (MQTTSNDeserialize_publish(&dup, &qos, &retained, &id, &topic, &payload, &payloadlen, readbuf, readlen) != 1)
+                break;
+            code = MQTTSN_RC_ACCEPTED;
+            if (topic.type == MQTTSN_TOPIC_TYPE_SHORT)
+            {
+                topicName.lenstring.data = topic.data.short_name;
+                topicName.lenstring.len = 2;
+                topicid = (unsigned char)topic.data.short_name[0] << 8 | (unsigned char)topic.data.short_name[1];
+            }
+            else
+            {
+                int i = (topic.type == MQTTSN_TOPIC_TYPE_NORMAL) ? findTopic(topic.data.id) : -1;
+                topicid = topic.data.id;
+                if (i < 0)
+                    code = MQTTSN_RC_REJECTED_INVALID_TOPIC_ID;
+                else
+                {
+                    topicName.lenstring.data = topicStore + topics[i].offset;
+                    topicName.lenstring.len = topics[i].len;
+                }
+            }
+            if (qos > MQTT::QOS1)
+                code = MQTTSN_RC_REJECTED_NOT_SUPPORTED;
+            if (code == MQTTSN_RC_ACCEPTED)
+            {
+                msg.qos = (qos == MQTT::QOS1) ? MQTT::QOS1 : MQTT::QOS0;
+                msg.retained = retained;
+                msg.dup = dup;
+                msg.id = id;
+                msg.payload = payload;
+                msg.payloadlen = payloadlen;
+                deliverMessage(topicName, msg);
+            }
+            if (qos == MQTT::QOS1 || code != MQTTSN_RC_ACCEPTED)
+            {
+                if ((len = MQTTSNSerialize_puback(ackbuf, sizeof(ackbuf), topicid, id, code)) <= 0)
+                    rc = MQTT::FAILURE;
+                else
+                    rc = sendPacket(ackbuf, len, timer);
+            }
+            break;
+        }
+        case MQTTSN_PINGRESP:
+            ping_outstanding = false;
+            break;
+        case MQTTSN_PINGREQ:
+            if ((len = MQTTSNSerialize_pingresp(ackbuf, sizeof(ackbuf))) > 0)
+                rc = sendPacket(ackbuf, len, timer);
+            break;
+        case MQTTSN_DISCONNECT:
+            isconnected = false;
+            break;
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::keepalive()
+{
+    int rc = MQTT::SUCCESS;
+
+    if (keepAliveInterval == 0 || !isconnected)
+        goto exit;
+
+    if (ping_outstanding && ping_response.expired())
+        isconnected = false;
+    else if ((!ping_outstanding && (last_sent.expired() || last_received.expired())) || (ping_outstanding && ping_retry.expired()))
+    {
+        Timer timer(1000);
+        MQTTString clientid = MQTTString_initializer;
+        int len = MQTTSNSerialize_pingreq(sendbuf, MAX_PACKET_SIZE, clientid);
+        if (len > 0 && (rc = sendPacket(sendbuf, len, timer)) == MQTT::SUCCESS)
+        {
+            if (!ping_outstanding)
+                ping_response.countdown(this->keepAliveInterval);
+            ping_retry.countdown_ms(MQTTSNCLIENT_RETRY_MS); // the ping or its response may be lost
+            ping_outstanding = true;
+        }
+    }
+
+exit:
+    return rc;
+}
+
+
+/**
+ * Send the request in sendbuf and wait for its reply, sending it again every MQTTSNCLIENT_RETRY_MS with the
+ * dup flag set, until the reply arrives or the timer expires.
+ * @param length the length of the request
+ * @param packet_type the type of the reply
+ * @param id the packet id of the request, matched against the reply
+ * @return success code - the reply is in replyCode, replyTopicId and replyQoS
+ */
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::request(int length, int packet_type, unsigned short id, Timer& timer)
+{
+    int rc = MQTT::FAILURE;
+    int header = (sendbuf[0] == 0x01) ? 3 : 1;
+
+    replyType = packet_type;
+    replyId = id;
+    replyReceived = false;
+    while (!timer.expired())
+    {
+        if ((rc = sendPacket(sendbuf, length, timer)) != MQTT::SUCCESS)
+            break;
+        Timer retry(timer.left_ms() < MQTTSNCLIENT_RETRY_MS ? timer.left_ms() : MQTTSNCLIENT_RETRY_MS);
+        while (!replyReceived && !retry.expired() && rc == MQTT::SUCCESS)
+        {
+            if (cycle(retry) == MQTT::FAILURE && sendbuf[header] != MQTTSN_CONNECT)
+                rc = MQTT::FAILURE;
+        }
+        if (replyReceived || rc != MQTT::SUCCESS)
+            break;
+        if (sendbuf[header] == MQTTSN_PUBLISH || sendbuf[header] == MQTTSN_SUBSCRIBE)
+            sendbuf[header + 1] |= 0x80; // the dup flag
+        rc = MQTT::FAILURE;
+    }
+    if (!replyReceived)
+        rc = MQTT::FAILURE;
+    replyType = -1;
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::connect()
+{
+    MQTTSNPacket_connectData default_options = MQTTSNPacket_connectData_initializer;
+    return connect(default_options);
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::connect(MQTTSNPacket_connectData& options)
+{
+    Timer connect_timer(command_timeout_ms);
+    int rc = MQTT::FAILURE;
+    int len = 0;
+
+    if (isconnected) // don't send connect packet again if we are already connected
+        goto exit;
+
+    this->keepAliveInterval = options.duration;
+    ping_outstanding = false;
+    returnCode = 0;
+    if (options.cleansession)
+        topicCount = topicStoreLen = 0; // the gateway forgets the topic ids of a clean session
+    if ((len = MQTTSNSerialize_connect(sendbuf, MAX_PACKET_SIZE, &options)) <= 0)
+        goto exit;
+    if ((rc = request(len, MQTTSN_CONNACK, 0, connect_timer)) != MQTT::SUCCESS)
+        goto exit;
+    rc = replyCode;
+    if (rc == MQTTSN_RC_ACCEPTED)
+    {
+        isconnected = true;
+        if (this->keepAliveInterval > 0)
+        {
+            last_sent.countdown(this->keepAliveInterval);
+            last_received.countdown(this->keepAliveInterval);
+        }
+    }
+    else
+        returnCode = rc;
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::connect(MQTTPacket_connectData& options)
+{
+    MQTTSNPacket_connectData data = MQTTSNPacket_connectData_initializer;
+    data.clientID = options.clientID;
+    data.duration = options.keepAliveInterval;
+    data.cleansession = options.cleansession;
+    return connect(data);
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::registerTopic(const char* topicName, unsigned short& topicId)
+{
+    Timer timer(command_timeout_ms);
+    int rc = MQTT::FAILURE;
+    int i = findTopic(topicName);
+    int len = 0;
+    MQTTString name = MQTTString_initializer;
+    unsigned short id = 0;
+
+    if (i >= 0)
+    {
+        topicId = topics[i].id;
+        rc = MQTT::SUCCESS;
+        goto exit;
+    }
+    if (!isconnected)
+        goto exit;
+
+    name.cstring = (char*)topicName;
+    id = packetid.getNext();
+    if ((len = MQTTSNSerialize_register(sendbuf, MAX_PACKET_SIZE, 0, id, &name)) <= 0)
+        goto exit;
+    if ((rc = request(len, MQTTSN_REGACK, id, timer)) != MQTT::SUCCESS)
+        goto exit;
+    if (replyCode != MQTTSN_RC_ACCEPTED)
+    {
+        rc = returnCode = replyCode;
+        goto exit;
+    }
+    topicId = replyTopicId;
+    addTopic(replyTopicId, topicName, (int)strlen(topicName));
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::publishPrepared(const unsigned char* packet, int packetlen, bool retained)
+{
+    char topicName[MAX_PACKET_SIZE + 1];
+    int topiclen = (packetlen < 2) ? -1 : (packet[0] << 8) + packet[1];
+
+    if (topiclen < 0 || 2 + topiclen > packetlen)
+        return MQTT::FAILURE;
+    if (topiclen > MAX_PACKET_SIZE)
+        return MQTT::BUFFER_OVERFLOW;
+    memcpy(topicName, &packet[2], topiclen);
+    topicName[topiclen] = '\0';
+    return publish(topicName, (void*)&packet[2 + topiclen], packetlen - 2 - topiclen, MQTT::QOS0, retained);
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::publish(MQTTSN_topicid& topic, void* payload, size_t payloadlen,
+        enum MQTT::QoS qos, bool retained, Timer& timer)
+{
+    int rc = MQTT::FAILURE;
+    int len = 0;
+    unsigned short id = 0;
+
+    if (!isconnected || qos > MQTT::QOS1)
+        goto exit;
+
+    if (qos == MQTT::QOS1)
+        id = packetid.getNext();
+    if ((len = MQTTSNSerialize_publish(sendbuf, MAX_PACKET_SIZE, 0, qos, retained, id, topic, (unsigned char*)payload, (int)payloadlen)) <= 0)
+        goto exit;
+    if (qos == MQTT::QOS0)
+    {
+        rc = sendPacket(sendbuf, len, timer);
+        goto exit;
+    }
+    if ((rc = request(len, MQTTSN_PUBACK, id, timer)) == MQTT::SUCCESS && replyCode != MQTTSN_RC_ACCEPTED)
+        rc = returnCode = replyCode;
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::publish(unsigned short topicId, void* payload, size_t payloadlen, enum MQTT::QoS qos, bool retained)
+{
+    Timer timer(command_timeout_ms);
+    MQTTSN_topicid topic;
+
+    topic.type = MQTTSN_TOPIC_TYPE_NORMAL;
+    topic.data.id = topicId;
+    return publish(topic, payload, payloadlen, qos, retained, timer);
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::publish(const char* topicName, void* payload, size_t payloadlen, enum MQTT::QoS qos, bool retained)
+{
+    Timer timer(command_timeout_ms);
+    MQTTSN_topicid topic;
+    int rc = MQTT::SUCCESS;
+
+    if (isShortTopic(topicName))
+    {
+        topic.type = MQTTSN_TOPIC_TYPE_SHORT;
+        memcpy(topic.data.short_name, topicName, 2);
+        return publish(topic, payload, payloadlen, qos, retained, timer);
+    }
+
+    topic.type = MQTTSN_TOPIC_TYPE_NORMAL;
+    if ((rc = registerTopic(topicName, topic.data.id)) != MQTT::SUCCESS)
+        return rc;
+    rc = publish(topic, payload, payloadlen, qos, retained, timer);
+    if (rc == MQTTSN_RC_REJECTED_INVALID_TOPIC_ID && registerTopic(topicName, topic.data.id) == MQTT::SUCCESS)
+        rc = publish(topic, payload, payloadlen, qos, retained, timer); // the registration was lost and has been made again
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter, enum MQTT::QoS qos, messageHandler mh)
+{
+    Timer timer(command_timeout_ms);
+    MQTTSN_topicid topic;
+    int rc = MQTT::FAILURE;
+    int len = 0;
+    unsigned short id = 0;
+
+    if (!isconnected)
+        goto exit;
+
+    setTopicFilter(topic, topicFilter);
+    id = packetid.getNext();
+    if ((len = MQTTSNSerialize_subscribe(sendbuf, MAX_PACKET_SIZE, 0, qos, id, &topic)) <= 0)
+        goto exit;
+    if ((rc = request(len, MQTTSN_SUBACK, id, timer)) != MQTT::SUCCESS)
+        goto exit;
+    if (replyCode != MQTTSN_RC_ACCEPTED)
+    {
+        returnCode = replyCode;
+        rc = 0x80;
+        goto exit;
+    }
+    // a topic name without wildcards gets its topic id in the suback, the gateway registers the names matching a wildcard before publishing to them
+    if (topic.type == MQTTSN_TOPIC_TYPE_NORMAL && replyTopicId != 0)
+        addTopic(replyTopicId, topicFilter, topic.data.long_.len);
+    for (int i = 0; mh && i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter == 0)
+        {
+            messageHandlers[i].topicFilter = topicFilter;
+            messageHandlers[i].fp.attach(mh);
+            break;
+        }
+    }
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::subscribeMany(int count, const char* topicFilters[], enum MQTT::QoS qos, messageHandler mhs[], int grantedQoSs[])
+{
+    int rc = MQTT::SUCCESS;
+
+    for (int i = 0; i < count; ++i)
+    {
+        int result = subscribe(topicFilters[i], qos, mhs ? mhs[i] : NULL);
+        if (grantedQoSs)
+            grantedQoSs[i] = (result == MQTT::SUCCESS) ? replyQoS : 0x80;
+        if (result == 0x80)
+            rc = 0x80;
+        else if (result != MQTT::SUCCESS)
+            return result;
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribe(const char* topicFilter)
+{
+    Timer timer(command_timeout_ms);
+    MQTTSN_topicid topic;
+    int rc = MQTT::FAILURE;
+    int len = 0;
+    unsigned short id = 0;
+
+    if (!isconnected)
+        goto exit;
+
+    setTopicFilter(topic, topicFilter);
+    id = packetid.getNext();
+    if ((len = MQTTSNSerialize_unsubscribe(sendbuf, MAX_PACKET_SIZE, id, &topic)) <= 0)
+        goto exit;
+    if ((rc = request(len, MQTTSN_UNSUBACK, id, timer)) != MQTT::SUCCESS)
+        goto exit;
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+        {
+            messageHandlers[i].topicFilter = 0;
+            messageHandlers[i].fp.detach();
+        }
+    }
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b>
+int MQTTSN::Client<Network, Timer, a, b>::unsubscribeMany(int count, const char* topicFilters[])
+{
+    int rc = MQTT::SUCCESS;
+
+    for (int i = 0; i < count && rc == MQTT::SUCCESS; ++i)
+        rc = unsubscribe(topicFilters[i]);
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_PACKET_SIZE, int b>
+int MQTTSN::Client<Network, Timer, MAX_PACKET_SIZE, b>::disconnect()
+{
+    int rc = MQTT::FAILURE;
+    Timer timer(command_timeout_ms);
+    int len = MQTTSNSerialize_disconnect(sendbuf, MAX_PACKET_SIZE, -1);
+
+    if (len > 0)
+        rc = sendPacket(sendbuf, len, timer);
+    isconnected = false;
+    return rc;
+}
+
+
+#endif
@@ -24,11 +24,11 @@ class NetworkInterface
 {
 public:
 	/**
-	* Read data from the network.
+	* Read data from the network. This should return as soon as any data is available, it does not need to wait until len bytes have been read.
 	* @param[out] buffer Buffer that receives the data
 	* @param[in] len Buffer length
 	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
-	* @return Number of bytes read, or a negative value if there was an error
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
 	*/
 	virtual int read(unsigned char* buffer, int len, int timeout_ms) = 0;
 	
@@ -40,6 +40,23 @@ public:
 	* @return Number of bytes written on success, a negative value for error
 	*/
 	virtual int write(unsigned char* buffer, int len, int timeout_ms) = 0;
+
+	/**
+	* Write data from several buffers to the network. This is optional, it is only required if MQTTCLIENT_WRITEV is set to 1.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written on success, a negative value for error
+	*/
+	// virtual int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms) = 0;
+
+	/**
+	* Get the socket file descriptor. This is optional, it is only required if the client is used in non-blocking mode.
+	* In that mode read and write are called with a timeout of 0 and should return 0 rather than block.
+	* @return The socket file descriptor
+	*/
+	// virtual int getSocket() = 0;
 };
 
 #endif
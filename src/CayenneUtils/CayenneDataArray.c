@@ -17,7 +17,6 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 
 #include "CayenneDataArray.h"
 #include <string.h>
-#include <stdio.h>
 
 
 /**
@@ -82,12 +81,9 @@ int CayenneDataArrayAdd(CayenneDataArray* dataArray, const char* unit, const cha
 */
 int CayenneDataArrayAddInt(CayenneDataArray* dataArray, const char* unit, int value)
 {
-	char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	itoa(value, str, 10);
-#else
-	snprintf(str, sizeof(str), "%d", value);
-#endif
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatLong(str, &length, value);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -100,12 +96,9 @@ int CayenneDataArrayAddInt(CayenneDataArray* dataArray, const char* unit, int va
 */
 int CayenneDataArrayAddUInt(CayenneDataArray* dataArray, const char* unit, unsigned int value)
 {
-	char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	utoa(value, str, 10);
-#else
-	snprintf(str, sizeof(str), "%u", value);
-#endif
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatULong(str, &length, value);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -118,12 +111,9 @@ int CayenneDataArrayAddUInt(CayenneDataArray* dataArray, const char* unit, unsig
 */
 int CayenneDataArrayAddLong(CayenneDataArray* dataArray, const char* unit, long value)
 {
-	char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	ltoa(value, str, 10);
-#else
-	snprintf(str, sizeof(str), "%ld", value);
-#endif
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatLong(str, &length, value);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -136,12 +126,9 @@ int CayenneDataArrayAddLong(CayenneDataArray* dataArray, const char* unit, long
 */
 int CayenneDataArrayAddULong(CayenneDataArray* dataArray, const char* unit, unsigned long value)
 {
-	char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	ultoa(value, str, 10);
-#else
-	snprintf(str, sizeof(str), "%lu", value);
-#endif
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatULong(str, &length, value);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -154,12 +141,22 @@ int CayenneDataArrayAddULong(CayenneDataArray* dataArray, const char* unit, unsi
 */
 int CayenneDataArrayAddDouble(CayenneDataArray* dataArray, const char* unit, double value)
 {
-	char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	dtostrf(value, 5, 3, str);
-#else
-	snprintf(str, 33, "%2.3f", value);
-#endif
+	return CayenneDataArrayAddDoublePrecision(dataArray, unit, value, CAYENNE_DEFAULT_PRECISION);
+}
+
+/**
+* Add the specified unit/value pair to the array.
+* @param[in] dataArray The data array to add values to
+* @param[in] unit The unit to add
+* @param[in] value The value to add
+* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST
+* @return CAYENNE_SUCCESS if unit/value pair was add, CAYENNE_FAILURE otherwise
+*/
+int CayenneDataArrayAddDoublePrecision(CayenneDataArray* dataArray, const char* unit, double value, int precision)
+{
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatDouble(str, &length, value, precision);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -172,12 +169,9 @@ int CayenneDataArrayAddDouble(CayenneDataArray* dataArray, const char* unit, dou
 */
 int CayenneDataArrayAddFloat(CayenneDataArray* dataArray, const char* unit, float value)
 {
-	char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-	dtostrf(value, 5, 3, str);
-#else
-	snprintf(str, 33, "%2.3f", value);
-#endif
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	CayenneFormatFloat(str, &length, value, CAYENNE_DEFAULT_PRECISION);
 	return CayenneDataArrayAdd(dataArray, unit, str);
 }
 
@@ -47,7 +47,7 @@ namespace CayenneMQTT
 		* Clear the array.
 		*/
 		void clear() {
-			for (int i = 0; i < CAYENNE_MAX_MESSAGE_VALUES; ++i) {
+			for (int i = 0; i < MAX_VALUES; ++i) {
 				_values[i].unit = NULL;
 				_values[i].value = NULL;
 			}
@@ -63,7 +63,7 @@ namespace CayenneMQTT
 		* @param[in] valueInFlash If true the value string is in flash memory, otherwise false.
 		*/
 		void add(const char* unit, const char* value, bool unitInFlash = false, bool valueInFlash = false) {
-			if (_valueCount >= CAYENNE_MAX_MESSAGE_VALUES)
+			if (_valueCount >= static_cast<size_t>(MAX_VALUES))
 				return;
 
 			size_t unitLength = 0;
@@ -104,12 +104,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const char* unit, const int value) {
-			char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			itoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%d", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -119,12 +116,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const char* unit, const unsigned int value) {
-			char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			utoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%u", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -134,12 +128,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const char* unit, const long value) {
-			char str[2 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			ltoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%ld", value);
-#endif
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -149,24 +140,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const char* unit, const unsigned long value) {
-			char str[1 + 8 * sizeof(value)];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			ultoa(value, str, 10);
-#else
-			snprintf(str, sizeof(str), "%lu", value);
-#endif
-			add(unit, str);
-		}
-
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-		/**
-		* Add the specified unit/value pair to the array.
-		* @param[in] unit The unit to add.
-		* @param[in] value The value to add.
-		*/
-		inline void add(const char* unit, const float value) {
-			char str[33];
-			dtostrf(value, 5, 3, str);
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -174,38 +150,28 @@ namespace CayenneMQTT
 		* Add the specified unit/value pair to the array.
 		* @param[in] unit The unit to add.
 		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST.
 		*/
-		inline void add(const char* unit, const double value) {
-			char str[33];
-			dtostrf(value, 5, 3, str);
+		inline void add(const char* unit, const float value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatFloat(str, &length, value, precision);
 			add(unit, str);
 		}
 
-#else
 		/**
 		* Add the specified unit/value pair to the array.
 		* @param[in] unit The unit to add.
 		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST.
 		*/
-		inline void add(const char* unit, const float value) {
-			char str[33];
-			snprintf(str, 33, "%2.3f", value);
+		inline void add(const char* unit, const double value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatDouble(str, &length, value, precision);
 			add(unit, str);
 		}
 
-		/**
-		* Add the specified unit/value pair to the array.
-		* @param[in] unit The unit to add.
-		* @param[in] value The value to add.
-		*/
-		inline void add(const char* unit, const double value) {
-			char str[33];
-			snprintf(str, 33, "%2.3f", value);
-			add(unit, str);
-		}
-
-#endif
-
 #ifdef CAYENNE_USING_PROGMEM
 		/**
 		* Add the specified unit/value pair to the array.
@@ -244,8 +210,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const __FlashStringHelper* unit, const int value) {
-			char str[2 + 8 * sizeof(value)];
-			itoa(value, str, 10);
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -255,8 +222,9 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const __FlashStringHelper* unit, const unsigned int value) {
-			char str[1 + 8 * sizeof(value)];
-			utoa(value, str, 10);
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -266,19 +234,21 @@ namespace CayenneMQTT
 		* @param[in] value The value to add.
 		*/
 		inline void add(const __FlashStringHelper* unit, const long value) {
-			char str[2 + 8 * sizeof(value)];
-			ltoa(value, str, 10);
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatLong(str, &length, value);
 			add(unit, str);
 		}
-		
+
 		/**
 		* Add the specified unit/value pair to the array.
 		* @param[in] unit The unit to add.
 		* @param[in] value The value to add.
 		*/
 		inline void add(const __FlashStringHelper* unit, const unsigned long value) {
-			char str[1 + 8 * sizeof(value)];
-			ultoa(value, str, 10);
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatULong(str, &length, value);
 			add(unit, str);
 		}
 
@@ -286,14 +256,12 @@ namespace CayenneMQTT
 		* Add the specified unit/value pair to the array.
 		* @param[in] unit The unit to add.
 		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST.
 		*/
-		inline void add(const __FlashStringHelper* unit, const float value) {
-			char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			dtostrf(value, 5, 3, str);
-#else
-			snprintf(str, 33, "%2.3f", value);
-#endif
+		inline void add(const __FlashStringHelper* unit, const float value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatFloat(str, &length, value, precision);
 			add(unit, str);
 		}
 
@@ -301,14 +269,12 @@ namespace CayenneMQTT
 		* Add the specified unit/value pair to the array.
 		* @param[in] unit The unit to add.
 		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST.
 		*/
-		inline void add(const __FlashStringHelper* unit, const double value) {
-			char str[33];
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			dtostrf(value, 5, 3, str);
-#else
-			snprintf(str, 33, "%2.3f", value);
-#endif
+		inline void add(const __FlashStringHelper* unit, const double value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			char str[CAYENNE_NUMBER_SIZE];
+			size_t length = sizeof(str);
+			CayenneFormatDouble(str, &length, value, precision);
 			add(unit, str);
 		}
 
@@ -335,9 +301,136 @@ namespace CayenneMQTT
 		char _buffer[BUFFER_SIZE];
 		size_t _index;
 	};
+
+	/**
+	* @class TypedDataArray
+	* Class for manipulating a data array of unit/value pairs that keeps the units as codes and the values as numbers.
+	* The numbers are only formatted when the array is published, directly into the packet, so each value takes a few
+	* bytes and values that are never sent are never formatted.
+	* @param MAX_VALUES Maximum number of unit/value pairs in the array.
+	*/
+	template<int MAX_VALUES = CAYENNE_MAX_MESSAGE_VALUES>
+	class TypedDataArray
+	{
+	public:
+		/**
+		* Construct an empty array.
+		*/
+		TypedDataArray() : _valueCount(0) {
+		}
+
+		/**
+		* Clear the array.
+		*/
+		void clear() {
+			_valueCount = 0;
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		*/
+		inline void add(CayenneUnit unit, const int value) {
+			add(unit, static_cast<long>(value));
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		*/
+		inline void add(CayenneUnit unit, const unsigned int value) {
+			add(unit, static_cast<unsigned long>(value));
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		*/
+		inline void add(CayenneUnit unit, const long value) {
+			CayenneTypedValue* typedValue = next(unit, LONG_NUMBER, 0);
+			if (typedValue)
+				typedValue->number.longValue = value;
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		*/
+		inline void add(CayenneUnit unit, const unsigned long value) {
+			CayenneTypedValue* typedValue = next(unit, UNSIGNED_LONG_NUMBER, 0);
+			if (typedValue)
+				typedValue->number.unsignedLongValue = value;
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to send, or CAYENNE_PRECISION_SHORTEST.
+		*/
+		inline void add(CayenneUnit unit, const float value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			CayenneTypedValue* typedValue = next(unit, FLOAT_NUMBER, precision);
+			if (typedValue)
+				typedValue->number.doubleValue = value;
+		}
+
+		/**
+		* Add the specified unit/value pair to the array.
+		* @param[in] unit The unit to add.
+		* @param[in] value The value to add.
+		* @param[in] precision The most decimal places to send, or CAYENNE_PRECISION_SHORTEST.
+		*/
+		inline void add(CayenneUnit unit, const double value, int precision = CAYENNE_DEFAULT_PRECISION) {
+			CayenneTypedValue* typedValue = next(unit, DOUBLE_NUMBER, precision);
+			if (typedValue)
+				typedValue->number.doubleValue = value;
+		}
+
+		/**
+		* Get the typed unit/value pair array.
+		* @return Pointer to the array.
+		*/
+		const CayenneTypedValue* getArray() const {
+			return _values;
+		}
+
+		/**
+		* Get the number of items in the typed unit/value pair array.
+		* @return Count of items.
+		*/
+		size_t getCount() const {
+			return _valueCount;
+		}
+
+	private:
+		/**
+		* Start the next unit/value pair.
+		* @param[in] unit The unit.
+		* @param[in] numberType The type of number the value is.
+		* @param[in] precision The most decimal places to send.
+		* @return The pair, NULL if the array is full.
+		*/
+		CayenneTypedValue* next(CayenneUnit unit, CayenneNumberType numberType, int precision) {
+			if (_valueCount >= static_cast<size_t>(MAX_VALUES))
+				return NULL;
+			CayenneTypedValue* typedValue = &_values[_valueCount++];
+			typedValue->numberType = static_cast<unsigned char>(numberType);
+			typedValue->unit = static_cast<unsigned char>(unit);
+			typedValue->precision = static_cast<signed char>((precision > 127) ? 127 : precision);
+			return typedValue;
+		}
+
+		CayenneTypedValue _values[MAX_VALUES];
+		size_t _valueCount;
+	};
 }
 
 typedef CayenneMQTT::DataArray<> CayenneDataArray;
+typedef CayenneMQTT::TypedDataArray<> CayenneTypedDataArray;
 
 #else
 
@@ -423,6 +516,16 @@ typedef CayenneMQTT::DataArray<> CayenneDataArray;
 	*/
 	DLLExport int CayenneDataArrayAddFloat(CayenneDataArray* dataArray, const char* unit, float value);
 
+	/**
+	* Add the specified unit/value pair to the array.
+	* @param[in] dataArray The data array to add values to
+	* @param[in] unit The unit to add
+	* @param[in] value The value to add
+	* @param[in] precision The most decimal places to add, or CAYENNE_PRECISION_SHORTEST
+	* @return CAYENNE_SUCCESS if unit/value pair was add, CAYENNE_FAILURE otherwise
+	*/
+	DLLExport int CayenneDataArrayAddDoublePrecision(CayenneDataArray* dataArray, const char* unit, double value, int precision);
+
 	/**
 	* Clear the data array.
 	* @param[in] dataArray The data array to clear
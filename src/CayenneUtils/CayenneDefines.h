@@ -33,6 +33,12 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 #define CAYENNE_MAX_MESSAGE_HANDLERS 5 /* Redefine to change number of handlers */
 #endif
 
+#define CAYENNE_PRECISION_SHORTEST -1 // As many decimal places as it takes to read back the same value
+
+#ifndef CAYENNE_DEFAULT_PRECISION
+#define CAYENNE_DEFAULT_PRECISION 3 /* Redefine to change the most decimal places floating point values are sent with */
+#endif
+
 #ifndef CAYENNE_MAX_MESSAGE_VALUES
 #define CAYENNE_MAX_MESSAGE_VALUES 4 /* Redefine to change max number of values in a message, must be at least 1 */
 #endif
@@ -47,4 +47,36 @@ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEAL
 
 #define MAX_UNIT_LENGTH 4
 
+// Codes for the data types and units above, for storing them in a byte rather than as strings.
+typedef enum CayenneDataType
+{
+	NO_TYPE,
+	BAROMETRIC_PRESSURE_TYPE,
+	BATTERY_TYPE,
+	LUMINOSITY_TYPE,
+	PROXIMITY_TYPE,
+	RELATIVE_HUMIDITY_TYPE,
+	TEMPERATURE_TYPE,
+	VOLTAGE_TYPE,
+} CayenneDataType;
+
+typedef enum CayenneUnit
+{
+	NO_UNIT,
+	UNDEFINED_UNIT,
+	PASCAL_UNIT,
+	HECTOPASCAL_UNIT,
+	PERCENT_UNIT,
+	RATIO_UNIT,
+	VOLTS_UNIT,
+	LUX_UNIT,
+	CENTIMETER_UNIT,
+	METER_UNIT,
+	DIGITAL_UNIT,
+	FAHRENHEIT_UNIT,
+	CELSIUS_UNIT,
+	KELVIN_UNIT,
+	MILLIVOLTS_UNIT,
+} CayenneUnit;
+
 #endif
@@ -43,118 +43,933 @@ typedef struct TopicChannel
 } TopicChannel;
 
 /**
-* Build a specified topic string.
-* @param[out] topic Returned topic string
-* @param[in] length CayenneTopic buffer length
-* @param[in] username Cayenne username
-* @param[in] clientID Cayennne client ID
-* @param[in] suffix The topic suffix
-* @return CAYENNE_SUCCESS if topic string was created, error code otherwise
+* Append a string to a buffer, without writing past the end of the buffer or adding a terminating null.
+* @param[in,out] cursor Where to write the string, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] string The string to append
+* @param[in] inFlash Nonzero if the string is in flash memory
+* @return CAYENNE_SUCCESS if the string was appended, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
 */
-int buildTopic(char* topic, size_t length, const char* username, const char* clientID, const char* suffix) {
-	size_t topicLength = 0;
-	if (!topic || !username || !clientID || !suffix)
-		return CAYENNE_FAILURE;
-	topicLength = strlen(username) + strlen(clientID) + strlen(suffix) + 11;
-	if (topicLength > length)
+static int appendString(char** cursor, const char* end, const char* string, int inFlash) {
+	size_t length = inFlash ? CAYENNE_STRLEN(string) : strlen(string);
+	if (length > (size_t)(end - *cursor))
 		return CAYENNE_BUFFER_OVERFLOW;
+	inFlash ? CAYENNE_MEMCPY(*cursor, string, length) : memcpy(*cursor, string, length);
+	*cursor += length;
+	return CAYENNE_SUCCESS;
+}
 
-	topic[0] = '\0';
-	strcat(topic, CAYENNE_VERSION);
-	strcat(topic, "/");
-	strcat(topic, username);
-	CAYENNE_STRCAT(topic, THINGS_STRING);
-	strcat(topic, clientID);
-	strcat(topic, "/");
-	strcat(topic, suffix);
+/**
+* Append a character to a buffer, without writing past the end of the buffer.
+* @param[in,out] cursor Where to write the character, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] c The character to append
+* @return CAYENNE_SUCCESS if the character was appended, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+static int appendChar(char** cursor, const char* end, char c) {
+	if (*cursor >= end)
+		return CAYENNE_BUFFER_OVERFLOW;
+	*(*cursor)++ = c;
 	return CAYENNE_SUCCESS;
 }
 
+#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
+	#define SHORTEST_SEARCH_DIGITS 17
+#else
+	#define SHORTEST_SEARCH_DIGITS 9
+#endif
+
+static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+	1e17, 1e18, 1e19, 1e20, 1e21, 1e22 }; // the powers of 10 a double holds exactly
+static const unsigned long long integerPowersOf10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+	1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL };
+#ifndef CAYENNE_USING_PROGMEM
+static const char digitPairs[] = "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+	"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+#endif
+
 /**
-* Build a specified topic suffix string.
-* @param[out] suffix Returned suffix string
-* @param[in] length Suffix buffer length
+* Write an unsigned number in decimal, backwards from the end of a buffer.
+* @param[in] end The end of the digits
+* @param[in] value The number to write
+* @return The start of the digits
+*/
+static char* writeDigits(char* end, unsigned long long value) {
+#ifdef CAYENNE_USING_PROGMEM
+	do {
+		*--end = '0' + (char)(value % 10);
+		value /= 10;
+	} while (value);
+#else
+	// two digits per division
+	while (value >= 100) {
+		unsigned int pair = (unsigned int)(value % 100) * 2;
+		value /= 100;
+		*--end = digitPairs[pair + 1];
+		*--end = digitPairs[pair];
+	}
+	if (value >= 10) {
+		*--end = digitPairs[value * 2 + 1];
+		*--end = digitPairs[value * 2];
+	}
+	else {
+		*--end = '0' + (char)value;
+	}
+#endif
+	return end;
+}
+
+/**
+* Write a decimal number, backwards from the end of a buffer, without trailing zeros in the fraction.
+* @param[in] end The end of the number
+* @param[in] integer The integer part
+* @param[in] fraction The fraction, as an integer
+* @param[in] places The number of decimal places the fraction has
+* @return The start of the number
+*/
+static char* writeDecimal(char* end, unsigned long long integer, unsigned long long fraction, int places) {
+	char* start = end;
+	if (fraction != 0) {
+		while (fraction % 10 == 0) {
+			fraction /= 10;
+			--places;
+		}
+		start = writeDigits(start, fraction);
+		while (end - start < places)
+			*--start = '0';
+		*--start = '.';
+	}
+	return writeDigits(start, integer);
+}
+
+/**
+* Round a fraction to a number of decimal places, as printf does: to the nearest, and ties to even.
+* @param[in] fraction The fraction, from 0 to 1
+* @param[in] places The number of decimal places, up to 15
+* @param[in] integer The integer part, whose last digit breaks ties when there are no decimal places
+* @return The rounded fraction, as an integer, 10^places if it rounded up to 1
+*/
+static unsigned long long roundFraction(double fraction, int places, unsigned long long integer) {
+	double scaled = fraction * powersOf10[places];
+	unsigned long long result = (unsigned long long)scaled;
+	double remainder = scaled - (double)result; // exact, as scaled is below 2^53
+	double error = 0; // what the multiplication rounded off, which only matters for what looks like a tie
+#ifndef CAYENNE_USING_PROGMEM
+	if (remainder == 0.5) {
+		// Dekker's product, with each factor split into halves whose products are exact
+		const double split = 134217729.0; // 2^27 + 1
+		double t = split * fraction;
+		double fractionHigh = t - (t - fraction);
+		double fractionLow = fraction - fractionHigh;
+		t = split * powersOf10[places];
+		double powerHigh = t - (t - powersOf10[places]);
+		double powerLow = powersOf10[places] - powerHigh;
+		error = ((fractionHigh * powerHigh - scaled) + fractionHigh * powerLow + fractionLow * powerHigh) + fractionLow * powerLow;
+	}
+#endif
+	if (remainder > 0.5 || (remainder == 0.5 && (error > 0 || (error == 0 && ((places ? result : integer) & 1)))))
+		++result;
+	return result;
+}
+
+/**
+* Write the shortest decimal number that reads back as the same value, backwards from the end of a buffer. Whether
+* a number reads back as the value is checked with exact arithmetic, so only numbers with up to 15 or 16 digits and
+* a decimal exponent from -22 to 22 can be written, as in the fast path of decimal to binary conversion. Each digit
+* tried costs a multiplication and a division, so where writeGrisu takes the longer numbers only up to
+* SHORTEST_SEARCH_DIGITS are tried, which covers sensor readings.
+* @param[in] end The end of the number
+* @param[in] value The value, greater than 0
+* @param[in] single Nonzero if the value is a float, so the number only has to read back as the same float
+* @return The start of the number, NULL if it couldn't be written
+*/
+static char* writeShortest(char* end, double value, int single) {
+	int exponent = 0; // of the leading digit
+	int digits = 0;
+	if (value >= 1) {
+		if (value >= 1e23)
+			return NULL;
+		while (exponent < 22 && value >= powersOf10[exponent + 1])
+			++exponent;
+	}
+	else {
+		if (value < 1e-22)
+			return NULL;
+		exponent = -1;
+		while (exponent > -22 && value * powersOf10[-exponent] < 1)
+			--exponent;
+	}
+	for (digits = 1; digits <= SHORTEST_SEARCH_DIGITS; ++digits) {
+		int shift = digits - 1 - exponent; // the number is mantissa / 10^shift
+		double scaled = 0;
+		double parsed = 0;
+		unsigned long long mantissa = 0;
+		if (shift > 22 || shift < -22)
+			return NULL;
+		scaled = (shift >= 0) ? value * powersOf10[shift] : value / powersOf10[-shift];
+		mantissa = (unsigned long long)(scaled + 0.5);
+		if (mantissa > (1ULL << 53))
+			return NULL;
+		// the mantissa and the power of 10 are exact, so this is how the number would be read back
+		parsed = (shift >= 0) ? (double)mantissa / powersOf10[shift] : (double)mantissa * powersOf10[-shift];
+		if (single ? ((float)parsed == (float)value) : (parsed == value)) {
+			if (shift <= 0) {
+				for (; shift < 0; ++shift)
+					*--end = '0';
+				return writeDigits(end, mantissa);
+			}
+			if (shift > 18)
+				return writeDecimal(end, 0, mantissa, shift);
+			return writeDecimal(end, mantissa / integerPowersOf10[shift], mantissa % integerPowersOf10[shift], shift);
+		}
+	}
+	return NULL;
+}
+
+#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
+/**
+* Write a number in exponent form with 9 significant digits, backwards from the end of a buffer. This is for values
+* writeShortest can't write, and the last digit may be off as the value is scaled in floating point.
+* @param[in] end The end of the number
+* @param[in] value The value, greater than 0
+* @return The start of the number
+*/
+static char* writeExponent(char* end, double value) {
+	int exponent = 8; // of the leading digit
+	unsigned long long mantissa = 0;
+	char* start = end;
+	while (value >= 1e9) {
+		value /= 10;
+		++exponent;
+	}
+	while (value < 1e8) {
+		value *= 10;
+		--exponent;
+	}
+	mantissa = (unsigned long long)(value + 0.5);
+	if (mantissa >= 1000000000ULL) {
+		mantissa /= 10;
+		++exponent;
+	}
+	start = writeDigits(start, (unsigned long long)(exponent < 0 ? -exponent : exponent));
+	*--start = (exponent < 0) ? '-' : '+';
+	*--start = 'e';
+	return writeDecimal(start, mantissa / integerPowersOf10[8], mantissa % integerPowersOf10[8], 8);
+}
+#else
+/**
+* A floating point number with a 64 bit significand, f * 2^e, for Grisu2.
+*/
+typedef struct DiyFp
+{
+	unsigned long long f;
+	int e;
+} DiyFp;
+
+/**
+* A power of 10, f * 2^e = 10^k rounded to 64 bits.
+*/
+typedef struct CachedPower
+{
+	unsigned long long f;
+	int e;
+	int k;
+} CachedPower;
+
+// 10^k for k from -300 to 324 in steps of 8, enough to bring any double into the range Grisu2 works in
+static const CachedPower cachedPowers[] = {
+	{ 0xAB70FE17C79AC6CAULL, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+	{ 0xBE5691EF416BD60CULL, -1007, -284 },
+	{ 0x8DD01FAD907FFC3CULL, -980, -276 },
+	{ 0xD3515C2831559A83ULL, -954, -268 },
+	{ 0x9D71AC8FADA6C9B5ULL, -927, -260 },
+	{ 0xEA9C227723EE8BCBULL, -901, -252 },
+	{ 0xAECC49914078536DULL, -874, -244 },
+	{ 0x823C12795DB6CE57ULL, -847, -236 },
+	{ 0xC21094364DFB5637ULL, -821, -228 },
+	{ 0x9096EA6F3848984FULL, -794, -220 },
+	{ 0xD77485CB25823AC7ULL, -768, -212 },
+	{ 0xA086CFCD97BF97F4ULL, -741, -204 },
+	{ 0xEF340A98172AACE5ULL, -715, -196 },
+	{ 0xB23867FB2A35B28EULL, -688, -188 },
+	{ 0x84C8D4DFD2C63F3BULL, -661, -180 },
+	{ 0xC5DD44271AD3CDBAULL, -635, -172 },
+	{ 0x936B9FCEBB25C996ULL, -608, -164 },
+	{ 0xDBAC6C247D62A584ULL, -582, -156 },
+	{ 0xA3AB66580D5FDAF6ULL, -555, -148 },
+	{ 0xF3E2F893DEC3F126ULL, -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8ULL, -502, -132 },
+	{ 0x87625F056C7C4A8BULL, -475, -124 },
+	{ 0xC9BCFF6034C13053ULL, -449, -116 },
+	{ 0x964E858C91BA2655ULL, -422, -108 },
+	{ 0xDFF9772470297EBDULL, -396, -100 },
+	{ 0xA6DFBD9FB8E5B88FULL, -369, -92 },
+	{ 0xF8A95FCF88747D94ULL, -343, -84 },
+	{ 0xB94470938FA89BCFULL, -316, -76 },
+	{ 0x8A08F0F8BF0F156BULL, -289, -68 },
+	{ 0xCDB02555653131B6ULL, -263, -60 },
+	{ 0x993FE2C6D07B7FACULL, -236, -52 },
+	{ 0xE45C10C42A2B3B06ULL, -210, -44 },
+	{ 0xAA242499697392D3ULL, -183, -36 },
+	{ 0xFD87B5F28300CA0EULL, -157, -28 },
+	{ 0xBCE5086492111AEBULL, -130, -20 },
+	{ 0x8CBCCC096F5088CCULL, -103, -12 },
+	{ 0xD1B71758E219652CULL, -77, -4 },
+	{ 0x9C40000000000000ULL, -50, 4 },
+	{ 0xE8D4A51000000000ULL, -24, 12 },
+	{ 0xAD78EBC5AC620000ULL, 3, 20 },
+	{ 0x813F3978F8940984ULL, 30, 28 },
+	{ 0xC097CE7BC90715B3ULL, 56, 36 },
+	{ 0x8F7E32CE7BEA5C70ULL, 83, 44 },
+	{ 0xD5D238A4ABE98068ULL, 109, 52 },
+	{ 0x9F4F2726179A2245ULL, 136, 60 },
+	{ 0xED63A231D4C4FB27ULL, 162, 68 },
+	{ 0xB0DE65388CC8ADA8ULL, 189, 76 },
+	{ 0x83C7088E1AAB65DBULL, 216, 84 },
+	{ 0xC45D1DF942711D9AULL, 242, 92 },
+	{ 0x924D692CA61BE758ULL, 269, 100 },
+	{ 0xDA01EE641A708DEAULL, 295, 108 },
+	{ 0xA26DA3999AEF774AULL, 322, 116 },
+	{ 0xF209787BB47D6B85ULL, 348, 124 },
+	{ 0xB454E4A179DD1877ULL, 375, 132 },
+	{ 0x865B86925B9BC5C2ULL, 402, 140 },
+	{ 0xC83553C5C8965D3DULL, 428, 148 },
+	{ 0x952AB45CFA97A0B3ULL, 455, 156 },
+	{ 0xDE469FBD99A05FE3ULL, 481, 164 },
+	{ 0xA59BC234DB398C25ULL, 508, 172 },
+	{ 0xF6C69A72A3989F5CULL, 534, 180 },
+	{ 0xB7DCBF5354E9BECEULL, 561, 188 },
+	{ 0x88FCF317F22241E2ULL, 588, 196 },
+	{ 0xCC20CE9BD35C78A5ULL, 614, 204 },
+	{ 0x98165AF37B2153DFULL, 641, 212 },
+	{ 0xE2A0B5DC971F303AULL, 667, 220 },
+	{ 0xA8D9D1535CE3B396ULL, 694, 228 },
+	{ 0xFB9B7CD9A4A7443CULL, 720, 236 },
+	{ 0xBB764C4CA7A44410ULL, 747, 244 },
+	{ 0x8BAB8EEFB6409C1AULL, 774, 252 },
+	{ 0xD01FEF10A657842CULL, 800, 260 },
+	{ 0x9B10A4E5E9913129ULL, 827, 268 },
+	{ 0xE7109BFBA19C0C9DULL, 853, 276 },
+	{ 0xAC2820D9623BF429ULL, 880, 284 },
+	{ 0x80444B5E7AA7CF85ULL, 907, 292 },
+	{ 0xBF21E44003ACDD2DULL, 933, 300 },
+	{ 0x8E679C2F5E44FF8FULL, 960, 308 },
+	{ 0xD433179D9C8CB841ULL, 986, 316 },
+	{ 0x9E19DB92B4E31BA9ULL, 1013, 324 },
+};
+
+/**
+* Multiply two numbers, rounding the product to 64 bits.
+* @param[in] x The first number
+* @param[in] y The second number
+* @return The product
+*/
+static DiyFp multiplyDiyFp(DiyFp x, DiyFp y) {
+	unsigned long long xHigh = x.f >> 32, xLow = x.f & 0xFFFFFFFFULL;
+	unsigned long long yHigh = y.f >> 32, yLow = y.f & 0xFFFFFFFFULL;
+	unsigned long long highHigh = xHigh * yHigh, highLow = xHigh * yLow, lowHigh = xLow * yHigh, lowLow = xLow * yLow;
+	unsigned long long middle = (lowLow >> 32) + (highLow & 0xFFFFFFFFULL) + (lowHigh & 0xFFFFFFFFULL) + (1ULL << 31); // rounded
+	DiyFp product;
+	product.f = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+	product.e = x.e + y.e + 64;
+	return product;
+}
+
+/**
+* Shift a number left until the top bit of its significand is set.
+* @param[in] x The number, not 0
+* @return The normalized number
+*/
+static DiyFp normalizeDiyFp(DiyFp x) {
+	while ((x.f >> 63) == 0) {
+		x.f <<= 1;
+		--x.e;
+	}
+	return x;
+}
+
+/**
+* Move the last digit of a number towards the value while it stays inside the interval the number must be in.
+* @param[in,out] digits The digits
+* @param[in] length The number of digits
+* @param[in] distance The distance from the upper end of the interval to the value
+* @param[in] delta The width of the interval
+* @param[in] rest The distance from the upper end of the interval to the number
+* @param[in] unit The value of the last digit
+*/
+static void roundGrisu(char* digits, int length, unsigned long long distance, unsigned long long delta, unsigned long long rest, unsigned long long unit) {
+	while (rest < distance && delta - rest >= unit && (rest + unit < distance || distance - rest > rest + unit - distance)) {
+		--digits[length - 1];
+		rest += unit;
+	}
+}
+
+/**
+* Find the shortest digits of a number that lie inside the interval of numbers that read back as the same value, with
+* Grisu2: the value and its interval are scaled by a cached power of 10 so the digits come from 64 bit integer
+* arithmetic. The interval is narrowed by the rounding error of the scaling, so the digits always read back as the
+* value. In rare cases the digits are one longer than the shortest, when a shorter number lies within the rounding
+* error of the ends of the interval, and those cases are flagged for checking.
+* @param[out] digits Returned digits, room for 17
+* @param[out] exponent Returned decimal exponent of the last digit
+* @param[out] uncertain Returned nonzero if a shorter number may read back as the value
+* @param[in] value The value, greater than 0
+* @param[in] single Nonzero if the value is a float, so the interval is that of the float
+* @return The number of digits
+*/
+static int grisu2(char* digits, int* exponent, int* uncertain, double value, int single) {
+	DiyFp v, plus, minus, scale, scaledPlus, scaledMinus, scaledValue, one;
+	unsigned long long delta, distance, fraction, power = 1, margin = 2;
+	unsigned int integer;
+	const CachedPower* cached;
+	int closerBelow, k, length = 0, count = 0;
+
+	// the significand and exponent of the value, and the halfway points to its neighbours
+	if (single) {
+		float narrow = (float)value;
+		unsigned int bits;
+		memcpy(&bits, &narrow, sizeof(bits));
+		v.f = bits & 0x7FFFFF;
+		v.e = (int)((bits >> 23) & 0xFF);
+		closerBelow = (v.f == 0 && v.e > 1);
+		if (v.e) {
+			v.f += 1ULL << 23;
+			v.e -= 150;
+		}
+		else
+			v.e = -149;
+	}
+	else {
+		unsigned long long bits;
+		memcpy(&bits, &value, sizeof(bits));
+		v.f = bits & 0xFFFFFFFFFFFFFULL;
+		v.e = (int)((bits >> 52) & 0x7FF);
+		closerBelow = (v.f == 0 && v.e > 1);
+		if (v.e) {
+			v.f += 1ULL << 52;
+			v.e -= 1075;
+		}
+		else
+			v.e = -1074;
+	}
+	plus.f = 2 * v.f + 1;
+	plus.e = v.e - 1;
+	plus = normalizeDiyFp(plus);
+	minus.f = closerBelow ? 4 * v.f - 1 : 2 * v.f - 1;
+	minus.e = closerBelow ? v.e - 2 : v.e - 1;
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	v = normalizeDiyFp(v);
+
+	// a power of 10 that brings the upper end of the interval to a binary exponent from -60 to -32
+	k = -61 - plus.e;
+	k = k * 78913 / (1 << 18) + (k > 0);
+	cached = &cachedPowers[(300 + k + 7) / 8];
+	scale.f = cached->f;
+	scale.e = cached->e;
+	*exponent = -cached->k;
+	scaledValue = multiplyDiyFp(v, scale);
+	scaledPlus = multiplyDiyFp(plus, scale);
+	scaledMinus = multiplyDiyFp(minus, scale);
+	++scaledMinus.f; // the products are off by up to 1, so the interval is narrowed by that
+	--scaledPlus.f;
+	*uncertain = 0;
+
+	// the digits of the upper end, until the rest of it is within the interval
+	delta = scaledPlus.f - scaledMinus.f;
+	distance = scaledPlus.f - scaledValue.f;
+	one.e = scaledPlus.e;
+	one.f = 1ULL << -one.e;
+	integer = (unsigned int)(scaledPlus.f >> -one.e);
+	fraction = scaledPlus.f & (one.f - 1);
+	while (power * 10 <= integer) {
+		power *= 10;
+		++count;
+	}
+	for (++count; count > 0; power /= 10) {
+		unsigned long long rest;
+		digits[length++] = (char)('0' + integer / power);
+		integer %= power;
+		--count;
+		rest = ((unsigned long long)integer << -one.e) + fraction;
+		if (rest <= delta) {
+			*exponent += count;
+			roundGrisu(digits, length, distance, delta, rest, power << -one.e);
+			return length;
+		}
+		// the interval widened by the error, 2 at each end, may hold a number with these digits or the next one up
+		if (rest <= delta + margin || (power << -one.e) - rest <= margin)
+			*uncertain = 1;
+	}
+	for (count = 0; ; ) {
+		fraction *= 10;
+		digits[length++] = (char)('0' + (fraction >> -one.e));
+		fraction &= one.f - 1;
+		++count;
+		delta *= 10;
+		distance *= 10;
+		margin *= 10;
+		if (fraction <= delta)
+			break;
+		if (fraction <= delta + margin || one.f - fraction <= margin)
+			*uncertain = 1;
+	}
+	*exponent -= count;
+	roundGrisu(digits, length, distance, delta, fraction, one.f);
+	return length;
+}
+
+/**
+* Try to drop the last of the digits Grisu2 found, for the rare values where it finds one more than the shortest. The
+* two numbers a digit shorter either side of the value are read back with strtod, which is exact, and is given no
+* decimal point so the locale doesn't matter.
+* @param[in,out] digits The digits, returns the shorter digits
+* @param[in,out] length The number of digits
+* @param[in,out] exponent The decimal exponent of the last digit
+* @param[in] value The value
+* @param[in] single Nonzero if the value is a float
+* @return Nonzero if the digits were shortened
+*/
+static int shortenGrisu(char* digits, int* length, int* exponent, double value, int single) {
+	char number[32];
+	char* end = number + sizeof(number) - 1;
+	unsigned long long below = 0;
+	int i = 0;
+	for (i = 0; i < *length - 1; ++i)
+		below = below * 10 + (unsigned long long)(digits[i] - '0');
+	for (i = 0; i < 2; ++i) {
+		// the nearer of the two first
+		unsigned long long candidate = below + (unsigned long long)((digits[*length - 1] >= '5') != (i == 1));
+		int power = *exponent + 1;
+		char* start = end;
+		double parsed = 0;
+		*end = '\0';
+		start = writeDigits(start, (unsigned long long)(power < 0 ? -power : power));
+		if (power < 0)
+			*--start = '-';
+		*--start = 'e';
+		start = writeDigits(start, candidate);
+		parsed = strtod(start, NULL);
+		if (candidate != 0 && (single ? ((float)parsed == (float)value) : (parsed == value))) {
+			for (; candidate % 10 == 0; candidate /= 10)
+				++power;
+			start = writeDigits(end, candidate);
+			*length = (int)(end - start);
+			*exponent = power;
+			memcpy(digits, start, *length);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+* Write the shortest number that reads back as the same value, backwards from the end of a buffer. This is for the
+* values writeShortest can't write. Numbers from 1e-6 to below 1e21 are written in full, others in exponent form.
+* @param[in] end The end of the number
+* @param[in] value The value, greater than 0
+* @param[in] single Nonzero if the value is a float, so the number only has to read back as the same float
+* @return The start of the number
+*/
+static char* writeGrisu(char* end, double value, int single) {
+	char digits[17];
+	int exponent = 0, uncertain = 0;
+	int length = grisu2(digits, &exponent, &uncertain, value, single);
+	int point = 0;
+	char* start = end;
+	int i = 0;
+
+	while (uncertain && length > 1 && shortenGrisu(digits, &length, &exponent, value, single))
+		;
+	point = length + exponent; // the number is 0.digits * 10^point
+
+	if (point > 21 || point < -5) {
+		int power = point - 1;
+		start = writeDigits(start, (unsigned long long)(power < 0 ? -power : power));
+		*--start = (power < 0) ? '-' : '+';
+		*--start = 'e';
+		point = 1;
+	}
+	for (i = point; i > length; --i)
+		*--start = '0';
+	for (i = length - 1; i >= 0; --i) {
+		*--start = digits[i];
+		if (i == point && i > 0)
+			*--start = '.';
+	}
+	if (point <= 0) {
+		for (i = point; i < 0; ++i)
+			*--start = '0';
+		*--start = '.';
+		*--start = '0';
+	}
+	return start;
+}
+#endif
+
+/**
+* Copy a number written by the write functions to the caller's buffer, with a terminating null.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] number The number
+* @param[in] numberLength The length of the number
+* @return CAYENNE_SUCCESS if the number was copied, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+static int copyNumber(char* str, size_t* length, const char* number, size_t numberLength) {
+	if (!str || numberLength + 1 > *length)
+		return CAYENNE_BUFFER_OVERFLOW;
+	memcpy(str, number, numberLength);
+	str[numberLength] = '\0';
+	*length = numberLength;
+	return CAYENNE_SUCCESS;
+}
+
+/**
+* Format a floating point number.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, or CAYENNE_PRECISION_SHORTEST
+* @param[in] single Nonzero if the value is a float
+* @return CAYENNE_SUCCESS if the number was written, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+static int formatDouble(char* str, size_t* length, double value, int precision, int single) {
+	char buffer[CAYENNE_NUMBER_SIZE];
+	char* end = buffer + sizeof(buffer);
+	char* start = end;
+	int negative = (value < 0);
+	double magnitude = negative ? -value : value;
+
+	if (value != value)
+		return copyNumber(str, length, "nan", 3);
+	if (magnitude - magnitude != 0)
+		return negative ? copyNumber(str, length, "-inf", 4) : copyNumber(str, length, "inf", 3);
+	if (precision >= 0 && precision <= 15 && magnitude < 1e18) {
+		unsigned long long integer = (unsigned long long)magnitude;
+		unsigned long long fraction = roundFraction(magnitude - (double)integer, precision, integer);
+		if (fraction == integerPowersOf10[precision]) {
+			fraction = 0;
+			++integer;
+		}
+		start = writeDecimal(end, integer, fraction, precision);
+		negative = negative && (integer != 0 || fraction != 0);
+	}
+	else if (magnitude == 0) {
+		*--start = '0';
+		negative = 0;
+	}
+	else if ((start = writeShortest(end, magnitude, single)) == NULL) {
+#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
+		start = writeExponent(end, magnitude);
+#else
+		start = writeGrisu(end, magnitude, single);
+#endif
+	}
+	if (negative)
+		*--start = '-';
+	return copyNumber(str, length, start, end - start);
+}
+
+/**
+* Append an unsigned number in decimal to a buffer, without writing past the end of the buffer.
+* @param[in,out] cursor Where to write the number, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] value The number to append
+* @return CAYENNE_SUCCESS if the number was appended, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+static int appendUInt(char** cursor, const char* end, unsigned int value) {
+	char digits[3 * sizeof(value)];
+	char* start = writeDigits(digits + sizeof(digits), value);
+	size_t count = digits + sizeof(digits) - start;
+	if (count > (size_t)(end - *cursor))
+		return CAYENNE_BUFFER_OVERFLOW;
+	memcpy(*cursor, start, count);
+	*cursor += count;
+	return CAYENNE_SUCCESS;
+}
+
+/**
+* Get the string for a topic.
 * @param[in] topic Cayenne topic
-* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
-* @return CAYENNE_SUCCESS if suffix string was created, error code otherwise
+* @return The topic string, in flash memory where that is used, NULL if the topic is unknown
 */
-int buildSuffix(char* suffix, size_t length, const CayenneTopic topic, unsigned int channel) {
-	char* topicString = NULL;
-	if (!suffix)
-		return CAYENNE_FAILURE;
+static const char* getTopicString(const CayenneTopic topic) {
 	switch (topic)
 	{
 	case COMMAND_TOPIC:
-		topicString = COMMAND_STRING;
-		break;
+		return COMMAND_STRING;
 	case CONFIG_TOPIC:
-		topicString = CONFIG_STRING;
-		break;
+		return CONFIG_STRING;
 	case DATA_TOPIC:
-		topicString = DATA_STRING;
-		break;
+		return DATA_STRING;
 	case RESPONSE_TOPIC:
-		topicString = RESPONSE_STRING;
-		break;
+		return RESPONSE_STRING;
 	case SYS_MODEL_TOPIC:
-		topicString = SYS_MODEL_STRING;
-		break;
+		return SYS_MODEL_STRING;
 	case SYS_VERSION_TOPIC:
-		topicString = SYS_VERSION_STRING;
-		break;
+		return SYS_VERSION_STRING;
 	case SYS_CPU_MODEL_TOPIC:
-		topicString = SYS_CPU_MODEL_STRING;
-		break;
+		return SYS_CPU_MODEL_STRING;
 	case SYS_CPU_SPEED_TOPIC:
-		topicString = SYS_CPU_SPEED_STRING;
-		break;
+		return SYS_CPU_SPEED_STRING;
 #ifdef DIGITAL_AND_ANALOG_SUPPORT
 	case DIGITAL_TOPIC:
-		topicString = DIGITAL_STRING;
-		break;
+		return DIGITAL_STRING;
 	case DIGITAL_COMMAND_TOPIC:
-		topicString = DIGITAL_COMMAND_STRING;
-		break;
+		return DIGITAL_COMMAND_STRING;
 	case DIGITAL_CONFIG_TOPIC:
-		topicString = DIGITAL_CONFIG_STRING;
-		break;
+		return DIGITAL_CONFIG_STRING;
 	case ANALOG_TOPIC:
-		topicString = ANALOG_STRING;
-		break;
+		return ANALOG_STRING;
 	case ANALOG_COMMAND_TOPIC:
-		topicString = ANALOG_COMMAND_STRING;
-		break;
+		return ANALOG_COMMAND_STRING;
 	case ANALOG_CONFIG_TOPIC:
-		topicString = ANALOG_CONFIG_STRING;
-		break;
+		return ANALOG_CONFIG_STRING;
 #endif
 	default:
-		return CAYENNE_FAILURE;
+		return NULL;
 	}
+}
 
+/**
+* Append a topic suffix, the topic string and channel, to a buffer.
+* @param[in,out] cursor Where to write the suffix, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
+* @return CAYENNE_SUCCESS if the suffix was appended, error code otherwise
+*/
+static int appendSuffix(char** cursor, const char* end, const CayenneTopic topic, unsigned int channel) {
+	const char* topicString = getTopicString(topic);
+	int result = CAYENNE_FAILURE;
 	if (!topicString)
 		return CAYENNE_FAILURE;
-	if (CAYENNE_STRLEN(topicString) >= length)
-		return CAYENNE_BUFFER_OVERFLOW;
+	if ((result = appendString(cursor, end, topicString, 1)) != CAYENNE_SUCCESS || channel == CAYENNE_NO_CHANNEL)
+		return result;
+	if ((result = appendChar(cursor, end, '/')) != CAYENNE_SUCCESS)
+		return result;
+	if (channel == CAYENNE_ALL_CHANNELS)
+		return appendChar(cursor, end, '+');
+	return appendUInt(cursor, end, channel);
+}
 
-	suffix[0] = '\0';
-	CAYENNE_STRCAT(suffix, topicString);
-	if (channel != CAYENNE_NO_CHANNEL) {
-		strcat(suffix, "/");
-		if (channel == CAYENNE_ALL_CHANNELS) {
-			strcat(suffix, "+");
-		}
-		else {
-#if defined(__AVR__) || defined (ARDUINO_ARCH_ARC32)
-			itoa(channel, &suffix[strlen(suffix)], 10);
-#else
-			snprintf(&suffix[strlen(suffix)], length - strlen(suffix), "%u", channel);
-#endif
-		}
+/**
+* Append a topic, "v1/username/things/clientID/suffix", to a buffer.
+* @param[in,out] cursor Where to write the topic, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] username Cayenne username
+* @param[in] clientID Cayennne client ID
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
+* @return CAYENNE_SUCCESS if the topic was appended, error code otherwise
+*/
+static int appendTopic(char** cursor, const char* end, const char* username, const char* clientID, CayenneTopic topic, unsigned int channel) {
+	int result = CAYENNE_FAILURE;
+	if (!username || !clientID || !getTopicString(topic))
+		return CAYENNE_FAILURE;
+	if ((result = appendString(cursor, end, CAYENNE_VERSION "/", 0)) != CAYENNE_SUCCESS ||
+		(result = appendString(cursor, end, username, 0)) != CAYENNE_SUCCESS ||
+		(result = appendString(cursor, end, THINGS_STRING, 1)) != CAYENNE_SUCCESS ||
+		(result = appendString(cursor, end, clientID, 0)) != CAYENNE_SUCCESS ||
+		(result = appendChar(cursor, end, '/')) != CAYENNE_SUCCESS)
+		return result;
+	return appendSuffix(cursor, end, topic, channel);
+}
+
+/**
+* Append a data payload, "type,unit1,unit2=value1,value2", to a buffer.
+* @param[in,out] cursor Where to write the payload, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] type Optional type to use for type,unit=value payload, can be NULL
+* @param[in] values Unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the payload was appended, error code otherwise
+*/
+static int appendDataPayload(char** cursor, const char* end, const char* type, const CayenneValuePair* values, size_t valueCount) {
+	const char* start = *cursor;
+	int result = CAYENNE_SUCCESS;
+	size_t i;
+	if (type)
+		result = appendString(cursor, end, type, 0);
+	for (i = 0; i < valueCount && result == CAYENNE_SUCCESS; ++i) {
+		if (*cursor != start)
+			result = appendChar(cursor, end, ',');
+		if (result == CAYENNE_SUCCESS && values[i].unit)
+			result = appendString(cursor, end, values[i].unit, 0);
+		else if (result == CAYENNE_SUCCESS && type)
+			result = appendString(cursor, end, UNIT_UNDEFINED, 0); // If type exists but unit does not, use UNIT_UNDEFINED for the unit.
+	}
+	if (result == CAYENNE_SUCCESS && *cursor != start && valueCount > 0 && values[0].value)
+		result = appendChar(cursor, end, '=');
+	for (i = 0; i < valueCount && values[i].value && result == CAYENNE_SUCCESS; ++i) {
+		result = appendString(cursor, end, values[i].value, 0);
+		if (result == CAYENNE_SUCCESS && i + 1 < valueCount)
+			result = appendChar(cursor, end, ',');
+	}
+	return result;
+}
+
+/**
+* Get the string for a data type.
+* @param[in] type The data type
+* @return The type string, in flash memory where that is used, NULL for NO_TYPE or an unknown type
+*/
+static const char* getTypeString(CayenneDataType type) {
+	switch (type)
+	{
+	case BAROMETRIC_PRESSURE_TYPE:
+		return CAYENNE_PSTR(TYPE_BAROMETRIC_PRESSURE);
+	case BATTERY_TYPE:
+		return CAYENNE_PSTR(TYPE_BATTERY);
+	case LUMINOSITY_TYPE:
+		return CAYENNE_PSTR(TYPE_LUMINOSITY);
+	case PROXIMITY_TYPE:
+		return CAYENNE_PSTR(TYPE_PROXIMITY);
+	case RELATIVE_HUMIDITY_TYPE:
+		return CAYENNE_PSTR(TYPE_RELATIVE_HUMIDITY);
+	case TEMPERATURE_TYPE:
+		return CAYENNE_PSTR(TYPE_TEMPERATURE);
+	case VOLTAGE_TYPE:
+		return CAYENNE_PSTR(TYPE_VOLTAGE);
+	default:
+		return NULL;
 	}
+}
+
+/**
+* Get the string for a unit.
+* @param[in] unit The unit
+* @return The unit string, in flash memory where that is used, NULL for NO_UNIT or an unknown unit
+*/
+static const char* getUnitString(CayenneUnit unit) {
+	switch (unit)
+	{
+	case UNDEFINED_UNIT:
+		return CAYENNE_PSTR(UNIT_UNDEFINED);
+	case PASCAL_UNIT:
+		return CAYENNE_PSTR(UNIT_PASCAL);
+	case HECTOPASCAL_UNIT:
+		return CAYENNE_PSTR(UNIT_HECTOPASCAL);
+	case PERCENT_UNIT:
+		return CAYENNE_PSTR(UNIT_PERCENT);
+	case RATIO_UNIT:
+		return CAYENNE_PSTR(UNIT_RATIO);
+	case VOLTS_UNIT:
+		return CAYENNE_PSTR(UNIT_VOLTS);
+	case LUX_UNIT:
+		return CAYENNE_PSTR(UNIT_LUX);
+	case CENTIMETER_UNIT:
+		return CAYENNE_PSTR(UNIT_CENTIMETER);
+	case METER_UNIT:
+		return CAYENNE_PSTR(UNIT_METER);
+	case DIGITAL_UNIT:
+		return CAYENNE_PSTR(UNIT_DIGITAL);
+	case FAHRENHEIT_UNIT:
+		return CAYENNE_PSTR(UNIT_FAHRENHEIT);
+	case CELSIUS_UNIT:
+		return CAYENNE_PSTR(UNIT_CELSIUS);
+	case KELVIN_UNIT:
+		return CAYENNE_PSTR(UNIT_KELVIN);
+	case MILLIVOLTS_UNIT:
+		return CAYENNE_PSTR(UNIT_MILLIVOLTS);
+	default:
+		return NULL;
+	}
+}
+
+/**
+* Append the number of a typed value to a buffer.
+* @param[in,out] cursor Where to write the number, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] value The typed value
+* @return CAYENNE_SUCCESS if the number was appended, error code otherwise
+*/
+static int appendNumber(char** cursor, const char* end, const CayenneTypedValue* value) {
+	char number[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(number);
+	int result = CAYENNE_FAILURE;
+	switch (value->numberType)
+	{
+	case LONG_NUMBER:
+		result = CayenneFormatLong(number, &length, value->number.longValue);
+		break;
+	case UNSIGNED_LONG_NUMBER:
+		result = CayenneFormatULong(number, &length, value->number.unsignedLongValue);
+		break;
+	case DOUBLE_NUMBER:
+		result = formatDouble(number, &length, value->number.doubleValue, value->precision, 0);
+		break;
+	case FLOAT_NUMBER:
+		result = formatDouble(number, &length, value->number.doubleValue, value->precision, 1);
+		break;
+	default:
+		return CAYENNE_FAILURE;
+	}
+	if (result != CAYENNE_SUCCESS)
+		return result;
+	if (length > (size_t)(end - *cursor))
+		return CAYENNE_BUFFER_OVERFLOW;
+	memcpy(*cursor, number, length);
+	*cursor += length;
 	return CAYENNE_SUCCESS;
 }
 
+/**
+* Append a data payload from typed values, "type,unit1,unit2=value1,value2", to a buffer.
+* @param[in,out] cursor Where to write the payload, returns the position after it
+* @param[in] end The end of the buffer
+* @param[in] type Type to use for type,unit=value payload, NO_TYPE for none
+* @param[in] values Typed unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the payload was appended, error code otherwise
+*/
+static int appendTypedDataPayload(char** cursor, const char* end, CayenneDataType type, const CayenneTypedValue* values, size_t valueCount) {
+	const char* start = *cursor;
+	const char* typeString = getTypeString(type);
+	const char* unitString = NULL;
+	int result = CAYENNE_SUCCESS;
+	size_t i;
+	if (typeString)
+		result = appendString(cursor, end, typeString, 1);
+	for (i = 0; i < valueCount && result == CAYENNE_SUCCESS; ++i) {
+		unitString = getUnitString((CayenneUnit)values[i].unit);
+		if (*cursor != start)
+			result = appendChar(cursor, end, ',');
+		if (result == CAYENNE_SUCCESS && unitString)
+			result = appendString(cursor, end, unitString, 1);
+		else if (result == CAYENNE_SUCCESS && typeString)
+			result = appendString(cursor, end, CAYENNE_PSTR(UNIT_UNDEFINED), 1); // If type exists but unit does not, use UNIT_UNDEFINED for the unit.
+	}
+	if (result == CAYENNE_SUCCESS && *cursor != start && valueCount > 0)
+		result = appendChar(cursor, end, '=');
+	for (i = 0; i < valueCount && result == CAYENNE_SUCCESS; ++i) {
+		result = appendNumber(cursor, end, &values[i]);
+		if (result == CAYENNE_SUCCESS && i + 1 < valueCount)
+			result = appendChar(cursor, end, ',');
+	}
+	return result;
+}
+
+/**
+* Build a specified topic suffix string.
+* @param[out] suffix Returned suffix string
+* @param[in] length Suffix buffer length
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL for none, CAYENNE_ALL_CHANNELS for all
+* @return CAYENNE_SUCCESS if suffix string was created, error code otherwise
+*/
+int buildSuffix(char* suffix, size_t length, const CayenneTopic topic, unsigned int channel) {
+	char* cursor = suffix;
+	int result = CAYENNE_FAILURE;
+	if (!suffix || length == 0)
+		return CAYENNE_FAILURE;
+	result = appendSuffix(&cursor, suffix + length - 1, topic, channel);
+	*cursor = '\0';
+	return result;
+}
+
 /**
 * Check if topic matches.
 * @param[in] filter Filter to check topic against
@@ -314,11 +1129,13 @@ int parsePayload(CayenneValuePair* values, size_t* valuesSize, const char** type
 * @return CAYENNE_SUCCESS if topic string was created, error code otherwise
 */
 int CayenneBuildTopic(char* topicName, size_t length, const char* username, const char* clientID, CayenneTopic topic, unsigned int channel) {
-	char channelSuffix[20] = {0};
-	int result = buildSuffix(channelSuffix, sizeof(channelSuffix), topic, channel);
-	if (result != CAYENNE_SUCCESS)
-		return result;
-	return buildTopic(topicName, length, username, clientID, channelSuffix);
+	char* cursor = topicName;
+	int result = CAYENNE_FAILURE;
+	if (!topicName || length == 0)
+		return CAYENNE_FAILURE;
+	result = appendTopic(&cursor, topicName + length - 1, username, clientID, topic, channel);
+	*cursor = '\0';
+	return result;
 }
 
 /**
@@ -331,45 +1148,79 @@ int CayenneBuildTopic(char* topicName, size_t length, const char* username, cons
 * @return CAYENNE_SUCCESS if topic string was created, error code otherwise
 */
 int CayenneBuildDataPayload(char* payload, size_t* length, const char* type, const CayenneValuePair* values, size_t valueCount) {
-	size_t i;
-	size_t payloadLength = 0;
-	for (i = 0; i < valueCount; ++i) {
-		if (values[i].unit) {
-			payloadLength += strlen(values[i].unit) + 1;
-		}
-		else if (type) {
-			// If type exists but unit does not, use UNIT_UNDEFINED for the unit.
-			payloadLength += strlen(UNIT_UNDEFINED) + 1;
-		}
-		payloadLength += values[i].value ? strlen(values[i].value) + 1 : 0;
-	}
-	payloadLength += type ? strlen(type) + 1 : 0;
-	//If payload can't fit the payload plus a terminating null byte return.
-	if (payloadLength > *length) {
+	char* cursor = payload;
+	int result = CAYENNE_FAILURE;
+	if (!payload || *length == 0)
 		return CAYENNE_BUFFER_OVERFLOW;
-	}
+	result = appendDataPayload(&cursor, payload + *length - 1, type, values, valueCount);
+	*cursor = '\0';
+	if (result == CAYENNE_SUCCESS)
+		*length = cursor - payload;
+	return result;
+}
 
-	payload[0] = '\0';
-	if (type) {
-		strcat(payload, type);
-	}
-	for (i = 0; i < valueCount; ++i) {
-		if (payload[0] != '\0')
-			strcat(payload, ",");
-		if (values[i].unit)
-			strcat(payload, values[i].unit);
-		else if (type)
-			strcat(payload, UNIT_UNDEFINED);
-	}
-	if (payload[0] != '\0' && valueCount > 0 && values[0].value)
-		strcat(payload, "=");
-	for (i = 0; i < valueCount && values[i].value; ++i) {
-		strcat(payload, values[i].value);
-		if (i + 1 < valueCount)
-			strcat(payload, ",");
-	}
-	*length = --payloadLength; //Subtract terminating null 
-	return CAYENNE_SUCCESS;
+/**
+* Build the topic and data payload of a publish packet in one pass, laid out as they are in the packet: the topic
+* length in 2 bytes, the topic and then the payload, with no terminating nulls. See MQTTClient publishPrepared.
+* @param[out] buffer Returned topic length, topic and payload
+* @param[in,out] length Buffer length, returns the length used
+* @param[in] username Cayenne username
+* @param[in] clientID Cayennne client ID
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL if none is required
+* @param[in] type Optional type to use for type,unit=value payload, can be NULL
+* @param[in] values Unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the topic and payload were created, error code otherwise
+*/
+int CayenneBuildDataPublish(unsigned char* buffer, size_t* length, const char* username, const char* clientID, CayenneTopic topic, unsigned int channel,
+	const char* type, const CayenneValuePair* values, size_t valueCount) {
+	char* cursor = (char*)buffer + 2;
+	const char* end = (char*)buffer + *length;
+	size_t topicLength = 0;
+	int result = CAYENNE_FAILURE;
+	if (!buffer || *length < 2)
+		return CAYENNE_BUFFER_OVERFLOW;
+	if ((result = appendTopic(&cursor, end, username, clientID, topic, channel)) != CAYENNE_SUCCESS)
+		return result;
+	topicLength = cursor - ((char*)buffer + 2);
+	buffer[0] = (unsigned char)(topicLength >> 8);
+	buffer[1] = (unsigned char)(topicLength & 0xFF);
+	if ((result = appendDataPayload(&cursor, end, type, values, valueCount)) == CAYENNE_SUCCESS)
+		*length = cursor - (char*)buffer;
+	return result;
+}
+
+/**
+* Build the topic and data payload of a publish packet from typed values, formatting the numbers as they are
+* written. The layout is the same as CayenneBuildDataPublish.
+* @param[out] buffer Returned topic length, topic and payload
+* @param[in,out] length Buffer length, returns the length used
+* @param[in] username Cayenne username
+* @param[in] clientID Cayennne client ID
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, CAYENNE_NO_CHANNEL if none is required
+* @param[in] type Type to use for type,unit=value payload, NO_TYPE for none
+* @param[in] values Typed unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the topic and payload were created, error code otherwise
+*/
+int CayenneBuildTypedDataPublish(unsigned char* buffer, size_t* length, const char* username, const char* clientID, CayenneTopic topic,
+	unsigned int channel, CayenneDataType type, const CayenneTypedValue* values, size_t valueCount) {
+	char* cursor = (char*)buffer + 2;
+	const char* end = (char*)buffer + *length;
+	size_t topicLength = 0;
+	int result = CAYENNE_FAILURE;
+	if (!buffer || *length < 2)
+		return CAYENNE_BUFFER_OVERFLOW;
+	if ((result = appendTopic(&cursor, end, username, clientID, topic, channel)) != CAYENNE_SUCCESS)
+		return result;
+	topicLength = cursor - ((char*)buffer + 2);
+	buffer[0] = (unsigned char)(topicLength >> 8);
+	buffer[1] = (unsigned char)(topicLength & 0xFF);
+	if ((result = appendTypedDataPayload(&cursor, end, type, values, valueCount)) == CAYENNE_SUCCESS)
+		*length = cursor - (char*)buffer;
+	return result;
 }
 
 /**
@@ -542,5 +1393,56 @@ int CayenneParsePayload(CayenneValuePair* values, size_t* valuesSize, const char
 	return CAYENNE_SUCCESS;
 }
 
+/**
+* Format a signed integer in decimal.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] value The number
+* @return CAYENNE_SUCCESS if the number was written, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+int CayenneFormatLong(char* str, size_t* length, long value) {
+	char buffer[CAYENNE_NUMBER_SIZE];
+	char* end = buffer + sizeof(buffer);
+	char* start = writeDigits(end, (value < 0) ? 0UL - (unsigned long)value : (unsigned long)value);
+	if (value < 0)
+		*--start = '-';
+	return copyNumber(str, length, start, end - start);
+}
+
+/**
+* Format an unsigned integer in decimal.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] value The number
+* @return CAYENNE_SUCCESS if the number was written, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+int CayenneFormatULong(char* str, size_t* length, unsigned long value) {
+	char buffer[CAYENNE_NUMBER_SIZE];
+	char* end = buffer + sizeof(buffer);
+	char* start = writeDigits(end, value);
+	return copyNumber(str, length, start, end - start);
+}
 
+/**
+* Format a double.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, trailing zeros are left out. CAYENNE_PRECISION_SHORTEST writes the shortest number that reads back as the same value.
+* @return CAYENNE_SUCCESS if the number was written, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+int CayenneFormatDouble(char* str, size_t* length, double value, int precision) {
+	return formatDouble(str, length, value, precision, 0);
+}
 
+/**
+* Format a float.
+* @param[out] str Returned number string
+* @param[in,out] length Buffer length, returns the length of the number
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, trailing zeros are left out. CAYENNE_PRECISION_SHORTEST writes the shortest number that reads back as the same float.
+* @return CAYENNE_SUCCESS if the number was written, CAYENNE_BUFFER_OVERFLOW if it doesn't fit
+*/
+int CayenneFormatFloat(char* str, size_t* length, float value, int precision) {
+	return formatDouble(str, length, value, precision, 1);
+}
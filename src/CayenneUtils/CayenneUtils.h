@@ -39,6 +39,8 @@ extern "C" {
 
 enum CayenneReturnCode { CAYENNE_BUFFER_OVERFLOW = -2, CAYENNE_FAILURE = -1, CAYENNE_SUCCESS = 0 };
 
+#define CAYENNE_NUMBER_SIZE 33 // Buffer size that holds any number written by the CayenneFormat functions
+
 /**
 * A unit/value pair used in Cayenne payloads.
 */
@@ -48,6 +50,28 @@ typedef struct CayenneValuePair
 	const char* value; /**< The data value. */
 } CayenneValuePair;
 
+/**
+* The kinds of number a CayenneTypedValue holds.
+*/
+typedef enum CayenneNumberType { LONG_NUMBER, UNSIGNED_LONG_NUMBER, DOUBLE_NUMBER, FLOAT_NUMBER } CayenneNumberType;
+
+/**
+* A unit/value pair used in Cayenne payloads, with the unit as a code and the value as a number, which is only
+* formatted when the payload is built.
+*/
+typedef struct CayenneTypedValue
+{
+	union
+	{
+		long longValue;
+		unsigned long unsignedLongValue;
+		double doubleValue; /**< A double or float value. */
+	} number; /**< The data value. */
+	unsigned char numberType; /**< The CayenneNumberType of the value. */
+	unsigned char unit; /**< The CayenneUnit of the value. */
+	signed char precision; /**< The most decimal places of a double or float value, or CAYENNE_PRECISION_SHORTEST. */
+} CayenneTypedValue;
+
 /**
 * Build a specified topic string.
 * @param[out] topicName Returned topic string
@@ -71,6 +95,40 @@ DLLExport int CayenneBuildTopic(char* topicName, size_t length, const char* user
 */
 DLLExport int CayenneBuildDataPayload(char* payload, size_t* length, const char* type, const CayenneValuePair* values, size_t valueCount);
 
+/**
+* Build the topic and data payload of a publish packet in one pass, laid out as they are in the packet: the topic
+* length in 2 bytes, the topic and then the payload, with no terminating nulls.
+* @param[out] buffer Returned topic length, topic and payload
+* @param[in,out] length Buffer length, returns the length used
+* @param[in] username Cayenne username
+* @param[in] clientID Cayennne client ID
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, use CAYENNE_NO_CHANNEL if none is required
+* @param[in] type Optional type to use for type,unit=value payload, can be NULL
+* @param[in] values Unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the topic and payload were created, error code otherwise
+*/
+DLLExport int CayenneBuildDataPublish(unsigned char* buffer, size_t* length, const char* username, const char* clientID, CayenneTopic topic, unsigned int channel,
+	const char* type, const CayenneValuePair* values, size_t valueCount);
+
+/**
+* Build the topic and data payload of a publish packet from typed values, formatting the numbers as they are
+* written. The layout is the same as CayenneBuildDataPublish.
+* @param[out] buffer Returned topic length, topic and payload
+* @param[in,out] length Buffer length, returns the length used
+* @param[in] username Cayenne username
+* @param[in] clientID Cayennne client ID
+* @param[in] topic Cayenne topic
+* @param[in] channel The topic channel, use CAYENNE_NO_CHANNEL if none is required
+* @param[in] type Type to use for type,unit=value payload, NO_TYPE for none
+* @param[in] values Typed unit/value array
+* @param[in] valueCount Number of values
+* @return CAYENNE_SUCCESS if the topic and payload were created, error code otherwise
+*/
+DLLExport int CayenneBuildTypedDataPublish(unsigned char* buffer, size_t* length, const char* username, const char* clientID, CayenneTopic topic,
+	unsigned int channel, CayenneDataType type, const CayenneTypedValue* values, size_t valueCount);
+
 /**
 * Build a specified response payload.
 * @param[out] payload Returned payload
@@ -81,6 +139,50 @@ DLLExport int CayenneBuildDataPayload(char* payload, size_t* length, const char*
 */
 DLLExport int CayenneBuildResponsePayload(char* payload, size_t* length, const char* id, const char* error);
 
+/**
+* Format a signed integer in decimal.
+* @param[out] str Returned number string, CAYENNE_NUMBER_SIZE bytes is enough for any number
+* @param[in,out] length Buffer length, returns the length of the number, not counting the terminating null
+* @param[in] value The number
+* @return CAYENNE_SUCCESS if the number was written, error code otherwise
+*/
+DLLExport int CayenneFormatLong(char* str, size_t* length, long value);
+
+/**
+* Format an unsigned integer in decimal.
+* @param[out] str Returned number string, CAYENNE_NUMBER_SIZE bytes is enough for any number
+* @param[in,out] length Buffer length, returns the length of the number, not counting the terminating null
+* @param[in] value The number
+* @return CAYENNE_SUCCESS if the number was written, error code otherwise
+*/
+DLLExport int CayenneFormatULong(char* str, size_t* length, unsigned long value);
+
+/**
+* Format a double in decimal. Fixed precision rounds like printf, but whole numbers have no decimal point.
+* @param[out] str Returned number string, CAYENNE_NUMBER_SIZE bytes is enough for any number
+* @param[in,out] length Buffer length, returns the length of the number, not counting the terminating null
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, up to 15, as trailing zeros are left out.
+* CAYENNE_PRECISION_SHORTEST, or a larger precision, writes the shortest number that reads back as the same value.
+* Sensor readings, with a few significant digits, are found by trying each length in turn. Other values, such as the
+* results of arithmetic that need 16 or 17 digits, are found with Grisu2 and, in the few cases it can't rule out a
+* shorter number, checked with strtod. Neither depends on the locale, and both are faster than snprintf with "%.17g".
+* Numbers below 1e-6 or from 1e21 up may be written in exponent form. On AVR, values that need more than 15 digits or
+* have a decimal exponent beyond 22 are written in exponent form with 9 significant digits instead.
+* @return CAYENNE_SUCCESS if the number was written, error code otherwise
+*/
+DLLExport int CayenneFormatDouble(char* str, size_t* length, double value, int precision);
+
+/**
+* Format a float, like CayenneFormatDouble. CAYENNE_PRECISION_SHORTEST writes the shortest number that reads back as the same float.
+* @param[out] str Returned number string, CAYENNE_NUMBER_SIZE bytes is enough for any number
+* @param[in,out] length Buffer length, returns the length of the number, not counting the terminating null
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, or CAYENNE_PRECISION_SHORTEST
+* @return CAYENNE_SUCCESS if the number was written, error code otherwise
+*/
+DLLExport int CayenneFormatFloat(char* str, size_t* length, float value, int precision);
+
 /**
 * Parse a topic string in place. This may modify the topic string.
 * @param[out] topic Returned Cayenne topic
@@ -91,7 +91,7 @@ typedef struct
 	char struct_id[4];
 	/** The version number of this structure.  Must be 0 */
 	int struct_version;
-	/** Version of MQTT to be used.  3 = 3.1 4 = 3.1.1
+	/** Version of MQTT to be used.  3 = 3.1 4 = 3.1.1 5 = 5.0
 	  */
 	unsigned char MQTTVersion;
 	MQTTString clientID;
@@ -109,14 +109,14 @@ typedef union
 #if defined(REVERSED)
 	struct
 	{
+		unsigned int : 7;	     			/**< unused */
 		unsigned int sessionpresent : 1;    /**< session present flag */
-		unsigned int : 7;	  	          /**< unused */
 	} bits;
 #else
 	struct
 	{
-		unsigned int : 7;	     			/**< unused */
 		unsigned int sessionpresent : 1;    /**< session present flag */
+		unsigned int : 7;	  	          /**< unused */
 	} bits;
 #endif
 } MQTTConnackFlags;	/**< connack flags byte */
@@ -133,4 +133,11 @@ DLLExport int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned ch
 DLLExport int MQTTSerialize_disconnect(unsigned char* buf, size_t buflen);
 DLLExport int MQTTSerialize_pingreq(unsigned char* buf, size_t buflen);
 
+DLLExport int MQTTV5Serialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectData* options,
+		MQTTProperties* connectProperties, MQTTProperties* willProperties);
+DLLExport int MQTTV5Deserialize_connack(MQTTProperties* connackProperties, unsigned char* sessionPresent, unsigned char* connack_rc,
+		unsigned char* buf, size_t buflen);
+DLLExport int MQTTV5Serialize_disconnect(unsigned char* buf, size_t buflen, unsigned char reasonCode, MQTTProperties* properties);
+DLLExport int MQTTV5Deserialize_disconnect(MQTTProperties* properties, unsigned char* reasonCode, unsigned char* buf, size_t buflen);
+
 #endif /* MQTTCONNECT_H_ */
@@ -21,9 +21,11 @@
 /**
   * Determines the length of the MQTT connect packet that would be produced using the supplied connect options.
   * @param options the options to be used to build the connect packet
+  * @param connectProperties the MQTT 5 connect properties, NULL for none. Not used for other versions.
+  * @param willProperties the MQTT 5 will properties, NULL for none. Not used for other versions.
   * @return the length of buffer needed to contain the serialized version of the packet
   */
-size_t MQTTSerialize_connectLength(MQTTPacket_connectData* options)
+size_t MQTTV5Serialize_connectLength(MQTTPacket_connectData* options, MQTTProperties* connectProperties, MQTTProperties* willProperties)
 {
 	size_t len = 0;
 
@@ -32,10 +34,16 @@ size_t MQTTSerialize_connectLength(MQTTPacket_connectData* options)
 		len = 12; /* variable depending on MQTT or MQIsdp */
 	else if (options->MQTTVersion == 4)
 		len = 10;
+	else if (options->MQTTVersion == 5)
+		len = 10 + MQTTProperties_len(connectProperties);
 
 	len += MQTTstrlen(options->clientID)+2;
 	if (options->willFlag)
+	{
 		len += MQTTstrlen(options->will.topicName)+2 + MQTTstrlen(options->will.message)+2;
+		if (options->MQTTVersion == 5)
+			len += MQTTProperties_len(willProperties);
+	}
 	if (options->username.cstring || options->username.lenstring.data)
 		len += MQTTstrlen(options->username)+2;
 	if (options->password.cstring || options->password.lenstring.data)
@@ -45,6 +53,17 @@ size_t MQTTSerialize_connectLength(MQTTPacket_connectData* options)
 }
 
 
+/**
+  * Determines the length of the MQTT connect packet that would be produced using the supplied connect options.
+  * @param options the options to be used to build the connect packet
+  * @return the length of buffer needed to contain the serialized version of the packet
+  */
+size_t MQTTSerialize_connectLength(MQTTPacket_connectData* options)
+{
+	return MQTTV5Serialize_connectLength(options, NULL, NULL);
+}
+
+
 /**
   * Serializes the connect options into the buffer.
   * @param buf the buffer into which the packet will be serialized
@@ -53,6 +72,22 @@ size_t MQTTSerialize_connectLength(MQTTPacket_connectData* options)
   * @return serialized length, or error if 0
   */
 int MQTTSerialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectData* options)
+{
+	return MQTTV5Serialize_connect(buf, buflen, options, NULL, NULL);
+}
+
+
+/**
+  * Serializes the connect options and, for MQTT 5, the connect and will properties into the buffer.
+  * @param buf the buffer into which the packet will be serialized
+  * @param len the length in bytes of the supplied buffer
+  * @param options the options to be used to build the connect packet
+  * @param connectProperties the MQTT 5 connect properties, NULL for none. Not used for other versions.
+  * @param willProperties the MQTT 5 will properties, NULL for none. Not used for other versions.
+  * @return serialized length, or error if 0
+  */
+int MQTTV5Serialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectData* options,
+		MQTTProperties* connectProperties, MQTTProperties* willProperties)
 {
 	unsigned char *ptr = buf;
 	MQTTHeader header = {0};
@@ -60,7 +95,7 @@ int MQTTSerialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectD
 	size_t len = 0;
 	int rc = -1;
 
-	if (MQTTPacket_len(len = MQTTSerialize_connectLength(options)) > buflen)
+	if (MQTTPacket_len(len = MQTTV5Serialize_connectLength(options, connectProperties, willProperties)) > buflen)
 	{
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
@@ -72,10 +107,10 @@ int MQTTSerialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectD
 
 	ptr += MQTTPacket_encode(ptr, len); /* write remaining length */
 
-	if (options->MQTTVersion == 4)
+	if (options->MQTTVersion == 4 || options->MQTTVersion == 5)
 	{
 		writeCString(&ptr, "MQTT");
-		writeChar(&ptr, (char) 4);
+		writeChar(&ptr, (char) options->MQTTVersion);
 	}
 	else
 	{
@@ -99,9 +134,13 @@ int MQTTSerialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectD
 
 	writeChar(&ptr, flags.all);
 	writeInt(&ptr, options->keepAliveInterval);
+	if (options->MQTTVersion == 5)
+		MQTTProperties_write(&ptr, connectProperties);
 	writeMQTTString(&ptr, options->clientID);
 	if (options->willFlag)
 	{
+		if (options->MQTTVersion == 5)
+			MQTTProperties_write(&ptr, willProperties);
 		writeMQTTString(&ptr, options->will.topicName);
 		writeMQTTString(&ptr, options->will.message);
 	}
@@ -126,6 +165,22 @@ int MQTTSerialize_connect(unsigned char* buf, size_t buflen, MQTTPacket_connectD
   * @return error code.  1 is success, 0 is failure
   */
 int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connack_rc, unsigned char* buf, size_t buflen)
+{
+	return MQTTV5Deserialize_connack(NULL, sessionPresent, connack_rc, buf, buflen);
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into connack data - return code and, for MQTT 5, properties
+  * @param connackProperties the properties returned, NULL to skip them. They are only present in MQTT 5.
+  * @param sessionPresent the session present flag returned (only for MQTT 3.1.1 and 5)
+  * @param connack_rc returned integer value of the connack return code, an MQTTReasonCodes value for MQTT 5
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param len the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTV5Deserialize_connack(MQTTProperties* connackProperties, unsigned char* sessionPresent, unsigned char* connack_rc,
+		unsigned char* buf, size_t buflen)
 {
 	MQTTHeader header = {0};
 	unsigned char* curdata = buf;
@@ -146,6 +201,11 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	flags.all = readChar(&curdata);
 	*sessionPresent = flags.bits.sessionpresent;
 	*connack_rc = readChar(&curdata);
+	if (curdata < enddata && !MQTTProperties_read(connackProperties, &curdata, enddata))
+	{
+		rc = 0;
+		goto exit;
+	}
 
 	rc = 1;
 exit:
@@ -204,3 +264,70 @@ int MQTTSerialize_pingreq(unsigned char* buf, size_t buflen)
 {
 	return MQTTSerialize_zero(buf, buflen, PINGREQ_MSG);
 }
+
+
+/**
+  * Serializes an MQTT 5 disconnect packet with a reason code and properties into the supplied buffer. A normal
+  * disconnection without properties is the same as the 0-length packet from MQTTSerialize_disconnect.
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer, to avoid overruns
+  * @param reasonCode the MQTTReasonCodes value
+  * @param properties the properties, NULL for none
+  * @return serialized length, or error if 0
+  */
+int MQTTV5Serialize_disconnect(unsigned char* buf, size_t buflen, unsigned char reasonCode, MQTTProperties* properties)
+{
+	MQTTHeader header = {0};
+	unsigned char *ptr = buf;
+	size_t rem_len = 1 + MQTTProperties_len(properties);
+	int rc = -1;
+
+	if (MQTTPacket_len(rem_len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	header.byte = 0;
+	header.bits.type = DISCONNECT_MSG;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */
+	writeChar(&ptr, reasonCode);
+	MQTTProperties_write(&ptr, properties);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes an MQTT 5 disconnect packet, which the server can send before it closes the connection
+  * @param properties the properties returned, NULL to skip them
+  * @param reasonCode the MQTTReasonCodes value returned, 0 if the packet has none
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTV5Deserialize_disconnect(MQTTProperties* properties, unsigned char* reasonCode, unsigned char* buf, size_t buflen)
+{
+	MQTTHeader header = {0};
+	unsigned char* curdata = buf;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+	int mylen;
+
+	header.byte = readChar(&curdata);
+	if (header.bits.type != DISCONNECT_MSG)
+		goto exit;
+
+	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	enddata = curdata + mylen;
+	rc = 0;
+	*reasonCode = (curdata < enddata) ? readChar(&curdata) : MQTTREASONCODE_NORMAL_DISCONNECTION;
+	if (curdata < enddata && !MQTTProperties_read(properties, &curdata, enddata))
+		goto exit;
+
+	rc = 1;
+exit:
+	return rc;
+}
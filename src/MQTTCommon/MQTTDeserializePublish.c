@@ -19,6 +19,9 @@
 
 #define min(a, b) ((a < b) ? 1 : 0)
 
+static int MQTTDeserialize_publishVersion(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
+		MQTTProperties* properties, unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t buflen, int v5);
+
 /**
   * Deserializes the supplied (wire) buffer into publish data
   * @param dup returned integer - the MQTT dup flag
@@ -34,6 +37,39 @@
   */
 int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
 		unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t buflen)
+{
+	return MQTTDeserialize_publishVersion(dup, qos, retained, packetid, topicName, NULL, payload, payloadlen, buf, buflen, 0);
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into MQTT 5 publish data
+  * @param dup returned integer - the MQTT dup flag
+  * @param qos returned integer - the MQTT QoS value
+  * @param retained returned integer - the MQTT retained flag
+  * @param packetid returned integer - the MQTT packet identifier
+  * @param topicName returned MQTTString - the MQTT topic in the publish, empty if a topic alias is used
+  * @param properties the properties returned, NULL to skip them
+  * @param payload returned byte buffer - the MQTT publish payload
+  * @param payloadlen returned integer - the length of the MQTT payload
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success
+  */
+int MQTTV5Deserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
+		MQTTProperties* properties, unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t buflen)
+{
+	return MQTTDeserialize_publishVersion(dup, qos, retained, packetid, topicName, properties, payload, payloadlen, buf, buflen, 1);
+}
+
+
+/**
+  * Deserializes a publish packet with or without the MQTT 5 properties.
+  * @param v5 non-zero to read the properties, 0 for MQTT 3.1 and 3.1.1
+  * @return error code.  1 is success
+  */
+static int MQTTDeserialize_publishVersion(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
+		MQTTProperties* properties, unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t buflen, int v5)
 {
 	MQTTHeader header = {0};
 	unsigned char* curdata = buf;
@@ -57,6 +93,11 @@ int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retaine
 
 	if (*qos > 0)
 		*packetid = readInt(&curdata);
+	if (v5 && !MQTTProperties_read(properties, &curdata, enddata))
+	{
+		rc = 0;
+		goto exit;
+	}
 
 	*payloadlen = enddata - curdata;
 	*payload = curdata;
@@ -100,3 +141,44 @@ exit:
 	return rc;
 }
 
+
+
+
+/**
+  * Deserializes the supplied (wire) buffer into an MQTT 5 ack, with its reason code and properties
+  * @param packettype returned integer - the MQTT packet type
+  * @param dup returned integer - the MQTT dup flag
+  * @param packetid returned integer - the MQTT packet identifier
+  * @param reasonCode returned MQTTReasonCodes value, 0 if the packet has none
+  * @param properties the properties returned, NULL to skip them
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTV5Deserialize_ack(unsigned char* packettype, unsigned char* dup, unsigned short* packetid, unsigned char* reasonCode,
+		MQTTProperties* properties, unsigned char* buf, size_t buflen)
+{
+	MQTTHeader header = {0};
+	unsigned char* curdata = buf;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+	int mylen;
+
+	header.byte = readChar(&curdata);
+	*dup = header.bits.dup;
+	*packettype = header.bits.type;
+
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
+	enddata = curdata + mylen;
+
+	if (enddata - curdata < 2)
+		goto exit;
+	*packetid = readInt(&curdata);
+	*reasonCode = (curdata < enddata) ? readChar(&curdata) : MQTTREASONCODE_SUCCESS;
+	if (curdata < enddata && !MQTTProperties_read(properties, &curdata, enddata))
+		goto exit;
+
+	rc = 1;
+exit:
+	return rc;
+}
@@ -399,3 +399,348 @@ exit:
 	return rc;
 }
 
+
+
+/**
+ * Calculates the number of bytes a length takes when encoded by MQTTPacket_encode
+ * @param rem_len the length to be encoded
+ * @return the number of bytes, 1 to 4
+ */
+int MQTTPacket_VBIlen(size_t rem_len)
+{
+	int rc = 0;
+
+	if (rem_len < 128)
+		rc = 1;
+	else if (rem_len < 16384)
+		rc = 2;
+	else if (rem_len < 2097152)
+		rc = 3;
+	else
+		rc = 4;
+	return rc;
+}
+
+
+/**
+ * Decodes a variable byte integer from a buffer, without reading beyond its end
+ * @param value the decoded value returned
+ * @param pptr pointer to the input buffer - incremented by the number of bytes used
+ * @param enddata pointer to the end of the data: do not read beyond
+ * @return 1 if successful, 0 if not
+ */
+int readVariableInt(int* value, unsigned char** pptr, unsigned char* enddata)
+{
+	int multiplier = 1;
+	int len = 0;
+	unsigned char c;
+
+	*value = 0;
+	do
+	{
+		if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES || *pptr >= enddata)
+			return 0;
+		c = *(*pptr)++;
+		*value += (c & 127) * multiplier;
+		multiplier *= 128;
+	} while ((c & 128) != 0);
+	return 1;
+}
+
+
+/**
+ * Reads a four byte integer from the input buffer
+ * @param pptr pointer to the input buffer - incremented by the number of bytes used & returned
+ * @return the integer value calculated
+ */
+unsigned int readInt4(unsigned char** pptr)
+{
+	unsigned char* ptr = *pptr;
+	unsigned int value = ((unsigned int)ptr[0] << 24) | ((unsigned int)ptr[1] << 16) | ((unsigned int)ptr[2] << 8) | ptr[3];
+	*pptr += 4;
+	return value;
+}
+
+
+/**
+ * Writes a four byte integer as 4 bytes to an output buffer
+ * @param pptr pointer to the output buffer - incremented by the number of bytes used & returned
+ * @param anInt the integer to write
+ */
+void writeInt4(unsigned char** pptr, unsigned int anInt)
+{
+	writeInt(pptr, (int)(anInt >> 16));
+	writeInt(pptr, (int)(anInt & 0xFFFF));
+}
+
+
+/**
+ * Gets the way a property value is encoded
+ * @param identifier the property identifier
+ * @return one of MQTTPropertyTypes, or -1 if the identifier is not known
+ */
+int MQTTProperty_getType(int identifier)
+{
+	int rc = -1;
+
+	switch (identifier)
+	{
+	case MQTTPROPERTY_CODE_PAYLOAD_FORMAT_INDICATOR:
+	case MQTTPROPERTY_CODE_REQUEST_PROBLEM_INFORMATION:
+	case MQTTPROPERTY_CODE_REQUEST_RESPONSE_INFORMATION:
+	case MQTTPROPERTY_CODE_MAXIMUM_QOS:
+	case MQTTPROPERTY_CODE_RETAIN_AVAILABLE:
+	case MQTTPROPERTY_CODE_WILDCARD_SUBSCRIPTION_AVAILABLE:
+	case MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIERS_AVAILABLE:
+	case MQTTPROPERTY_CODE_SHARED_SUBSCRIPTION_AVAILABLE:
+		rc = MQTTPROPERTY_TYPE_BYTE;
+		break;
+	case MQTTPROPERTY_CODE_SERVER_KEEP_ALIVE:
+	case MQTTPROPERTY_CODE_RECEIVE_MAXIMUM:
+	case MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM:
+	case MQTTPROPERTY_CODE_TOPIC_ALIAS:
+		rc = MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_MESSAGE_EXPIRY_INTERVAL:
+	case MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL:
+	case MQTTPROPERTY_CODE_WILL_DELAY_INTERVAL:
+	case MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE:
+		rc = MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIER:
+		rc = MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_CONTENT_TYPE:
+	case MQTTPROPERTY_CODE_RESPONSE_TOPIC:
+	case MQTTPROPERTY_CODE_ASSIGNED_CLIENT_IDENTIFER:
+	case MQTTPROPERTY_CODE_AUTHENTICATION_METHOD:
+	case MQTTPROPERTY_CODE_RESPONSE_INFORMATION:
+	case MQTTPROPERTY_CODE_SERVER_REFERENCE:
+	case MQTTPROPERTY_CODE_REASON_STRING:
+		rc = MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING;
+		break;
+	case MQTTPROPERTY_CODE_CORRELATION_DATA:
+	case MQTTPROPERTY_CODE_AUTHENTICATION_DATA:
+		rc = MQTTPROPERTY_TYPE_BINARY_DATA;
+		break;
+	case MQTTPROPERTY_CODE_USER_PROPERTY:
+		rc = MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR;
+		break;
+	}
+	return rc;
+}
+
+
+/**
+ * Calculates the serialized length of a property, including its identifier
+ * @param prop the property
+ * @return the length, or -1 if the identifier is not known
+ */
+static int MQTTProperty_len(const MQTTProperty* prop)
+{
+	int rc = -1;
+
+	switch (MQTTProperty_getType(prop->identifier))
+	{
+	case MQTTPROPERTY_TYPE_BYTE:
+		rc = 1;
+		break;
+	case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+		rc = 2;
+		break;
+	case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+		rc = 4;
+		break;
+	case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+		rc = MQTTPacket_VBIlen(prop->value.integer4);
+		break;
+	case MQTTPROPERTY_TYPE_BINARY_DATA:
+	case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+		rc = 2 + (int)prop->value.data.len;
+		break;
+	case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+		rc = 2 + (int)prop->value.data.len + 2 + (int)prop->value.value.len;
+		break;
+	}
+	return (rc < 0) ? rc : rc + 1; /* the identifier is a variable byte integer, but all known ones fit in 1 byte */
+}
+
+
+/**
+ * Calculates the serialized length of a property list, including the length that precedes it
+ * @param props the properties, NULL for none
+ * @return the length
+ */
+int MQTTProperties_len(MQTTProperties* props)
+{
+	return (props == NULL) ? 1 : props->length + MQTTPacket_VBIlen(props->length);
+}
+
+
+/**
+ * Adds a property to a list, if there is room in its array
+ * @param props the properties
+ * @param prop the property to add. Strings and binary data are not copied.
+ * @return 0 if successful, -1 if the array is full or the identifier is not known
+ */
+int MQTTProperties_add(MQTTProperties* props, const MQTTProperty* prop)
+{
+	int len = MQTTProperty_len(prop);
+
+	if (props->count >= props->max_count || len < 0)
+		return -1;
+	props->array[props->count++] = *prop;
+	props->length += len;
+	return 0;
+}
+
+
+/**
+ * Finds the first property in a list with an identifier
+ * @param props the properties
+ * @param identifier the property identifier
+ * @return the property, or NULL if the list doesn't have it
+ */
+MQTTProperty* MQTTProperties_get(MQTTProperties* props, int identifier)
+{
+	int i;
+
+	for (i = 0; props && i < props->count; ++i)
+	{
+		if (props->array[i].identifier == identifier)
+			return &props->array[i];
+	}
+	return NULL;
+}
+
+
+static void writeLenString(unsigned char** pptr, MQTTLenString string)
+{
+	writeInt(pptr, (int)string.len);
+	memcpy(*pptr, string.data, string.len);
+	*pptr += string.len;
+}
+
+
+/**
+ * Writes a property list, preceded by its length
+ * @param pptr pointer to the output buffer - incremented by the number of bytes used & returned
+ * @param properties the properties, NULL for none
+ * @return the number of bytes written
+ */
+int MQTTProperties_write(unsigned char** pptr, const MQTTProperties* properties)
+{
+	unsigned char* start = *pptr;
+	int i;
+
+	if (properties == NULL)
+	{
+		writeChar(pptr, 0);
+		return 1;
+	}
+	*pptr += MQTTPacket_encode(*pptr, properties->length);
+	for (i = 0; i < properties->count; ++i)
+	{
+		const MQTTProperty* prop = &properties->array[i];
+		writeChar(pptr, (char)prop->identifier);
+		switch (MQTTProperty_getType(prop->identifier))
+		{
+		case MQTTPROPERTY_TYPE_BYTE:
+			writeChar(pptr, prop->value.byte);
+			break;
+		case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+			writeInt(pptr, prop->value.integer2);
+			break;
+		case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+			writeInt4(pptr, prop->value.integer4);
+			break;
+		case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+			*pptr += MQTTPacket_encode(*pptr, prop->value.integer4);
+			break;
+		case MQTTPROPERTY_TYPE_BINARY_DATA:
+		case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+			writeLenString(pptr, prop->value.data);
+			break;
+		case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+			writeLenString(pptr, prop->value.data);
+			writeLenString(pptr, prop->value.value);
+			break;
+		}
+	}
+	return (int)(*pptr - start);
+}
+
+
+static int readLenString(MQTTLenString* string, unsigned char** pptr, unsigned char* enddata)
+{
+	if (enddata - *pptr < 2)
+		return 0;
+	string->len = readInt(pptr);
+	if (enddata - *pptr < (int)string->len)
+		return 0;
+	string->data = (char*)*pptr;
+	*pptr += string->len;
+	return 1;
+}
+
+
+/**
+ * Reads a property list, preceded by its length. Properties that don't fit in the array are skipped.
+ * @param properties the properties returned, or NULL to skip them all
+ * @param pptr pointer to the input buffer - incremented by the number of bytes used & returned
+ * @param enddata pointer to the end of the data: do not read beyond
+ * @return 1 if successful, 0 if the properties are malformed
+ */
+int MQTTProperties_read(MQTTProperties* properties, unsigned char** pptr, unsigned char* enddata)
+{
+	unsigned char* propsend;
+	int length = 0;
+
+	if (!readVariableInt(&length, pptr, enddata) || enddata - *pptr < length)
+		return 0;
+	propsend = *pptr + length;
+	if (properties)
+		properties->count = properties->length = 0;
+	while (*pptr < propsend)
+	{
+		MQTTProperty prop;
+		int ok = 1;
+		int value = 0;
+
+		prop.identifier = readChar(pptr);
+		switch (MQTTProperty_getType(prop.identifier))
+		{
+		case MQTTPROPERTY_TYPE_BYTE:
+			if ((ok = (propsend - *pptr >= 1)))
+				prop.value.byte = readChar(pptr);
+			break;
+		case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+			if ((ok = (propsend - *pptr >= 2)))
+				prop.value.integer2 = readInt(pptr);
+			break;
+		case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+			if ((ok = (propsend - *pptr >= 4)))
+				prop.value.integer4 = readInt4(pptr);
+			break;
+		case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+			ok = readVariableInt(&value, pptr, propsend);
+			prop.value.integer4 = value;
+			break;
+		case MQTTPROPERTY_TYPE_BINARY_DATA:
+		case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+			ok = readLenString(&prop.value.data, pptr, propsend);
+			break;
+		case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+			ok = readLenString(&prop.value.data, pptr, propsend) && readLenString(&prop.value.value, pptr, propsend);
+			break;
+		default:
+			ok = 0; /* the length of an unknown property can't be known, so the rest can't be read */
+			break;
+		}
+		if (!ok)
+			return 0;
+		if (properties)
+			MQTTProperties_add(properties, &prop);
+	}
+	return 1;
+}
@@ -90,6 +90,7 @@ typedef struct
 
 size_t MQTTstrlen(MQTTString mqttstring);
 
+#include "MQTTProperties.h"
 #include "MQTTConnect.h"
 #include "MQTTPublish.h"
 #include "MQTTSubscribe.h"
@@ -104,11 +105,15 @@ int MQTTPacket_equals(MQTTString* a, char* b);
 int MQTTPacket_encode(unsigned char* buf, size_t length);
 int MQTTPacket_decode(int (*getcharfn)(unsigned char*, int), int* value);
 int MQTTPacket_decodeBuf(unsigned char* buf, int* value);
+int MQTTPacket_VBIlen(size_t rem_len);
 
 int readInt(unsigned char** pptr);
 char readChar(unsigned char** pptr);
 void writeChar(unsigned char** pptr, char c);
 void writeInt(unsigned char** pptr, int anInt);
+unsigned int readInt4(unsigned char** pptr);
+void writeInt4(unsigned char** pptr, unsigned int anInt);
+int readVariableInt(int* value, unsigned char** pptr, unsigned char* enddata);
 int readMQTTLenString(MQTTString* mqttstring, unsigned char** pptr, unsigned char* enddata);
 void writeCString(unsigned char** pptr, const char* string);
 void writeMQTTString(unsigned char** pptr, MQTTString mqttstring);
@@ -0,0 +1,166 @@
+/*******************************************************************************
+ * Copyright (c) 2017 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+#ifndef MQTTPROPERTIES_H_
+#define MQTTPROPERTIES_H_
+
+#if !defined(DLLImport)
+  #define DLLImport
+#endif
+#if !defined(DLLExport)
+  #define DLLExport
+#endif
+
+/**
+ * The MQTT 5 property identifiers.
+ */
+enum MQTTPropertyCodes
+{
+	MQTTPROPERTY_CODE_PAYLOAD_FORMAT_INDICATOR = 1,
+	MQTTPROPERTY_CODE_MESSAGE_EXPIRY_INTERVAL = 2,
+	MQTTPROPERTY_CODE_CONTENT_TYPE = 3,
+	MQTTPROPERTY_CODE_RESPONSE_TOPIC = 8,
+	MQTTPROPERTY_CODE_CORRELATION_DATA = 9,
+	MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIER = 11,
+	MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL = 17,
+	MQTTPROPERTY_CODE_ASSIGNED_CLIENT_IDENTIFER = 18,
+	MQTTPROPERTY_CODE_SERVER_KEEP_ALIVE = 19,
+	MQTTPROPERTY_CODE_AUTHENTICATION_METHOD = 21,
+	MQTTPROPERTY_CODE_AUTHENTICATION_DATA = 22,
+	MQTTPROPERTY_CODE_REQUEST_PROBLEM_INFORMATION = 23,
+	MQTTPROPERTY_CODE_WILL_DELAY_INTERVAL = 24,
+	MQTTPROPERTY_CODE_REQUEST_RESPONSE_INFORMATION = 25,
+	MQTTPROPERTY_CODE_RESPONSE_INFORMATION = 26,
+	MQTTPROPERTY_CODE_SERVER_REFERENCE = 28,
+	MQTTPROPERTY_CODE_REASON_STRING = 31,
+	MQTTPROPERTY_CODE_RECEIVE_MAXIMUM = 33,
+	MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM = 34,
+	MQTTPROPERTY_CODE_TOPIC_ALIAS = 35,
+	MQTTPROPERTY_CODE_MAXIMUM_QOS = 36,
+	MQTTPROPERTY_CODE_RETAIN_AVAILABLE = 37,
+	MQTTPROPERTY_CODE_USER_PROPERTY = 38,
+	MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE = 39,
+	MQTTPROPERTY_CODE_WILDCARD_SUBSCRIPTION_AVAILABLE = 40,
+	MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIERS_AVAILABLE = 41,
+	MQTTPROPERTY_CODE_SHARED_SUBSCRIPTION_AVAILABLE = 42
+};
+
+/**
+ * The ways a property value is encoded.
+ */
+enum MQTTPropertyTypes
+{
+	MQTTPROPERTY_TYPE_BYTE,
+	MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER,
+	MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER,
+	MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER,
+	MQTTPROPERTY_TYPE_BINARY_DATA,
+	MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING,
+	MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR
+};
+
+/**
+ * The MQTT 5 reason codes. Codes below 0x80 report success, the rest report failure.
+ */
+enum MQTTReasonCodes
+{
+	MQTTREASONCODE_SUCCESS = 0,
+	MQTTREASONCODE_NORMAL_DISCONNECTION = 0,
+	MQTTREASONCODE_GRANTED_QOS_0 = 0,
+	MQTTREASONCODE_GRANTED_QOS_1 = 1,
+	MQTTREASONCODE_GRANTED_QOS_2 = 2,
+	MQTTREASONCODE_DISCONNECT_WITH_WILL_MESSAGE = 4,
+	MQTTREASONCODE_NO_MATCHING_SUBSCRIBERS = 16,
+	MQTTREASONCODE_NO_SUBSCRIPTION_FOUND = 17,
+	MQTTREASONCODE_CONTINUE_AUTHENTICATION = 24,
+	MQTTREASONCODE_RE_AUTHENTICATE = 25,
+	MQTTREASONCODE_UNSPECIFIED_ERROR = 128,
+	MQTTREASONCODE_MALFORMED_PACKET = 129,
+	MQTTREASONCODE_PROTOCOL_ERROR = 130,
+	MQTTREASONCODE_IMPLEMENTATION_SPECIFIC_ERROR = 131,
+	MQTTREASONCODE_UNSUPPORTED_PROTOCOL_VERSION = 132,
+	MQTTREASONCODE_CLIENT_IDENTIFIER_NOT_VALID = 133,
+	MQTTREASONCODE_BAD_USER_NAME_OR_PASSWORD = 134,
+	MQTTREASONCODE_NOT_AUTHORIZED = 135,
+	MQTTREASONCODE_SERVER_UNAVAILABLE = 136,
+	MQTTREASONCODE_SERVER_BUSY = 137,
+	MQTTREASONCODE_BANNED = 138,
+	MQTTREASONCODE_SERVER_SHUTTING_DOWN = 139,
+	MQTTREASONCODE_BAD_AUTHENTICATION_METHOD = 140,
+	MQTTREASONCODE_KEEP_ALIVE_TIMEOUT = 141,
+	MQTTREASONCODE_SESSION_TAKEN_OVER = 142,
+	MQTTREASONCODE_TOPIC_FILTER_INVALID = 143,
+	MQTTREASONCODE_TOPIC_NAME_INVALID = 144,
+	MQTTREASONCODE_PACKET_IDENTIFIER_IN_USE = 145,
+	MQTTREASONCODE_PACKET_IDENTIFIER_NOT_FOUND = 146,
+	MQTTREASONCODE_RECEIVE_MAXIMUM_EXCEEDED = 147,
+	MQTTREASONCODE_TOPIC_ALIAS_INVALID = 148,
+	MQTTREASONCODE_PACKET_TOO_LARGE = 149,
+	MQTTREASONCODE_MESSAGE_RATE_TOO_HIGH = 150,
+	MQTTREASONCODE_QUOTA_EXCEEDED = 151,
+	MQTTREASONCODE_ADMINISTRATIVE_ACTION = 152,
+	MQTTREASONCODE_PAYLOAD_FORMAT_INVALID = 153,
+	MQTTREASONCODE_RETAIN_NOT_SUPPORTED = 154,
+	MQTTREASONCODE_QOS_NOT_SUPPORTED = 155,
+	MQTTREASONCODE_USE_ANOTHER_SERVER = 156,
+	MQTTREASONCODE_SERVER_MOVED = 157,
+	MQTTREASONCODE_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED = 158,
+	MQTTREASONCODE_CONNECTION_RATE_EXCEEDED = 159,
+	MQTTREASONCODE_MAXIMUM_CONNECT_TIME = 160,
+	MQTTREASONCODE_SUBSCRIPTION_IDENTIFIERS_NOT_SUPPORTED = 161,
+	MQTTREASONCODE_WILDCARD_SUBSCRIPTIONS_NOT_SUPPORTED = 162
+};
+
+/**
+ * One MQTT 5 property. Strings and binary data point into the buffer they were read from, or to the caller's data.
+ */
+typedef struct
+{
+	int identifier; /**< one of MQTTPropertyCodes */
+	union
+	{
+		unsigned char byte;
+		unsigned short integer2;
+		unsigned int integer4;
+		struct
+		{
+			MQTTLenString data;
+			MQTTLenString value; /**< the second string of a user property */
+		};
+	} value;
+} MQTTProperty;
+
+/**
+ * A list of properties held in an array supplied by the caller, so no memory is allocated.
+ */
+typedef struct
+{
+	int count;     /**< the number of properties in the array */
+	int max_count; /**< the size of the array */
+	int length;    /**< the serialized length of the properties, without the length that precedes them */
+	MQTTProperty* array;
+} MQTTProperties;
+
+#define MQTTProperties_initializer {0, 0, 0, NULL}
+
+DLLExport int MQTTProperty_getType(int identifier);
+DLLExport int MQTTProperties_len(MQTTProperties* props);
+DLLExport int MQTTProperties_add(MQTTProperties* props, const MQTTProperty* prop);
+DLLExport int MQTTProperties_write(unsigned char** pptr, const MQTTProperties* properties);
+DLLExport int MQTTProperties_read(MQTTProperties* properties, unsigned char** pptr, unsigned char* enddata);
+DLLExport MQTTProperty* MQTTProperties_get(MQTTProperties* props, int identifier);
+
+#endif /* MQTTPROPERTIES_H_ */
@@ -25,12 +25,29 @@
   #define DLLExport
 #endif
 
+DLLExport size_t MQTTSerialize_publishLength(int qos, MQTTString topicName, size_t payloadlen);
 DLLExport int MQTTSerialize_publish(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
 		MQTTString topicName, unsigned char* payload, size_t payloadlen);
+DLLExport int MQTTSerialize_publishHeader(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, size_t payloadlen);
 
 DLLExport int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
 		unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t len);
 
+DLLExport size_t MQTTV5Serialize_publishLength(int qos, MQTTString topicName, MQTTProperties* properties, size_t payloadlen);
+DLLExport int MQTTV5Serialize_publish(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, unsigned char* payload, size_t payloadlen);
+DLLExport int MQTTV5Serialize_publishHeader(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, size_t payloadlen);
+
+DLLExport int MQTTV5Deserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
+		MQTTProperties* properties, unsigned char** payload, size_t* payloadlen, unsigned char* buf, size_t len);
+
+DLLExport int MQTTV5Serialize_ack(unsigned char* buf, size_t buflen, unsigned char packettype, unsigned char dup, unsigned short packetid,
+		unsigned char reasonCode, MQTTProperties* properties);
+DLLExport int MQTTV5Deserialize_ack(unsigned char* packettype, unsigned char* dup, unsigned short* packetid, unsigned char* reasonCode,
+		MQTTProperties* properties, unsigned char* buf, size_t buflen);
+
 DLLExport int MQTTSerialize_puback(unsigned char* buf, size_t buflen, unsigned short packetid);
 DLLExport int MQTTSerialize_pubrel(unsigned char* buf, size_t buflen, unsigned char dup, unsigned short packetid);
 DLLExport int MQTTSerialize_pubcomp(unsigned char* buf, size_t buflen, unsigned short packetid);
@@ -0,0 +1,707 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+#include "MQTTSNPacket.h"
+
+#include <string.h>
+
+#define MQTTSN_PROTOCOL_ID 0x01
+
+
+/**
+ * Determines the length of an MQTT-SN packet, including the length field
+ * @param length the length of the packet without the length field
+ * @return the length of the whole packet
+ */
+int MQTTSNPacket_len(int length)
+{
+	/* one byte for lengths up to 255, otherwise 0x01 followed by two bytes */
+	return (length + 1 > 255) ? length + 3 : length + 1;
+}
+
+
+/**
+ * Encodes the length of an MQTT-SN packet
+ * @param buf the buffer into which the length will be written
+ * @param length the length of the whole packet, including the length field
+ * @return the number of bytes written to the buffer
+ */
+int MQTTSNPacket_encode(unsigned char* buf, int length)
+{
+	int rc = 0;
+
+	if (length > 255)
+	{
+		writeChar(&buf, 0x01);
+		writeInt(&buf, length);
+		rc = 3;
+	}
+	else
+	{
+		buf[0] = (unsigned char)length;
+		rc = 1;
+	}
+	return rc;
+}
+
+
+/**
+ * Decodes the length of an MQTT-SN packet
+ * @param buf the buffer containing the packet
+ * @param buflen the length in bytes of the data in the buffer
+ * @param value returns the length of the whole packet, including the length field
+ * @return the number of bytes of the length field, 0 if there are too few bytes
+ */
+int MQTTSNPacket_decode(unsigned char* buf, int buflen, int* value)
+{
+	int len = 0;
+
+	if (buflen < 1)
+		goto exit;
+	if (buf[0] == 0x01)
+	{
+		if (buflen < 3)
+			goto exit;
+		*value = (buf[1] << 8) + buf[2];
+		len = 3;
+	}
+	else
+	{
+		*value = buf[0];
+		len = 1;
+	}
+exit:
+	return len;
+}
+
+
+/**
+ * Gets the type of an MQTT-SN packet, checking that the whole packet is in the buffer
+ * @param buf the buffer containing the packet
+ * @param buflen the length in bytes of the data in the buffer
+ * @return the message type, or MQTTPACKET_READ_ERROR if the packet is malformed or incomplete
+ */
+int MQTTSNPacket_type(unsigned char* buf, int buflen)
+{
+	int length = 0;
+	int len = MQTTSNPacket_decode(buf, buflen, &length);
+
+	if (len == 0 || length <= len || length > buflen)
+		return MQTTPACKET_READ_ERROR;
+	return buf[len];
+}
+
+
+/**
+ * Checks the length and type of a packet and skips past its header
+ * @param pptr returns a pointer to the first byte after the message type
+ * @param enddata returns a pointer to the end of the packet
+ * @param type the expected message type
+ * @param minlen the smallest valid length of the packet without its header
+ * @return 1 if the packet can be read, 0 otherwise
+ */
+static int MQTTSNPacket_start(unsigned char** pptr, unsigned char** enddata, unsigned char* buf, int buflen, int type, int minlen)
+{
+	int length = 0;
+	int len = MQTTSNPacket_decode(buf, buflen, &length);
+
+	if (len == 0 || length > buflen || length < len + 1 + minlen || buf[len] != type)
+		return 0;
+	*pptr = buf + len + 1;
+	*enddata = buf + length;
+	return 1;
+}
+
+
+/**
+ * Writes the length and type of a packet
+ * @param pptr pointer to the output buffer - incremented by the number of bytes written
+ * @param length the length of the packet without the length field, including the message type
+ * @param type the message type
+ */
+static void MQTTSNPacket_header(unsigned char** pptr, int length, int type)
+{
+	*pptr += MQTTSNPacket_encode(*pptr, MQTTSNPacket_len(length));
+	writeChar(pptr, (char)type);
+}
+
+
+/**
+  * Serializes the connect options into the buffer.
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param options the options to be used to build the connect packet
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_connect(unsigned char* buf, int buflen, MQTTSNPacket_connectData* options)
+{
+	unsigned char *ptr = buf;
+	MQTTSNFlags flags = {0};
+	int idlen = (int)MQTTstrlen(options->clientID);
+	int len = 5 + idlen;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_CONNECT);
+	flags.bits.cleanSession = options->cleansession;
+	writeChar(&ptr, flags.all);
+	writeChar(&ptr, MQTTSN_PROTOCOL_ID);
+	writeInt(&ptr, options->duration);
+	if (idlen > 0)
+	{
+		memcpy(ptr, options->clientID.cstring ? options->clientID.cstring : options->clientID.lenstring.data, idlen);
+		ptr += idlen;
+	}
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into connack data - return code
+  * @param connack_rc returned integer value of the connack return code
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_connack(int* connack_rc, unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_CONNACK, 1))
+		goto exit;
+	*connack_rc = readChar(&curdata);
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a disconnect packet into the supplied buffer, ready for writing to a socket
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param duration the sleep duration in seconds for a sleeping client, or -1 for a plain disconnect
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_disconnect(unsigned char* buf, int buflen, int duration)
+{
+	unsigned char *ptr = buf;
+	int len = (duration >= 0) ? 3 : 1;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_DISCONNECT);
+	if (duration >= 0)
+		writeInt(&ptr, duration);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a pingreq packet into the supplied buffer, ready for writing to a socket
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param clientid the client id, only sent by a sleeping client, otherwise empty
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_pingreq(unsigned char* buf, int buflen, MQTTString clientid)
+{
+	unsigned char *ptr = buf;
+	int idlen = (int)MQTTstrlen(clientid);
+	int len = 1 + idlen;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_PINGREQ);
+	if (idlen > 0)
+	{
+		memcpy(ptr, clientid.cstring ? clientid.cstring : clientid.lenstring.data, idlen);
+		ptr += idlen;
+	}
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a pingresp packet into the supplied buffer, ready for writing to a socket
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_pingresp(unsigned char* buf, int buflen)
+{
+	unsigned char *ptr = buf;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(1) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, 1, MQTTSN_PINGRESP);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a register packet into the supplied buffer, ready for writing to a socket
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param topicid the topic id, 0 when sent by a client
+  * @param packetid integer - the MQTT-SN packet identifier
+  * @param topicname the topic name to be registered
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_register(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, MQTTString* topicname)
+{
+	unsigned char *ptr = buf;
+	int topiclen = (int)MQTTstrlen(*topicname);
+	int len = 5 + topiclen;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_REGISTER);
+	writeInt(&ptr, topicid);
+	writeInt(&ptr, packetid);
+	memcpy(ptr, topicname->cstring ? topicname->cstring : topicname->lenstring.data, topiclen);
+	ptr += topiclen;
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into register data
+  * @param topicid returned topic id the gateway gave the topic name
+  * @param packetid returned integer - the MQTT-SN packet identifier
+  * @param topicname returned topic name, pointing into the buffer
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_register(unsigned short* topicid, unsigned short* packetid, MQTTString* topicname,
+		unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_REGISTER, 4))
+		goto exit;
+	*topicid = readInt(&curdata);
+	*packetid = readInt(&curdata);
+	topicname->cstring = NULL;
+	topicname->lenstring.data = (char*)curdata;
+	topicname->lenstring.len = enddata - curdata;
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a regack packet, for a register from the gateway, into the supplied buffer
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param topicid the topic id from the register
+  * @param packetid integer - the MQTT-SN packet identifier from the register
+  * @param return_code one of MQTTSN_returnCodes
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_regack(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, unsigned char return_code)
+{
+	unsigned char *ptr = buf;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(6) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, 6, MQTTSN_REGACK);
+	writeInt(&ptr, topicid);
+	writeInt(&ptr, packetid);
+	writeChar(&ptr, return_code);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into regack data
+  * @param topicid returned topic id the gateway gave the registered topic name
+  * @param packetid returned integer - the MQTT-SN packet identifier
+  * @param return_code returned one of MQTTSN_returnCodes
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_regack(unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_REGACK, 5))
+		goto exit;
+	*topicid = readInt(&curdata);
+	*packetid = readInt(&curdata);
+	*return_code = readChar(&curdata);
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Determines the length of the MQTT-SN publish packet that would be produced using the supplied parameters
+  * @param payloadlen the length of the payload to be sent
+  * @return the length of buffer needed to contain the serialized version of the packet
+  */
+int MQTTSNSerialize_publishLength(int payloadlen)
+{
+	return MQTTSNPacket_len(6 + payloadlen);
+}
+
+
+/**
+  * Serializes the supplied publish data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT-SN dup flag
+  * @param qos integer - the MQTT-SN QoS value, -1 to publish without connecting
+  * @param retained integer - the MQTT-SN retained flag
+  * @param packetid integer - the MQTT-SN packet identifier, 0 for QoS 0
+  * @param topic the topic id, or a short topic name
+  * @param payload byte buffer - the MQTT-SN publish payload
+  * @param payloadlen integer - the length of the MQTT-SN payload
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTSNSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTSN_topicid topic, unsigned char* payload, int payloadlen)
+{
+	unsigned char *ptr = buf;
+	MQTTSNFlags flags = {0};
+	int len = 6 + payloadlen;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_PUBLISH);
+	flags.bits.dup = dup;
+	flags.bits.QoS = (qos == -1) ? 3 : qos;
+	flags.bits.retain = retained;
+	flags.bits.topicIdType = topic.type;
+	writeChar(&ptr, flags.all);
+	if (topic.type == MQTTSN_TOPIC_TYPE_SHORT)
+	{
+		writeChar(&ptr, topic.data.short_name[0]);
+		writeChar(&ptr, topic.data.short_name[1]);
+	}
+	else
+		writeInt(&ptr, topic.data.id);
+	writeInt(&ptr, packetid);
+	memcpy(ptr, payload, payloadlen);
+	ptr += payloadlen;
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into publish data
+  * @param dup returned integer - the MQTT-SN dup flag
+  * @param qos returned integer - the MQTT-SN QoS value, -1 for a publish without a connection
+  * @param retained returned integer - the MQTT-SN retained flag
+  * @param packetid returned integer - the MQTT-SN packet identifier
+  * @param topic returned topic id, or short topic name
+  * @param payload returned pointer to the payload in the buffer
+  * @param payloadlen returned integer - the length of the payload
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid,
+		MQTTSN_topicid* topic, unsigned char** payload, int* payloadlen, unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	MQTTSNFlags flags = {0};
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_PUBLISH, 5))
+		goto exit;
+	flags.all = readChar(&curdata);
+	*dup = flags.bits.dup;
+	*qos = (flags.bits.QoS == 3) ? -1 : flags.bits.QoS;
+	*retained = flags.bits.retain;
+	topic->type = (enum MQTTSN_topicTypes)flags.bits.topicIdType;
+	if (topic->type == MQTTSN_TOPIC_TYPE_SHORT)
+	{
+		topic->data.short_name[0] = readChar(&curdata);
+		topic->data.short_name[1] = readChar(&curdata);
+	}
+	else
+		topic->data.id = readInt(&curdata);
+	*packetid = readInt(&curdata);
+	*payloadlen = (int)(enddata - curdata);
+	*payload = curdata;
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes a puback packet into the supplied buffer
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param topicid the topic id of the publish
+  * @param packetid integer - the MQTT-SN packet identifier of the publish
+  * @param return_code one of MQTTSN_returnCodes
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_puback(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, unsigned char return_code)
+{
+	unsigned char *ptr = buf;
+	int rc = 0;
+
+	if (MQTTSNPacket_len(6) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, 6, MQTTSN_PUBACK);
+	writeInt(&ptr, topicid);
+	writeInt(&ptr, packetid);
+	writeChar(&ptr, return_code);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into puback data
+  * @param topicid returned topic id of the publish
+  * @param packetid returned integer - the MQTT-SN packet identifier of the publish
+  * @param return_code returned one of MQTTSN_returnCodes
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_puback(unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_PUBACK, 5))
+		goto exit;
+	*topicid = readInt(&curdata);
+	*packetid = readInt(&curdata);
+	*return_code = readChar(&curdata);
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Writes the topic of a subscribe or unsubscribe packet
+  * @param pptr pointer to the output buffer - incremented by the number of bytes written
+  * @param topicFilter the topic name, topic id or short topic name
+  */
+static void MQTTSNSerialize_topicFilter(unsigned char** pptr, MQTTSN_topicid* topicFilter)
+{
+	if (topicFilter->type == MQTTSN_TOPIC_TYPE_NORMAL)
+	{
+		memcpy(*pptr, topicFilter->data.long_.name, topicFilter->data.long_.len);
+		*pptr += topicFilter->data.long_.len;
+	}
+	else if (topicFilter->type == MQTTSN_TOPIC_TYPE_SHORT)
+	{
+		writeChar(pptr, topicFilter->data.short_name[0]);
+		writeChar(pptr, topicFilter->data.short_name[1]);
+	}
+	else
+		writeInt(pptr, topicFilter->data.id);
+}
+
+
+/**
+  * Determines the length of the topic of a subscribe or unsubscribe packet
+  * @param topicFilter the topic name, topic id or short topic name
+  * @return the length in bytes
+  */
+static int MQTTSNSerialize_topicFilterLength(MQTTSN_topicid* topicFilter)
+{
+	return (topicFilter->type == MQTTSN_TOPIC_TYPE_NORMAL) ? topicFilter->data.long_.len : 2;
+}
+
+
+/**
+  * Serializes a subscribe packet into the supplied buffer
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT-SN dup flag
+  * @param qos integer - the QoS requested
+  * @param packetid integer - the MQTT-SN packet identifier
+  * @param topicFilter the topic name, which can include wildcards, predefined topic id or short topic name
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_subscribe(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned short packetid,
+		MQTTSN_topicid* topicFilter)
+{
+	unsigned char *ptr = buf;
+	MQTTSNFlags flags = {0};
+	int len = 4 + MQTTSNSerialize_topicFilterLength(topicFilter);
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_SUBSCRIBE);
+	flags.bits.dup = dup;
+	flags.bits.QoS = qos;
+	flags.bits.topicIdType = topicFilter->type;
+	writeChar(&ptr, flags.all);
+	writeInt(&ptr, packetid);
+	MQTTSNSerialize_topicFilter(&ptr, topicFilter);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into suback data
+  * @param qos returned integer - the QoS granted
+  * @param topicid returned topic id of the topic name subscribed to, 0 for a topic filter with wildcards
+  * @param packetid returned integer - the MQTT-SN packet identifier
+  * @param return_code returned one of MQTTSN_returnCodes
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_suback(int* qos, unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	MQTTSNFlags flags = {0};
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_SUBACK, 6))
+		goto exit;
+	flags.all = readChar(&curdata);
+	*qos = flags.bits.QoS;
+	*topicid = readInt(&curdata);
+	*packetid = readInt(&curdata);
+	*return_code = readChar(&curdata);
+	rc = 1;
+exit:
+	return rc;
+}
+
+
+/**
+  * Serializes an unsubscribe packet into the supplied buffer
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param packetid integer - the MQTT-SN packet identifier
+  * @param topicFilter the topic name, which can include wildcards, predefined topic id or short topic name
+  * @return serialized length, or error if 0
+  */
+int MQTTSNSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned short packetid, MQTTSN_topicid* topicFilter)
+{
+	unsigned char *ptr = buf;
+	MQTTSNFlags flags = {0};
+	int len = 4 + MQTTSNSerialize_topicFilterLength(topicFilter);
+	int rc = 0;
+
+	if (MQTTSNPacket_len(len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	MQTTSNPacket_header(&ptr, len, MQTTSN_UNSUBSCRIBE);
+	flags.bits.topicIdType = topicFilter->type;
+	writeChar(&ptr, flags.all);
+	writeInt(&ptr, packetid);
+	MQTTSNSerialize_topicFilter(&ptr, topicFilter);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into unsuback data
+  * @param packetid returned integer - the MQTT-SN packet identifier
+  * @param buf the raw buffer data, of the correct length determined by the length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTSNDeserialize_unsuback(unsigned short* packetid, unsigned char* buf, int buflen)
+{
+	unsigned char* curdata = NULL;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+
+	if (!MQTTSNPacket_start(&curdata, &enddata, buf, buflen, MQTTSN_UNSUBACK, 2))
+		goto exit;
+	*packetid = readInt(&curdata);
+	rc = 1;
+exit:
+	return rc;
+}
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *******************************************************************************/
+
+#ifndef MQTTSNPACKET_H_
+#define MQTTSNPACKET_H_
+
+#include "MQTTPacket.h"
+
+#if defined(__cplusplus) /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+
+/**
+ * The MQTT-SN 1.2 message types.
+ */
+enum MQTTSN_msgTypes
+{
+	MQTTSN_ADVERTISE, MQTTSN_SEARCHGW, MQTTSN_GWINFO, MQTTSN_RESERVED1,
+	MQTTSN_CONNECT, MQTTSN_CONNACK,
+	MQTTSN_WILLTOPICREQ, MQTTSN_WILLTOPIC, MQTTSN_WILLMSGREQ, MQTTSN_WILLMSG,
+	MQTTSN_REGISTER, MQTTSN_REGACK,
+	MQTTSN_PUBLISH, MQTTSN_PUBACK, MQTTSN_PUBCOMP, MQTTSN_PUBREC, MQTTSN_PUBREL, MQTTSN_RESERVED2,
+	MQTTSN_SUBSCRIBE, MQTTSN_SUBACK, MQTTSN_UNSUBSCRIBE, MQTTSN_UNSUBACK,
+	MQTTSN_PINGREQ, MQTTSN_PINGRESP,
+	MQTTSN_DISCONNECT, MQTTSN_RESERVED3,
+	MQTTSN_WILLTOPICUPD, MQTTSN_WILLTOPICRESP, MQTTSN_WILLMSGUPD, MQTTSN_WILLMSGRESP,
+	MQTTSN_ENCAPSULATED = 0xfe
+};
+
+/**
+ * The return codes of CONNACK, REGACK, PUBACK and SUBACK.
+ */
+enum MQTTSN_returnCodes
+{
+	MQTTSN_RC_ACCEPTED,
+	MQTTSN_RC_REJECTED_CONGESTED,
+	MQTTSN_RC_REJECTED_INVALID_TOPIC_ID,
+	MQTTSN_RC_REJECTED_NOT_SUPPORTED
+};
+
+/**
+ * How the topic of a PUBLISH, SUBSCRIBE or UNSUBSCRIBE is given.
+ */
+enum MQTTSN_topicTypes
+{
+	MQTTSN_TOPIC_TYPE_NORMAL,     /**< a topic id from REGISTER or SUBACK, or the topic name in SUBSCRIBE and UNSUBSCRIBE */
+	MQTTSN_TOPIC_TYPE_PREDEFINED, /**< a topic id agreed with the gateway beforehand */
+	MQTTSN_TOPIC_TYPE_SHORT       /**< a topic name of two characters, sent in place of the id */
+};
+
+/**
+ * Bitfields for the flags byte.
+ */
+typedef union
+{
+	unsigned char all;
+#if defined(REVERSED)
+	struct
+	{
+		unsigned int dup : 1;
+		unsigned int QoS : 2;
+		unsigned int retain : 1;
+		unsigned int will : 1;
+		unsigned int cleanSession : 1;
+		unsigned int topicIdType : 2;
+	} bits;
+#else
+	struct
+	{
+		unsigned int topicIdType : 2;
+		unsigned int cleanSession : 1;
+		unsigned int will : 1;
+		unsigned int retain : 1;
+		unsigned int QoS : 2;
+		unsigned int dup : 1;
+	} bits;
+#endif
+} MQTTSNFlags;
+
+/**
+ * The topic of a PUBLISH, SUBSCRIBE or UNSUBSCRIBE.
+ */
+typedef struct
+{
+	enum MQTTSN_topicTypes type;
+	union
+	{
+		unsigned short id;
+		char short_name[2];
+		struct
+		{
+			char* name;
+			int len;
+		} long_; /**< the topic name, only in SUBSCRIBE and UNSUBSCRIBE */
+	} data;
+} MQTTSN_topicid;
+
+typedef struct
+{
+	/** The eyecatcher for this structure.  must be MQSC. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0. */
+	int struct_version;
+	MQTTString clientID;
+	unsigned short duration; /**< keep alive interval, in seconds */
+	unsigned char cleansession;
+} MQTTSNPacket_connectData;
+
+#define MQTTSNPacket_connectData_initializer { {'M', 'Q', 'S', 'C'}, 0, {NULL, {0, NULL}}, 10, 1 }
+
+DLLExport int MQTTSNPacket_len(int length);
+DLLExport int MQTTSNPacket_encode(unsigned char* buf, int length);
+DLLExport int MQTTSNPacket_decode(unsigned char* buf, int buflen, int* value);
+DLLExport int MQTTSNPacket_type(unsigned char* buf, int buflen);
+
+DLLExport int MQTTSNSerialize_connect(unsigned char* buf, int buflen, MQTTSNPacket_connectData* options);
+DLLExport int MQTTSNDeserialize_connack(int* connack_rc, unsigned char* buf, int buflen);
+DLLExport int MQTTSNSerialize_disconnect(unsigned char* buf, int buflen, int duration);
+DLLExport int MQTTSNSerialize_pingreq(unsigned char* buf, int buflen, MQTTString clientid);
+DLLExport int MQTTSNSerialize_pingresp(unsigned char* buf, int buflen);
+
+DLLExport int MQTTSNSerialize_register(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, MQTTString* topicname);
+DLLExport int MQTTSNDeserialize_register(unsigned short* topicid, unsigned short* packetid, MQTTString* topicname,
+		unsigned char* buf, int buflen);
+DLLExport int MQTTSNSerialize_regack(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, unsigned char return_code);
+DLLExport int MQTTSNDeserialize_regack(unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen);
+
+DLLExport int MQTTSNSerialize_publishLength(int payloadlen);
+DLLExport int MQTTSNSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTSN_topicid topic, unsigned char* payload, int payloadlen);
+DLLExport int MQTTSNDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid,
+		MQTTSN_topicid* topic, unsigned char** payload, int* payloadlen, unsigned char* buf, int buflen);
+DLLExport int MQTTSNSerialize_puback(unsigned char* buf, int buflen, unsigned short topicid, unsigned short packetid, unsigned char return_code);
+DLLExport int MQTTSNDeserialize_puback(unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen);
+
+DLLExport int MQTTSNSerialize_subscribe(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned short packetid,
+		MQTTSN_topicid* topicFilter);
+DLLExport int MQTTSNDeserialize_suback(int* qos, unsigned short* topicid, unsigned short* packetid, unsigned char* return_code,
+		unsigned char* buf, int buflen);
+DLLExport int MQTTSNSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned short packetid, MQTTSN_topicid* topicFilter);
+DLLExport int MQTTSNDeserialize_unsuback(unsigned short* packetid, unsigned char* buf, int buflen);
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+}
+#endif
+
+#endif /* MQTTSNPACKET_H_ */
@@ -19,6 +19,10 @@
 
 #include <string.h>
 
+static int MQTTSerialize_publishVersion(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, unsigned char* payload, size_t payloadlen, int v5);
+static int MQTTSerialize_publishHeaderVersion(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained,
+		unsigned short packetid, MQTTString topicName, MQTTProperties* properties, size_t payloadlen, int v5);
 
 /**
   * Determines the length of the MQTT publish packet that would be produced using the supplied parameters
@@ -38,6 +42,20 @@ size_t MQTTSerialize_publishLength(int qos, MQTTString topicName, size_t payload
 }
 
 
+/**
+  * Determines the length of the MQTT 5 publish packet that would be produced using the supplied parameters
+  * @param qos the MQTT QoS of the publish (packetid is omitted for QoS 0)
+  * @param topicName the topic name to be used in the publish, empty when a topic alias is set
+  * @param properties the publish properties, NULL for none
+  * @param payloadlen the length of the payload to be sent
+  * @return the length of buffer needed to contain the serialized version of the packet
+  */
+size_t MQTTV5Serialize_publishLength(int qos, MQTTString topicName, MQTTProperties* properties, size_t payloadlen)
+{
+	return MQTTSerialize_publishLength(qos, topicName, payloadlen) + MQTTProperties_len(properties);
+}
+
+
 /**
   * Serializes the supplied publish data into the supplied buffer, ready for sending
   * @param buf the buffer into which the packet will be serialized
@@ -53,13 +71,47 @@ size_t MQTTSerialize_publishLength(int qos, MQTTString topicName, size_t payload
   */
 int MQTTSerialize_publish(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
 		MQTTString topicName, unsigned char* payload, size_t payloadlen)
+{
+	return MQTTSerialize_publishVersion(buf, buflen, dup, qos, retained, packetid, topicName, NULL, payload, payloadlen, 0);
+}
+
+
+/**
+  * Serializes the supplied MQTT 5 publish data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish, empty to use the topic alias in the properties
+  * @param properties the publish properties, NULL for none
+  * @param payload byte buffer - the MQTT publish payload
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTV5Serialize_publish(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, unsigned char* payload, size_t payloadlen)
+{
+	return MQTTSerialize_publishVersion(buf, buflen, dup, qos, retained, packetid, topicName, properties, payload, payloadlen, 1);
+}
+
+
+/**
+  * Serializes a publish packet with or without the MQTT 5 properties.
+  * @param v5 non-zero to write the properties, 0 for MQTT 3.1 and 3.1.1
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+static int MQTTSerialize_publishVersion(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, unsigned char* payload, size_t payloadlen, int v5)
 {
 	unsigned char *ptr = buf;
 	MQTTHeader header = {0};
 	size_t rem_len = 0;
 	int rc = 0;
 
-	if (MQTTPacket_len(rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen)) > buflen)
+	rem_len = v5 ? MQTTV5Serialize_publishLength(qos, topicName, properties, payloadlen) : MQTTSerialize_publishLength(qos, topicName, payloadlen);
+	if (MQTTPacket_len(rem_len) > buflen)
 	{
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
@@ -77,6 +129,8 @@ int MQTTSerialize_publish(unsigned char* buf, size_t buflen, unsigned char dup,
 
 	if (qos > 0)
 		writeInt(&ptr, packetid);
+	if (v5)
+		MQTTProperties_write(&ptr, properties);
 
 	memcpy(ptr, payload, payloadlen);
 	ptr += payloadlen;
@@ -89,6 +143,94 @@ exit:
 
 
 
+/**
+  * Serializes the parts of a publish packet that surround the topic name and payload, so the packet can be
+  * sent from separate buffers without copying the topic and payload.
+  * The buffer receives the fixed header and the topic name length, which are followed on the wire by the topic
+  * name. If qos is greater than 0 the packet identifier is written to the 2 bytes directly after the returned
+  * length, and must be sent between the topic name and the payload.
+  * @param buf the buffer into which the header will be serialized, 9 bytes is always large enough
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the data to send before the topic name.  <= 0 indicates error
+  */
+int MQTTSerialize_publishHeader(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, size_t payloadlen)
+{
+	return MQTTSerialize_publishHeaderVersion(buf, buflen, dup, qos, retained, packetid, topicName, NULL, payloadlen, 0);
+}
+
+
+/**
+  * Serializes the parts of an MQTT 5 publish packet that surround the topic name and payload, like
+  * MQTTSerialize_publishHeader. The packet identifier, if qos is greater than 0, and then the properties are
+  * written directly after the returned length, ((qos > 0) ? 2 : 0) + MQTTProperties_len(properties) bytes in all,
+  * and must be sent between the topic name and the payload.
+  * @param buf the buffer into which the header will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish, empty to use the topic alias in the properties
+  * @param properties the publish properties, NULL for none
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the data to send before the topic name.  <= 0 indicates error
+  */
+int MQTTV5Serialize_publishHeader(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, MQTTProperties* properties, size_t payloadlen)
+{
+	return MQTTSerialize_publishHeaderVersion(buf, buflen, dup, qos, retained, packetid, topicName, properties, payloadlen, 1);
+}
+
+
+/**
+  * Serializes the header of a publish packet with or without the MQTT 5 properties.
+  * @param v5 non-zero to write the properties, 0 for MQTT 3.1 and 3.1.1
+  * @return the length of the data to send before the topic name.  <= 0 indicates error
+  */
+static int MQTTSerialize_publishHeaderVersion(unsigned char* buf, size_t buflen, unsigned char dup, int qos, unsigned char retained,
+		unsigned short packetid, MQTTString topicName, MQTTProperties* properties, size_t payloadlen, int v5)
+{
+	unsigned char *ptr = buf;
+	MQTTHeader header = {0};
+	size_t rem_len = v5 ? MQTTV5Serialize_publishLength(qos, topicName, properties, payloadlen) : MQTTSerialize_publishLength(qos, topicName, payloadlen);
+	size_t trailer_len = ((qos > 0) ? 2 : 0) + (v5 ? MQTTProperties_len(properties) : 0);
+	int rc = 0;
+
+	if (MQTTPacket_len(rem_len) - rem_len + 2 + trailer_len > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	header.bits.type = PUBLISH_MSG;
+	header.bits.dup = dup;
+	header.bits.qos = qos;
+	header.bits.retain = retained;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */;
+
+	writeInt(&ptr, (int)MQTTstrlen(topicName));
+	rc = (int)(ptr - buf);
+
+	if (qos > 0)
+		writeInt(&ptr, packetid);
+	if (v5)
+		MQTTProperties_write(&ptr, properties);
+
+exit:
+	return rc;
+}
+
+
+
 /**
   * Serializes the ack packet into the supplied buffer.
   * @param buf the buffer into which the packet will be serialized
@@ -122,6 +264,46 @@ exit:
 }
 
 
+/**
+  * Serializes an MQTT 5 ack packet with a reason code and properties into the supplied buffer. A successful ack
+  * without properties is the same as the one from MQTTSerialize_ack.
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param type the MQTT packet type
+  * @param dup the MQTT dup flag
+  * @param packetid the MQTT packet identifier
+  * @param reasonCode the MQTTReasonCodes value
+  * @param properties the properties, NULL for none
+  * @return serialized length, or error if 0
+  */
+int MQTTV5Serialize_ack(unsigned char* buf, size_t buflen, unsigned char packettype, unsigned char dup, unsigned short packetid,
+		unsigned char reasonCode, MQTTProperties* properties)
+{
+	MQTTHeader header = {0};
+	int rc = 0;
+	unsigned char *ptr = buf;
+	size_t rem_len = 3 + MQTTProperties_len(properties);
+
+	if (MQTTPacket_len(rem_len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+	header.bits.type = packettype;
+	header.bits.dup = dup;
+	header.bits.qos = (packettype == PUBREL_MSG) ? 1 : 0;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */
+	writeInt(&ptr, packetid);
+	writeChar(&ptr, reasonCode);
+	MQTTProperties_write(&ptr, properties);
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
 /**
   * Serializes a puback packet into the supplied buffer.
   * @param buf the buffer into which the packet will be serialized
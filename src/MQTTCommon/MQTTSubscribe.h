@@ -35,5 +35,11 @@ DLLExport int MQTTSerialize_suback(unsigned char* buf, size_t buflen, unsigned s
 
 DLLExport int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, int grantedQoSs[], unsigned char* buf, size_t len);
 
+DLLExport int MQTTV5Serialize_subscribe(unsigned char* buf, size_t buflen, unsigned char dup, unsigned short packetid, MQTTProperties* properties,
+		int count, MQTTString topicFilters[], int options[]);
+
+DLLExport int MQTTV5Deserialize_suback(unsigned short* packetid, MQTTProperties* properties, int maxcount, int* count, int reasonCodes[],
+		unsigned char* buf, size_t len);
+
 
 #endif /* MQTTSUBSCRIBE_H_ */
@@ -130,3 +130,104 @@ exit:
 }
 
 
+
+
+/**
+  * Serializes the supplied MQTT 5 subscribe data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied bufferr
+  * @param dup integer - the MQTT dup flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param properties the subscribe properties, NULL for none
+  * @param count - number of members in the topicFilters and options arrays
+  * @param topicFilters - array of topic filter names
+  * @param options - array of subscription options, the requested QoS in the low 2 bits
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTV5Serialize_subscribe(unsigned char* buf, size_t buflen, unsigned char dup, unsigned short packetid, MQTTProperties* properties,
+		int count, MQTTString topicFilters[], int options[])
+{
+	unsigned char *ptr = buf;
+	MQTTHeader header = {0};
+	size_t rem_len = 0;
+	int rc = 0;
+	int i = 0;
+
+	rem_len = MQTTSerialize_subscribeLength(count, topicFilters) + MQTTProperties_len(properties);
+	if (MQTTPacket_len(rem_len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	header.byte = 0;
+	header.bits.type = SUBSCRIBE_MSG;
+	header.bits.dup = dup;
+	header.bits.qos = 1;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */;
+
+	writeInt(&ptr, packetid);
+	MQTTProperties_write(&ptr, properties);
+
+	for (i = 0; i < count; ++i)
+	{
+		writeMQTTString(&ptr, topicFilters[i]);
+		writeChar(&ptr, options[i]);
+	}
+
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
+
+
+/**
+  * Deserializes the supplied (wire) buffer into MQTT 5 suback data
+  * @param packetid returned integer - the MQTT packet identifier
+  * @param properties the properties returned, NULL to skip them
+  * @param maxcount - the maximum number of members allowed in the reasonCodes array
+  * @param count returned integer - number of members in the reasonCodes array
+  * @param reasonCodes returned array of integers - the granted QoS, or an MQTTReasonCodes failure from 0x80 up
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTV5Deserialize_suback(unsigned short* packetid, MQTTProperties* properties, int maxcount, int* count, int reasonCodes[],
+		unsigned char* buf, size_t buflen)
+{
+	MQTTHeader header = {0};
+	unsigned char* curdata = buf;
+	unsigned char* enddata = NULL;
+	int rc = 0;
+	int mylen;
+
+	header.byte = readChar(&curdata);
+	if (header.bits.type != SUBACK_MSG)
+		goto exit;
+
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
+	enddata = curdata + mylen;
+	if (enddata - curdata < 2)
+		goto exit;
+
+	*packetid = readInt(&curdata);
+	if (!MQTTProperties_read(properties, &curdata, enddata))
+		goto exit;
+
+	*count = 0;
+	while (curdata < enddata)
+	{
+		if (*count >= maxcount)
+		{
+			rc = -1;
+			goto exit;
+		}
+		reasonCodes[(*count)++] = (unsigned char)readChar(&curdata);
+	}
+
+	rc = 1;
+exit:
+	return rc;
+}
@@ -35,4 +35,7 @@ DLLExport int MQTTSerialize_unsuback(unsigned char* buf, size_t buflen, unsigned
 
 DLLExport int MQTTDeserialize_unsuback(unsigned short* packetid, unsigned char* buf, size_t len);
 
+DLLExport int MQTTV5Serialize_unsubscribe(unsigned char* buf, size_t buflen, unsigned char dup, unsigned short packetid, MQTTProperties* properties,
+		int count, MQTTString topicFilters[]);
+
 #endif /* MQTTUNSUBSCRIBE_H_ */
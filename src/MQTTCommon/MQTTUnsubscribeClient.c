@@ -99,3 +99,50 @@ int MQTTDeserialize_unsuback(unsigned short* packetid, unsigned char* buf, size_
 }
 
 
+
+
+/**
+  * Serializes the supplied MQTT 5 unsubscribe data into the supplied buffer, ready for sending
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param properties the unsubscribe properties, NULL for none
+  * @param count - number of members in the topicFilters array
+  * @param topicFilters - array of topic filter names
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTV5Serialize_unsubscribe(unsigned char* buf, size_t buflen, unsigned char dup, unsigned short packetid, MQTTProperties* properties,
+		int count, MQTTString topicFilters[])
+{
+	unsigned char *ptr = buf;
+	MQTTHeader header = {0};
+	size_t rem_len = 0;
+	int rc = -1;
+	int i = 0;
+
+	rem_len = MQTTSerialize_unsubscribeLength(count, topicFilters) + MQTTProperties_len(properties);
+	if (MQTTPacket_len(rem_len) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	header.byte = 0;
+	header.bits.type = UNSUBSCRIBE_MSG;
+	header.bits.dup = dup;
+	header.bits.qos = 1;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */;
+
+	writeInt(&ptr, packetid);
+	MQTTProperties_write(&ptr, properties);
+
+	for (i = 0; i < count; ++i)
+		writeMQTTString(&ptr, topicFilters[i]);
+
+	rc = (int)(ptr - buf);
+exit:
+	return rc;
+}
@@ -0,0 +1,406 @@
+/**
+* @file MQTTLocalNetwork.h
+*
+* In-process network class for use with MQTTClient. A client and a bridge, or a test broker, in the same process
+* exchange packets through a pair of shared ring buffers, without system calls while both sides keep up.
+*/
+
+#if !defined(__MQTT_LOCAL_NETWORK_h)
+#define __MQTT_LOCAL_NETWORK_h
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if !defined(MQTTLOCAL_RING_SIZE)
+	#define MQTTLOCAL_RING_SIZE 65536 // bytes buffered in each direction, must be a power of two
+#endif
+
+/**
+* Single producer, single consumer byte ring. The positions are on separate cache lines so the two sides don't
+* contend for them.
+*/
+class MQTTLocalRing
+{
+public:
+	/**
+	* Default constructor.
+	*/
+	MQTTLocalRing()
+	{
+		reset();
+	}
+
+	/**
+	* Empty the ring. Only call this while neither side is using it.
+	*/
+	void reset()
+	{
+		_head = _tail = 0;
+		_readerWaiting = 1; // the consumer may be waiting in poll or epoll without having read yet
+		_writerWaiting = 0;
+	}
+
+	/**
+	* Copy data into the ring. Only the producer calls this.
+	* @param[in] data The data
+	* @param[in] len Number of bytes to copy
+	* @return Number of bytes copied, fewer than len if the ring is full
+	*/
+	int put(const unsigned char* data, int len)
+	{
+		unsigned int tail = _tail;
+		unsigned int space = MQTTLOCAL_RING_SIZE - (tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE));
+		if ((unsigned int)len > space)
+			len = space;
+		unsigned int offset = tail & (MQTTLOCAL_RING_SIZE - 1);
+		unsigned int first = MQTTLOCAL_RING_SIZE - offset;
+		if (first > (unsigned int)len)
+			first = len;
+		memcpy(&_data[offset], data, first);
+		memcpy(_data, data + first, len - first);
+		__atomic_store_n(&_tail, tail + len, __ATOMIC_RELEASE);
+		return len;
+	}
+
+	/**
+	* Copy data out of the ring. Only the consumer calls this.
+	* @param[out] data Buffer that receives the data
+	* @param[in] len Buffer length
+	* @return Number of bytes copied, 0 if the ring is empty
+	*/
+	int get(unsigned char* data, int len)
+	{
+		unsigned int head = _head;
+		unsigned int available = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) - head;
+		if ((unsigned int)len > available)
+			len = available;
+		unsigned int offset = head & (MQTTLOCAL_RING_SIZE - 1);
+		unsigned int first = MQTTLOCAL_RING_SIZE - offset;
+		if (first > (unsigned int)len)
+			first = len;
+		memcpy(data, &_data[offset], first);
+		memcpy(data + first, _data, len - first);
+		__atomic_store_n(&_head, head + len, __ATOMIC_RELEASE);
+		return len;
+	}
+
+	/**
+	* Check if the ring is empty. Only the consumer calls this.
+	* @return true if there is nothing to read
+	*/
+	bool empty()
+	{
+		return __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) == _head;
+	}
+
+	/**
+	* Check if the ring is full. Only the producer calls this.
+	* @return true if there is no space to write
+	*/
+	bool full()
+	{
+		return _tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE) == MQTTLOCAL_RING_SIZE;
+	}
+
+private:
+	friend class MQTTLocalNetwork;
+
+	unsigned int _head __attribute__((aligned(64))); // consumer position
+	int _writerWaiting; // set by the producer before it sleeps on a full ring
+	unsigned int _tail __attribute__((aligned(64))); // producer position
+	int _readerWaiting; // set by the consumer before it sleeps on an empty ring
+	unsigned char _data[MQTTLOCAL_RING_SIZE] __attribute__((aligned(64)));
+};
+
+/**
+* The shared state of an in-process connection: a ring for each direction and an eventfd for each side, which the
+* other side signals when it has written to an empty ring or read from a full one, and only if the side is waiting.
+* Like the network classes there is no destructor, a channel is expected to live as long as the program.
+*/
+class MQTTLocalChannel
+{
+public:
+	/**
+	* Default constructor.
+	*/
+	MQTTLocalChannel()
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			_doorbells[i] = -1;
+			_states[i] = IDLE;
+		}
+	}
+
+	/**
+	* Prepare the channel for a new connection. Like socketpair, a channel carries one connection, so call this
+	* before each connection, while neither side is connected.
+	* @return 0 on success, -1 if the eventfds could not be created
+	*/
+	int init()
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			if (_doorbells[i] == -1 && (_doorbells[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+				return -1;
+			uint64_t count;
+			if (::read(_doorbells[i], &count, sizeof(count)) == -1 && errno != EAGAIN)
+				return -1;
+			_rings[i].reset();
+			_states[i] = IDLE;
+		}
+		return 0;
+	}
+
+private:
+	friend class MQTTLocalNetwork;
+
+	enum State { IDLE, OPEN, CLOSED };
+
+	MQTTLocalRing _rings[2]; // written by the side with the same index
+	int _doorbells[2]; // waited on by the side with the same index
+	int _states[2];
+};
+
+/**
+* Networking class for an in-process connection. Reads and writes copy straight between the client buffers and
+* the ring, and only make a system call to wake the other side if it is waiting, or to wait themselves.
+* getSocket returns an eventfd that becomes readable when there is something to do, so the client can also be
+* used in non-blocking mode and with MQTTReactor.
+*/
+class MQTTLocalNetwork
+{
+public:
+	enum Side { CLIENT, BRIDGE };
+
+	/**
+	* Default constructor.
+	*/
+	MQTTLocalNetwork() : _channel(NULL), _side(CLIENT), _connected(false)
+	{
+	}
+
+	/**
+	* Connect to one side of a channel.
+	* @param[in] channel The channel, which must have been initialized for this connection
+	* @param[in] side The side of the channel to use, CLIENT or BRIDGE. The other side is used by the peer.
+	* @return 0 if successfully connected, -1 if the channel is not initialized or the side is in use
+	*/
+	int connect(MQTTLocalChannel& channel, Side side = CLIENT)
+	{
+		int idle = MQTTLocalChannel::IDLE;
+		if (channel._doorbells[side] == -1 ||
+			!__atomic_compare_exchange_n(&channel._states[side], &idle, (int)MQTTLocalChannel::OPEN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return -1;
+		_channel = &channel;
+		_side = side;
+		_connected = true;
+		return 0;
+	}
+
+	/**
+	* Read data from the network. This returns as soon as any data is available, so fewer than len bytes may be read.
+	* @param[out] buffer Buffer that receives the data
+	* @param[in] len Buffer length
+	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
+	*/
+	int read(unsigned char* buffer, int len, int timeout_ms)
+	{
+		if (!_connected)
+			return -1;
+		MQTTLocalRing& ring = _channel->_rings[!_side];
+		bool waited = false;
+		while (true)
+		{
+			int bytes = ring.get(buffer, len);
+			if (bytes > 0)
+			{
+				wake(ring._writerWaiting);
+				return bytes;
+			}
+			if (len == 0)
+				return 0;
+			if (peerState() == MQTTLocalChannel::CLOSED && ring.empty())
+			{
+				_connected = false; // everything the peer wrote has been read
+				return -1;
+			}
+			if (waited)
+				return 0;
+			waited = true;
+			int rc = wait(ring._readerWaiting, ring, true, timeout_ms);
+			if (rc <= 0)
+				return rc;
+		}
+	}
+
+	/**
+	* Write data to the network.
+	* @param[in] buffer Buffer that contains data to write
+	* @param[in] len Number of bytes to write
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int write(unsigned char* buffer, int len, int timeout_ms)
+	{
+		return writev(&buffer, &len, 1, timeout_ms);
+	}
+
+	/**
+	* Write data from several buffers to the network.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms)
+	{
+		if (!_connected)
+			return -1;
+		MQTTLocalRing& ring = _channel->_rings[_side];
+		bool waited = false;
+		while (true)
+		{
+			if (peerState() == MQTTLocalChannel::CLOSED)
+			{
+				_connected = false;
+				return -1;
+			}
+			int bytes = 0, total = 0;
+			for (int i = 0; i < count && bytes == total; ++i)
+			{
+				bytes += ring.put(buffers[i], lengths[i]);
+				total += lengths[i];
+			}
+			if (bytes > 0 || total == 0)
+			{
+				wake(ring._readerWaiting);
+				if (bytes < total)
+					expectSpace(ring); // the rest is written when the peer has read some
+				return bytes;
+			}
+			if (waited)
+				return 0;
+			waited = true;
+			if (wait(ring._writerWaiting, ring, false, timeout_ms) < 0)
+				return -1;
+		}
+	}
+
+	/**
+	* Close the connection. The peer reads what was already written, then gets an error.
+	* @return 0 on success, -1 on error
+	*/
+	int disconnect()
+	{
+		if (!_channel)
+			return -1;
+		__atomic_store_n(&_channel->_states[_side], (int)MQTTLocalChannel::CLOSED, __ATOMIC_SEQ_CST);
+		signal(_channel->_doorbells[!_side]);
+		_connected = false;
+		return 0;
+	}
+
+	/**
+	* Get the connection state.
+	* @return true if connected, false if not
+	*/
+	bool connected()
+	{
+		return _connected;
+	}
+
+	/**
+	* Get the eventfd that becomes readable when the peer has written or made space, for use with poll, select or epoll.
+	* @return The file descriptor, -1 if not connected
+	*/
+	int getSocket()
+	{
+		return _channel ? _channel->_doorbells[_side] : -1;
+	}
+
+private:
+	/**
+	* Get the state of the other side of the channel.
+	*/
+	int peerState()
+	{
+		return __atomic_load_n(&_channel->_states[!_side], __ATOMIC_ACQUIRE);
+	}
+
+	/**
+	* Wait for the peer to read from or write to a ring. The waiting flag is set before the ring is checked again,
+	* and the peer checks the flag after changing the ring, so one of the two always sees the other.
+	* @param[in] flag The waiting flag of the ring
+	* @param[in] ring The ring
+	* @param[in] reading true to wait for data to read, false to wait for space to write
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return 1 if the ring may have changed, 0 if the timeout expired, -1 if there was an error
+	*/
+	int wait(int& flag, MQTTLocalRing& ring, bool reading, int timeout_ms)
+	{
+		__atomic_store_n(&flag, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((reading ? !ring.empty() : !ring.full()) || peerState() == MQTTLocalChannel::CLOSED)
+			return 1;
+
+		int doorbell = _channel->_doorbells[_side];
+		struct pollfd fd = { doorbell, POLLIN, 0 };
+		int rc;
+		while ((rc = ::poll(&fd, 1, (timeout_ms < 0) ? 0 : timeout_ms)) == -1 && errno == EINTR)
+			;
+		if (rc > 0)
+		{
+			uint64_t count;
+			if (::read(doorbell, &count, sizeof(count)) == -1 && errno != EAGAIN)
+				rc = -1;
+		}
+		return rc;
+	}
+
+	/**
+	* Ask the peer to signal when it reads from a full ring, as a socket becomes writable again. If it already has,
+	* signal this side, so a caller waiting on getSocket doesn't miss it.
+	* @param[in] ring The ring written by this side
+	*/
+	void expectSpace(MQTTLocalRing& ring)
+	{
+		__atomic_store_n(&ring._writerWaiting, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!ring.full())
+			signal(_channel->_doorbells[_side]);
+	}
+
+	/**
+	* Wake the peer if it is waiting on a ring.
+	* @param[in] flag The waiting flag of the ring
+	*/
+	void wake(int& flag)
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&flag, __ATOMIC_RELAXED) && __atomic_exchange_n(&flag, 0, __ATOMIC_SEQ_CST))
+			signal(_channel->_doorbells[!_side]);
+	}
+
+	/**
+	* Signal an eventfd.
+	*/
+	static void signal(int doorbell)
+	{
+		uint64_t one = 1;
+		if (::write(doorbell, &one, sizeof(one)) == -1)
+			return; // the counter can only overflow if nobody has been reading it for a very long time
+	}
+
+	MQTTLocalChannel* _channel;
+	Side _side;
+	bool _connected;
+};
+
+#endif
@@ -19,10 +19,211 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
+#include <string.h>
+#include "MQTTTimer.h"
+
+#if !defined(TCP_FASTOPEN_CONNECT)
+	#define TCP_FASTOPEN_CONNECT 30 // from linux/tcp.h, for C libraries that don't define it yet
+#endif
+
+#if !defined(MQTTNETWORK_CONNECT_TIMEOUT_MS)
+	#define MQTTNETWORK_CONNECT_TIMEOUT_MS 10000 // default time allowed for connect, in milliseconds
+#endif
+
+#if !defined(MQTTNETWORK_ATTEMPT_DELAY_MS)
+	#define MQTTNETWORK_ATTEMPT_DELAY_MS 250 // time to wait on an address before also trying the next one, in milliseconds
+#endif
+
+#if !defined(MQTTNETWORK_ADDRESS_TTL_MS)
+	#define MQTTNETWORK_ADDRESS_TTL_MS 300000 // time to reuse resolved addresses before resolving the host again, in milliseconds
+#endif
+
+#if !defined(MQTTNETWORK_MAX_ADDRESSES)
+	#define MQTTNETWORK_MAX_ADDRESSES 8 // maximum number of addresses cached and tried for a host
+#endif
+
+#if !defined(MQTTNETWORK_MAX_HOSTNAME)
+	#define MQTTNETWORK_MAX_HOSTNAME 64 // maximum length of a hostname that can be cached, including the terminator
+#endif
+
+#if !defined(MQTTNETWORK_MAX_HOSTS)
+	#define MQTTNETWORK_MAX_HOSTS 4 // maximum number of hosts whose addresses are cached, for all the networks together
+#endif
+
+/**
+* A resolved IPv4 or IPv6 address, including the port.
+*/
+union MQTTAddress
+{
+	struct sockaddr any;
+	struct sockaddr_in ipv4;
+	struct sockaddr_in6 ipv6;
+};
+
+/**
+* The resolved addresses of the hosts connected to, shared by every MQTTNetwork in the process, so the connections
+* of a gateway to one broker resolve it once rather than once each. Hosts are found by hostname and port, and when
+* the cache is full the host resolved longest ago is replaced. Copies go in and out under a spin lock, the resolver
+* is never called with it held.
+*/
+class MQTTAddressCache
+{
+public:
+	/**
+	* Get the cache used by every MQTTNetwork.
+	* @return The shared cache
+	*/
+	static MQTTAddressCache& shared()
+	{
+		static MQTTAddressCache cache; // zero initialized, so it is empty and unlocked without a constructor
+		return cache;
+	}
+
+	/**
+	* Copy the addresses of a host, if they are cached and haven't expired.
+	* @param[in] hostname The hostname
+	* @param[in] port The port
+	* @param[out] addresses Returns the addresses, in the order to try them, MQTTNETWORK_MAX_ADDRESSES at most
+	* @return The number of addresses, 0 if the host isn't cached
+	*/
+	int get(const char* hostname, int port, MQTTAddress* addresses)
+	{
+		int count = 0;
+		lock();
+		Host* host = find(hostname, port);
+		if (host && !isExpired(host->expiry))
+		{
+			count = host->count;
+			memcpy(addresses, host->addresses, count * sizeof(MQTTAddress));
+		}
+		unlock();
+		return count;
+	}
+
+	/**
+	* Cache the addresses of a host for MQTTNETWORK_ADDRESS_TTL_MS. Names too long to cache are resolved every time.
+	* @param[in] hostname The hostname
+	* @param[in] port The port
+	* @param[in] addresses The addresses, in the order to try them
+	* @param[in] count The number of addresses, MQTTNETWORK_MAX_ADDRESSES at most
+	*/
+	void put(const char* hostname, int port, const MQTTAddress* addresses, int count)
+	{
+		if (strlen(hostname) >= MQTTNETWORK_MAX_HOSTNAME)
+			return;
+		lock();
+		Host* host = find(hostname, port);
+		for (int i = 0; !host && i < MQTTNETWORK_MAX_HOSTS; ++i)
+		{
+			if (_hosts[i].count == 0)
+				host = &_hosts[i];
+		}
+		if (!host)
+		{
+			host = &_hosts[0];
+			for (int i = 1; i < MQTTNETWORK_MAX_HOSTS; ++i)
+			{
+				if (timercmp(&_hosts[i].expiry, &host->expiry, <))
+					host = &_hosts[i];
+			}
+		}
+		strcpy(host->hostname, hostname);
+		host->port = port;
+		memcpy(host->addresses, addresses, count * sizeof(MQTTAddress));
+		host->count = count;
+		struct timeval now, ttl = { MQTTNETWORK_ADDRESS_TTL_MS / 1000, (MQTTNETWORK_ADDRESS_TTL_MS % 1000) * 1000 };
+		gettimeofday(&now, NULL);
+		timeradd(&now, &ttl, &host->expiry);
+		unlock();
+	}
+
+	/**
+	* Move an address of a host to the front, so the next connect tries it first.
+	* @param[in] hostname The hostname
+	* @param[in] port The port
+	* @param[in] address The address that connected
+	*/
+	void promote(const char* hostname, int port, const MQTTAddress& address)
+	{
+		lock();
+		Host* host = find(hostname, port);
+		for (int i = 0; host && i < host->count; ++i)
+		{
+			if (memcmp(&host->addresses[i], &address, sizeof(address)) == 0)
+			{
+				memmove(&host->addresses[1], &host->addresses[0], i * sizeof(MQTTAddress));
+				host->addresses[0] = address;
+				break;
+			}
+		}
+		unlock();
+	}
+
+	/**
+	* Forget the addresses of a host, or of every host.
+	* @param[in] hostname The hostname, NULL for every host
+	* @param[in] port The port
+	*/
+	void clear(const char* hostname = NULL, int port = 0)
+	{
+		lock();
+		for (int i = 0; i < MQTTNETWORK_MAX_HOSTS; ++i)
+		{
+			if (!hostname || (_hosts[i].port == port && strcmp(_hosts[i].hostname, hostname) == 0))
+				_hosts[i].count = 0;
+		}
+		unlock();
+	}
+
+private:
+	struct Host
+	{
+		char hostname[MQTTNETWORK_MAX_HOSTNAME];
+		int port;
+		MQTTAddress addresses[MQTTNETWORK_MAX_ADDRESSES];
+		int count;  // 0 if the entry is free
+		struct timeval expiry;
+	};
+
+	static bool isExpired(const struct timeval& expiry)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		return !timercmp(&now, &expiry, <);
+	}
+
+	Host* find(const char* hostname, int port)
+	{
+		for (int i = 0; i < MQTTNETWORK_MAX_HOSTS; ++i)
+		{
+			if (_hosts[i].count > 0 && _hosts[i].port == port && strcmp(_hosts[i].hostname, hostname) == 0)
+				return &_hosts[i];
+		}
+		return NULL;
+	}
+
+	void lock()
+	{
+		while (__atomic_test_and_set(&_lock, __ATOMIC_ACQUIRE))
+			;
+	}
+
+	void unlock()
+	{
+		__atomic_clear(&_lock, __ATOMIC_RELEASE);
+	}
+
+	Host _hosts[MQTTNETWORK_MAX_HOSTS];
+	bool _lock;
+};
 
  /**
  * Networking class for use with MQTTClient.
@@ -33,100 +234,121 @@ public:
 	/**
 	* Default constructor.
 	*/
-	MQTTNetwork() : _connected(false)
+	MQTTNetwork() : _socket(-1), _connected(false), _fastOpen(false)
 	{
 	}
 
 	/**
-	* Connect to the specified host.
+	* Connect to the specified host. The addresses of the host are kept in MQTTAddressCache, so reconnecting, or connecting
+	* another network to the same host, doesn't wait for the resolver until they are MQTTNETWORK_ADDRESS_TTL_MS old.
+	* Connections to the addresses are raced, a new attempt starting every MQTTNETWORK_ATTEMPT_DELAY_MS, or as soon as
+	* an attempt fails, and the first to connect is used. The address that connected is tried first next time. If none
+	* of the cached addresses connect the host is resolved again.
 	* @param[in] hostname Destination hostname
 	* @param[in] port Destination port
+	* @param[in] timeout_ms Maximum time to wait for the connection, in milliseconds
 	* @return 0 if successfully connected, an error code otherwise
 	*/
-	int connect(const char* hostname, int port)
+	int connect(const char* hostname, int port, int timeout_ms = MQTTNETWORK_CONNECT_TIMEOUT_MS)
 	{
-		int type = SOCK_STREAM;
-		struct sockaddr_in address;
-		int rc = -1;
-		sa_family_t family = AF_INET;
-		struct addrinfo *result = NULL;
-		struct addrinfo hints = { 0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL };
+		MQTTTimer timer(timeout_ms);
+		MQTTAddress addresses[MQTTNETWORK_MAX_ADDRESSES];
+		int count = MQTTAddressCache::shared().get(hostname, port, addresses);
+		bool cached = (count > 0);
+		int winner = -1;
+		int rc = 0;
 
-		if ((rc = getaddrinfo(hostname, NULL, &hints, &result)) == 0)
+		if (!cached && (rc = resolve(hostname, port, addresses, &count)) != 0)
+			return rc;
+		_socket = race(addresses, count, timer, &winner);
+		if (_socket == -1 && cached && !timer.expired() && resolve(hostname, port, addresses, &count) == 0)
+			_socket = race(addresses, count, timer, &winner); // the broker may have moved
+		if (_socket == -1)
 		{
-			struct addrinfo* res = result;
-
-			/* prefer ip4 addresses */
-			while (res)
-			{
-				if (res->ai_family == AF_INET)
-				{
-					result = res;
-					break;
-				}
-				res = res->ai_next;
-			}
+			MQTTAddressCache::shared().clear(hostname, port);
+			return -1;
+		}
+		if (winner > 0)
+			MQTTAddressCache::shared().promote(hostname, port, addresses[winner]); // try the address that worked first next time
 
-			if (result->ai_family == AF_INET)
-			{
-				address.sin_port = htons(port);
-				address.sin_family = family = AF_INET;
-				address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
-			}
-			else
-				rc = -1;
+		// Reads and writes wait for the socket with poll, so the socket timeouts don't need to be set on every call.
+		// Packets are written whole, or gathered by the client, so don't let Nagle hold them back.
+		setNoDelay(true);
+		_connected = true;
+		return 0;
+	}
 
-			freeaddrinfo(result);
-		}
+	/**
+	* Use TCP Fast Open for the following connects. Once the kernel has a cookie from the server, connect returns
+	* straight away and the first write goes out with the SYN, so a pipelined MQTT connect saves another round trip.
+	* Until then, or if the server doesn't support it, connects are the same as without it.
+	* @param[in] fastOpen true to use TCP Fast Open
+	*/
+	void setFastOpen(bool fastOpen)
+	{
+		_fastOpen = fastOpen;
+	}
 
-		if (rc == 0)
-		{
-			_socket = socket(family, type, 0);
-			if (_socket != -1)
-			{
-				if ((rc = ::connect(_socket, (struct sockaddr*)&address, sizeof(address))) == 0)
-					_connected = true;
-			}
-		}
+	/**
+	* Forget the cached addresses of every host, so the next connects resolve them again.
+	*/
+	void clearAddressCache()
+	{
+		MQTTAddressCache::shared().clear();
+	}
 
-		return rc;
+	/**
+	* Use a stream socket that is already connected, such as one from accept or socketpair. The network owns the
+	* socket from now on and closes it on disconnect.
+	* @param[in] socket The connected socket
+	* @return 0 on success, -1 on error
+	*/
+	int attach(int socket)
+	{
+		int flags = fcntl(socket, F_GETFL, 0);
+		if (flags == -1 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1)
+			return -1;
+		_socket = socket;
+		_connected = true;
+		return 0;
 	}
 
 	/**
-	* Read data from the network.
+	* Read data from the network. This returns as soon as any data is available, so fewer than len bytes may be read.
 	* @param[out] buffer Buffer that receives the data
 	* @param[in] len Buffer length
 	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
-	* @return Number of bytes read, or a negative value if there was an error
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
 	*/
 	int read(unsigned char* buffer, int len, int timeout_ms)
 	{
-		struct timeval interval = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
-		//Make sure the timeout isn't zero, otherwise it can block forever.
-		if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
-		{
-			interval.tv_sec = 0;
-			interval.tv_usec = 100;
-		}
-
-		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&interval, sizeof(struct timeval));
-
-		int bytes = 0;
-		while (bytes < len && _connected)
+		bool waited = false;
+		int bytes = -1;
+		while (_connected)
 		{
-			int rc = ::recv(_socket, &buffer[bytes], (size_t)(len - bytes), 0);
-			if (rc == -1)
+			int rc = ::recv(_socket, buffer, (size_t)len, 0);
+			if (rc > 0)
+				bytes = rc;
+			else if (rc == 0 && len != 0)
+				_connected = false;
+			else if (rc == 0)
+				bytes = 0;
+			else if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
 			{
-				if (errno != ENOTCONN && errno != ECONNRESET)
+				if (waited)
+					bytes = 0;
+				else if ((bytes = waitReady(POLLIN, timeout_ms)) > 0)
 				{
+					waited = true;
 					bytes = -1;
-					break;
+					continue;
 				}
 			}
-			else if ((rc == 0 && len != 0) || errno == ENOTCONN || errno == ECONNRESET || errno == EPIPE)
+			else if (errno == ENOTCONN || errno == ECONNRESET || errno == EPIPE)
 				_connected = false;
-			else
-				bytes += rc;
+			break;
 		}
 
 		return bytes;
@@ -141,19 +363,37 @@ public:
 	*/
 	int write(unsigned char* buffer, int len, int timeout_ms)
 	{
-		struct timeval interval = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
-		//Make sure the timeout isn't zero, otherwise it can block forever.
-		if (interval.tv_sec < 0 || (interval.tv_sec == 0 && interval.tv_usec <= 0))
+		int rc;
+		bool waited = false;
+		while ((rc = ::write(_socket, buffer, len)) == -1 && retryWrite(waited, timeout_ms))
+			;
+		return (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)) ? 0 : rc;
+	}
+
+	/**
+	* Write data from several buffers to the network with a single system call.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms)
+	{
+		struct iovec vec[MAX_WRITE_BUFFERS];
+		if (count > MAX_WRITE_BUFFERS)
+			count = MAX_WRITE_BUFFERS; // the rest is sent by the next call
+		for (int i = 0; i < count; ++i)
 		{
-			interval.tv_sec = 0;
-			interval.tv_usec = 100;
+			vec[i].iov_base = buffers[i];
+			vec[i].iov_len = lengths[i];
 		}
 
-		setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&interval, sizeof(struct timeval));
-		int	rc = ::write(_socket, buffer, len);
-		if (rc == -1 && (errno == ENOTCONN || errno == ECONNRESET || errno == EPIPE))
-			_connected = false;
-		return rc;
+		int rc;
+		bool waited = false;
+		while ((rc = ::writev(_socket, vec, count)) == -1 && retryWrite(waited, timeout_ms))
+			;
+		return (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)) ? 0 : rc;
 	}
 
 	/**
@@ -176,10 +416,212 @@ public:
 		return _connected;
 	}
 
+	/**
+	* Turn Nagle's algorithm off or on. It is off by default so each write goes out straight away, for the lowest latency.
+	* @param[in] noDelay true to send small writes immediately, false to let the kernel combine them
+	* @return 0 on success, -1 on error
+	*/
+	int setNoDelay(bool noDelay)
+	{
+		int value = noDelay;
+		return setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+	}
+
+	/**
+	* Cork or uncork the connection. While corked the kernel only sends full segments, so a burst of writes goes out
+	* in as few segments as possible. Uncorking sends whatever is left straight away.
+	* @param[in] cork true to cork, false to uncork
+	* @return 0 on success, -1 on error
+	*/
+	int setCork(bool cork)
+	{
+		int value = cork;
+		return setsockopt(_socket, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+	}
+
+	/**
+	* Get the socket, for use with poll, select or epoll.
+	* @return The socket file descriptor, -1 if not connected
+	*/
+	int getSocket()
+	{
+		return _socket;
+	}
+
 private:
+	static const int MAX_WRITE_BUFFERS = 8;
+
+	/**
+	* Resolve the host and cache its addresses. The resolver sorts the addresses by preference, this keeps that
+	* order within each address family but alternates the families, so a broken IPv6 or IPv4 route only costs one attempt delay.
+	* @param[in] hostname Destination hostname
+	* @param[in] port Destination port
+	* @param[out] addresses Returns the addresses, MQTTNETWORK_MAX_ADDRESSES at most
+	* @param[out] count Returns the number of addresses
+	* @return 0 on success, a getaddrinfo error code otherwise
+	*/
+	int resolve(const char* hostname, int port, MQTTAddress* addresses, int* count)
+	{
+		struct addrinfo *result = NULL;
+		struct addrinfo hints = { 0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL };
+		int rc;
+
+		*count = 0;
+		MQTTAddressCache::shared().clear(hostname, port);
+		if ((rc = getaddrinfo(hostname, NULL, &hints, &result)) != 0)
+			return rc;
+
+		MQTTAddress families[2][MQTTNETWORK_MAX_ADDRESSES]; // addresses of the family listed first, then of the other family
+		int counts[2] = { 0, 0 };
+		for (struct addrinfo* res = result; res; res = res->ai_next)
+		{
+			int family = (res->ai_family == result->ai_family) ? 0 : 1;
+			if ((res->ai_family != AF_INET && res->ai_family != AF_INET6) || counts[family] == MQTTNETWORK_MAX_ADDRESSES)
+				continue;
+			MQTTAddress& address = families[family][counts[family]++];
+			memset(&address, 0, sizeof(address));
+			memcpy(&address, res->ai_addr, res->ai_addrlen);
+			if (address.any.sa_family == AF_INET)
+				address.ipv4.sin_port = htons(port);
+			else
+				address.ipv6.sin6_port = htons(port);
+		}
+		for (int i = 0; *count < MQTTNETWORK_MAX_ADDRESSES && (i < counts[0] || i < counts[1]); ++i)
+		{
+			if (i < counts[0])
+				addresses[(*count)++] = families[0][i];
+			if (i < counts[1] && *count < MQTTNETWORK_MAX_ADDRESSES)
+				addresses[(*count)++] = families[1][i];
+		}
+		freeaddrinfo(result);
+
+		if (*count == 0)
+			return EAI_FAMILY;
+		MQTTAddressCache::shared().put(hostname, port, addresses, *count);
+		return 0;
+	}
+
+	/**
+	* Race connections to the addresses of a host.
+	* @param[in] addresses The addresses, in the order to try them
+	* @param[in] count The number of addresses
+	* @param[in] timer Time allowed for the connection
+	* @param[out] winner Returns the index of the address that connected
+	* @return The connected socket, or -1 if no address could be connected to in time
+	*/
+	int race(const MQTTAddress* addresses, int count, MQTTTimer& timer, int* winner)
+	{
+		struct pollfd attempts[MQTTNETWORK_MAX_ADDRESSES];
+		int indexes[MQTTNETWORK_MAX_ADDRESSES];
+		MQTTTimer attemptTimer(0);
+		int next = 0, pending = 0, connected = -1;
+
+		while (connected == -1 && !timer.expired())
+		{
+			if (next < count && (pending == 0 || attemptTimer.expired()))
+			{
+				const MQTTAddress& address = addresses[next];
+				socklen_t length = (address.any.sa_family == AF_INET) ? sizeof(address.ipv4) : sizeof(address.ipv6);
+				int s = ::socket(address.any.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				if (s != -1 && _fastOpen)
+				{
+					int value = 1;
+					setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &value, sizeof(value));
+				}
+				if (s != -1 && ::connect(s, &address.any, length) == 0)
+				{
+					connected = s;
+					*winner = next;
+				}
+				else if (s != -1 && errno == EINPROGRESS)
+				{
+					attempts[pending].fd = s;
+					attempts[pending].events = POLLOUT;
+					attempts[pending].revents = 0;
+					indexes[pending++] = next;
+					attemptTimer.countdown_ms(MQTTNETWORK_ATTEMPT_DELAY_MS);
+				}
+				else if (s != -1)
+					close(s);
+				next++;
+				continue;
+			}
+			if (pending == 0)
+				break; // every address failed
+
+			int wait = timer.left_ms();
+			if (next < count && attemptTimer.left_ms() < wait)
+				wait = attemptTimer.left_ms();
+			if (::poll(attempts, pending, wait) <= 0)
+				continue;
+			for (int i = 0; i < pending && connected == -1; )
+			{
+				int error = 0;
+				socklen_t length = sizeof(error);
+				if (attempts[i].revents == 0)
+					++i;
+				else if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0)
+				{
+					connected = attempts[i].fd;
+					*winner = indexes[i];
+				}
+				else
+				{
+					close(attempts[i].fd);
+					attempts[i] = attempts[--pending];
+					indexes[i] = indexes[pending];
+					attemptTimer.countdown_ms(0); // don't wait to try the next address
+				}
+			}
+		}
+
+		for (int i = 0; i < pending; ++i)
+		{
+			if (attempts[i].fd != connected)
+				close(attempts[i].fd);
+		}
+		return connected;
+	}
+
+	/**
+	* Wait for the socket to become readable or writable.
+	* @param[in] events The poll events to wait for
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return 1 if the socket is ready, 0 if the timeout expired, -1 if there was an error
+	*/
+	int waitReady(short events, int timeout_ms)
+	{
+		struct pollfd fd = { _socket, events, 0 };
+		int rc;
+		while ((rc = ::poll(&fd, 1, (timeout_ms < 0) ? 0 : timeout_ms)) == -1 && errno == EINTR)
+			;
+		return rc;
+	}
+
+	/**
+	* Check if a failed write should be retried, waiting for the socket to become writable if the write would have blocked.
+	* @param[in,out] waited true if this write has already waited for the socket
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return true if the write should be retried, false otherwise
+	*/
+	bool retryWrite(bool& waited, int timeout_ms)
+	{
+		if (errno == EINTR)
+			return true;
+		// EINPROGRESS is from the first write of a Fast Open connect whose data didn't fit in the SYN
+		if ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) && !waited)
+		{
+			waited = true;
+			return waitReady(POLLOUT, timeout_ms) > 0;
+		}
+		if (errno == ENOTCONN || errno == ECONNRESET || errno == EPIPE)
+			_connected = false;
+		return false;
+	}
 
 	int _socket;
 	bool _connected;
+	bool _fastOpen;
 };
 
 
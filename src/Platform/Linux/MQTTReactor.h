@@ -0,0 +1,211 @@
+/**
+* @file MQTTReactor.h
+*
+* Single-threaded event loop that drives many non-blocking MQTT clients over one epoll instance.
+*/
+
+#if !defined(__MQTT_REACTOR_h)
+#define __MQTT_REACTOR_h
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include "MQTTTimer.h"
+#include "FP.h"
+
+#if !defined(MQTTREACTOR_MAX_EVENTS)
+	#define MQTTREACTOR_MAX_EVENTS 256 // events handled per call to epoll_wait
+#endif
+
+/**
+* Whether the reactor can drive clients using a network class. It can if epoll reports the network's socket
+* readable when there is data to read, which is not the case for networks that read the socket themselves.
+* @param Network The network class
+*/
+template<class Network>
+struct MQTTReactorNetwork
+{
+	enum { supported = 1 };
+};
+
+/**
+* Runs reading, dispatch, sending and keep alive for many clients from a single thread.
+* Use one reactor per thread, typically one per core. The Client class is either MQTT::Client or
+* CayenneMQTT::MQTTClient, the clients are switched to non-blocking mode when they are added.
+* Like the network classes there is no destructor, a reactor is expected to live as long as the program.
+* @param Client The client class
+* @param MAX_CLIENTS The maximum number of clients the reactor can drive
+*/
+template<class Client, int MAX_CLIENTS = 1024>
+class MQTTReactor
+{
+	static_assert(MQTTReactorNetwork<typename Client::NetworkType>::supported, "The reactor can't wait for this network's socket with epoll");
+
+public:
+	/**
+	* Construct the reactor.
+	* @param[in] tick_ms How often to run the client timers, in milliseconds. This only needs to be fine enough for connect timeouts and keep alive pings.
+	*/
+	MQTTReactor(int tick_ms = 100) : _tickInterval(tick_ms), _count(0)
+	{
+		_epoll = epoll_create1(EPOLL_CLOEXEC);
+		_tick.countdown_ms(tick_ms);
+		for (int i = 0; i < MAX_CLIENTS; ++i)
+			_clients[i] = NULL;
+	}
+
+	/**
+	* Set the function called when a client's connection fails. The client has been removed from the reactor
+	* when the handler is called, it can be reconnected and added again.
+	* @param[in] handler Function called with the failed client
+	*/
+	void setDisconnectHandler(void(*handler)(Client&))
+	{
+		_disconnectHandler.attach(handler);
+	}
+
+	/**
+	* Set the function called when a client's connection fails.
+	* @param item Address of initialized object
+	* @param handler Function called with the failed client
+	*/
+	template<class T>
+	void setDisconnectHandler(T *item, void (T::*handler)(Client&))
+	{
+		_disconnectHandler.attach(item, handler);
+	}
+
+	/**
+	* Add a client to the reactor. The client's network must already be connected, the MQTT connect
+	* can be sent before or after adding the client.
+	* @param[in] client The client
+	* @return 0 on success, -1 if the reactor is full or the socket could not be registered
+	*/
+	int add(Client& client)
+	{
+		if (_count == MAX_CLIENTS)
+			return -1;
+		client.setNonBlocking(true);
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLOUT | EPOLLET; // edge triggered, the client always reads and writes until the socket would block
+		event.data.u32 = _count;
+		if (epoll_ctl(_epoll, EPOLL_CTL_ADD, client.getSocket(), &event) == -1)
+			return -1;
+		_clients[_count++] = &client;
+		return 0;
+	}
+
+	/**
+	* Remove a client from the reactor. This does not disconnect the client.
+	* @param[in] client The client
+	* @return 0 on success, -1 if the client was not found
+	*/
+	int remove(Client& client)
+	{
+		for (int i = 0; i < _count; ++i) {
+			if (_clients[i] == &client) {
+				removeAt(i);
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	/**
+	* Get the number of clients in the reactor.
+	* @return The number of clients
+	*/
+	int count()
+	{
+		return _count;
+	}
+
+	/**
+	* Wait for and handle network events and timers.
+	* @param[in] timeout_ms The maximum time to wait for events, in milliseconds
+	* @return The number of events handled, or -1 if epoll failed
+	*/
+	int run(int timeout_ms)
+	{
+		struct epoll_event events[MQTTREACTOR_MAX_EVENTS];
+		int tick = _tick.left_ms();
+		if (tick < timeout_ms)
+			timeout_ms = tick;
+
+		int n = epoll_wait(_epoll, events, MQTTREACTOR_MAX_EVENTS, timeout_ms);
+		if (n == -1)
+			return (errno == EINTR) ? 0 : -1;
+
+		for (int i = 0; i < n; ++i) {
+			int slot = events[i].data.u32;
+			Client* client = _clients[slot];
+			if (!client)
+				continue; // removed while handling an earlier event
+			int rc = 0;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				rc = -1;
+			if (rc == 0 && (events[i].events & EPOLLOUT) && client->isWritePending())
+				rc = client->onWritable();
+			if (rc == 0 && (events[i].events & EPOLLIN))
+				rc = client->onReadable();
+			if (rc != 0)
+				fail(slot, events, i + 1, n);
+		}
+
+		if (_tick.expired()) {
+			_tick.countdown_ms(_tickInterval);
+			for (int i = 0; i < _count; ) {
+				if (_clients[i]->onTimer() != 0)
+					fail(i, events, 0, 0);
+				else
+					++i;
+			}
+		}
+		return n;
+	}
+
+private:
+	/**
+	* Remove a failed client and call the disconnect handler.
+	*/
+	void fail(int slot, struct epoll_event* events, int next, int n)
+	{
+		Client* client = _clients[slot];
+		int last = _count - 1;
+		removeAt(slot);
+		// Events still to be handled in this pass refer to clients by slot, so follow the moves.
+		for (int i = next; i < n; ++i) {
+			if ((int)events[i].data.u32 == slot)
+				events[i].data.u32 = last; // the failed client, now cleared
+			else if ((int)events[i].data.u32 == last)
+				events[i].data.u32 = slot;
+		}
+		_disconnectHandler(*client);
+	}
+
+	/**
+	* Remove the client in a slot, moving the last client into its place.
+	*/
+	void removeAt(int slot)
+	{
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, _clients[slot]->getSocket(), NULL);
+		int last = --_count;
+		if (slot != last) {
+			_clients[slot] = _clients[last];
+			struct epoll_event event;
+			event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+			event.data.u32 = slot;
+			epoll_ctl(_epoll, EPOLL_CTL_MOD, _clients[slot]->getSocket(), &event);
+		}
+		_clients[last] = NULL;
+	}
+
+	int _epoll;
+	int _tickInterval;
+	MQTTTimer _tick;
+	Client* _clients[MAX_CLIENTS];
+	int _count;
+	FP<void, Client&> _disconnectHandler;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/**
+* @file MQTTSessionFile.h
+*
+* Keeps the session snapshot of an MQTTClient in a file, so a restarted process can resume the session the server kept.
+*/
+
+#if !defined(__MQTT_SESSION_FILE_h)
+#define __MQTT_SESSION_FILE_h
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+* Saves and loads the snapshot written by the client's saveSession. Save the session after subscribing and before
+* exiting, then load it in the new process before connecting with cleansession 0.
+*/
+class MQTTSessionFile
+{
+public:
+	/**
+	* Write the session of a client to a file. The snapshot goes to a temporary file that replaces the old one,
+	* so the file holds either the old or the new snapshot if the process stops part way through.
+	* @param[in] client The client
+	* @param[in] path Path of the file
+	* @return 0 if the session was written, -1 otherwise
+	*/
+	template<class Client>
+	static int save(Client& client, const char* path)
+	{
+		unsigned char buffer[Client::SESSION_SIZE];
+		char temporary[256];
+		int length = client.saveSession(buffer, sizeof(buffer));
+		if (length < 0 || snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary))
+			return -1;
+
+		int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (fd == -1)
+			return -1;
+		int written = write(fd, buffer, length);
+		if (written != length || fsync(fd) != 0)
+		{
+			close(fd);
+			unlink(temporary);
+			return -1;
+		}
+		close(fd);
+		return (rename(temporary, path) == 0) ? 0 : -1;
+	}
+
+	/**
+	* Read the session of a client from a file. The client must not be connected.
+	* @param[in] client The client
+	* @param[in] path Path of the file
+	* @return 0 if the session was read, -1 if there is no file or it does not hold a valid snapshot
+	*/
+	template<class Client>
+	static int load(Client& client, const char* path)
+	{
+		unsigned char buffer[Client::SESSION_SIZE];
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			return -1;
+		int length = read(fd, buffer, sizeof(buffer));
+		close(fd);
+		return (length > 0 && client.restoreSession(buffer, length) == 0) ? 0 : -1;
+	}
+};
+
+#endif
@@ -0,0 +1,446 @@
+/**
+* @file MQTTTLSNetwork.h
+*
+* TLS network class for use with MQTTClient, built on OpenSSL. Link with -lssl -lcrypto.
+*/
+
+#if !defined(__MQTT_TLS_NETWORK_h)
+#define __MQTT_TLS_NETWORK_h
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include "MQTTNetwork.h"
+#include "MQTTTimer.h"
+
+#if !defined(MQTTTLS_HANDSHAKE_TIMEOUT_MS)
+	#define MQTTTLS_HANDSHAKE_TIMEOUT_MS 10000 // maximum time for the TLS handshake
+#endif
+
+#if !defined(MQTTTLS_GATHER_BUFFER_SIZE)
+	#define MQTTTLS_GATHER_BUFFER_SIZE 2048 // buffer used to send the parts of a packet as a single TLS record
+#endif
+
+class MQTTTLSNetwork;
+
+/**
+* TLS settings shared by many connections: the trusted certificates, the client certificate and the protocol options.
+* Like the network classes there is no destructor, a context is expected to live as long as the program.
+*/
+class MQTTTLSContext
+{
+public:
+	/**
+	* Default constructor.
+	*/
+	MQTTTLSContext() : _ctx(NULL), _verify(true)
+	{
+	}
+
+	/**
+	* Initialize the context.
+	* @param[in] caFile File with the trusted CA certificates in PEM format. If NULL the system default certificates are used.
+	* @param[in] verify true to verify the server certificate and hostname, false to accept any server (for testing only)
+	* @param[in] certFile File with the client certificate in PEM format, NULL if the client does not use a certificate
+	* @param[in] keyFile File with the client private key in PEM format, NULL if the client does not use a certificate
+	* @return 0 on success, -1 on error
+	*/
+	int init(const char* caFile = NULL, bool verify = true, const char* certFile = NULL, const char* keyFile = NULL)
+	{
+		if (!_ctx && !(_ctx = SSL_CTX_new(TLS_client_method())))
+			return -1;
+		_verify = verify;
+		SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+		// The client may retry a write that would have blocked from a different address, and wants to know about each record sent.
+		SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		// Each network keeps the session for its own reconnects, so new sessions are handed to it rather than to the internal cache.
+		SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(_ctx, newSession);
+#if defined(SSL_OP_ENABLE_KTLS)
+		// Hand the record layer to the kernel if it supports it. OpenSSL falls back to encrypting in userspace if it doesn't.
+		SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+		if (verify)
+		{
+			SSL_CTX_set_verify(_ctx, SSL_VERIFY_PEER, NULL);
+			if ((caFile ? SSL_CTX_load_verify_locations(_ctx, caFile, NULL) : SSL_CTX_set_default_verify_paths(_ctx)) != 1)
+				return -1;
+		}
+		else
+			SSL_CTX_set_verify(_ctx, SSL_VERIFY_NONE, NULL);
+		if (certFile && (SSL_CTX_use_certificate_chain_file(_ctx, certFile) != 1 ||
+			SSL_CTX_use_PrivateKey_file(_ctx, keyFile ? keyFile : certFile, SSL_FILETYPE_PEM) != 1))
+			return -1;
+		return 0;
+	}
+
+	/**
+	* Get the OpenSSL context, for settings not covered by init.
+	* @return The context, NULL if it has not been initialized
+	*/
+	SSL_CTX* get()
+	{
+		return _ctx;
+	}
+
+	/**
+	* Check if server certificates are verified.
+	* @return true if the server certificate and hostname are verified
+	*/
+	bool verifying()
+	{
+		return _verify;
+	}
+
+private:
+	static int newSession(SSL* ssl, SSL_SESSION* session);
+
+	SSL_CTX* _ctx;
+	bool _verify;
+};
+
+/**
+* TLS networking class for use with MQTTClient. The TCP connection is made with MQTTNetwork.
+*
+* The session is kept when the connection closes, so reconnecting to the same server resumes it with a ticket
+* or session id instead of a full handshake. If the kernel TLS offload is available the record layer is handed
+* to the kernel after the handshake, and writes go straight to the socket, gathered, with no userspace encryption.
+*/
+class MQTTTLSNetwork
+{
+public:
+	/**
+	* Construct the network.
+	* @param[in] context The TLS settings, shared by any number of networks
+	*/
+	MQTTTLSNetwork(MQTTTLSContext& context) : _context(context), _ssl(NULL), _session(NULL), _connected(false), _resumed(false), _kernelSend(false), _kernelReceive(false)
+	{
+	}
+
+	/**
+	* Connect to the specified host and run the TLS handshake.
+	* @param[in] hostname Destination hostname, also used for SNI and to verify the server certificate
+	* @param[in] port Destination port, normally CAYENNE_TLS_PORT
+	* @return 0 if successfully connected, an error code otherwise
+	*/
+	int connect(const char* hostname, int port)
+	{
+		unsigned char address[sizeof(struct in6_addr)];
+		bool literal = inet_pton(AF_INET, hostname, address) == 1 || inet_pton(AF_INET6, hostname, address) == 1;
+		int rc = -1;
+
+		if (!_context.get() || _network.connect(hostname, port) != 0)
+			return -1;
+		if (!(_ssl = SSL_new(_context.get())) || SSL_set_fd(_ssl, _network.getSocket()) != 1)
+			goto exit;
+		SSL_set_app_data(_ssl, this);
+		if (!literal)
+			SSL_set_tlsext_host_name(_ssl, hostname); // SNI doesn't allow addresses
+		if (_context.verifying() &&
+			(literal ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(_ssl), hostname) : SSL_set1_host(_ssl, hostname)) != 1)
+			goto exit;
+		if (_session)
+			SSL_set_session(_ssl, _session);
+
+		if ((rc = handshake()) == 0)
+		{
+			_connected = true;
+			_resumed = SSL_session_reused(_ssl) == 1;
+#if defined(SSL_OP_ENABLE_KTLS)
+			_kernelSend = BIO_get_ktls_send(SSL_get_wbio(_ssl)) == 1;
+			_kernelReceive = BIO_get_ktls_recv(SSL_get_rbio(_ssl)) == 1;
+#else
+			_kernelSend = _kernelReceive = false; // OpenSSL before 3.0 can't report it
+#endif
+		}
+
+	exit:
+		if (rc != 0)
+		{
+			if (_ssl)
+				SSL_free(_ssl);
+			_ssl = NULL;
+			_network.disconnect();
+			ERR_clear_error();
+		}
+		return rc;
+	}
+
+	/**
+	* Read data from the network. This returns as soon as any data is available, so fewer than len bytes may be read.
+	* @param[out] buffer Buffer that receives the data
+	* @param[in] len Buffer length
+	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
+	*/
+	int read(unsigned char* buffer, int len, int timeout_ms)
+	{
+		bool waited = false;
+		if (!_connected)
+			return -1;
+		if (len == 0)
+			return 0;
+		while (true)
+		{
+			int rc = SSL_read(_ssl, buffer, len);
+			if (rc > 0)
+				return rc;
+			if ((rc = retry(rc, waited, timeout_ms)) <= 0)
+				return rc;
+		}
+	}
+
+	/**
+	* Write data to the network.
+	* @param[in] buffer Buffer that contains data to write
+	* @param[in] len Number of bytes to write
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int write(unsigned char* buffer, int len, int timeout_ms)
+	{
+		bool waited = false;
+		if (!_connected)
+			return -1;
+		if (_kernelSend)
+			return _network.write(buffer, len, timeout_ms);
+		while (true)
+		{
+			int rc = SSL_write(_ssl, buffer, len);
+			if (rc > 0)
+				return rc;
+			if ((rc = retry(rc, waited, timeout_ms)) <= 0)
+				return rc;
+		}
+	}
+
+	/**
+	* Write data from several buffers to the network. With kernel TLS the buffers are written with a single system call,
+	* otherwise they are copied into one TLS record, rather than one record for each buffer.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms)
+	{
+		int len = 0;
+		if (!_connected)
+			return -1;
+		if (_kernelSend)
+			return _network.writev(buffers, lengths, count, timeout_ms);
+		if (count == 1 || lengths[0] >= MQTTTLS_GATHER_BUFFER_SIZE)
+			return write(buffers[0], lengths[0], timeout_ms);
+		for (int i = 0; i < count && len < MQTTTLS_GATHER_BUFFER_SIZE; ++i)
+		{
+			int part = lengths[i];
+			if (part > MQTTTLS_GATHER_BUFFER_SIZE - len)
+				part = MQTTTLS_GATHER_BUFFER_SIZE - len; // the rest is sent by the next call
+			memcpy(&_gather[len], buffers[i], part);
+			len += part;
+		}
+		return write(_gather, len, timeout_ms);
+	}
+
+	/**
+	* Close the connection. The session is kept, so the next connect to the same server can resume it.
+	* @return 0 on success, -1 on error
+	*/
+	int disconnect()
+	{
+		if (_ssl)
+		{
+			if (_connected)
+				SSL_shutdown(_ssl); // send close_notify if the socket takes it, don't wait for the reply
+			SSL_free(_ssl);
+			_ssl = NULL;
+			ERR_clear_error();
+		}
+		_connected = false;
+		return _network.disconnect();
+	}
+
+	/**
+	* Get the connection state.
+	* @return true if connected, false if not
+	*/
+	bool connected()
+	{
+		return _connected && _network.connected();
+	}
+
+	/**
+	* Forget the saved session, so the next connect runs a full handshake.
+	*/
+	void clearSession()
+	{
+		if (_session)
+			SSL_SESSION_free(_session);
+		_session = NULL;
+	}
+
+	/**
+	* Check if the last handshake resumed a saved session.
+	* @return true if the session was resumed, false if a full handshake was run
+	*/
+	bool sessionReused()
+	{
+		return _resumed;
+	}
+
+	/**
+	* Check if the kernel encrypts the data sent on this connection.
+	* @return true if sending is offloaded to kernel TLS
+	*/
+	bool kernelSend()
+	{
+		return _kernelSend;
+	}
+
+	/**
+	* Check if the kernel decrypts the data received on this connection.
+	* @return true if receiving is offloaded to kernel TLS
+	*/
+	bool kernelReceive()
+	{
+		return _kernelReceive;
+	}
+
+	/**
+	* Use TCP Fast Open for the following connects, so the ClientHello goes out with the SYN. See MQTTNetwork::setFastOpen.
+	* @param[in] fastOpen true to use TCP Fast Open
+	*/
+	void setFastOpen(bool fastOpen)
+	{
+		_network.setFastOpen(fastOpen);
+	}
+
+	/**
+	* Turn Nagle's algorithm off or on. See MQTTNetwork::setNoDelay.
+	* @param[in] noDelay true to send small writes immediately, false to let the kernel combine them
+	* @return 0 on success, -1 on error
+	*/
+	int setNoDelay(bool noDelay)
+	{
+		return _network.setNoDelay(noDelay);
+	}
+
+	/**
+	* Cork or uncork the connection. See MQTTNetwork::setCork.
+	* @param[in] cork true to cork, false to uncork
+	* @return 0 on success, -1 on error
+	*/
+	int setCork(bool cork)
+	{
+		return _network.setCork(cork);
+	}
+
+	/**
+	* Get the socket, for use with poll, select or epoll.
+	* @return The socket file descriptor, -1 if not connected
+	*/
+	int getSocket()
+	{
+		return _network.getSocket();
+	}
+
+private:
+	friend class MQTTTLSContext;
+
+	/**
+	* Run the TLS handshake on the connected socket.
+	* @return 0 on success, -1 on error or timeout
+	*/
+	int handshake()
+	{
+		MQTTTimer timer(MQTTTLS_HANDSHAKE_TIMEOUT_MS);
+		int rc;
+		while ((rc = SSL_connect(_ssl)) != 1)
+		{
+			int error = SSL_get_error(_ssl, rc);
+			if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) || timer.expired() ||
+				waitReady(error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, timer.left_ms()) <= 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	/**
+	* Check if a failed read or write should be retried, waiting for the socket if the call would have blocked.
+	* TLS can need to read while writing, or write while reading, so the wait depends on what OpenSSL asks for.
+	* @param[in] rc The return code of SSL_read or SSL_write
+	* @param[in,out] waited true if this call has already waited for the socket
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return 1 if the call should be retried, 0 if it would block, or -1 if the connection failed
+	*/
+	int retry(int rc, bool& waited, int timeout_ms)
+	{
+		int error = SSL_get_error(_ssl, rc);
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+		{
+			if (waited)
+				return 0;
+			waited = true;
+			return waitReady(error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, timeout_ms);
+		}
+		if (error == SSL_ERROR_SYSCALL && (errno == EINTR))
+			return 1;
+		_connected = false; // closed by the server, or a protocol or socket error
+		ERR_clear_error();
+		return -1;
+	}
+
+	/**
+	* Wait for the socket to become readable or writable.
+	* @param[in] events The poll events to wait for
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return 1 if the socket is ready, 0 if the timeout expired, -1 if there was an error
+	*/
+	int waitReady(short events, int timeout_ms)
+	{
+		struct pollfd fd = { _network.getSocket(), events, 0 };
+		int rc;
+		while ((rc = ::poll(&fd, 1, (timeout_ms < 0) ? 0 : timeout_ms)) == -1 && errno == EINTR)
+			;
+		return rc;
+	}
+
+	/**
+	* Keep a new session for the next connect. TLS 1.3 servers send tickets after the handshake, so this can be
+	* called while reading.
+	* @param[in] session The session, owned by the network from now on
+	*/
+	void saveSession(SSL_SESSION* session)
+	{
+		clearSession();
+		_session = session;
+	}
+
+	MQTTTLSContext& _context;
+	MQTTNetwork _network;
+	SSL* _ssl;
+	SSL_SESSION* _session;
+	bool _connected;
+	bool _resumed;
+	bool _kernelSend;
+	bool _kernelReceive;
+	unsigned char _gather[MQTTTLS_GATHER_BUFFER_SIZE];
+};
+
+/**
+* Called by OpenSSL when the server issues a new session.
+* @return 1 if the network took ownership of the session, 0 if OpenSSL should free it
+*/
+inline int MQTTTLSContext::newSession(SSL* ssl, SSL_SESSION* session)
+{
+	MQTTTLSNetwork* network = (MQTTTLSNetwork*)SSL_get_app_data(ssl);
+	if (!network || SSL_SESSION_is_resumable(session) != 1)
+		return 0;
+	network->saveSession(session);
+	return 1;
+}
+
+#endif
@@ -80,7 +80,7 @@ public:
 	}
 
 	/**
-	* Get the number of milliseconds left in countdown.
+	* Get the number of milliseconds left in countdown. This is rounded up so it is only 0 once the timer has expired.
 	* @return Number of milliseconds left.
 	*/
 	int left_ms()
@@ -88,7 +88,7 @@ public:
 		struct timeval now, res;
 		gettimeofday(&now, NULL);
 		timersub(&end_time, &now, &res);
-		return (res.tv_sec < 0) ? 0 : res.tv_sec * 1000 + res.tv_usec / 1000;
+		return (res.tv_sec < 0) ? 0 : res.tv_sec * 1000 + (res.tv_usec + 999) / 1000;
 	}
 
 private:
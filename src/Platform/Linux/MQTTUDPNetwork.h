@@ -0,0 +1,216 @@
+/**
+* @file MQTTUDPNetwork.h
+*
+* UDP network class for use with MQTTSNClient, for MQTT-SN gateways.
+*/
+
+#if !defined(__MQTT_UDP_NETWORK_h)
+#define __MQTT_UDP_NETWORK_h
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+* Networking class that talks to an MQTT-SN gateway over a connected UDP socket. Each write sends one datagram and
+* each read returns one datagram, so every MQTT-SN packet is read and written whole. Datagrams from any address other
+* than the gateway are dropped by the kernel.
+*/
+class MQTTUDPNetwork
+{
+public:
+	/**
+	* Default constructor.
+	*/
+	MQTTUDPNetwork() : _socket(-1), _connected(false)
+	{
+	}
+
+	/**
+	* Set the gateway address. No packets are exchanged, so this succeeds whether or not a gateway is listening.
+	* @param[in] hostname Gateway hostname
+	* @param[in] port Gateway port
+	* @return 0 on success, -1 or a getaddrinfo error code otherwise
+	*/
+	int connect(const char* hostname, int port)
+	{
+		struct addrinfo *result = NULL;
+		struct addrinfo hints = { 0, AF_UNSPEC, SOCK_DGRAM, IPPROTO_UDP, 0, NULL, NULL, NULL };
+		char service[8];
+		int rc;
+
+		snprintf(service, sizeof(service), "%d", port);
+		if ((rc = getaddrinfo(hostname, service, &hints, &result)) != 0)
+			return rc;
+		rc = -1;
+		for (struct addrinfo* res = result; res && rc != 0; res = res->ai_next)
+		{
+			int s = ::socket(res->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (s == -1)
+				continue;
+			if (::connect(s, res->ai_addr, res->ai_addrlen) == 0)
+			{
+				_socket = s;
+				_connected = true;
+				rc = 0;
+			}
+			else
+				close(s);
+		}
+		freeaddrinfo(result);
+		return rc;
+	}
+
+	/**
+	* Read a datagram from the network.
+	* @param[out] buffer Buffer that receives the datagram
+	* @param[in] len Buffer length, the rest of a longer datagram is discarded
+	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
+	* @return Number of bytes read, 0 if the timeout expired before a datagram arrived, or a negative value if there was an error
+	*/
+	int read(unsigned char* buffer, int len, int timeout_ms)
+	{
+		bool waited = false;
+		while (_connected)
+		{
+			int rc = ::recv(_socket, buffer, (size_t)len, 0);
+			if (rc >= 0)
+				return rc;
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && !waited)
+			{
+				waited = true;
+				int ready = waitReady(POLLIN, timeout_ms);
+				if (ready > 0)
+					continue;
+				return ready;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1; // ECONNREFUSED when nothing is listening at the gateway address
+		}
+		return -1;
+	}
+
+	/**
+	* Write a datagram to the network.
+	* @param[in] buffer Buffer that contains the datagram
+	* @param[in] len Number of bytes to write
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int write(unsigned char* buffer, int len, int timeout_ms)
+	{
+		int rc;
+		bool waited = false;
+		while ((rc = ::send(_socket, buffer, len, 0)) == -1 && retryWrite(waited, timeout_ms))
+			;
+		return rc;
+	}
+
+	/**
+	* Write a datagram gathered from several buffers.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms)
+	{
+		struct iovec vec[MAX_WRITE_BUFFERS];
+		if (count > MAX_WRITE_BUFFERS)
+			return -1; // a datagram can't be split over several calls
+		for (int i = 0; i < count; ++i)
+		{
+			vec[i].iov_base = buffers[i];
+			vec[i].iov_len = lengths[i];
+		}
+
+		int rc;
+		bool waited = false;
+		while ((rc = ::writev(_socket, vec, count)) == -1 && retryWrite(waited, timeout_ms))
+			;
+		return rc;
+	}
+
+	/**
+	* Close the socket.
+	* @return 0 on success, -1 on error
+	*/
+	int disconnect()
+	{
+		int result = close(_socket);
+		_socket = -1;
+		_connected = false;
+		return result;
+	}
+
+	/**
+	* Get the connection state.
+	* @return true if the gateway address is set, false if not
+	*/
+	bool connected()
+	{
+		return _connected;
+	}
+
+	/**
+	* Get the socket, for use with poll, select or epoll.
+	* @return The socket file descriptor, -1 if not connected
+	*/
+	int getSocket()
+	{
+		return _socket;
+	}
+
+private:
+	static const int MAX_WRITE_BUFFERS = 8;
+
+	/**
+	* Wait for the socket to become readable or writable.
+	* @param[in] events The poll events to wait for
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return 1 if the socket is ready, 0 if the timeout expired, -1 if there was an error
+	*/
+	int waitReady(short events, int timeout_ms)
+	{
+		struct pollfd fd = { _socket, events, 0 };
+		int rc;
+		while ((rc = ::poll(&fd, 1, (timeout_ms < 0) ? 0 : timeout_ms)) == -1 && errno == EINTR)
+			;
+		return rc;
+	}
+
+	/**
+	* Check if a failed write should be retried, waiting for the socket to become writable if the write would have blocked.
+	* @param[in,out] waited true if this write has already waited for the socket
+	* @param[in] timeout_ms Maximum time to wait, in milliseconds
+	* @return true if the write should be retried, false otherwise
+	*/
+	bool retryWrite(bool& waited, int timeout_ms)
+	{
+		if (errno == EINTR)
+			return true;
+		if ((errno == EAGAIN || errno == EWOULDBLOCK) && !waited)
+		{
+			waited = true;
+			return waitReady(POLLOUT, timeout_ms) > 0;
+		}
+		return false;
+	}
+
+	int _socket;
+	bool _connected;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/**
+* @file MQTTUnixNetwork.h
+*
+* Unix domain socket network class for use with MQTTClient, for brokers and bridges running on the same machine.
+*/
+
+#if !defined(__MQTT_UNIX_NETWORK_h)
+#define __MQTT_UNIX_NETWORK_h
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/un.h>
+#include "MQTTNetwork.h"
+
+/**
+* Networking class that connects to a local broker over an AF_UNIX stream socket. This skips the TCP/IP stack,
+* so there is no checksumming, segmentation or loopback routing on each message. Reads and writes are the same as MQTTNetwork.
+*/
+class MQTTUnixNetwork : public MQTTNetwork
+{
+public:
+	/**
+	* Connect to a broker listening on a Unix domain socket.
+	* @param[in] path Path of the socket. A path starting with '@' is in the abstract namespace, which needs no file.
+	* @return 0 if successfully connected, -1 otherwise
+	*/
+	int connect(const char* path)
+	{
+		struct sockaddr_un address;
+		size_t length = strlen(path);
+		if (length == 0 || length >= sizeof(address.sun_path))
+			return -1;
+
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, path, length);
+		if (path[0] == '@')
+			address.sun_path[0] = '\0';
+
+		int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (s == -1)
+			return -1;
+		if (::connect(s, (struct sockaddr*)&address, offsetof(struct sockaddr_un, sun_path) + length) != 0 || attach(s) != 0)
+		{
+			close(s);
+			return -1;
+		}
+		return 0;
+	}
+
+	/**
+	* Nagle's algorithm doesn't apply to Unix domain sockets, so this does nothing.
+	* @return 0
+	*/
+	int setNoDelay(bool noDelay)
+	{
+		return 0;
+	}
+
+	/**
+	* Corking doesn't apply to Unix domain sockets, so this does nothing.
+	* @return 0
+	*/
+	int setCork(bool cork)
+	{
+		return 0;
+	}
+};
+
+#endif
@@ -0,0 +1,848 @@
+/**
+* @file MQTTUringNetwork.h
+*
+* io_uring based networking for use with MQTTClient. Many connections share one ring, so a gateway can submit
+* the sends and collect the receives of all its connections with a single io_uring_enter call per loop.
+*
+* The io_uring code is only compiled if MQTTNETWORK_URING is set to 1. Otherwise, or if the kernel doesn't support
+* io_uring, the connections fall back to the plain socket calls of MQTTNetwork.
+*/
+
+#if !defined(__MQTT_URING_NETWORK_h)
+#define __MQTT_URING_NETWORK_h
+
+#include "MQTTNetwork.h"
+#include "MQTTTimer.h"
+
+#if !defined(MQTTNETWORK_URING)
+	#define MQTTNETWORK_URING 0
+#endif
+
+#if MQTTNETWORK_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(MQTTURING_ENTRIES)
+	#define MQTTURING_ENTRIES 256 // submission queue entries
+#endif
+#if !defined(MQTTURING_MAX_CONNECTIONS)
+	#define MQTTURING_MAX_CONNECTIONS 64 // connections that can share a ring
+#endif
+#if !defined(MQTTURING_SEND_BUFFER_SIZE)
+	#define MQTTURING_SEND_BUFFER_SIZE 4096 // registered send buffer per connection
+#endif
+#if !defined(MQTTURING_RECV_BUFFERS)
+	#define MQTTURING_RECV_BUFFERS 256 // provided receive buffers shared by all connections, must be a power of 2
+#endif
+#if !defined(MQTTURING_RECV_BUFFER_SIZE)
+	#define MQTTURING_RECV_BUFFER_SIZE 2048
+#endif
+
+class MQTTUringNetwork;
+
+/**
+* An io_uring instance shared by a set of MQTTUringNetwork connections.
+*
+* Each connection keeps one multishot receive armed, which fills buffers from a ring of provided buffers,
+* and one send in flight from its registered send buffer. Writes are copied into the send buffer and sent
+* when the ring is next submitted, apart from unbatched writes on a connection with nothing waiting to be sent,
+* which go straight to the socket.
+*
+* The ring reads the sockets itself, so the connections can't be driven by MQTTReactor, which waits for the
+* sockets with epoll. Using them with it fails to compile.
+*/
+class MQTTUring
+{
+public:
+	/**
+	* Default constructor. The ring is not usable until init has been called.
+	*/
+	MQTTUring() : _fd(-1), _batching(false), _sqRing(MAP_FAILED), _cqRing(MAP_FAILED), _sqes((struct io_uring_sqe*)MAP_FAILED),
+		_bufRing((struct io_uring_buf_ring*)MAP_FAILED)
+	{
+	}
+
+	/**
+	* Set up the ring.
+	* @return 0 on success, -1 if io_uring is not available, in which case connections use plain socket calls
+	*/
+	int init()
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		if ((_fd = syscall(__NR_io_uring_setup, MQTTURING_ENTRIES, &params)) == -1)
+			return -1;
+
+		size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if ((params.features & IORING_FEAT_SINGLE_MMAP) && cqSize > sqSize)
+			sqSize = cqSize;
+		_sqRingSize = sqSize;
+		_sqRing = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+		if (_sqRing == MAP_FAILED)
+			return fail();
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			_cqRingSize = cqSize;
+			if ((_cqRing = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+				return fail();
+		}
+		_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		_sqes = (struct io_uring_sqe*)mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+		if (_sqes == MAP_FAILED)
+			return fail();
+		unsigned char* sq = (unsigned char*)_sqRing;
+		unsigned char* cq = (_cqRing != MAP_FAILED) ? (unsigned char*)_cqRing : sq;
+
+		_sqHead = (unsigned*)(sq + params.sq_off.head);
+		_sqTail = (unsigned*)(sq + params.sq_off.tail);
+		_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		_sqEntries = params.sq_entries;
+		_sqArray = (unsigned*)(sq + params.sq_off.array);
+		_cqHead = (unsigned*)(cq + params.cq_off.head);
+		_cqTail = (unsigned*)(cq + params.cq_off.tail);
+		_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+		_sqLocalTail = *_sqTail;
+		_sqSubmitted = _sqLocalTail;
+
+		// The send buffers are registered so the kernel doesn't have to map them for every send.
+		struct iovec sendBuffers = { _sendBuffers, sizeof(_sendBuffers) };
+		_fixedBuffers = syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, &sendBuffers, 1) == 0;
+
+		// The receive buffers are provided to the kernel, which picks one for each multishot receive completion.
+		_bufRing = (struct io_uring_buf_ring*)mmap(NULL, MQTTURING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (_bufRing == MAP_FAILED)
+			return fail();
+		_bufs = (struct io_uring_buf*)_bufRing; // not _bufRing->bufs, the flexible array is misplaced when the header is compiled as C++
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (unsigned long)_bufRing;
+		reg.ring_entries = MQTTURING_RECV_BUFFERS;
+		reg.bgid = BUFFER_GROUP;
+		if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+			return fail(); // multishot receive needs a kernel with provided buffer rings
+		_bufTail = 0;
+		for (int i = 0; i < MQTTURING_RECV_BUFFERS; ++i)
+			provideBuffer(i);
+		__atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+		_starved = 0;
+
+		for (int i = 0; i < MQTTURING_MAX_CONNECTIONS; ++i)
+		{
+			_connections[i] = NULL;
+			_generations[i] = 0;
+		}
+		_dirtyCount = 0;
+		return 0;
+	}
+
+	/**
+	* Check if the ring was set up.
+	* @return true if io_uring is in use, false if connections use plain socket calls
+	*/
+	bool available()
+	{
+		return _fd != -1;
+	}
+
+	/**
+	* Set whether writes are sent straight away, or held until the next call to run. Batching lets a gateway
+	* send the data of all its connections with one system call, but then it must call run regularly.
+	* @param[in] batching true to hold writes until run is called
+	*/
+	void setBatching(bool batching)
+	{
+		_batching = batching;
+	}
+
+	/**
+	* Submit the queued sends and receives, and handle the completions.
+	* @param[in] timeout_ms Maximum time to wait for a completion, in milliseconds, 0 to return straight away
+	* @return The number of completions handled, or -1 if there was an error
+	*/
+	int run(int timeout_ms);
+
+private:
+	friend class MQTTUringNetwork;
+
+	enum { BUFFER_GROUP = 0, OP_RECV = 1, OP_SEND = 2, OP_CANCEL = 3 };
+
+	/**
+	* Undo a failed init, so the connections use plain socket calls.
+	*/
+	int fail()
+	{
+		if (_bufRing != MAP_FAILED)
+			munmap(_bufRing, MQTTURING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+		if (_sqes != MAP_FAILED)
+			munmap(_sqes, _sqesSize);
+		if (_cqRing != MAP_FAILED)
+			munmap(_cqRing, _cqRingSize);
+		if (_sqRing != MAP_FAILED)
+			munmap(_sqRing, _sqRingSize);
+		_bufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+		_sqes = (struct io_uring_sqe*)MAP_FAILED;
+		_sqRing = _cqRing = MAP_FAILED;
+		close(_fd);
+		_fd = -1;
+		return -1;
+	}
+
+	void provideBuffer(unsigned short bid)
+	{
+		struct io_uring_buf* buf = &_bufs[_bufTail & (MQTTURING_RECV_BUFFERS - 1)];
+		buf->addr = (unsigned long)_recvBuffers[bid];
+		buf->len = MQTTURING_RECV_BUFFER_SIZE;
+		buf->bid = bid;
+		_bufTail++;
+	}
+
+	void recycle(unsigned short bid);
+
+	struct io_uring_sqe* getSqe()
+	{
+		if (_sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) == _sqEntries && enter(0, 0) < 0)
+			return NULL;
+		if (_sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) == _sqEntries)
+			return NULL;
+		unsigned index = _sqLocalTail & _sqMask;
+		struct io_uring_sqe* sqe = &_sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		_sqArray[index] = index;
+		_sqLocalTail++;
+		return sqe;
+	}
+
+	static unsigned long long userData(int slot, unsigned generation, int op)
+	{
+		return ((unsigned long long)generation << 32) | (slot << 8) | op;
+	}
+
+	int addConnection(MQTTUringNetwork* connection)
+	{
+		for (int i = 0; i < MQTTURING_MAX_CONNECTIONS; ++i)
+		{
+			if (_connections[i] == NULL)
+			{
+				_connections[i] = connection;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	void removeConnection(int slot);
+	void markDirty(int slot);
+	int flush();
+	int enter(int timeout_ms, unsigned minComplete);
+	int reap();
+	void handleCompletion(struct io_uring_cqe* cqe);
+
+	int _fd;
+	bool _batching;
+	bool _fixedBuffers;
+	void* _sqRing;
+	size_t _sqRingSize;
+	void* _cqRing;          // MAP_FAILED when the completion queue shares the mapping of the submission queue
+	size_t _cqRingSize;
+	unsigned* _sqHead;
+	unsigned* _sqTail;
+	unsigned _sqMask;
+	unsigned _sqEntries;
+	unsigned* _sqArray;
+	unsigned _sqLocalTail;
+	unsigned _sqSubmitted;
+	struct io_uring_sqe* _sqes;
+	size_t _sqesSize;
+	unsigned* _cqHead;
+	unsigned* _cqTail;
+	unsigned _cqMask;
+	struct io_uring_cqe* _cqes;
+	struct io_uring_buf_ring* _bufRing;
+	struct io_uring_buf* _bufs;
+	unsigned short _bufTail;
+	int _starved;           // connections whose receive stopped because the buffers ran out
+	unsigned char _recvBuffers[MQTTURING_RECV_BUFFERS][MQTTURING_RECV_BUFFER_SIZE];
+	short _recvNext[MQTTURING_RECV_BUFFERS];
+	unsigned short _recvLen[MQTTURING_RECV_BUFFERS];
+	unsigned char _sendBuffers[MQTTURING_MAX_CONNECTIONS][MQTTURING_SEND_BUFFER_SIZE];
+	MQTTUringNetwork* _connections[MQTTURING_MAX_CONNECTIONS];
+	unsigned _generations[MQTTURING_MAX_CONNECTIONS];
+	int _dirty[MQTTURING_MAX_CONNECTIONS];
+	int _dirtyCount;
+};
+
+
+/**
+* Networking class for use with MQTTClient that sends and receives through a shared MQTTUring.
+*/
+class MQTTUringNetwork
+{
+public:
+	/**
+	* Constructor.
+	* @param[in] ring The ring used by this connection. If it is not available the connection uses plain socket calls.
+	*/
+	MQTTUringNetwork(MQTTUring& ring) : _ring(ring), _slot(-1), _connected(false)
+	{
+	}
+
+	/**
+	* Connect to the specified host.
+	* @param[in] hostname Destination hostname
+	* @param[in] port Destination port
+	* @return 0 if successfully connected, an error code otherwise
+	*/
+	int connect(const char* hostname, int port)
+	{
+		int rc = _network.connect(hostname, port);
+		if (rc == 0 && _ring.available() && (_slot = _ring.addConnection(this)) != -1)
+		{
+			// The ring waits for the socket itself, so it is switched back to blocking mode.
+			int socket = _network.getSocket();
+			fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) & ~O_NONBLOCK);
+			_connected = true;
+			_recvArmed = _recvStarved = false;
+			_recvHead = _recvTail = -1;
+			_recvOffset = 0;
+			_sendLen = _sendInflight = 0;
+			_pending = 0;
+			_ring.markDirty(_slot); // arm the receive
+		}
+		return rc;
+	}
+
+	/**
+	* Read data from the network. This returns as soon as any data is available, so fewer than len bytes may be read.
+	* @param[out] buffer Buffer that receives the data
+	* @param[in] len Buffer length
+	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
+	*/
+	int read(unsigned char* buffer, int len, int timeout_ms)
+	{
+		if (_slot == -1)
+			return _network.read(buffer, len, timeout_ms);
+
+		MQTTTimer timer(timeout_ms);
+		do
+		{
+			if (_recvHead != -1)
+				return copyReceived(buffer, len);
+			if (!_connected || _ring.run(timer.left_ms()) < 0)
+				return -1;
+		} while (!timer.expired());
+		return (_recvHead != -1) ? copyReceived(buffer, len) : 0;
+	}
+
+	/**
+	* Write data to the network. The data is copied to the send buffer and sent when the ring is submitted. When
+	* writes are not batched and nothing is waiting to be sent, it is sent straight away with a plain system call,
+	* and only what the socket doesn't take goes through the send buffer.
+	* @param[in] buffer Buffer that contains data to write
+	* @param[in] len Number of bytes to write
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int write(unsigned char* buffer, int len, int timeout_ms)
+	{
+		if (_slot == -1)
+			return _network.write(buffer, len, timeout_ms);
+
+		MQTTTimer timer(timeout_ms);
+		int written = 0;
+		if (!_ring._batching && _connected && _sendLen == 0 && (written = sendDirect(&buffer, &len, 1)) == len)
+			return len;
+		if (written < 0)
+			return -1;
+		while (_connected)
+		{
+			int space = MQTTURING_SEND_BUFFER_SIZE - _sendLen;
+			if (space > len - written)
+				space = len - written;
+			memcpy(_ring._sendBuffers[_slot] + _sendLen, buffer + written, space);
+			_sendLen += space;
+			written += space;
+			if (space > 0)
+				_ring.markDirty(_slot);
+			if (written == len || timer.expired())
+				break;
+			if (_ring.run(timer.left_ms()) < 0) // wait for the send buffer to drain
+				return -1;
+		}
+		if (!_connected)
+			return -1;
+		if (!_ring._batching && _ring.run(0) < 0)
+			return -1;
+		return written;
+	}
+
+	/**
+	* Write data from several buffers to the network.
+	* @param[in] buffers Array of buffers that contain data to write
+	* @param[in] lengths Array of the number of bytes to write from each buffer
+	* @param[in] count Number of buffers
+	* @param[in] timeout_ms Timeout for the write operation, in milliseconds
+	* @return Number of bytes written, or a negative value if there was an error
+	*/
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms)
+	{
+		if (_slot == -1)
+			return _network.writev(buffers, lengths, count, timeout_ms);
+
+		bool batching = _ring._batching;
+		int written = 0,
+			sent = 0;
+		if (!batching && _connected && _sendLen == 0 && count <= MAX_DIRECT_BUFFERS && (sent = sendDirect(buffers, lengths, count)) < 0)
+			return -1;
+		_ring._batching = true; // submit once for the whole packet
+		for (int i = 0; i < count; ++i)
+		{
+			if (sent >= lengths[i])
+			{
+				sent -= lengths[i]; // sent straight away
+				written += lengths[i];
+				continue;
+			}
+			int rc = write(buffers[i] + sent, lengths[i] - sent, timeout_ms);
+			if (rc < 0)
+				written = rc;
+			if (rc != lengths[i] - sent)
+				break;
+			written += rc + sent;
+			sent = 0;
+		}
+		_ring._batching = batching;
+		if (written >= 0 && !batching && _sendLen > 0 && _ring.run(0) < 0)
+			return -1;
+		return written;
+	}
+
+	/**
+	* Close the connection.
+	* @return 0 on success, -1 on error
+	*/
+	int disconnect()
+	{
+		if (_slot != -1)
+		{
+			// Let anything that is still queued, such as a disconnect packet, go out before the operations are cancelled.
+			MQTTTimer timer(1000);
+			while (_connected && _sendLen > 0 && !timer.expired() && _ring.run(timer.left_ms()) >= 0)
+				;
+			_ring.removeConnection(_slot);
+			_slot = -1;
+		}
+		_connected = false;
+		return _network.disconnect();
+	}
+
+	/**
+	* Get the connection state.
+	* @return true if connected, false if not
+	*/
+	bool connected()
+	{
+		return (_slot == -1) ? _network.connected() : _connected;
+	}
+
+	/**
+	* Get the socket.
+	* @return The socket file descriptor, -1 if not connected
+	*/
+	int getSocket()
+	{
+		return _network.getSocket();
+	}
+
+private:
+	friend class MQTTUring;
+
+	static const int MAX_DIRECT_BUFFERS = 8;
+
+	/**
+	* Send from the caller's buffers with a plain system call, which saves copying them and a submit for a lone
+	* write. The socket is in blocking mode for the ring, so the send is told not to wait.
+	* @return Number of bytes sent, or -1 if the connection failed
+	*/
+	int sendDirect(unsigned char** buffers, int* lengths, int count)
+	{
+		struct iovec vec[MAX_DIRECT_BUFFERS];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		for (int i = 0; i < count; ++i)
+		{
+			vec[i].iov_base = buffers[i];
+			vec[i].iov_len = lengths[i];
+		}
+		msg.msg_iov = vec;
+		msg.msg_iovlen = count;
+
+		int rc;
+		while ((rc = sendmsg(getSocket(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1 && errno == EINTR)
+			;
+		if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0; // the rest goes through the send buffer
+		if (rc == -1)
+			_connected = false;
+		return rc;
+	}
+
+	/**
+	* Copy received data out of the provided buffers, giving them back to the kernel once they are empty.
+	*/
+	int copyReceived(unsigned char* buffer, int len)
+	{
+		int bytes = 0;
+		while (_recvHead != -1 && bytes < len)
+		{
+			int count = _ring._recvLen[_recvHead] - _recvOffset;
+			if (count > len - bytes)
+				count = len - bytes;
+			memcpy(buffer + bytes, _ring._recvBuffers[_recvHead] + _recvOffset, count);
+			bytes += count;
+			_recvOffset += count;
+			if (_recvOffset == _ring._recvLen[_recvHead])
+			{
+				short bid = _recvHead;
+				_recvHead = _ring._recvNext[bid];
+				if (_recvHead == -1)
+					_recvTail = -1;
+				_recvOffset = 0;
+				_ring.recycle(bid);
+			}
+		}
+		return bytes;
+	}
+
+	MQTTNetwork _network;
+	MQTTUring& _ring;
+	int _slot;
+	bool _connected;
+	bool _recvArmed;    // a multishot receive is in flight
+	bool _recvStarved;  // the receive stopped because there were no free buffers
+	short _recvHead;    // received buffers waiting to be read, linked through MQTTUring::_recvNext
+	short _recvTail;
+	int _recvOffset;    // bytes already read from the head buffer
+	int _sendLen;       // bytes in the send buffer
+	int _sendInflight;  // bytes at the start of the send buffer that have been submitted
+	int _pending;       // operations in flight
+};
+
+
+template<class Network> struct MQTTReactorNetwork;
+
+/**
+* The ring takes the data as it arrives, so epoll never sees the socket readable.
+*/
+template<>
+struct MQTTReactorNetwork<MQTTUringNetwork>
+{
+	enum { supported = 0 };
+};
+
+
+/**
+* Give a receive buffer back to the kernel once its data has been read.
+*/
+inline void MQTTUring::recycle(unsigned short bid)
+{
+	provideBuffer(bid);
+	__atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+	for (int i = 0; _starved > 0 && i < MQTTURING_MAX_CONNECTIONS; ++i)
+	{
+		if (_connections[i] && _connections[i]->_recvStarved)
+		{
+			_connections[i]->_recvStarved = false;
+			_starved--;
+			markDirty(i);
+		}
+	}
+}
+
+
+inline void MQTTUring::markDirty(int slot)
+{
+	for (int i = 0; i < _dirtyCount; ++i)
+	{
+		if (_dirty[i] == slot)
+			return;
+	}
+	_dirty[_dirtyCount++] = slot;
+}
+
+
+/**
+* Queue the receives and sends of the connections that have changed since the last submit.
+*/
+inline int MQTTUring::flush()
+{
+	int count = _dirtyCount;
+	_dirtyCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		int slot = _dirty[i];
+		MQTTUringNetwork* connection = _connections[slot];
+		struct io_uring_sqe* sqe;
+		if (!connection || !connection->_connected)
+			continue;
+		if (!connection->_recvArmed && !connection->_recvStarved)
+		{
+			if ((sqe = getSqe()) == NULL)
+				goto retry;
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = connection->getSocket();
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = BUFFER_GROUP;
+			sqe->user_data = userData(slot, _generations[slot], OP_RECV);
+			connection->_recvArmed = true;
+			connection->_pending++;
+		}
+		if (connection->_sendInflight == 0 && connection->_sendLen > 0)
+		{
+			if ((sqe = getSqe()) == NULL)
+				goto retry;
+			sqe->opcode = _fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+			sqe->fd = connection->getSocket();
+			sqe->addr = (unsigned long)_sendBuffers[slot];
+			sqe->len = connection->_sendLen;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL; // unused by write_fixed
+			if (_fixedBuffers)
+			{
+				sqe->off = 0;
+				sqe->msg_flags = 0;
+				sqe->buf_index = 0;
+			}
+			sqe->user_data = userData(slot, _generations[slot], OP_SEND);
+			connection->_sendInflight = connection->_sendLen;
+			connection->_pending++;
+		}
+		continue;
+retry:
+		for (; i < count; ++i) // the submission queue is full, try these again on the next submit
+			markDirty(_dirty[i]);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+* Submit the queued entries and optionally wait for completions.
+*/
+inline int MQTTUring::enter(int timeout_ms, unsigned minComplete)
+{
+	__atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+	unsigned toSubmit = _sqLocalTail - _sqSubmitted;
+	if (toSubmit == 0 && minComplete == 0)
+		return 0; // completions can be read from the shared ring without a system call
+
+	if (timeout_ms < 0)
+		timeout_ms = 0;
+	struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL };
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (unsigned long)&ts;
+	unsigned flags = minComplete ? (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG) : 0;
+	int rc;
+	while ((rc = syscall(__NR_io_uring_enter, _fd, toSubmit, minComplete, flags, minComplete ? &arg : NULL, sizeof(arg))) == -1 && errno == EINTR)
+		;
+	if (rc >= 0)
+		_sqSubmitted += rc;
+	else if (errno == ETIME || errno == EBUSY || errno == EAGAIN)
+		rc = 0; // timed out, or the completion queue needs to be emptied first
+	return rc;
+}
+
+
+inline int MQTTUring::run(int timeout_ms)
+{
+	if (_fd == -1)
+		return -1;
+	flush();
+	int handled = reap();
+	if (handled == 0 && timeout_ms > 0)
+	{
+		// Submit and wait in the same system call.
+		if (enter(timeout_ms, 1) < 0)
+			return -1;
+		handled = reap();
+	}
+	if (enter(0, 0) < 0) // submit anything queued so far, this doesn't make a system call if there is nothing
+		return -1;
+	return handled;
+}
+
+
+/**
+* Handle the completions that are in the completion queue.
+*/
+inline int MQTTUring::reap()
+{
+	int handled = 0;
+	unsigned head = *_cqHead;
+	unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head, ++handled)
+		handleCompletion(&_cqes[head & _cqMask]);
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+	if (_dirtyCount > 0)
+		flush(); // completions re-arm receives and queue the rest of partial sends
+	return handled;
+}
+
+
+inline void MQTTUring::handleCompletion(struct io_uring_cqe* cqe)
+{
+	int slot = (cqe->user_data >> 8) & 0xFFFFFF;
+	int op = cqe->user_data & 0xFF;
+	MQTTUringNetwork* connection = _connections[slot];
+	bool current = connection && (unsigned)(cqe->user_data >> 32) == _generations[slot];
+
+	if (op == OP_RECV)
+	{
+		if (cqe->flags & IORING_CQE_F_BUFFER)
+		{
+			unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			if (!current || cqe->res <= 0)
+				recycle(bid);
+			else
+			{
+				// Queue the buffer on the connection until it is read.
+				_recvLen[bid] = cqe->res;
+				_recvNext[bid] = -1;
+				if (connection->_recvTail == -1)
+					connection->_recvHead = bid;
+				else
+					_recvNext[connection->_recvTail] = bid;
+				connection->_recvTail = bid;
+			}
+		}
+		if (!current)
+			return;
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+		{
+			connection->_recvArmed = false;
+			connection->_pending--;
+			if (cqe->res == -ENOBUFS)
+			{
+				connection->_recvStarved = true; // rearmed once buffers are given back
+				_starved++;
+			}
+		}
+		if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED))
+			connection->_connected = false; // closed by the other end, or failed
+	}
+	else if (op == OP_SEND && current)
+	{
+		connection->_pending--;
+		if (cqe->res < 0)
+		{
+			connection->_connected = false;
+			return;
+		}
+		// Drop the data that was sent, anything that wasn't is sent by the next submit.
+		connection->_sendLen -= cqe->res;
+		memmove(_sendBuffers[slot], _sendBuffers[slot] + cqe->res, connection->_sendLen);
+		connection->_sendInflight = 0;
+		if (connection->_sendLen > 0)
+			markDirty(slot);
+	}
+	else if (op == OP_CANCEL && current)
+		connection->_pending--;
+}
+
+
+/**
+* Cancel the operations of a connection and wait for them to complete, so its slot and buffers can be reused.
+*/
+inline void MQTTUring::removeConnection(int slot)
+{
+	MQTTUringNetwork* connection = _connections[slot];
+	struct io_uring_sqe* sqe = getSqe();
+	if (sqe)
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = connection->getSocket();
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = userData(slot, _generations[slot], OP_CANCEL);
+		connection->_pending++;
+	}
+	connection->_connected = false;
+	MQTTTimer timer(1000);
+	while (connection->_pending > 0 && !timer.expired())
+	{
+		if (run(timer.left_ms()) < 0)
+			break;
+	}
+
+	while (connection->_recvHead != -1)
+	{
+		short bid = connection->_recvHead;
+		connection->_recvHead = _recvNext[bid];
+		recycle(bid);
+	}
+	connection->_recvTail = -1;
+	if (connection->_recvStarved)
+		_starved--;
+	for (int i = 0; i < _dirtyCount; ++i)
+	{
+		if (_dirty[i] == slot)
+		{
+			_dirty[i] = _dirty[--_dirtyCount];
+			break;
+		}
+	}
+	_generations[slot]++;
+	_connections[slot] = NULL;
+}
+
+#else
+
+/**
+* Stand-in for the io_uring ring when MQTTNETWORK_URING is not set. It is never available.
+*/
+class MQTTUring
+{
+public:
+	int init()
+	{
+		return -1;
+	}
+
+	bool available()
+	{
+		return false;
+	}
+
+	void setBatching(bool batching)
+	{
+	}
+
+	int run(int timeout_ms)
+	{
+		return -1;
+	}
+};
+
+/**
+* Without MQTTNETWORK_URING the connections use plain socket calls.
+*/
+class MQTTUringNetwork : public MQTTNetwork
+{
+public:
+	MQTTUringNetwork(MQTTUring& ring)
+	{
+	}
+};
+
+#endif
+
+#endif
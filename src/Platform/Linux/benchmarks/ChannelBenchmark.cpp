@@ -0,0 +1,348 @@
+/**
+* @file ChannelBenchmark.cpp
+*
+* Compares publishing Cayenne data by topic, type and unit, which builds the topic and payload for every publish, with
+* publishing to channels initialized once with initChannel and to a StaticChannel built by the compiler, and publishing
+* several values from a DataArray with publishing them from a TypedDataArray. The client writes to an in-memory network,
+* so the run times the client alone, and each packet from a channel or a TypedDataArray is checked against the packet
+* built the usual way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "MQTTLinux.h"
+#include "CayenneMQTTClient.h"
+
+#define MAX_CHANNELS 256
+
+// Cayenne usernames and client IDs are UUIDs, so the topics are as long as real ones.
+#define USERNAME "8b5b1a70-2a2e-11e7-9aa2-5b3e7ed4a3b5"
+#define CLIENT_ID "d2f6a9b0-2a2e-11e7-bd1e-25d7c1f6a1a0"
+char username[] = USERNAME;
+char password[] = "MQTT_PASSWORD";
+char clientID[] = CLIENT_ID;
+
+CAYENNE_STATIC_STRING(StaticUsername, USERNAME);
+CAYENNE_STATIC_STRING(StaticClientID, CLIENT_ID);
+typedef CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, DATA_TOPIC, 3, TEMPERATURE_TYPE, CELSIUS_UNIT> StaticTemperature;
+typedef CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, SYS_MODEL_TOPIC> StaticModel;
+
+/**
+* A network that answers the connect and keeps the last packet written, rather than sending anything.
+*/
+class MemoryNetwork
+{
+public:
+	MemoryNetwork() : connack(0), length(0) {
+	}
+
+	int read(unsigned char* buffer, int len, int timeout_ms) {
+		// CONNACK, with an empty property list for MQTT 5
+		static const unsigned char ack[] = { 0x20, 0x02, 0x00, 0x00 };
+		static const unsigned char ack5[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+		const unsigned char* reply = (connack == 5) ? ack5 : ack;
+		int replyLength = (connack == 5) ? sizeof(ack5) : sizeof(ack);
+		if (connack == 0 || len < replyLength)
+			return 0;
+		memcpy(buffer, reply, replyLength);
+		connack = 0;
+		return replyLength;
+	}
+
+	int write(unsigned char* buffer, int len, int timeout_ms) {
+		return writev(&buffer, &len, 1, timeout_ms);
+	}
+
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms) {
+		int written = 0;
+		for (int i = 0; i < count; ++i) {
+			if (written + lengths[i] <= (int)sizeof(packet))
+				memcpy(&packet[written], buffers[i], lengths[i]);
+			written += lengths[i];
+		}
+		length = written;
+		return written;
+	}
+
+	int connack;                 // the MQTT version to answer the next read with a CONNACK for, 0 for none
+	unsigned char packet[512];   // the last packet written
+	int length;
+};
+
+MemoryNetwork network;
+CayenneMQTT::MQTTClient<MemoryNetwork, MQTTTimer> mqttClient(network, username, password, clientID);
+CayenneMQTT::Channel channels[MAX_CHANNELS];
+
+struct opts_struct
+{
+	int messages;
+	int channels;
+	int version;
+} opts =
+{
+	1000000, 16, 4
+};
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("Cayenne Channel Benchmark\n");
+	printf("Usage: channelbench <options>, where options are:\n");
+	printf("  --messages <count of publishes to time each way> (default is 1000000)\n");
+	printf("  --channels <count of channels published to> (default is 16, max is %d)\n", MAX_CHANNELS);
+	printf("  --version <MQTT version, 4 or 5> (default is 4)\n");
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--channels") == 0)
+			opts.channels = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--version") == 0)
+			opts.version = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.messages < 1 || opts.channels < 1 || opts.channels > MAX_CHANNELS || (opts.version != 4 && opts.version != 5))
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Get the value published by a message.
+* @param[in] i The message number
+* @return The value
+*/
+double value(int i)
+{
+	return 20.0 + (i % 1000) / 10.0;
+}
+
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+
+	mqttClient.setMQTTVersion(opts.version);
+	network.connack = opts.version;
+	if (mqttClient.connect() != MQTT::SUCCESS)
+	{
+		printf("Connect failed\n");
+		return -1;
+	}
+	for (int i = 0; i < opts.channels; ++i)
+	{
+		if (mqttClient.initChannel(channels[i], DATA_TOPIC, i, TYPE_TEMPERATURE, UNIT_CELSIUS) != CAYENNE_SUCCESS)
+		{
+			printf("Channel %d could not be initialized\n", i);
+			return -1;
+		}
+	}
+
+	// a channel must give the same packet as publishData with the topic, type and unit
+	unsigned char expected[sizeof(network.packet)];
+	int expectedLength = 0;
+	for (int i = 0; i < opts.channels * 10; ++i)
+	{
+		int channel = i % opts.channels;
+		if (mqttClient.publishData(DATA_TOPIC, channel, TYPE_TEMPERATURE, UNIT_CELSIUS, value(i)) != MQTT::SUCCESS)
+		{
+			printf("Publish %d failed\n", i);
+			return -1;
+		}
+		expectedLength = network.length;
+		memcpy(expected, network.packet, expectedLength);
+		if (mqttClient.publishData(channels[channel], value(i)) != MQTT::SUCCESS)
+		{
+			printf("Channel publish %d failed\n", i);
+			return -1;
+		}
+		if (network.length != expectedLength || memcmp(network.packet, expected, expectedLength) != 0)
+		{
+			printf("Channel publish %d differs from publishData: %.*s\n", i, network.length, network.packet);
+			return -1;
+		}
+	}
+	// as do strings and integers, and topics without a type
+	CayenneMQTT::Channel model;
+	if (mqttClient.initChannel(model, SYS_MODEL_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL) != CAYENNE_SUCCESS ||
+		mqttClient.publishData(SYS_MODEL_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, "Linux") != MQTT::SUCCESS)
+	{
+		printf("Model publish failed\n");
+		return -1;
+	}
+	expectedLength = network.length;
+	memcpy(expected, network.packet, expectedLength);
+	if (mqttClient.publishData(model, "Linux") != MQTT::SUCCESS || network.length != expectedLength ||
+		memcmp(network.packet, expected, expectedLength) != 0)
+	{
+		printf("Model channel publish differs from publishData\n");
+		return -1;
+	}
+	if (mqttClient.publishData(DATA_TOPIC, 0, TYPE_TEMPERATURE, UNIT_CELSIUS, 42) != MQTT::SUCCESS)
+	{
+		printf("Integer publish failed\n");
+		return -1;
+	}
+	expectedLength = network.length;
+	memcpy(expected, network.packet, expectedLength);
+	if (mqttClient.publishData(channels[0], 42) != MQTT::SUCCESS || network.length != expectedLength ||
+		memcmp(network.packet, expected, expectedLength) != 0)
+	{
+		printf("Integer channel publish differs from publishData\n");
+		return -1;
+	}
+	// and static channels give the same packets as channels
+	CayenneMQTT::Channel temperature;
+	if (mqttClient.initChannel(temperature, DATA_TOPIC, 3, TYPE_TEMPERATURE, UNIT_CELSIUS) != CAYENNE_SUCCESS)
+	{
+		printf("Temperature channel could not be initialized\n");
+		return -1;
+	}
+	for (int i = 0; i < 1000; ++i)
+	{
+		if (mqttClient.publishData(temperature, value(i)) != MQTT::SUCCESS)
+		{
+			printf("Channel publish %d failed\n", i);
+			return -1;
+		}
+		expectedLength = network.length;
+		memcpy(expected, network.packet, expectedLength);
+		if (mqttClient.publishData(StaticTemperature(), value(i)) != MQTT::SUCCESS || network.length != expectedLength ||
+			memcmp(network.packet, expected, expectedLength) != 0)
+		{
+			printf("Static channel publish %d differs from channel publish\n", i);
+			return -1;
+		}
+	}
+	if (mqttClient.publishData(model, "Linux") != MQTT::SUCCESS)
+	{
+		printf("Model channel publish failed\n");
+		return -1;
+	}
+	expectedLength = network.length;
+	memcpy(expected, network.packet, expectedLength);
+	if (mqttClient.publishData(StaticModel(), "Linux") != MQTT::SUCCESS || network.length != expectedLength ||
+		memcmp(network.packet, expected, expectedLength) != 0)
+	{
+		printf("Static model publish differs from channel publish\n");
+		return -1;
+	}
+
+	long long start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (mqttClient.publishData(DATA_TOPIC, i % opts.channels, TYPE_TEMPERATURE, UNIT_CELSIUS, value(i)) != MQTT::SUCCESS)
+		{
+			printf("Publish %d failed\n", i);
+			return -1;
+		}
+	}
+	long long topicElapsed = microseconds() - start;
+
+	start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (mqttClient.publishData(channels[i % opts.channels], value(i)) != MQTT::SUCCESS)
+		{
+			printf("Channel publish %d failed\n", i);
+			return -1;
+		}
+	}
+	long long channelElapsed = microseconds() - start;
+
+	start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (mqttClient.publishData(StaticTemperature(), value(i)) != MQTT::SUCCESS)
+		{
+			printf("Static channel publish %d failed\n", i);
+			return -1;
+		}
+	}
+	long long staticElapsed = microseconds() - start;
+
+	// a batch of values is built and published each way
+	CayenneDataArray values;
+	CayenneTypedDataArray typedValues;
+	start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		values.clear();
+		values.add(UNIT_CELSIUS, value(i));
+		values.add(UNIT_FAHRENHEIT, value(i) * 1.8 + 32);
+		values.add(UNIT_KELVIN, value(i) + 273.15);
+		if (mqttClient.publishData(DATA_TOPIC, i % opts.channels, TYPE_TEMPERATURE, values.getArray(), values.getCount()) != MQTT::SUCCESS)
+		{
+			printf("Array publish %d failed\n", i);
+			return -1;
+		}
+	}
+	long long arrayElapsed = microseconds() - start;
+	expectedLength = network.length;
+	memcpy(expected, network.packet, expectedLength);
+
+	start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		typedValues.clear();
+		typedValues.add(CELSIUS_UNIT, value(i));
+		typedValues.add(FAHRENHEIT_UNIT, value(i) * 1.8 + 32);
+		typedValues.add(KELVIN_UNIT, value(i) + 273.15);
+		if (mqttClient.publishData(DATA_TOPIC, i % opts.channels, TEMPERATURE_TYPE, typedValues.getArray(), typedValues.getCount()) != MQTT::SUCCESS)
+		{
+			printf("Typed array publish %d failed\n", i);
+			return -1;
+		}
+	}
+	long long typedElapsed = microseconds() - start;
+	if (network.length != expectedLength || memcmp(network.packet, expected, expectedLength) != 0)
+	{
+		printf("Typed array publish differs from array publish\n");
+		return -1;
+	}
+	mqttClient.disconnect();
+
+	printf("%d QoS 0 publishes to %d channels over MQTT %s\n", opts.messages, opts.channels, (opts.version == 5) ? "5" : "3.1.1");
+	printf("publishData with topic, type and unit  %10.0f messages/s, %6.1f ns each\n", opts.messages * 1e6 / topicElapsed,
+		topicElapsed * 1000.0 / opts.messages);
+	printf("publishData with a channel             %10.0f messages/s, %6.1f ns each\n", opts.messages * 1e6 / channelElapsed,
+		channelElapsed * 1000.0 / opts.messages);
+	printf("publishData with a StaticChannel       %10.0f messages/s, %6.1f ns each\n", opts.messages * 1e6 / staticElapsed,
+		staticElapsed * 1000.0 / opts.messages);
+	printf("publishData with a DataArray of 3      %10.0f messages/s, %6.1f ns each\n", opts.messages * 1e6 / arrayElapsed,
+		arrayElapsed * 1000.0 / opts.messages);
+	printf("publishData with a TypedDataArray of 3 %10.0f messages/s, %6.1f ns each\n", opts.messages * 1e6 / typedElapsed,
+		typedElapsed * 1000.0 / opts.messages);
+	return 0;
+}
@@ -0,0 +1,294 @@
+/**
+* @file FormatBenchmark.cpp
+*
+* Compares the CayenneFormat functions used to write data values with the snprintf calls they replace. Every number
+* is checked first: fixed precision must match snprintf with its trailing zeros left out, and the shortest form must
+* read back as the same value.
+*
+* The shortest form is timed separately for sensor readings, which have a few significant digits, and for computed
+* values, which need 16 or 17 digits to read back and so are written with Grisu2, see CayenneFormatDouble.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../../../CayenneUtils/CayenneUtils.h"
+
+#define MAX_VALUES 65536
+
+double doubles[MAX_VALUES];
+double sensorDoubles[MAX_VALUES];
+float sensorFloats[MAX_VALUES];
+double computedDoubles[MAX_VALUES];
+long longs[MAX_VALUES];
+
+struct opts_struct
+{
+	int count;
+	int precision;
+} opts =
+{
+	1000000, CAYENNE_DEFAULT_PRECISION
+};
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("Cayenne Number Format Benchmark\n");
+	printf("Usage: formatbench <options>, where options are:\n");
+	printf("  --count <count of numbers to time each way> (default is 1000000)\n");
+	printf("  --precision <decimal places of doubles, 0 to 15> (default is %d)\n", CAYENNE_DEFAULT_PRECISION);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--count") == 0)
+			opts.count = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--precision") == 0)
+			opts.precision = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.count < 1 || opts.precision < 0 || opts.precision > 15)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Leave the trailing zeros of a fixed precision number out, as CayenneFormatDouble does.
+* @param[in,out] str The number
+*/
+void trimZeros(char* str)
+{
+	char* point = strchr(str, '.');
+	if (point)
+	{
+		char* end = str + strlen(str);
+		while (end[-1] == '0')
+			--end;
+		if (end[-1] == '.')
+			--end;
+		*end = '\0';
+	}
+	if (strcmp(str, "-0") == 0)
+		strcpy(str, "0");
+}
+
+/**
+* Time the shortest form of a set of values.
+* @param[in] values The values
+* @param[in] single Nonzero to format the values as floats
+* @param[in,out] total Adds the lengths of the numbers, so the formatting can't be optimized away
+* @return The time taken, in microseconds
+*/
+long long timeShortest(const double* values, int single, size_t* total)
+{
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length;
+	long long start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+	{
+		length = sizeof(str);
+		if (single)
+			CayenneFormatFloat(str, &length, sensorFloats[i % MAX_VALUES], CAYENNE_PRECISION_SHORTEST);
+		else
+			CayenneFormatDouble(str, &length, values[i % MAX_VALUES], CAYENNE_PRECISION_SHORTEST);
+		*total += length;
+	}
+	return microseconds() - start;
+}
+
+/**
+* Time snprintf with enough significant digits for every value to read back, 17 for a double and 9 for a float.
+* @param[in] values The values
+* @param[in] single Nonzero to format the values as floats
+* @param[in,out] total Adds the lengths of the numbers, so the formatting can't be optimized away
+* @return The time taken, in microseconds
+*/
+long long timeSnprintfShortest(const double* values, int single, size_t* total)
+{
+	char str[CAYENNE_NUMBER_SIZE];
+	long long start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+	{
+		if (single)
+			*total += snprintf(str, sizeof(str), "%.9g", sensorFloats[i % MAX_VALUES]);
+		else
+			*total += snprintf(str, sizeof(str), "%.17g", values[i % MAX_VALUES]);
+	}
+	return microseconds() - start;
+}
+
+/**
+* Print how long formatting took.
+* @param[in] name What was timed
+* @param[in] elapsed The time taken, in microseconds
+*/
+void report(const char* name, long long elapsed)
+{
+	printf("%-40s %12.0f numbers/s, %6.1f ns each\n", name, opts.count * 1e6 / elapsed, elapsed * 1000.0 / opts.count);
+}
+
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+
+	// sensor readings mostly, with some wider values
+	srand(1);
+	for (int i = 0; i < MAX_VALUES; ++i)
+	{
+		switch (i % 4)
+		{
+		case 0: doubles[i] = (rand() % 2000 - 500) / 10.0; break;
+		case 1: doubles[i] = rand() / (double)RAND_MAX * 100.0; break;
+		case 2: doubles[i] = (rand() - RAND_MAX / 2) * 1.37e-3; break;
+		default: doubles[i] = rand() * (double)rand() / 7.0; break;
+		}
+		longs[i] = (i % 2) ? rand() - RAND_MAX / 2 : rand() % 1000;
+		// temperatures, pressures and humidities as sensors report them, to a tenth or a hundredth
+		switch (i % 3)
+		{
+		case 0: sensorDoubles[i] = (rand() % 2000 - 500) / 10.0; break;
+		case 1: sensorDoubles[i] = (95000 + rand() % 10000) / 100.0; break;
+		default: sensorDoubles[i] = (rand() % 10000) / 100.0; break;
+		}
+		sensorFloats[i] = (float)sensorDoubles[i];
+		// averages, conversions and the like, which use every bit of the double
+		switch (i % 3)
+		{
+		case 0: computedDoubles[i] = rand() / (double)RAND_MAX * 100.0; break;
+		case 1: computedDoubles[i] = (rand() % 1024) * 3.3 / 1023.0; break;
+		default: computedDoubles[i] = rand() * (double)rand() / 7.0; break;
+		}
+	}
+
+	char str[CAYENNE_NUMBER_SIZE];
+	char expected[64];
+	size_t length;
+	for (int i = 0; i < MAX_VALUES; ++i)
+	{
+		length = sizeof(str);
+		snprintf(expected, sizeof(expected), "%.*f", opts.precision, doubles[i]);
+		trimZeros(expected);
+		if (CayenneFormatDouble(str, &length, doubles[i], opts.precision) != CAYENNE_SUCCESS || strcmp(str, expected) != 0 || length != strlen(str))
+		{
+			printf("%.17g formatted as %s, expected %s\n", doubles[i], str, expected);
+			return -1;
+		}
+		length = sizeof(str);
+		if (CayenneFormatDouble(str, &length, doubles[i], CAYENNE_PRECISION_SHORTEST) != CAYENNE_SUCCESS || strtod(str, NULL) != doubles[i])
+		{
+			printf("%.17g formatted as %s, which reads back differently\n", doubles[i], str);
+			return -1;
+		}
+		const double* sets[] = { sensorDoubles, computedDoubles };
+		for (int j = 0; j < 2; ++j)
+		{
+			length = sizeof(str);
+			if (CayenneFormatDouble(str, &length, sets[j][i], CAYENNE_PRECISION_SHORTEST) != CAYENNE_SUCCESS || strtod(str, NULL) != sets[j][i])
+			{
+				printf("%.17g formatted as %s, which reads back differently\n", sets[j][i], str);
+				return -1;
+			}
+		}
+		length = sizeof(str);
+		if (CayenneFormatFloat(str, &length, sensorFloats[i], CAYENNE_PRECISION_SHORTEST) != CAYENNE_SUCCESS || strtof(str, NULL) != sensorFloats[i])
+		{
+			printf("%.9g formatted as %s, which reads back differently\n", sensorFloats[i], str);
+			return -1;
+		}
+		length = sizeof(str);
+		snprintf(expected, sizeof(expected), "%ld", longs[i]);
+		if (CayenneFormatLong(str, &length, longs[i]) != CAYENNE_SUCCESS || strcmp(str, expected) != 0)
+		{
+			printf("%ld formatted as %s\n", longs[i], str);
+			return -1;
+		}
+	}
+
+	// the lengths are summed so the formatting can't be optimized away
+	size_t total = 0;
+	long long start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+		total += snprintf(str, sizeof(str), "%.*f", opts.precision, doubles[i % MAX_VALUES]);
+	long long snprintfElapsed = microseconds() - start;
+
+	start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+	{
+		length = sizeof(str);
+		CayenneFormatDouble(str, &length, doubles[i % MAX_VALUES], opts.precision);
+		total += length;
+	}
+	long long formatElapsed = microseconds() - start;
+
+	long long snprintfShortestElapsed = timeSnprintfShortest(doubles, 0, &total);
+	long long shortestElapsed = timeShortest(doubles, 0, &total);
+	long long snprintfSensorElapsed = timeSnprintfShortest(sensorDoubles, 0, &total);
+	long long sensorElapsed = timeShortest(sensorDoubles, 0, &total);
+	long long snprintfFloatElapsed = timeSnprintfShortest(NULL, 1, &total);
+	long long floatElapsed = timeShortest(NULL, 1, &total);
+	long long snprintfComputedElapsed = timeSnprintfShortest(computedDoubles, 0, &total);
+	long long computedElapsed = timeShortest(computedDoubles, 0, &total);
+
+	start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+		total += snprintf(str, sizeof(str), "%ld", longs[i % MAX_VALUES]);
+	long long snprintfLongElapsed = microseconds() - start;
+
+	start = microseconds();
+	for (int i = 0; i < opts.count; ++i)
+	{
+		length = sizeof(str);
+		CayenneFormatLong(str, &length, longs[i % MAX_VALUES]);
+		total += length;
+	}
+	long long longElapsed = microseconds() - start;
+
+	printf("%d numbers formatted each way (%lu characters)\n", opts.count, (unsigned long)total);
+	char name[32];
+	snprintf(name, sizeof(name), "snprintf %%.%df", opts.precision);
+	report(name, snprintfElapsed);
+	snprintf(name, sizeof(name), "CayenneFormatDouble, %d places", opts.precision);
+	report(name, formatElapsed);
+	report("snprintf %.17g, mixed", snprintfShortestElapsed);
+	report("CayenneFormatDouble, shortest, mixed", shortestElapsed);
+	report("snprintf %.17g, sensor", snprintfSensorElapsed);
+	report("CayenneFormatDouble, shortest, sensor", sensorElapsed);
+	report("snprintf %.9g, sensor floats", snprintfFloatElapsed);
+	report("CayenneFormatFloat, shortest, sensor", floatElapsed);
+	report("snprintf %.17g, computed", snprintfComputedElapsed);
+	report("CayenneFormatDouble, shortest, computed", computedElapsed);
+	report("snprintf %ld", snprintfLongElapsed);
+	report("CayenneFormatLong", longElapsed);
+	return 0;
+}
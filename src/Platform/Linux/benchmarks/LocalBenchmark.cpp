@@ -0,0 +1,331 @@
+/**
+* @file LocalBenchmark.cpp
+*
+* Compares the transports for a broker or bridge on the same machine: TCP loopback with MQTTNetwork, a Unix domain
+* socket with MQTTUnixNetwork and the in-process ring buffers of MQTTLocalNetwork. A minimal broker thread answers
+* the client, so the in-process run also shows the cost of the client itself, without any network.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "MQTTLinux.h"
+#include "MQTTUnixNetwork.h"
+#include "MQTTLocalNetwork.h"
+#include "MQTTClient.h"
+
+#define MAX_PAYLOAD_SIZE 1024
+
+MQTTNetwork tcp;
+MQTTUnixNetwork unixSocket;
+MQTTLocalNetwork local;
+MQTT::Client<MQTTNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 64, 1> tcpClient(tcp);
+MQTT::Client<MQTTUnixNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 64, 1> unixClient(unixSocket);
+MQTT::Client<MQTTLocalNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 64, 1> localClient(local);
+char payload[MAX_PAYLOAD_SIZE];
+
+struct opts_struct
+{
+	int roundTrips;
+	int messages;
+	int size;
+	int window;
+} opts =
+{
+	20000, 500000, 64, 1
+};
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("MQTT Local Transport Benchmark\n");
+	printf("Usage: localbench <options>, where options are:\n");
+	printf("  --roundtrips <count of QoS 1 publishes to time> (default is 20000)\n");
+	printf("  --messages <count of QoS 0 publishes to time> (default is 500000)\n");
+	printf("  --size <payload size> (default is 64, max is %d)\n", MAX_PAYLOAD_SIZE);
+	printf("  --window <QoS 1 publishes sent before waiting for acknowledgements> (default is 1, max is %d)\n", MQTTCLIENT_MAX_INFLIGHT);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--roundtrips") == 0)
+			opts.roundTrips = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--size") == 0)
+			opts.size = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--window") == 0)
+			opts.window = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.roundTrips < 1 || opts.messages < 1 || opts.size < 0 || opts.size > MAX_PAYLOAD_SIZE ||
+		opts.window < 1 || opts.window > MQTTCLIENT_MAX_INFLIGHT)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Get the CPU time used by this process, the broker thread included.
+* @return The CPU time in microseconds
+*/
+long long cpuMicroseconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+* Answer a client until it disconnects: CONNACK for CONNECT, PUBACK for QoS 1 PUBLISH and PINGRESP for PINGREQ.
+* @param[in] network The broker side of the connection
+*/
+template<class Network>
+void serve(Network& network)
+{
+	static unsigned char buffer[65536];
+	int length = 0;
+
+	while (true)
+	{
+		int bytes = network.read(buffer + length, sizeof(buffer) - length, 1000);
+		if (bytes < 0)
+			break;
+		length += bytes;
+
+		int start = 0;
+		while (length - start >= 2)
+		{
+			int remaining = 0, multiplier = 1, header = start + 1;
+			while (header < length && (buffer[header] & 128) && header < start + 4)
+			{
+				remaining += (buffer[header++] & 127) * multiplier;
+				multiplier *= 128;
+			}
+			if (header >= length)
+				break;
+			remaining += (buffer[header++] & 127) * multiplier;
+			if (header + remaining > length)
+				break;
+
+			unsigned char reply[4] = { 0, 2, 0, 0 };
+			int type = buffer[start] >> 4, qos = (buffer[start] >> 1) & 3;
+			if (type == CONNECT_MSG)
+				reply[0] = CONNACK_MSG << 4;
+			else if (type == PUBLISH_MSG && qos == 1)
+			{
+				int id = header + 2 + (buffer[header] << 8) + buffer[header + 1];
+				reply[0] = PUBACK_MSG << 4;
+				reply[2] = buffer[id];
+				reply[3] = buffer[id + 1];
+			}
+			else if (type == PINGREQ_MSG)
+			{
+				reply[0] = PINGRESP_MSG << 4;
+				reply[1] = 0;
+			}
+			else if (type == DISCONNECT_MSG)
+				return;
+			if (reply[0] && network.write(reply, reply[1] + 2, 1000) != reply[1] + 2)
+				return;
+			start = header + remaining;
+		}
+		memmove(buffer, buffer + start, length - start);
+		length -= start;
+	}
+}
+
+MQTTLocalChannel channel;
+int listener = -1;
+
+/**
+* Broker thread for the socket transports.
+*/
+void* serveSocket(void*)
+{
+	MQTTNetwork network;
+	int socket = accept(listener, NULL, NULL);
+	if (socket != -1 && network.attach(socket) == 0)
+	{
+		serve(network);
+		network.disconnect();
+	}
+	return NULL;
+}
+
+/**
+* Broker thread for the in-process transport.
+*/
+void* serveLocal(void*)
+{
+	MQTTLocalNetwork network;
+	if (network.connect(channel, MQTTLocalNetwork::BRIDGE) == 0)
+	{
+		serve(network);
+		network.disconnect();
+	}
+	return NULL;
+}
+
+/**
+* Time QoS 1 round trips and QoS 0 publishes over a connected network.
+* @param[in] name Name of the transport
+* @param[in] network The client side of the connection
+* @param[in] client The client using the network
+* @param[in] broker The broker thread
+*/
+template<class Network, class Client>
+void runBenchmark(const char* name, Network& network, Client& client, pthread_t broker)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	data.keepAliveInterval = 0;
+	client.setPublishWindow(opts.window);
+	if (client.connect(data) != MQTT::SUCCESS)
+	{
+		printf("%s: connect failed\n", name);
+		exit(-1);
+	}
+
+	long long start = microseconds();
+	for (int i = 0; i < opts.roundTrips; ++i)
+	{
+		if (client.publish("v1/bench/things/device/data/1", payload, opts.size, MQTT::QOS1) != MQTT::SUCCESS)
+		{
+			printf("%s: QoS 1 publish failed\n", name);
+			exit(-1);
+		}
+	}
+	if (client.waitForAcks(1000) != MQTT::SUCCESS)
+	{
+		printf("%s: QoS 1 acknowledgements missing\n", name);
+		exit(-1);
+	}
+	long long roundTrip = microseconds() - start;
+
+	start = microseconds();
+	long long cpuStart = cpuMicroseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (client.publish("v1/bench/things/device/data/1", payload, opts.size, MQTT::QOS0) != MQTT::SUCCESS)
+		{
+			printf("%s: QoS 0 publish failed\n", name);
+			exit(-1);
+		}
+	}
+	client.disconnect();
+	pthread_join(broker, NULL);
+	long long elapsed = microseconds() - start;
+	long long cpu = cpuMicroseconds() - cpuStart;
+	network.disconnect();
+
+	printf("%-16s %8.2f us per QoS 1 round trip, %9.0f QoS 0 messages/s, %6.3f us CPU per message\n", name,
+		(double)roundTrip / opts.roundTrips, opts.messages * 1e6 / elapsed, (double)cpu / opts.messages);
+}
+
+/**
+* Start a broker thread.
+* @param[in] function The thread function
+* @return The thread
+*/
+pthread_t startBroker(void* (*function)(void*))
+{
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, function, NULL) != 0)
+	{
+		printf("Could not start the broker thread\n");
+		exit(-1);
+	}
+	return thread;
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+	memset(payload, 'x', sizeof(payload));
+	printf("%d QoS 1 round trips with a window of %d and %d QoS 0 messages of %d bytes\n", opts.roundTrips, opts.window, opts.messages, opts.size);
+
+	// TCP loopback
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+		getsockname(listener, (struct sockaddr*)&address, &length) != 0)
+	{
+		printf("Could not listen on loopback\n");
+		return -1;
+	}
+	pthread_t broker = startBroker(serveSocket);
+	if (tcp.connect("127.0.0.1", ntohs(address.sin_port)) != 0)
+	{
+		printf("TCP connect failed\n");
+		return -1;
+	}
+	runBenchmark("TCP loopback", tcp, tcpClient, broker);
+	close(listener);
+
+	// Unix domain socket, in the abstract namespace so there is no file to clean up
+	char path[64];
+	struct sockaddr_un unixAddress;
+	snprintf(path, sizeof(path), "@mqtt-localbench-%d", (int)getpid());
+	memset(&unixAddress, 0, sizeof(unixAddress));
+	unixAddress.sun_family = AF_UNIX;
+	memcpy(unixAddress.sun_path + 1, path + 1, strlen(path) - 1);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&unixAddress, offsetof(struct sockaddr_un, sun_path) + strlen(path)) != 0 || listen(listener, 1) != 0)
+	{
+		printf("Could not listen on %s\n", path);
+		return -1;
+	}
+	broker = startBroker(serveSocket);
+	if (unixSocket.connect(path) != 0)
+	{
+		printf("Unix domain socket connect failed\n");
+		return -1;
+	}
+	runBenchmark("Unix socket", unixSocket, unixClient, broker);
+	close(listener);
+
+	// In-process ring buffers
+	if (channel.init() != 0 || local.connect(channel) != 0)
+	{
+		printf("In-process connect failed\n");
+		return -1;
+	}
+	broker = startBroker(serveLocal);
+	runBenchmark("In-process", local, localClient, broker);
+	return 0;
+}
@@ -0,0 +1,414 @@
+/**
+* @file ReactorBenchmark.cpp
+*
+* Benchmark for driving many Cayenne MQTT clients from a single thread with MQTTReactor.
+* Reports the connect rate, the CPU time used to keep the clients publishing, and the memory used per connection.
+* By default the clients connect to a minimal broker on TCP loopback, run in a child process so its CPU time, memory
+* and file descriptors aren't counted against the clients. It answers CONNECT, QoS 1 PUBLISH, SUBSCRIBE and PINGREQ.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "MQTTLinux.h"
+#include "MQTTReactor.h"
+#include "CayenneMQTTClient.h"
+
+#define MAX_DEVICES 10000
+#define BROKER_BUFFER_SIZE 256 // room for a partly received packet, the clients' packets are at most CAYENNE_MAX_MESSAGE_SIZE
+
+typedef CayenneMQTT::MQTTClient<MQTTNetwork, MQTTTimer> Client;
+
+// The footprint budget documented in MQTTClient.h, for builds that keep the default buffer sizes.
+static_assert(MQTTCLIENT_QOS2 || MQTTCLIENT_RECVBUF_SIZE > 512 || MQTTCLIENT_SENDQUEUE_SIZE > 512 || MQTTCLIENT_INFLIGHT_STORE_SIZE > 0 ||
+	MQTTCLIENT_SUBSCRIPTION_STORE_SIZE > 0 || MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE > 0 || sizeof(Client) <= 3 * 1024, "The default MQTT client is over its memory budget");
+
+/**
+* A simulated field device with its own connection.
+*/
+struct Device
+{
+	Device() : client(network)
+	{
+	}
+
+	MQTTNetwork network;
+	Client client;
+	char clientID[24];
+};
+
+Device devices[MAX_DEVICES];
+MQTTReactor<Client, MAX_DEVICES> reactor;
+int disconnects = 0;
+
+struct opts_struct
+{
+	char* username;
+	char* password;
+	char* host;
+	int port;
+	int clients;
+	int seconds;
+	int interval;
+} opts =
+{
+	(char*)"username", (char*)"password", NULL, CAYENNE_PORT, MAX_DEVICES, 10, 1000
+};
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("Cayenne MQTT Reactor Benchmark\n");
+	printf("Usage: reactorbench <options>, where options are:\n");
+	printf("  --host <hostname> (default is a loopback broker the benchmark starts, %s is the Cayenne server)\n", CAYENNE_DOMAIN);
+	printf("  --port <port> (default is %d, only used with --host)\n", CAYENNE_PORT);
+	printf("  --username <username> (default is username)\n");
+	printf("  --password <password> (default is password)\n");
+	printf("  --clients <count> (default and max is %d)\n", MAX_DEVICES);
+	printf("  --seconds <seconds to publish for> (default is 10)\n");
+	printf("  --interval <milliseconds between publishes from each client> (default is 1000)\n");
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--host") == 0)
+			opts.host = argv[++count];
+		else if (strcmp(argv[count], "--port") == 0)
+			opts.port = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--username") == 0)
+			opts.username = argv[++count];
+		else if (strcmp(argv[count], "--password") == 0)
+			opts.password = argv[++count];
+		else if (strcmp(argv[count], "--clients") == 0)
+			opts.clients = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--seconds") == 0)
+			opts.seconds = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--interval") == 0)
+			opts.interval = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.clients < 1 || opts.clients > MAX_DEVICES || opts.interval < 1)
+		usage();
+}
+
+/**
+* Get the resident memory of the process.
+* @return The resident memory in kilobytes
+*/
+long residentKB(void)
+{
+	long pages = 0, resident = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file) {
+		if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(file);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+* Get the CPU time used by the process.
+* @return The CPU time in microseconds
+*/
+long long cpuMicroseconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+* Get the wall clock time.
+* @return The time in microseconds
+*/
+long long wallMicroseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* A connection to the loopback broker, with the part of a packet received so far.
+*/
+struct BrokerConnection
+{
+	unsigned char buffer[BROKER_BUFFER_SIZE];
+	int length;
+};
+
+/**
+* Answer the complete packets received on a broker connection: CONNACK for CONNECT, PUBACK for QoS 1 PUBLISH, SUBACK for
+* SUBSCRIBE and PINGRESP for PINGREQ.
+* @param[in] socket The broker side of the connection
+* @param[in] connection The data received on it
+* @return 0 on success, -1 if the connection should be closed
+*/
+int answerPackets(int socket, BrokerConnection& connection)
+{
+	unsigned char* buffer = connection.buffer;
+	int start = 0;
+	while (connection.length - start >= 2)
+	{
+		int remaining = 0, multiplier = 1, header = start + 1;
+		while (header < connection.length && (buffer[header] & 128) && header < start + 4)
+		{
+			remaining += (buffer[header++] & 127) * multiplier;
+			multiplier *= 128;
+		}
+		if (header >= connection.length)
+			break;
+		remaining += (buffer[header++] & 127) * multiplier;
+		if (header + remaining > connection.length)
+			break;
+
+		unsigned char reply[5] = { 0, 2, 0, 0, 0 };
+		int type = buffer[start] >> 4, qos = (buffer[start] >> 1) & 3;
+		if (type == CONNECT_MSG)
+			reply[0] = CONNACK_MSG << 4;
+		else if (type == PUBLISH_MSG && qos == 1)
+		{
+			int id = header + 2 + (buffer[header] << 8) + buffer[header + 1];
+			reply[0] = PUBACK_MSG << 4;
+			reply[2] = buffer[id];
+			reply[3] = buffer[id + 1];
+		}
+		else if (type == SUBSCRIBE_MSG) // one topic filter, granted QoS 0
+		{
+			reply[0] = SUBACK_MSG << 4;
+			reply[1] = 3;
+			reply[2] = buffer[header];
+			reply[3] = buffer[header + 1];
+		}
+		else if (type == PINGREQ_MSG)
+		{
+			reply[0] = PINGRESP_MSG << 4;
+			reply[1] = 0;
+		}
+		else if (type == DISCONNECT_MSG)
+			return -1;
+		// the replies are a few bytes, so a loopback socket always has room for them
+		if (reply[0] && send(socket, reply, reply[1] + 2, MSG_NOSIGNAL) != reply[1] + 2)
+			return -1;
+		start = header + remaining;
+	}
+	if (start == 0 && connection.length == BROKER_BUFFER_SIZE)
+		return -1; // a packet bigger than any the clients send
+	memmove(buffer, buffer + start, connection.length - start);
+	connection.length -= start;
+	return 0;
+}
+
+/**
+* Run the loopback broker until the benchmark kills it, accepting the clients' connections and answering them.
+* @param[in] listener The listening socket
+*/
+void serveBroker(int listener)
+{
+	// indexed by socket, which are small numbers in this process
+	int maxConnections = MAX_DEVICES + 64;
+	BrokerConnection* connections = (BrokerConnection*)calloc(maxConnections, sizeof(BrokerConnection));
+	int epoll = epoll_create1(0);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = listener;
+	if (!connections || epoll == -1 || epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) != 0)
+		exit(-1);
+
+	struct epoll_event events[256];
+	while (true)
+	{
+		int count = epoll_wait(epoll, events, sizeof(events) / sizeof(events[0]), -1);
+		for (int i = 0; i < count; ++i)
+		{
+			int socket = events[i].data.fd;
+			if (socket == listener)
+			{
+				int client = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+				if (client == -1)
+					continue;
+				int nodelay = 1;
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+				event.data.fd = client;
+				if (client >= maxConnections || epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event) != 0)
+				{
+					close(client);
+					continue;
+				}
+				connections[client].length = 0;
+				continue;
+			}
+			BrokerConnection& connection = connections[socket];
+			int bytes = recv(socket, connection.buffer + connection.length, BROKER_BUFFER_SIZE - connection.length, 0);
+			if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				continue;
+			if (bytes > 0)
+				connection.length += bytes;
+			if (bytes <= 0 || answerPackets(socket, connection) != 0)
+				close(socket); // which also removes it from the epoll set
+		}
+	}
+}
+
+/**
+* Start the loopback broker in a child process.
+* @param[out] port The port the broker listens on
+* @return The broker process, or -1 if it could not be started
+*/
+pid_t startBroker(int* port)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0 ||
+		getsockname(listener, (struct sockaddr*)&address, &length) != 0)
+		return -1;
+	*port = ntohs(address.sin_port);
+	fflush(stdout); // so the child doesn't print what the parent has buffered
+	pid_t broker = fork();
+	if (broker == 0)
+	{
+		prctl(PR_SET_PDEATHSIG, SIGTERM); // however the benchmark exits
+		serveBroker(listener);
+		exit(0);
+	}
+	close(listener);
+	return broker;
+}
+
+/**
+* Count clients dropped by the reactor.
+* @param[in] client The client that failed
+*/
+void clientDisconnected(Client& client)
+{
+	disconnects++;
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+
+	// Each connection needs a file descriptor, so raise the limit as far as we are allowed. The broker process inherits it.
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && (long long)limit.rlim_cur < opts.clients + 16)
+		printf("Warning: the open file limit of %lld is too low for %d clients\n", (long long)limit.rlim_cur, opts.clients);
+
+	pid_t broker = -1;
+	const char* host = opts.host;
+	if (!host) {
+		broker = startBroker(&opts.port);
+		if (broker == -1) {
+			printf("Could not start the loopback broker\n");
+			return -1;
+		}
+		host = "127.0.0.1";
+	}
+
+	reactor.setDisconnectHandler(clientDisconnected);
+	long baseKB = residentKB();
+
+	// Open the connections and queue the MQTT connect packets, the reactor handles the connacks.
+	printf("Connecting %d clients to %s:%d%s\n", opts.clients, host, opts.port, opts.host ? "" : ", a loopback broker");
+	long long start = wallMicroseconds();
+	int opened = 0;
+	for (int i = 0; i < opts.clients; ++i) {
+		Device* device = &devices[i];
+		snprintf(device->clientID, sizeof(device->clientID), "bench-%d", i);
+		device->client.init(opts.username, opts.password, device->clientID);
+		if (device->network.connect(host, opts.port) != 0 || reactor.add(device->client) != 0 || device->client.connect() != MQTT::SUCCESS) {
+			printf("Client %d failed to connect\n", i);
+			break;
+		}
+		opened++;
+		reactor.run(0);
+	}
+	int connected = 0;
+	MQTTTimer timer(30000);
+	while (!timer.expired() && connected < opened) {
+		reactor.run(10);
+		connected = 0;
+		for (int i = 0; i < opened; ++i)
+			connected += devices[i].client.connected();
+	}
+	long long connectTime = wallMicroseconds() - start;
+	long connectionsKB = residentKB() - baseKB;
+	printf("Connected %d clients in %lld ms (%.0f connections/s)\n", connected, connectTime / 1000, connected * 1e6 / connectTime);
+	if (connected == 0)
+		return -1;
+
+	// Publish from every client at the requested interval, spreading the publishes over the interval.
+	long long published = 0;
+	long long cpuStart = cpuMicroseconds();
+	start = wallMicroseconds();
+	long long end = start + opts.seconds * 1000000LL;
+	int next = 0;
+	for (long long now = start; now < end; now = wallMicroseconds()) {
+		long long due = (now - start) * opened / (opts.interval * 1000LL);
+		for (; published < due; ++published) {
+			Device& device = devices[next];
+			if (device.client.connected())
+				device.client.publishData(DATA_TOPIC, 1, TYPE_TEMPERATURE, UNIT_CELSIUS, 20.0 + (published % 100) / 10.0);
+			next = (next + 1) % opened;
+		}
+		reactor.run(1);
+	}
+	long long wallTime = wallMicroseconds() - start;
+	long long cpuTime = cpuMicroseconds() - cpuStart;
+	double load = (double)cpuTime / wallTime;
+
+	printf("Published %lld messages in %lld ms (%.0f messages/s), %d clients dropped\n", published, wallTime / 1000, published * 1e6 / wallTime, disconnects);
+	printf("CPU time %lld ms, %.1f%% of one core\n", cpuTime / 1000, load * 100);
+	if (load > 0)
+		printf("Estimated clients per core at this publish interval: %.0f\n", connected / load);
+	// The client objects are static, so the resident memory growth while connecting only counts what else the connections touched.
+	printf("Memory per connection: %d bytes of client state (%d for the MQTT client, %d for the network), %d bytes of reactor state, %.2f KB other resident growth (excluding kernel socket buffers)\n",
+		(int)sizeof(Device), (int)sizeof(Client), (int)sizeof(MQTTNetwork), (int)sizeof(Client*), (double)connectionsKB / opened);
+	printf("MQTT client built with QoS 1 %s, QoS 2 %s, MQTT 5 %s, in-flight store %d bytes, topic alias store %d bytes\n",
+		MQTTCLIENT_QOS1 ? "on" : "off", MQTTCLIENT_QOS2 ? "on" : "off", MQTTCLIENT_MQTT5 ? "on" : "off",
+		(MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2) ? (MQTTCLIENT_INFLIGHT_STORE_SIZE > CAYENNE_MAX_MESSAGE_SIZE ? MQTTCLIENT_INFLIGHT_STORE_SIZE : CAYENNE_MAX_MESSAGE_SIZE) : 0,
+		MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE);
+
+	for (int i = 0; i < opened; ++i) {
+		reactor.remove(devices[i].client);
+		devices[i].network.disconnect();
+	}
+	if (broker != -1) {
+		kill(broker, SIGTERM);
+		waitpid(broker, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,312 @@
+/**
+* @file SNBenchmark.cpp
+*
+* Runs the Cayenne client over MQTT-SN against a minimal gateway on UDP loopback, and compares the bytes each publish
+* costs with what the same publish costs over MQTT. The gateway thread registers topics, acknowledges QoS 1 publishes,
+* answers a subscription with a command and checks that every publish uses a topic id it gave out, so the run also
+* shows that the client works end to end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "MQTTLinux.h"
+#include "MQTTUDPNetwork.h"
+#include "CayenneMQTTSNClient.h"
+
+#define MAX_TOPICS 64
+#define IP_UDP_HEADER_SIZE 28
+#define IP_TCP_HEADER_SIZE 52 // with the timestamp option Linux uses by default
+
+// Cayenne usernames and client IDs are UUIDs, so the topics are as long as real ones.
+char username[] = "8b5b1a70-2a2e-11e7-9aa2-5b3e7ed4a3b5";
+char password[] = "MQTT_PASSWORD";
+char clientID[] = "d2f6a9b0-2a2e-11e7-bd1e-25d7c1f6a1a0";
+
+MQTTUDPNetwork network;
+CayenneMQTT::MQTTSNClient<MQTTUDPNetwork, MQTTTimer> mqttClient(network, username, password, clientID);
+
+struct opts_struct
+{
+	int messages;
+	int channels;
+} opts =
+{
+	100000, 4
+};
+
+/**
+* What the gateway saw.
+*/
+struct
+{
+	char topics[MAX_TOPICS][CAYENNE_MAX_MESSAGE_SIZE];
+	int topicCount;
+	int registrations;  // REGISTER packets, including any for names that already had a topic id
+	long publishes;
+	long snBytes;       // MQTT-SN publish packets as received
+	long mqttBytes;     // the same publishes as MQTT 3.1.1 packets
+	int unknownTopics;  // publishes with a topic id that was never given out
+	bool commandSent;
+} gateway;
+
+int gatewaySocket = -1;
+int commandsReceived = 0;
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("MQTT-SN Benchmark\n");
+	printf("Usage: snbench <options>, where options are:\n");
+	printf("  --messages <count of QoS 0 publishes to time> (default is 100000)\n");
+	printf("  --channels <count of channels published to, each registered once> (default is 4, max is %d)\n", MQTTSNCLIENT_MAX_TOPICS - 2);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--channels") == 0)
+			opts.channels = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.messages < 1 || opts.channels < 1 || opts.channels > MQTTSNCLIENT_MAX_TOPICS - 2)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Send a packet from the gateway, with the one byte length field MQTT-SN uses for packets up to 255 bytes.
+* @param[in] packet The packet, from the message type on
+* @param[in] length The length of the packet, from the message type on
+* @param[in] client The client address
+* @param[in] clientLength The length of the client address
+*/
+void reply(const unsigned char* packet, int length, struct sockaddr* client, socklen_t clientLength)
+{
+	unsigned char buffer[256];
+	buffer[0] = length + 1;
+	memcpy(buffer + 1, packet, length);
+	sendto(gatewaySocket, buffer, length + 1, 0, client, clientLength);
+}
+
+/**
+* Get the gateway topic id of a topic name, giving it a new one if it has none yet.
+* @param[in] name The topic name
+* @param[in] length The length of the topic name
+* @return The topic id, or 0 if the gateway has run out of topic ids
+*/
+int findTopic(const char* name, int length)
+{
+	int id = 1;
+	for (; id <= gateway.topicCount; ++id)
+	{
+		if ((int)strlen(gateway.topics[id - 1]) == length && memcmp(gateway.topics[id - 1], name, length) == 0)
+			return id;
+	}
+	if (id > MAX_TOPICS || length >= CAYENNE_MAX_MESSAGE_SIZE)
+		return 0;
+	memcpy(gateway.topics[id - 1], name, length);
+	gateway.topics[id - 1][length] = '\0';
+	return ++gateway.topicCount;
+}
+
+/**
+* Gateway thread. Answers CONNECT, REGISTER, PUBLISH, SUBSCRIBE and PINGREQ until the client disconnects.
+*/
+void* serveGateway(void*)
+{
+	unsigned char buffer[512];
+	struct sockaddr_storage client;
+	socklen_t clientLength = sizeof(client);
+
+	while (true)
+	{
+		int length = recvfrom(gatewaySocket, buffer, sizeof(buffer), 0, (struct sockaddr*)&client, &clientLength);
+		if (length < 2)
+			break;
+		int header = (buffer[0] == 0x01) ? 3 : 1;
+		int type = buffer[header];
+		unsigned char* p = buffer + header + 1;
+		int rest = length - header - 1;
+
+		if (type == MQTTSN_CONNECT)
+		{
+			unsigned char connack[] = { MQTTSN_CONNACK, MQTTSN_RC_ACCEPTED };
+			reply(connack, sizeof(connack), (struct sockaddr*)&client, clientLength);
+		}
+		else if (type == MQTTSN_REGISTER && rest > 4)
+		{
+			int id = findTopic((char*)p + 4, rest - 4);
+			if (id == 0)
+				continue;
+			gateway.registrations++;
+			unsigned char regack[] = { MQTTSN_REGACK, 0, (unsigned char)id, p[2], p[3], MQTTSN_RC_ACCEPTED };
+			reply(regack, sizeof(regack), (struct sockaddr*)&client, clientLength);
+		}
+		else if (type == MQTTSN_PUBLISH && rest >= 5)
+		{
+			int qos = (p[0] >> 5) & 3;
+			int id = (p[1] << 8) + p[2];
+			unsigned char code = MQTTSN_RC_ACCEPTED;
+			if ((p[0] & 3) != MQTTSN_TOPIC_TYPE_NORMAL || id < 1 || id > gateway.topicCount)
+			{
+				gateway.unknownTopics++;
+				code = MQTTSN_RC_REJECTED_INVALID_TOPIC_ID;
+			}
+			else
+			{
+				int payloadlen = rest - 5;
+				int remaining = 2 + strlen(gateway.topics[id - 1]) + payloadlen + (qos ? 2 : 0);
+				gateway.publishes++;
+				gateway.snBytes += length;
+				gateway.mqttBytes += MQTTPacket_len(remaining);
+			}
+			if (qos == 1 || code != MQTTSN_RC_ACCEPTED)
+			{
+				unsigned char puback[] = { MQTTSN_PUBACK, p[1], p[2], p[3], p[4], code };
+				reply(puback, sizeof(puback), (struct sockaddr*)&client, clientLength);
+			}
+		}
+		else if (type == MQTTSN_SUBSCRIBE && rest > 3)
+		{
+			int id = findTopic((char*)p + 3, rest - 3);
+			if (id == 0)
+				continue;
+			unsigned char suback[] = { MQTTSN_SUBACK, 0, 0, (unsigned char)id, p[1], p[2], MQTTSN_RC_ACCEPTED };
+			reply(suback, sizeof(suback), (struct sockaddr*)&client, clientLength);
+
+			// send a command on the topic, as Cayenne does when a dashboard button is pressed
+			const char command[] = "seq-1,1";
+			unsigned char publish[5 + sizeof(command)] = { MQTTSN_PUBLISH, 0, 0, (unsigned char)id, 0, 0 };
+			memcpy(publish + 6, command, sizeof(command) - 1);
+			reply(publish, sizeof(publish) - 1, (struct sockaddr*)&client, clientLength);
+			gateway.commandSent = true;
+		}
+		else if (type == MQTTSN_PINGREQ)
+		{
+			unsigned char pingresp[] = { MQTTSN_PINGRESP };
+			reply(pingresp, sizeof(pingresp), (struct sockaddr*)&client, clientLength);
+		}
+		else if (type == MQTTSN_DISCONNECT)
+			break;
+	}
+	return NULL;
+}
+
+/**
+* Handle a command by sending the response Cayenne expects.
+* @param[in] message The command
+*/
+void commandArrived(CayenneMQTT::MessageData& message)
+{
+	commandsReceived++;
+	mqttClient.publishResponse(message.id, NULL, message.clientID);
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int size = 4 * 1024 * 1024;
+	gatewaySocket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (gatewaySocket == -1 || bind(gatewaySocket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+		getsockname(gatewaySocket, (struct sockaddr*)&address, &length) != 0)
+	{
+		printf("Could not bind the gateway on loopback\n");
+		return -1;
+	}
+	setsockopt(gatewaySocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)); // QoS 0 over UDP can be dropped if the gateway falls behind
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, serveGateway, NULL) != 0)
+	{
+		printf("Could not start the gateway thread\n");
+		return -1;
+	}
+	if (network.connect("127.0.0.1", ntohs(address.sin_port)) != 0 || mqttClient.connect() != MQTT::SUCCESS)
+	{
+		printf("MQTT-SN connect failed\n");
+		return -1;
+	}
+	if (mqttClient.subscribe(COMMAND_TOPIC, 1, commandArrived) != MQTT::SUCCESS)
+	{
+		printf("Subscribe failed\n");
+		return -1;
+	}
+	for (int i = 0; i < 10 && commandsReceived == 0; ++i)
+		mqttClient.yield(100);
+
+	long long start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (mqttClient.publishData(DATA_TOPIC, i % opts.channels, TYPE_TEMPERATURE, UNIT_CELSIUS, 20.0 + (i % 100) / 10.0) != MQTT::SUCCESS)
+		{
+			printf("Publish %d failed\n", i);
+			return -1;
+		}
+	}
+	// a QoS 1 publish after the QoS 0 ones, so once it is acknowledged the gateway has seen everything it is going to
+	if (mqttClient.publishData(SYS_MODEL_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, "Linux") != MQTT::SUCCESS ||
+		mqttClient.publishResponse("seq-2", NULL) != MQTT::SUCCESS)
+	{
+		printf("QoS 1 publish failed\n");
+		return -1;
+	}
+	long long elapsed = microseconds() - start;
+	mqttClient.disconnect();
+	pthread_join(thread, NULL);
+	network.disconnect();
+
+	printf("%d QoS 0 publishes to %d channels: %.0f messages/s, %ld received by the gateway\n", opts.messages, opts.channels,
+		opts.messages * 1e6 / elapsed, gateway.publishes - 3);
+	printf("Topics registered: %d, commands received: %d\n", gateway.registrations, commandsReceived);
+	printf("MQTT-SN over UDP %6.1f bytes per publish, %6.1f with IP and UDP headers\n", (double)gateway.snBytes / gateway.publishes,
+		(double)gateway.snBytes / gateway.publishes + IP_UDP_HEADER_SIZE);
+	printf("MQTT over TCP    %6.1f bytes per publish, %6.1f with IP and TCP headers\n", (double)gateway.mqttBytes / gateway.publishes,
+		(double)gateway.mqttBytes / gateway.publishes + IP_TCP_HEADER_SIZE);
+
+	// each topic is registered once: the data channels, the system model and the response topic
+	if (gateway.unknownTopics > 0 || gateway.registrations != opts.channels + 2 || commandsReceived != 1 || !gateway.commandSent)
+	{
+		printf("The gateway saw unexpected packets\n");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,395 @@
+/**
+* @file StreamBenchmark.cpp
+*
+* Sends and receives publishes far bigger than the client's packet buffers, which are the Cayenne default size, over
+* TCP loopback. A minimal broker thread sends large publishes with a small one behind each, first with fragment
+* delivery on and then with it off, and checks the large publishes the client streams to it. Every byte is checked,
+* so the run also shows that the stream stays in step whether large payloads are delivered or skipped.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "MQTTLinux.h"
+#include "MQTTClient.h"
+#include "../CayenneUtils/CayenneDefines.h"
+
+#define MAX_PAYLOAD_SIZE (1024 * 1024)
+#define INBOUND_TOPIC "v1/bench/things/device/cmd/1"
+#define OUTBOUND_TOPIC "v1/bench/things/device/data/1"
+
+MQTTNetwork network;
+MQTT::Client<MQTTNetwork, MQTTTimer, CAYENNE_MAX_MESSAGE_SIZE, 1> client(network);
+unsigned char payload[MAX_PAYLOAD_SIZE];
+
+struct opts_struct
+{
+	int messages;
+	int size;
+} opts =
+{
+	50, 65536
+};
+
+/**
+* What each side saw.
+*/
+struct
+{
+	long long bytes;        // payload bytes of large publishes, in the order they are expected
+	int large;              // complete large publishes
+	int small;              // small publishes
+	int errors;             // bytes out of place or with the wrong value
+} received, brokerReceived;
+int brokerAcks = 0;
+size_t nextOffset = 0;
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("MQTT Large Payload Benchmark\n");
+	printf("Usage: streambench <options>, where options are:\n");
+	printf("  --messages <count of large publishes each way> (default is 50)\n");
+	printf("  --size <payload size> (default is 65536, max is %d)\n", MAX_PAYLOAD_SIZE);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--size") == 0)
+			opts.size = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.messages < 1 || opts.size <= CAYENNE_MAX_MESSAGE_SIZE || opts.size > MAX_PAYLOAD_SIZE)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* The value of each payload byte, so a byte out of place is found.
+*/
+unsigned char patternAt(size_t offset)
+{
+	return (unsigned char)(offset % 251);
+}
+
+/**
+* Check a fragment or a whole payload against the pattern.
+* @param[in] data The bytes
+* @param[in] len The number of bytes
+* @param[in] offset Offset of the bytes in the payload
+* @param[in,out] errors Count of bytes with the wrong value
+*/
+void checkPayload(unsigned char* data, size_t len, size_t offset, int* errors)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		if (data[i] != patternAt(offset + i))
+			++*errors;
+	}
+}
+
+/**
+* Send a publish from the broker.
+* @param[in] network The broker side of the connection
+* @param[in] id The packet id
+* @param[in] len The length of the payload
+* @return 0 on success, -1 otherwise
+*/
+int sendPublish(MQTTNetwork& network, unsigned short id, int len)
+{
+	static unsigned char buffer[MAX_PAYLOAD_SIZE + 64];
+	MQTTString topic = MQTTString_initializer;
+	topic.cstring = (char*)INBOUND_TOPIC;
+	int length = MQTTSerialize_publish(buffer, sizeof(buffer), 0, 1, 0, id, topic, payload, len);
+	for (int sent = 0; length > 0 && sent < length; )
+	{
+		int bytes = network.write(buffer + sent, length - sent, 1000);
+		if (bytes < 0)
+			return -1;
+		sent += bytes;
+	}
+	return (length > 0) ? 0 : -1;
+}
+
+/**
+* Answer the client until it disconnects. Each SUBSCRIBE is answered with a batch of large QoS 1 publishes, each
+* followed by a small one, and the large publishes the client sends are checked and acknowledged.
+* @param[in] network The broker side of the connection
+*/
+void serve(MQTTNetwork& network)
+{
+	static unsigned char buffer[MAX_PAYLOAD_SIZE + 4096];
+	int length = 0;
+	unsigned short nextId = 1;
+
+	while (true)
+	{
+		int bytes = network.read(buffer + length, sizeof(buffer) - length, 1000);
+		if (bytes < 0)
+			break;
+		length += bytes;
+
+		int start = 0;
+		while (length - start >= 2)
+		{
+			int remaining = 0, multiplier = 1, header = start + 1;
+			while (header < length && (buffer[header] & 128) && header < start + 4)
+			{
+				remaining += (buffer[header++] & 127) * multiplier;
+				multiplier *= 128;
+			}
+			if (header >= length)
+				break;
+			remaining += (buffer[header++] & 127) * multiplier;
+			if (header + remaining > length)
+				break;
+
+			unsigned char reply[5] = { 0, 2, 0, 0, 0 };
+			int type = buffer[start] >> 4, qos = (buffer[start] >> 1) & 3;
+			if (type == CONNECT_MSG)
+				reply[0] = CONNACK_MSG << 4;
+			else if (type == SUBSCRIBE_MSG)
+			{
+				reply[0] = SUBACK_MSG << 4;
+				reply[1] = 3;
+				reply[2] = buffer[header];
+				reply[3] = buffer[header + 1];
+				reply[4] = 1;
+			}
+			else if (type == PUBLISH_MSG)
+			{
+				int topicLength = (buffer[header] << 8) + buffer[header + 1];
+				int data = header + 2 + topicLength + ((qos > 0) ? 2 : 0);
+				int len = header + remaining - data;
+				checkPayload(buffer + data, len, 0, &brokerReceived.errors);
+				if (len == opts.size)
+					brokerReceived.large++;
+				else
+					brokerReceived.errors++;
+				brokerReceived.bytes += len;
+				if (qos == 1)
+				{
+					reply[0] = PUBACK_MSG << 4;
+					reply[2] = buffer[data - 2];
+					reply[3] = buffer[data - 1];
+				}
+			}
+			else if (type == PUBACK_MSG)
+				brokerAcks++;
+			else if (type == PINGREQ_MSG)
+			{
+				reply[0] = PINGRESP_MSG << 4;
+				reply[1] = 0;
+			}
+			else if (type == DISCONNECT_MSG)
+				return;
+			if (reply[0] && network.write(reply, reply[1] + 2, 1000) != reply[1] + 2)
+				return;
+			if (type == SUBSCRIBE_MSG)
+			{
+				for (int i = 0; i < opts.messages; ++i)
+				{
+					if (sendPublish(network, nextId++, opts.size) != 0 || sendPublish(network, nextId++, 2) != 0)
+						return;
+				}
+			}
+			start = header + remaining;
+		}
+		memmove(buffer, buffer + start, length - start);
+		length -= start;
+	}
+}
+
+int listener = -1;
+
+/**
+* Broker thread.
+*/
+void* serveSocket(void*)
+{
+	MQTTNetwork network;
+	int socket = accept(listener, NULL, NULL);
+	if (socket != -1 && network.attach(socket) == 0)
+	{
+		serve(network);
+		network.disconnect();
+	}
+	return NULL;
+}
+
+/**
+* Count and check the publishes from the broker. Large ones arrive in fragments when fragment delivery is on.
+* @param[in] md The message, or a fragment of it
+*/
+void messageArrived(MQTT::MessageData& md)
+{
+	if (md.totallen == 2)
+	{
+		received.small++;
+		return;
+	}
+	if (md.offset != nextOffset || md.totallen != (size_t)opts.size)
+		received.errors++;
+	checkPayload((unsigned char*)md.message.payload, md.message.payloadlen, md.offset, &received.errors);
+	received.bytes += md.message.payloadlen;
+	nextOffset = md.offset + md.message.payloadlen;
+	if (nextOffset == md.totallen)
+	{
+		received.large++;
+		nextOffset = 0;
+	}
+}
+
+/**
+* Fill a chunk of a streamed publish with the pattern, as a reader of a file or a sensor would.
+* @param[in] chunk The chunk to fill
+* @return The number of bytes filled
+*/
+int fillChunk(MQTT::PayloadChunk& chunk)
+{
+	for (int i = 0; i < chunk.len; ++i)
+		chunk.data[i] = patternAt(chunk.offset + i);
+	return chunk.len;
+}
+
+/**
+* Subscribe, which makes the broker send a batch, and wait for the small publish behind the last large one.
+* @return The time taken in microseconds
+*/
+long long receiveBatch(void)
+{
+	int small = received.small;
+	long long start = microseconds();
+	if (client.subscribe(INBOUND_TOPIC, MQTT::QOS1, messageArrived) != MQTT::SUCCESS)
+	{
+		printf("Subscribe failed\n");
+		exit(-1);
+	}
+	for (int i = 0; i < 10000 && received.small < small + opts.messages; ++i)
+	{
+		if (client.yield(1) != MQTT::SUCCESS)
+		{
+			printf("Receive failed\n");
+			exit(-1);
+		}
+	}
+	return microseconds() - start;
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+	for (int i = 0; i < MAX_PAYLOAD_SIZE; ++i)
+		payload[i] = patternAt(i);
+	printf("%d publishes of %d bytes each way, through packet buffers of %d bytes\n", opts.messages, opts.size, CAYENNE_MAX_MESSAGE_SIZE);
+
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+		getsockname(listener, (struct sockaddr*)&address, &length) != 0)
+	{
+		printf("Could not listen on loopback\n");
+		return -1;
+	}
+	pthread_t broker;
+	if (pthread_create(&broker, NULL, serveSocket, NULL) != 0)
+	{
+		printf("Could not start the broker thread\n");
+		return -1;
+	}
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	data.keepAliveInterval = 0;
+	if (network.connect("127.0.0.1", ntohs(address.sin_port)) != 0 || client.connect(data) != MQTT::SUCCESS)
+	{
+		printf("Connect failed\n");
+		return -1;
+	}
+	double megabytes = (double)opts.messages * opts.size / (1024 * 1024);
+
+	client.setFragmentDelivery(true);
+	long long elapsed = receiveBatch();
+	printf("Receive in fragments   %8.1f MB/s, %d of %d publishes, %lld bytes\n", megabytes * 1e6 / elapsed, received.large,
+		opts.messages, received.bytes);
+	int delivered = received.large;
+
+	client.setFragmentDelivery(false);
+	elapsed = receiveBatch();
+	printf("Receive and skip       %8.1f MB/s, %d small publishes behind them delivered\n", megabytes * 1e6 / elapsed,
+		received.small - opts.messages);
+
+	long long start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (client.publishStream(OUTBOUND_TOPIC, opts.size, fillChunk, MQTT::QOS1) != MQTT::SUCCESS)
+		{
+			printf("Streamed publish failed\n");
+			return -1;
+		}
+	}
+	elapsed = microseconds() - start;
+	printf("Send from a callback   %8.1f MB/s\n", megabytes * 1e6 / elapsed);
+
+	start = microseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (client.publish(OUTBOUND_TOPIC, payload, opts.size, MQTT::QOS1) != MQTT::SUCCESS)
+		{
+			printf("Publish from memory failed\n");
+			return -1;
+		}
+	}
+	elapsed = microseconds() - start;
+	printf("Send from memory       %8.1f MB/s\n", megabytes * 1e6 / elapsed);
+
+	client.disconnect();
+	pthread_join(broker, NULL);
+	network.disconnect();
+	close(listener);
+
+	if (delivered != opts.messages || received.large != opts.messages || received.small != 2 * opts.messages ||
+		received.errors > 0 || brokerReceived.large != 2 * opts.messages || brokerReceived.errors > 0 ||
+		brokerAcks != 4 * opts.messages)
+	{
+		printf("Payloads were lost or damaged: %d errors received, %d errors sent, %d of %d acknowledgements\n",
+			received.errors, brokerReceived.errors, brokerAcks, 4 * opts.messages);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,376 @@
+/**
+* @file TLSBenchmark.cpp
+*
+* Benchmark for MQTTTLSNetwork. Compares reconnects with a full TLS handshake to reconnects that resume the
+* session, then measures the publish throughput over one connection and reports if kernel TLS was used.
+* By default the client connects to a minimal MQTT server on TCP loopback with a self-signed certificate made at
+* startup, so the numbers can be reproduced offline. The client verifies that certificate like any other.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include "MQTTLinux.h"
+#include "MQTTTLSNetwork.h"
+#include "CayenneMQTTClient.h"
+
+#define MAX_PAYLOAD_SIZE 1024
+
+MQTTTLSContext context;
+MQTTTLSNetwork network(context);
+CayenneMQTT::MQTTClient<MQTTTLSNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 128> client(network);
+char payload[MAX_PAYLOAD_SIZE + 1];
+
+struct opts_struct
+{
+	char* username;
+	char* password;
+	char* clientID;
+	char* host;
+	int port;
+	char* caFile;
+	bool verify;
+	int reconnects;
+	int messages;
+	int size;
+} opts =
+{
+	(char*)"username", (char*)"password", (char*)"clientID", NULL, CAYENNE_TLS_PORT, NULL, true, 20, 100000, 64
+};
+
+SSL_CTX* serverContext = NULL;
+X509* serverCertificate = NULL;
+int listener = -1;
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("Cayenne MQTT TLS Benchmark\n");
+	printf("Usage: tlsbench <options>, where options are:\n");
+	printf("  --host <hostname> (default is a loopback server the benchmark starts, %s is the Cayenne server)\n", CAYENNE_DOMAIN);
+	printf("  --port <port> (default is %d, only used with --host)\n", CAYENNE_TLS_PORT);
+	printf("  --username <username> (default is username)\n");
+	printf("  --password <password> (default is password)\n");
+	printf("  --clientID <clientID> (default is clientID)\n");
+	printf("  --cafile <file with trusted CA certificates> (default is the system certificates, and the loopback server's)\n");
+	printf("  --insecure (don't verify the server certificate)\n");
+	printf("  --reconnects <count> (default is 20)\n");
+	printf("  --messages <count> (default is 100000)\n");
+	printf("  --size <payload size> (default is 64, max is %d)\n", MAX_PAYLOAD_SIZE);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0)
+			usage();
+		else if (strcmp(argv[count], "--insecure") == 0)
+			opts.verify = false;
+		else if (count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--host") == 0)
+			opts.host = argv[++count];
+		else if (strcmp(argv[count], "--port") == 0)
+			opts.port = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--username") == 0)
+			opts.username = argv[++count];
+		else if (strcmp(argv[count], "--password") == 0)
+			opts.password = argv[++count];
+		else if (strcmp(argv[count], "--clientID") == 0)
+			opts.clientID = argv[++count];
+		else if (strcmp(argv[count], "--cafile") == 0)
+			opts.caFile = argv[++count];
+		else if (strcmp(argv[count], "--reconnects") == 0)
+			opts.reconnects = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--size") == 0)
+			opts.size = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.reconnects < 1 || opts.messages < 0 || opts.size < 1 || opts.size > MAX_PAYLOAD_SIZE)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Get the CPU time used by this thread, so the loopback server's isn't counted.
+* @return The CPU time in microseconds
+*/
+long long cpuMicroseconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+* Make the self-signed certificate and key of the loopback server, for the address 127.0.0.1.
+* @return true if they were made
+*/
+bool makeCertificate(void)
+{
+	EVP_PKEY* key = NULL;
+	EVP_PKEY_CTX* keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	X509V3_CTX extensionContext;
+	X509_EXTENSION* extension = NULL;
+	bool made = false;
+
+	if (!keyContext || EVP_PKEY_keygen_init(keyContext) != 1 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) != 1 ||
+		EVP_PKEY_keygen(keyContext, &key) != 1 || !(serverCertificate = X509_new()))
+		goto exit;
+	X509_set_version(serverCertificate, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(serverCertificate), 1);
+	X509_gmtime_adj(X509_getm_notBefore(serverCertificate), -60);
+	X509_gmtime_adj(X509_getm_notAfter(serverCertificate), 24 * 60 * 60);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(serverCertificate), "CN", MBSTRING_ASC, (const unsigned char*)"tlsbench", -1, -1, 0);
+	X509_set_issuer_name(serverCertificate, X509_get_subject_name(serverCertificate));
+	X509_set_pubkey(serverCertificate, key);
+	X509V3_set_ctx(&extensionContext, serverCertificate, serverCertificate, NULL, NULL, 0);
+	if (!(extension = X509V3_EXT_conf_nid(NULL, &extensionContext, NID_subject_alt_name, (char*)"IP:127.0.0.1")) ||
+		X509_add_ext(serverCertificate, extension, -1) != 1 || X509_sign(serverCertificate, key, EVP_sha256()) == 0)
+		goto exit;
+
+	serverContext = SSL_CTX_new(TLS_server_method());
+	made = serverContext && SSL_CTX_use_certificate(serverContext, serverCertificate) == 1 && SSL_CTX_use_PrivateKey(serverContext, key) == 1;
+
+exit:
+	if (extension)
+		X509_EXTENSION_free(extension);
+	if (key)
+		EVP_PKEY_free(key);
+	if (keyContext)
+		EVP_PKEY_CTX_free(keyContext);
+	return made;
+}
+
+/**
+* Answer a client until it disconnects: CONNACK for CONNECT, PUBACK for QoS 1 PUBLISH and PINGRESP for PINGREQ.
+* @param[in] ssl The server side of the connection
+*/
+void serve(SSL* ssl)
+{
+	static unsigned char buffer[65536];
+	int length = 0;
+
+	while (true)
+	{
+		int bytes = SSL_read(ssl, buffer + length, sizeof(buffer) - length);
+		if (bytes <= 0)
+			break;
+		length += bytes;
+
+		int start = 0;
+		while (length - start >= 2)
+		{
+			int remaining = 0, multiplier = 1, header = start + 1;
+			while (header < length && (buffer[header] & 128) && header < start + 4)
+			{
+				remaining += (buffer[header++] & 127) * multiplier;
+				multiplier *= 128;
+			}
+			if (header >= length)
+				break;
+			remaining += (buffer[header++] & 127) * multiplier;
+			if (header + remaining > length)
+				break;
+
+			unsigned char reply[4] = { 0, 2, 0, 0 };
+			int type = buffer[start] >> 4, qos = (buffer[start] >> 1) & 3;
+			if (type == CONNECT_MSG)
+				reply[0] = CONNACK_MSG << 4;
+			else if (type == PUBLISH_MSG && qos == 1)
+			{
+				int id = header + 2 + (buffer[header] << 8) + buffer[header + 1];
+				reply[0] = PUBACK_MSG << 4;
+				reply[2] = buffer[id];
+				reply[3] = buffer[id + 1];
+			}
+			else if (type == PINGREQ_MSG)
+			{
+				reply[0] = PINGRESP_MSG << 4;
+				reply[1] = 0;
+			}
+			else if (type == DISCONNECT_MSG)
+				return;
+			if (reply[0] && SSL_write(ssl, reply, reply[1] + 2) != reply[1] + 2)
+				return;
+			start = header + remaining;
+		}
+		memmove(buffer, buffer + start, length - start);
+		length -= start;
+	}
+}
+
+/**
+* Loopback server thread. Runs the TLS handshake with each connection in turn and answers it until it disconnects.
+*/
+void* serveTLS(void*)
+{
+	while (true)
+	{
+		int socket = accept(listener, NULL, NULL);
+		if (socket == -1)
+			break;
+		int nodelay = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)); // the replies are small, don't let them wait
+		SSL* ssl = SSL_new(serverContext);
+		if (ssl && SSL_set_fd(ssl, socket) == 1 && SSL_accept(ssl) == 1)
+		{
+			serve(ssl);
+			SSL_shutdown(ssl);
+		}
+		if (ssl)
+			SSL_free(ssl);
+		close(socket);
+		ERR_clear_error();
+	}
+	return NULL;
+}
+
+/**
+* Start the loopback server.
+* @return true if it was started, opts.host and opts.port are then set to its address
+*/
+bool startServer(void)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	pthread_t thread;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (!makeCertificate() || listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+		getsockname(listener, (struct sockaddr*)&address, &length) != 0 || pthread_create(&thread, NULL, serveTLS, NULL) != 0)
+		return false;
+	pthread_detach(thread);
+	opts.host = (char*)"127.0.0.1";
+	opts.port = ntohs(address.sin_port);
+	return true;
+}
+
+/**
+* Connect the network and the client.
+* @return true if connected, false if not
+*/
+bool connect(void)
+{
+	if (network.connect(opts.host, opts.port) != 0)
+	{
+		printf("TLS connect to %s:%d failed\n", opts.host, opts.port);
+		return false;
+	}
+	if (client.connect() != MQTT::SUCCESS)
+	{
+		printf("MQTT connect failed\n");
+		network.disconnect();
+		return false;
+	}
+	client.yield(10); // TLS 1.3 servers send the session tickets after the handshake
+	return true;
+}
+
+/**
+* Reconnect repeatedly and report the average time per reconnect.
+* @param[in] name Description of the run
+* @param[in] resume true to resume the session, false to run a full handshake each time
+* @return true if all the reconnects succeeded
+*/
+bool runReconnects(const char* name, bool resume)
+{
+	int resumed = 0;
+	long long elapsed = 0, cpu = 0;
+	for (int i = 0; i < opts.reconnects; ++i)
+	{
+		if (!resume)
+			network.clearSession();
+		long long start = microseconds();
+		long long cpuStart = cpuMicroseconds();
+		if (!connect())
+			return false;
+		elapsed += microseconds() - start;
+		cpu += cpuMicroseconds() - cpuStart;
+		resumed += network.sessionReused();
+		client.disconnect();
+		network.disconnect();
+	}
+	printf("%-20s %8.2f ms per reconnect, %8.2f ms CPU, %d of %d resumed\n", name, elapsed / 1000.0 / opts.reconnects, cpu / 1000.0 / opts.reconnects, resumed, opts.reconnects);
+	return true;
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+	memset(payload, 'x', opts.size);
+	payload[opts.size] = '\0';
+
+	bool local = !opts.host;
+	if (local && !startServer())
+	{
+		printf("Could not start the loopback server\n");
+		return -1;
+	}
+	if (context.init(opts.caFile, opts.verify) != 0 ||
+		(local && X509_STORE_add_cert(SSL_CTX_get_cert_store(context.get()), serverCertificate) != 1))
+	{
+		printf("Could not set up TLS\n");
+		return -1;
+	}
+	client.init(opts.username, opts.password, opts.clientID);
+
+	printf("Reconnecting %d times to %s:%d%s\n", opts.reconnects, opts.host, opts.port, local ? ", a loopback server" : "");
+	if (!runReconnects("Full handshake", false) || !runReconnects("Resumed session", true))
+		return -1;
+
+	if (opts.messages == 0 || !connect())
+		return 0;
+	printf("Publishing %d messages of %d bytes, kernel TLS send %s, receive %s\n", opts.messages, opts.size,
+		network.kernelSend() ? "on" : "off", network.kernelReceive() ? "on" : "off");
+	long long start = microseconds();
+	long long cpuStart = cpuMicroseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		if (client.publishData(DATA_TOPIC, 1, NULL, NULL, payload) != MQTT::SUCCESS)
+		{
+			printf("Publish failed after %d messages\n", i);
+			return -1;
+		}
+	}
+	client.disconnect();
+	network.disconnect();
+	long long elapsed = microseconds() - start;
+	long long cpu = cpuMicroseconds() - cpuStart;
+	printf("%-20s %8.0f messages/s %8.1f MB/s, CPU %6.0f ms\n", "Publish", opts.messages * 1e6 / elapsed, (double)opts.messages * opts.size / elapsed, cpu / 1000.0);
+	return 0;
+}
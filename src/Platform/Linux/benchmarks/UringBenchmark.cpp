@@ -0,0 +1,271 @@
+/**
+* @file UringBenchmark.cpp
+*
+* Throughput comparison of MQTTNetwork and MQTTUringNetwork on loopback. Each run publishes QoS 0 messages
+* round robin over a set of connections to a local sink process, which counts the bytes it receives.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "MQTTLinux.h"
+#include "MQTTUringNetwork.h"
+#include "MQTTClient.h"
+
+#define MAX_CONNECTIONS 64
+#define MAX_PAYLOAD_SIZE 1024
+
+MQTTUring ring;
+
+/**
+* A connection using plain socket calls.
+*/
+struct SocketConnection
+{
+	SocketConnection() : client(network)
+	{
+	}
+
+	MQTTNetwork network;
+	MQTT::Client<MQTTNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 64, 1> client;
+};
+
+/**
+* A connection using the shared io_uring.
+*/
+struct UringConnection
+{
+	UringConnection() : network(ring), client(network)
+	{
+	}
+
+	MQTTUringNetwork network;
+	MQTT::Client<MQTTUringNetwork, MQTTTimer, MAX_PAYLOAD_SIZE + 64, 1> client;
+};
+
+SocketConnection socketConnections[MAX_CONNECTIONS];
+UringConnection uringConnections[MAX_CONNECTIONS];
+char payload[MAX_PAYLOAD_SIZE];
+
+struct opts_struct
+{
+	int connections;
+	int messages;
+	int size;
+} opts =
+{
+	16, 500000, 64
+};
+
+/**
+* Output usage info for this benchmark.
+*/
+void usage(void)
+{
+	printf("MQTT io_uring Network Benchmark\n");
+	printf("Usage: uringbench <options>, where options are:\n");
+	printf("  --connections <count> (default is 16, max is %d)\n", MAX_CONNECTIONS);
+	printf("  --messages <count> (default is 500000)\n");
+	printf("  --size <payload size> (default is 64, max is %d)\n", MAX_PAYLOAD_SIZE);
+	printf("  --help (show this)\n");
+	exit(-1);
+}
+
+/**
+* Get options from the command line.
+* @param[in] argc Count of command line arguments.
+* @param[in] argv Command line argument string array.
+*/
+void getOptions(int argc, char** argv)
+{
+	int count = 1;
+
+	while (count < argc)
+	{
+		if (strcmp(argv[count], "--help") == 0 || count + 1 == argc)
+			usage();
+		else if (strcmp(argv[count], "--connections") == 0)
+			opts.connections = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--messages") == 0)
+			opts.messages = atoi(argv[++count]);
+		else if (strcmp(argv[count], "--size") == 0)
+			opts.size = atoi(argv[++count]);
+		else
+			usage();
+		count++;
+	}
+	if (opts.connections < 1 || opts.connections > MAX_CONNECTIONS || opts.messages < 1 || opts.size < 0 || opts.size > MAX_PAYLOAD_SIZE)
+		usage();
+}
+
+/**
+* Get the time.
+* @return The time in microseconds
+*/
+long long microseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/**
+* Get the CPU time used by this process.
+* @return The CPU time in microseconds
+*/
+long long cpuMicroseconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+* Run a sink in a child process. It accepts the connections, answers the MQTT connects, discards everything
+* else and writes the number of bytes it received to the pipe once all the connections have closed.
+* @param[in] listener The listening socket
+* @param[in] connections The number of connections to expect
+* @param[in] result The pipe to write the byte count to
+*/
+void runSink(int listener, int connections, int result)
+{
+	static struct pollfd fds[MAX_CONNECTIONS + 1];
+	static bool connected[MAX_CONNECTIONS + 1];
+	static unsigned char buffer[65536];
+	long long total = 0;
+	int accepted = 0, closed = 0;
+
+	fds[0].fd = listener;
+	fds[0].events = POLLIN;
+	while (closed < connections)
+	{
+		if (poll(fds, accepted + 1, -1) <= 0)
+			continue;
+		if ((fds[0].revents & POLLIN) && accepted < connections)
+		{
+			int socket = accept(listener, NULL, NULL);
+			if (socket != -1)
+			{
+				++accepted;
+				fds[accepted].fd = socket;
+				fds[accepted].events = POLLIN;
+				connected[accepted] = false;
+			}
+		}
+		for (int i = 1; i <= accepted; ++i)
+		{
+			if (fds[i].fd == -1 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			int bytes = ::read(fds[i].fd, buffer, sizeof(buffer));
+			if (bytes <= 0)
+			{
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				closed++;
+				continue;
+			}
+			total += bytes;
+			if (!connected[i]) // the first data is the connect packet
+			{
+				static unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+				connected[i] = ::write(fds[i].fd, connack, sizeof(connack)) == sizeof(connack);
+			}
+		}
+	}
+	if (::write(result, &total, sizeof(total)) != sizeof(total))
+		exit(1);
+	exit(0);
+}
+
+/**
+* Publish the messages over a set of connections and report the throughput.
+* @param[in] name Name of the network class
+* @param[in] connections The connections to use
+* @param[in] batch true to submit the ring once per round of publishes
+*/
+template<class Connection>
+void runBenchmark(const char* name, Connection* connections, bool batch)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	int result[2];
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, MAX_CONNECTIONS) != 0 ||
+		getsockname(listener, (struct sockaddr*)&address, &length) != 0 || pipe(result) != 0)
+	{
+		printf("Could not start the sink\n");
+		exit(-1);
+	}
+	fflush(stdout);
+	pid_t sink = fork();
+	if (sink == 0)
+		runSink(listener, opts.connections, result[1]);
+	close(listener);
+
+	for (int i = 0; i < opts.connections; ++i)
+	{
+		MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+		data.keepAliveInterval = 0;
+		if (connections[i].network.connect("127.0.0.1", ntohs(address.sin_port)) != 0 || connections[i].client.connect(data) != MQTT::SUCCESS)
+		{
+			printf("%s: connection %d failed\n", name, i);
+			exit(-1);
+		}
+	}
+
+	long long start = microseconds();
+	long long cpuStart = cpuMicroseconds();
+	for (int i = 0; i < opts.messages; ++i)
+	{
+		Connection& connection = connections[i % opts.connections];
+		if (connection.client.publish("v1/bench/things/device/data/1", payload, opts.size, MQTT::QOS0) != MQTT::SUCCESS)
+		{
+			printf("%s: publish failed\n", name);
+			exit(-1);
+		}
+		if (batch && (i % opts.connections) == opts.connections - 1)
+			ring.run(0); // one system call for the whole round
+	}
+	for (int i = 0; i < opts.connections; ++i)
+	{
+		connections[i].client.disconnect();
+		connections[i].network.disconnect();
+	}
+
+	long long total = 0;
+	if (::read(result[0], &total, sizeof(total)) != sizeof(total))
+		total = 0;
+	long long elapsed = microseconds() - start;
+	long long cpu = cpuMicroseconds() - cpuStart;
+	waitpid(sink, NULL, 0);
+	close(result[0]);
+	close(result[1]);
+
+	printf("%-28s %9.0f messages/s %8.1f MB/s, publisher CPU %6.0f ms\n", name, opts.messages * 1e6 / elapsed, total / (double)elapsed, cpu / 1000.0);
+}
+
+// Main function.
+int main(int argc, char** argv)
+{
+	getOptions(argc, argv);
+	memset(payload, 'x', sizeof(payload));
+	printf("%d messages of %d bytes over %d connections\n", opts.messages, opts.size, opts.connections);
+
+	runBenchmark("MQTTNetwork", socketConnections, false);
+	if (ring.init() != 0)
+	{
+		printf("io_uring is not available%s\n", MQTTNETWORK_URING ? "" : ", build with MQTTNETWORK_URING=1");
+		return 0;
+	}
+	runBenchmark("MQTTUringNetwork", uringConnections, false);
+	ring.setBatching(true);
+	runBenchmark("MQTTUringNetwork (batched)", uringConnections, true);
+	return 0;
+}
@@ -101,19 +101,17 @@ int connectClient(void)
 		sleep(2);
 	}
 
-	if ((error = mqttClient.connect()) != MQTT::SUCCESS) {
+	// Start the MQTT connection. Everything up to finishConnect is sent together with the connect packet, so the
+	// connection, subscriptions and device info only take about one round trip to the server.
+	if ((error = mqttClient.beginConnect()) != MQTT::SUCCESS) {
 		printf("MQTT connect failed, error: %d\n", error);
 		return error;
 	}
-	printf("Connected\n");
 
 	// Subscribe to required topics.
-	if ((error = mqttClient.subscribe(COMMAND_TOPIC, CAYENNE_ALL_CHANNELS)) != CAYENNE_SUCCESS) {
-		printf("Subscription to Command topic failed, error: %d\n", error);
-	}
-	if ((error = mqttClient.subscribe(CONFIG_TOPIC, CAYENNE_ALL_CHANNELS)) != CAYENNE_SUCCESS) {
-		printf("Subscription to Config topic failed, error:%d\n", error);
-	}
+	CayenneTopic topics[] = { COMMAND_TOPIC, CONFIG_TOPIC };
+	unsigned int channels[] = { CAYENNE_ALL_CHANNELS, CAYENNE_ALL_CHANNELS };
+	mqttClient.subscribeMany(2, topics, channels);
 
 	// Send device info. Here we just send some example values for the system info. These should be changed to use actual system data, or removed if not needed.
 	mqttClient.publishData(SYS_VERSION_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, CAYENNE_VERSION);
@@ -121,6 +119,12 @@ int connectClient(void)
 	mqttClient.publishData(SYS_CPU_MODEL_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, "CPU Model");
 	mqttClient.publishData(SYS_CPU_SPEED_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, "1000000000");
 
+	if ((error = mqttClient.finishConnect()) != MQTT::SUCCESS) {
+		printf("MQTT connect failed, error: %d\n", error);
+		return error;
+	}
+	printf("Connected\n");
+
 	return CAYENNE_SUCCESS;
 }
 
@@ -193,6 +197,9 @@ int main(int argc, char** argv)
 	// Set the default function that receives Cayenne messages.
 	mqttClient.setDefaultMessageHandler(messageArrived);
 
+	// Send the first packets with the TCP handshake when reconnecting, if the server supports TCP Fast Open.
+	ipstack.setFastOpen(true);
+
 	// Connect to Cayenne.
 	if (connectClient() == CAYENNE_SUCCESS) {
 		// Run main loop.
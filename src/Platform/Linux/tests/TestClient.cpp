@@ -5,11 +5,22 @@
 */
 
 
+// The session tests store publishes bigger than a packet, which the default one packet in-flight store can't hold.
+#define MQTTCLIENT_INFLIGHT_STORE_SIZE 1024
+// QoS 2 is off by default, the duplicate tracking test needs it.
+#define MQTTCLIENT_QOS2 1
+// Topic aliases are off by default, the MQTT 5 test needs room for a few.
+#define MQTTCLIENT_TOPIC_ALIAS_STORE_SIZE 256
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <unistd.h>
 #include "MQTTLinux.h"
+#include "MQTTSNPacket.h"
 #include "CayenneMQTTClient.h"
 
 bool checkMessages = false;
@@ -32,6 +43,7 @@ void usage(void)
 	printf("  --username <username> (default is username)\n");
 	printf("  --password <password> (default is password)\n");
 	printf("  --clientID <clientID> (default is clientID)\n");
+	printf("  --offline (only run the tests that don't need a server)\n");
 	printf("  --help (show this)\n");
 	exit(-1);
 }
@@ -44,9 +56,10 @@ struct opts_struct
 	char* clientID;
 	char* host;
 	int port;
+	bool offline;
 } opts =
 {
-	(char*)"username", (char*)"password", (char*)"clientID", (char*)CAYENNE_DOMAIN, CAYENNE_PORT
+	(char*)"username", (char*)"password", (char*)"clientID", (char*)CAYENNE_DOMAIN, CAYENNE_PORT, false
 };
 
 char alternateClientID[] = "alternateClientID";
@@ -101,6 +114,10 @@ void getOptions(int argc, char** argv)
 			else
 				usage();
 		}
+		else if (strcmp(argv[count], "--offline") == 0)
+		{
+			opts.offline = true;
+		}
 		count++;
 	}
 	
@@ -564,12 +581,928 @@ void testPublishFloat(CayenneTopic topic, unsigned int channel, float value, con
 	checkPublishSuccess(topic, type, unit, shouldReceive);
 }
 
+/**
+* Network that keeps what the client writes and answers reads from a queue of replies, for testing the session
+* state kept across reconnects without a server.
+*/
+class MemoryNetwork
+{
+public:
+	MemoryNetwork() : writtenLength(0), writeCount(0), replyLength(0), readLimit(0), disconnected(false) {
+	}
+
+	int read(unsigned char* buffer, int len, int timeout_ms) {
+		if (readLimit > 0 && len > readLimit)
+			len = readLimit;
+		int length = (len < replyLength) ? len : replyLength;
+		memcpy(buffer, reply, length);
+		memmove(reply, reply + length, replyLength - length);
+		replyLength -= length;
+		return length;
+	}
+
+	int write(unsigned char* buffer, int len, int timeout_ms) {
+		return writev(&buffer, &len, 1, timeout_ms);
+	}
+
+	int writev(unsigned char** buffers, int* lengths, int count, int timeout_ms) {
+		int length = 0;
+		++writeCount;
+		for (int i = 0; i < count; ++i) {
+			if (writtenLength + lengths[i] > (int)sizeof(written))
+				return -1;
+			memcpy(&written[writtenLength], buffers[i], lengths[i]);
+			writtenLength += lengths[i];
+			length += lengths[i];
+		}
+		return length;
+	}
+
+	int disconnect() {
+		disconnected = true;
+		return 0;
+	}
+
+	void addReply(const unsigned char* data, int length) {
+		memcpy(&reply[replyLength], data, length);
+		replyLength += length;
+	}
+
+	unsigned char written[4096];	// everything the client has written
+	int writtenLength;
+	int writeCount;					// calls to write and writev
+	unsigned char reply[4096];		// what the next reads return
+	int replyLength;
+	int readLimit;					// the most each read returns, 0 for no limit
+	bool disconnected;
+};
+
+typedef MQTT::Client<MemoryNetwork, MQTTTimer, CAYENNE_MAX_MESSAGE_SIZE> SessionClient;
+
+/**
+* Connect a client to the memory network with cleansession 0, so its in-flight publishes are kept for the next connection.
+* @param[in] client The client
+* @param[in] network The network the client uses
+* @param[in] sessionPresent The server has kept the session
+* @return success code
+*/
+int connectSession(SessionClient& client, MemoryNetwork& network, bool sessionPresent)
+{
+	const unsigned char connack[] = { 0x20, 0x02, (unsigned char)(sessionPresent ? 1 : 0), 0x00 };
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	data.cleansession = 0;
+	data.clientID.cstring = opts.clientID;
+	network.writtenLength = 0;
+	network.addReply(connack, sizeof(connack));
+	return client.connect(data);
+}
+
+/**
+* Check the publishes written after the connect packet are the expected ones, in order, and marked as duplicates.
+* @param[in] network The network the client wrote to
+* @param[in] payloads The payloads of the publishes, in the order they were first sent
+* @param[in] count The number of publishes
+* @return true if the publishes match, false otherwise
+*/
+bool checkResent(MemoryNetwork& network, const char* payloads[], int count)
+{
+	int found = 0;
+	int offset = 0;
+	while (offset < network.writtenLength) {
+		MQTTHeader header = { 0 };
+		int remainingLength = 0;
+		header.byte = network.written[offset];
+		int length = 1 + MQTTPacket_decodeBuf(&network.written[offset + 1], &remainingLength) + remainingLength;
+		if (header.bits.type == PUBLISH_MSG) {
+			unsigned char dup = 0, retained = 0;
+			int qos = 0;
+			size_t payloadLength = 0;
+			unsigned short id = 0;
+			MQTTString topicName = MQTTString_initializer;
+			unsigned char* payload = NULL;
+			if (found >= count || MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topicName, &payload, &payloadLength, &network.written[offset], length) != 1)
+				return false;
+			if (!dup || payloadLength != strlen(payloads[found]) || memcmp(payload, payloads[found], payloadLength) != 0)
+				return false;
+			++found;
+		}
+		offset += length;
+	}
+	return found == count;
+}
+
+/**
+* Serialize a publish from the server.
+* @param[out] buffer The buffer for the packet
+* @param[in] length The length of the buffer
+* @param[in] topic The topic name
+* @param[in] payload The payload
+* @param[in] qos The QoS of the publish
+* @param[in] id The packet id, for QoS 1 and 2
+* @return The length of the packet
+*/
+int buildPublish(unsigned char* buffer, int length, const char* topic, const char* payload, int qos, unsigned short id)
+{
+	MQTTString topicName = MQTTString_initializer;
+	topicName.cstring = (char*)topic;
+	return MQTTSerialize_publish(buffer, length, 0, qos, 0, id, topicName, (unsigned char*)payload, strlen(payload));
+}
+
+/**
+* Queue a publish from the server on the memory network.
+* @param[in] network The network
+* @param[in] topic The topic name
+* @param[in] payload The payload
+* @param[in] qos The QoS of the publish
+* @param[in] id The packet id, for QoS 1 and 2
+*/
+void addPublish(MemoryNetwork& network, const char* topic, const char* payload, int qos = 0, unsigned short id = 0)
+{
+	unsigned char packet[sizeof(network.reply)];
+	network.addReply(packet, buildPublish(packet, sizeof(packet), topic, payload, qos, id));
+}
+
+/**
+* Queue an acknowledgement from the server on the memory network.
+* @param[in] network The network
+* @param[in] type The packet type, such as PUBACK_MSG
+* @param[in] id The packet id
+*/
+void addAck(MemoryNetwork& network, unsigned char type, unsigned short id)
+{
+	unsigned char packet[4];
+	network.addReply(packet, MQTTSerialize_ack(packet, sizeof(packet), type, 0, id));
+}
+
+/**
+* Check the acknowledgements written to the memory network are the expected ones, in order.
+* @param[in] network The network the client wrote to
+* @param[in] types The packet types
+* @param[in] ids The packet ids
+* @param[in] count The number of acknowledgements
+* @return true if the acknowledgements match, false otherwise
+*/
+bool checkAcks(MemoryNetwork& network, const unsigned char types[], const unsigned short ids[], int count)
+{
+	if (network.writtenLength != count * 4)
+		return false;
+	for (int i = 0; i < count; ++i) {
+		unsigned char type = 0, dup = 0;
+		unsigned short id = 0;
+		if (MQTTDeserialize_ack(&type, &dup, &id, &network.written[i * 4], 4) != 1 || type != types[i] || id != ids[i])
+			return false;
+	}
+	return true;
+}
+
+char receivedPayloads[4096];
+int receivedLength = 0;
+size_t receivedOffset = 0;
+int receivedFragments = 0;
+
+/**
+* Message handler that records the payloads of the memory network tests, each followed by a '|'. The fragments of a
+* large publish are joined, and one that doesn't follow on from the last is left out, so the payload doesn't match.
+* @param[in] md The message
+*/
+void recordMessage(MQTT::MessageData& md)
+{
+	if (md.offset != receivedOffset || receivedLength + md.message.payloadlen + 2 > sizeof(receivedPayloads))
+		return;
+	memcpy(&receivedPayloads[receivedLength], md.message.payload, md.message.payloadlen);
+	receivedLength += md.message.payloadlen;
+	receivedOffset += md.message.payloadlen;
+	if (receivedOffset == md.totallen) {
+		receivedPayloads[receivedLength++] = '|';
+		receivedOffset = 0;
+	}
+	receivedPayloads[receivedLength] = '\0';
+	++receivedFragments;
+}
+
+/**
+* Forget the payloads recorded so far.
+*/
+void clearMessages(void)
+{
+	receivedLength = 0;
+	receivedPayloads[0] = '\0';
+	receivedOffset = 0;
+	receivedFragments = 0;
+}
+
+/**
+* Print the result of a test that needs no server.
+* @param[in] name The test
+* @param[in] succeeded The test passed
+*/
+void reportTest(const char* name, bool succeeded)
+{
+	printf("%s", name);
+	if (succeeded) {
+		printf(" - SUCCESS\n");
+	}
+	else {
+		failureCount++;
+		printf(" - FAILURE\n");
+	}
+}
+
+/**
+* Test that the unacknowledged publishes of a kept session are all resent, in order and marked as duplicates, when the
+* client reconnects. With writev the stored packets can be bigger than the send buffer, so one of them is.
+*/
+void testResendInflight(void)
+{
+	static char large[300];
+	memset(large, 'x', sizeof(large) - 1);
+	const char* payloads[] = { "1", "2", large };
+	int count = MQTTCLIENT_WRITEV ? 3 : 2;
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	client.setPublishWindow(count + 1); // so no publish waits for its acknowledgement
+	for (int i = 0; i < count && succeeded; ++i)
+		succeeded = (client.publish("test/resend", (void*)payloads[i], strlen(payloads[i]), MQTT::QOS1) == MQTT::SUCCESS);
+	if (succeeded)
+		client.disconnect();
+	succeeded = succeeded && connectSession(client, network, true) == MQTT::SUCCESS && checkResent(network, payloads, count);
+	reportTest("Resend in-flight publishes on reconnect", succeeded);
+}
+
+/**
+* Build a session snapshot holding a single QoS 1 publish.
+* @param[out] buffer The buffer for the snapshot
+* @param[in] length The length of the buffer
+* @param[in] payloadLength The length of the payload of the publish
+* @return The length of the snapshot
+*/
+int buildSnapshot(unsigned char* buffer, int length, int payloadLength)
+{
+	static unsigned char payload[2048];
+	MQTTString topicName = MQTTString_initializer;
+	topicName.cstring = (char*)"test/snapshot";
+	unsigned char* ptr = buffer;
+	memcpy(ptr, "MQS\2\0\0\1\0\1\1\0", 11); // the packet id counter, then one entry: id 1, QoS 1, no PUBREL
+	ptr += 13;
+	int packetLength = MQTTSerialize_publish(ptr, length - 17, 0, 1, 0, 1, topicName, payload, payloadLength);
+	buffer[11] = (unsigned char)(packetLength >> 8);
+	buffer[12] = (unsigned char)packetLength;
+	ptr += packetLength;
+	memset(ptr, 0, 4); // no subscriptions and no QoS 2 ids
+	return ptr + 4 - buffer;
+}
+
+/**
+* Test a session snapshot restores the in-flight publishes, so they are resent on connecting, and that a truncated,
+* corrupt or oversized snapshot is rejected without changing the session.
+*/
+void testSessionSnapshot(void)
+{
+	static unsigned char snapshot[SessionClient::SESSION_SIZE];
+	static unsigned char saved[SessionClient::SESSION_SIZE];
+	static unsigned char corrupt[SessionClient::SESSION_SIZE];
+	const char* payloads[] = { "1", "2", "3" };
+	int count = 3;
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	client.setPublishWindow(count + 1); // so no publish waits for its acknowledgement
+	for (int i = 0; i < count && succeeded; ++i)
+		succeeded = (client.publish("test/snapshot", (void*)payloads[i], strlen(payloads[i]), MQTT::QOS1) == MQTT::SUCCESS);
+	int length = client.saveSession(snapshot, sizeof(snapshot));
+	succeeded = succeeded && length > 0;
+
+	MemoryNetwork restoredNetwork;
+	SessionClient restored(restoredNetwork, 100);
+	succeeded = succeeded && restored.restoreSession(snapshot, length) == MQTT::SUCCESS
+		&& connectSession(restored, restoredNetwork, true) == MQTT::SUCCESS && checkResent(restoredNetwork, payloads, count);
+	reportTest("Restore a session snapshot", succeeded);
+
+	// the snapshot starts with 7 bytes, then 6 for each entry followed by the stored publishes
+	int store = 7 + count * 6;
+	SessionClient rejecting(network, 100);
+	succeeded = succeeded && rejecting.restoreSession(snapshot, length) == MQTT::SUCCESS;
+	succeeded = succeeded && rejecting.restoreSession(snapshot, length - 1) == MQTT::FAILURE;
+	memcpy(corrupt, snapshot, length);
+	corrupt[store] = 0x40; // the first stored packet is a PUBACK
+	succeeded = succeeded && rejecting.restoreSession(corrupt, length) == MQTT::FAILURE;
+	memcpy(corrupt, snapshot, length);
+	corrupt[store + 1] += 1; // the first stored publish is longer than its entry
+	succeeded = succeeded && rejecting.restoreSession(corrupt, length) == MQTT::FAILURE;
+	memcpy(corrupt, snapshot, length);
+	corrupt[7 + 5] -= 1; // the first entry is shorter than its publish
+	succeeded = succeeded && rejecting.restoreSession(corrupt, length) == MQTT::FAILURE;
+	succeeded = succeeded && rejecting.saveSession(saved, sizeof(saved)) == length && memcmp(saved, snapshot, length) == 0;
+	reportTest("Reject a corrupt session snapshot", succeeded);
+
+	// a publish bigger than the packet size can only be resent from the store with writev, and none can be bigger than the store
+	int largeLength = buildSnapshot(corrupt, sizeof(corrupt), 300);
+	succeeded = (rejecting.restoreSession(corrupt, largeLength) == (MQTTCLIENT_WRITEV ? MQTT::SUCCESS : MQTT::FAILURE));
+	succeeded = succeeded && rejecting.restoreSession(snapshot, length) == MQTT::SUCCESS;
+	largeLength = buildSnapshot(corrupt, sizeof(corrupt), SessionClient::INFLIGHTSTORE_SIZE);
+	succeeded = succeeded && rejecting.restoreSession(corrupt, largeLength) == MQTT::FAILURE;
+	succeeded = succeeded && rejecting.saveSession(saved, sizeof(saved)) == length && memcmp(saved, snapshot, length) == 0;
+	reportTest("Reject an oversized session snapshot", succeeded);
+}
+
+/**
+* Test beginConnect asks the server to keep the session only when resuming, and rebuilds the kept connect packet when
+* that changes.
+*/
+void testBeginConnect(void)
+{
+	const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	const bool resume[] = { false, true, true, false };
+	MemoryNetwork network;
+	CayenneMQTT::MQTTClient<MemoryNetwork, MQTTTimer> client(network, opts.username, opts.password, opts.clientID);
+	bool succeeded = true;
+	for (size_t i = 0; i < sizeof(resume) / sizeof(resume[0]) && succeeded; ++i) {
+		network.writtenLength = 0;
+		network.addReply(connack, sizeof(connack));
+		succeeded = client.beginConnect(resume[i]) == CAYENNE_SUCCESS && client.finishConnect() == CAYENNE_SUCCESS;
+		// the connect flags follow the fixed header, the protocol name and the protocol level
+		int flags = 2 + 2 + network.written[3] + 1;
+		succeeded = succeeded && network.written[0] == 0x10 && ((network.written[flags] & 0x02) != 0) == !resume[i];
+		client.disconnect();
+	}
+	reportTest("Begin connecting with and without resuming the session", succeeded);
+}
+
+/**
+* Test subscribing to more topics than fit in one packet sends every topic filter, in order, in packets no bigger than
+* the packet size.
+*/
+void testSubscribeMany(void)
+{
+	const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	const unsigned char suback[] = { 0x90, 0x03, 0x00, 0x00, 0x00 }; // the ids of subacks that follow a pipelined connect aren't checked
+	const int count = 8;
+	CayenneTopic topics[count];
+	unsigned int channels[count];
+	MemoryNetwork network;
+	CayenneMQTT::MQTTClient<MemoryNetwork, MQTTTimer> client(network, opts.username, opts.password, opts.clientID);
+	network.addReply(connack, sizeof(connack));
+	for (int i = 0; i < count; ++i) {
+		topics[i] = COMMAND_TOPIC;
+		channels[i] = i;
+		network.addReply(suback, sizeof(suback));
+	}
+	// sent behind the connect, so the subacks don't have to match the packets
+	bool succeeded = client.beginConnect() == CAYENNE_SUCCESS && client.subscribeMany(count, topics, channels) == CAYENNE_SUCCESS &&
+		client.finishConnect() == CAYENNE_SUCCESS;
+	int found = 0, packets = 0;
+	for (int offset = 0; succeeded && offset < network.writtenLength; ) {
+		MQTTHeader header = { 0 };
+		int remainingLength = 0;
+		header.byte = network.written[offset];
+		int headerLength = 1 + MQTTPacket_decodeBuf(&network.written[offset + 1], &remainingLength);
+		int end = offset + headerLength + remainingLength;
+		if (header.bits.type == SUBSCRIBE_MSG) {
+			succeeded = (headerLength + remainingLength <= CAYENNE_MAX_MESSAGE_SIZE);
+			++packets;
+			// the packet id, then each topic filter as its length, the topic and its QoS
+			for (int cursor = offset + headerLength + 2; succeeded && cursor < end; ++found) {
+				char expected[CAYENNE_MAX_MESSAGE_SIZE];
+				int length = (network.written[cursor] << 8) + network.written[cursor + 1];
+				CayenneBuildTopic(expected, sizeof(expected), opts.username, opts.clientID, topics[found], channels[found]);
+				succeeded = found < count && length == (int)strlen(expected) && memcmp(&network.written[cursor + 2], expected, length) == 0;
+				cursor += 2 + length + 1;
+			}
+		}
+		offset = end;
+	}
+	succeeded = succeeded && found == count && packets > 1;
+	client.disconnect();
+	reportTest("Subscribe to topics in several packets", succeeded);
+}
+
+/**
+* Test networks connecting to the same host share its resolved addresses, and that a network only holds its socket.
+*/
+void testAddressCache(void)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	bool succeeded = listener != -1 && bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0 && listen(listener, 2) == 0
+		&& getsockname(listener, (struct sockaddr*)&address, &length) == 0;
+	int port = ntohs(address.sin_port);
+	MQTTAddress addresses[MQTTNETWORK_MAX_ADDRESSES];
+	MQTTNetwork first, second;
+	MQTTAddressCache::shared().clear();
+	succeeded = succeeded && MQTTAddressCache::shared().get("127.0.0.1", port, addresses) == 0;
+	succeeded = succeeded && first.connect("127.0.0.1", port) == 0 && MQTTAddressCache::shared().get("127.0.0.1", port, addresses) == 1;
+	succeeded = succeeded && second.connect("127.0.0.1", port) == 0 && MQTTAddressCache::shared().get("127.0.0.1", port, addresses) == 1;
+	succeeded = succeeded && sizeof(MQTTNetwork) <= 2 * sizeof(int);
+	first.disconnect();
+	second.disconnect();
+	if (listener != -1)
+		close(listener);
+	reportTest("Share resolved addresses between networks", succeeded);
+}
+
+/**
+* Test that several packets that arrive in one read are each framed from the receive buffer, that a packet that arrives
+* a byte at a time is framed once it is whole, and that in non-blocking mode a partial packet stays buffered until the
+* rest of it arrives.
+*/
+void testReceiveFraming(void)
+{
+	const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	client.setDefaultMessageHandler(recordMessage);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	clearMessages();
+	addPublish(network, "test/framing", "one");
+	addPublish(network, "test/framing", "two");
+	addPublish(network, "test/framing", "three");
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "one|two|three|") == 0;
+	clearMessages();
+	network.readLimit = 1;
+	addPublish(network, "test/framing", "split");
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "split|") == 0;
+	client.disconnect();
+	reportTest("Frame packets from the receive buffer", succeeded);
+
+	unsigned char packet[64];
+	int length = buildPublish(packet, sizeof(packet), "test/framing", "halves", 0, 0);
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	data.clientID.cstring = opts.clientID;
+	MemoryNetwork stepNetwork;
+	SessionClient stepClient(stepNetwork, 100);
+	stepClient.setDefaultMessageHandler(recordMessage);
+	stepClient.setNonBlocking(true);
+	clearMessages();
+	succeeded = stepClient.connect(data) == MQTT::SUCCESS && !stepClient.isConnected();
+	stepNetwork.addReply(connack, sizeof(connack));
+	stepNetwork.addReply(packet, length / 2);
+	succeeded = succeeded && stepClient.onReadable() == MQTT::SUCCESS && stepClient.isConnected() && receivedLength == 0;
+	stepNetwork.addReply(packet + length / 2, length - length / 2);
+	succeeded = succeeded && stepClient.onReadable() == MQTT::SUCCESS && strcmp(receivedPayloads, "halves|") == 0;
+	reportTest("Keep a partial packet buffered in non-blocking mode", succeeded);
+}
+
+/**
+* Fill a payload with letters that depend on the position, so a misplaced chunk shows.
+* @param[out] payload The payload
+* @param[in] length The length of the payload, not counting the null that ends it
+*/
+void fillPattern(char* payload, int length)
+{
+	for (int i = 0; i < length; ++i)
+		payload[i] = 'a' + (i * 7) % 26;
+	payload[length] = '\0';
+}
+
+/**
+* Test that a publish too big for the packet buffers is delivered in fragments that join up to the whole payload, or
+* skipped when fragment delivery is off, and that the small publish behind it is delivered either way.
+*/
+void testReceiveFragments(void)
+{
+	static char large[1001];
+	static char expected[sizeof(large) + 16];
+	fillPattern(large, sizeof(large) - 1);
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	client.setDefaultMessageHandler(recordMessage);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	client.setFragmentDelivery(true);
+	clearMessages();
+	addPublish(network, "test/fragments", large);
+	addPublish(network, "test/fragments", "behind");
+	snprintf(expected, sizeof(expected), "%s|behind|", large);
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, expected) == 0 && receivedFragments > 2;
+	client.setFragmentDelivery(false);
+	clearMessages();
+	addPublish(network, "test/fragments", large);
+	addPublish(network, "test/fragments", "behind");
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "behind|") == 0;
+	client.disconnect();
+	reportTest("Receive a large publish in fragments", succeeded);
+}
+
+int streamFailAt = -1;
+
+/**
+* Fill a chunk of a streamed publish with the pattern of fillPattern, or give up once streamFailAt is reached.
+* @param[in,out] chunk The chunk to fill
+* @return The number of bytes filled, or -1 to give up
+*/
+int fillStreamChunk(MQTT::PayloadChunk& chunk)
+{
+	if (streamFailAt >= 0 && chunk.offset + chunk.len > (size_t)streamFailAt)
+		return -1;
+	for (int i = 0; i < chunk.len; ++i)
+		chunk.data[i] = 'a' + ((chunk.offset + i) * 7) % 26;
+	return chunk.len;
+}
+
+/**
+* Test a publish streamed from a callback is written whole, that a source that gives up before anything is sent fails
+* the publish and keeps the connection, and that one that gives up part way through disconnects the network.
+*/
+void testStreamPublish(void)
+{
+	static char expected[1001];
+	fillPattern(expected, sizeof(expected) - 1);
+	int length = sizeof(expected) - 1;
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	network.writtenLength = 0;
+	streamFailAt = -1;
+	succeeded = succeeded && client.publishStream("test/stream", length, fillStreamChunk) == MQTT::SUCCESS;
+	unsigned char dup = 0, retained = 0;
+	int qos = 0;
+	unsigned short id = 0;
+	MQTTString topicName = MQTTString_initializer;
+	unsigned char* payload = NULL;
+	size_t payloadLength = 0;
+	succeeded = succeeded && MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topicName, &payload, &payloadLength, network.written, network.writtenLength) == 1
+		&& payloadLength == (size_t)length && memcmp(payload, expected, length) == 0;
+
+	network.writtenLength = 0;
+	streamFailAt = 0;
+	succeeded = succeeded && client.publishStream("test/stream", length, fillStreamChunk) == MQTT::FAILURE
+		&& network.writtenLength == 0 && client.isConnected() && !network.disconnected;
+	streamFailAt = length / 2;
+	succeeded = succeeded && client.publishStream("test/stream", length, fillStreamChunk) == MQTT::FAILURE
+		&& network.writtenLength > 0 && !client.isConnected() && network.disconnected;
+	reportTest("Stream a large publish from a callback", succeeded);
+}
+
+unsigned short ackedIds[8];
+int ackedCount = 0;
+
+/**
+* Publish acknowledgement handler that records the packet ids.
+* @param[in] id The packet id of the acknowledged publish
+*/
+void recordAck(unsigned short id)
+{
+	if (ackedCount < (int)(sizeof(ackedIds) / sizeof(ackedIds[0])))
+		ackedIds[ackedCount++] = id;
+}
+
+/**
+* Test QoS 1 publishes return without waiting while the window has room, that the publish that fills the window waits
+* for an acknowledgement, and that acknowledgements that arrive out of order release the right publishes.
+*/
+void testPublishWindow(void)
+{
+	const int window = 3;
+	unsigned short ids[window];
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	client.setPublishAckHandler(recordAck);
+	ackedCount = 0;
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	client.setPublishWindow(window);
+	for (int i = 0; i < window - 1 && succeeded; ++i)
+		succeeded = client.publish("test/window", (void*)"w", 1, ids[i], MQTT::QOS1) == MQTT::SUCCESS;
+	succeeded = succeeded && client.getInflightCount() == window - 1 && ackedCount == 0;
+	addAck(network, PUBACK_MSG, ids[1]);
+	succeeded = succeeded && client.publish("test/window", (void*)"w", 1, ids[window - 1], MQTT::QOS1) == MQTT::SUCCESS
+		&& client.getInflightCount() == window - 1 && ackedCount == 1 && ackedIds[0] == ids[1];
+	addAck(network, PUBACK_MSG, ids[2]);
+	addAck(network, PUBACK_MSG, ids[0]);
+	succeeded = succeeded && client.waitForAcks(100) == MQTT::SUCCESS && client.getInflightCount() == 0 && ackedCount == 3
+		&& ackedIds[1] == ids[2] && ackedIds[2] == ids[0];
+	client.disconnect();
+	reportTest("Keep a window of QoS 1 publishes in flight", succeeded);
+}
+
+/**
+* Test the acknowledgements of a burst of QoS 1 publishes go out together in one write, in the order the publishes
+* arrived.
+*/
+void testCoalescedAcks(void)
+{
+	const unsigned char pubacks[] = { PUBACK_MSG, PUBACK_MSG, PUBACK_MSG };
+	const unsigned short ids[] = { 7, 3, 9 };
+	const int count = sizeof(ids) / sizeof(ids[0]);
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	client.setDefaultMessageHandler(recordMessage);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	clearMessages();
+	for (int i = 0; i < count; ++i)
+		addPublish(network, "test/acks", "a", 1, ids[i]);
+	network.writtenLength = network.writeCount = 0;
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "a|a|a|") == 0;
+	succeeded = succeeded && network.writeCount == 1 && checkAcks(network, pubacks, ids, count);
+	client.disconnect();
+	reportTest("Acknowledge a burst of publishes in one write", succeeded);
+}
+
+/**
+* Test a QoS 2 publish is delivered once however often it is resent before its PUBREL, that packet ids that share a
+* byte of the bitset are tracked apart, and that an id can be used again once the PUBREL has freed it.
+*/
+void testQoS2Duplicates(void)
+{
+	const unsigned char pubrecs[] = { PUBREC_MSG, PUBREC_MSG, PUBREC_MSG, PUBREC_MSG };
+	const unsigned short firstIds[] = { 65535, 8, 65535, 9 };
+	const unsigned char pubcomps[] = { PUBCOMP_MSG, PUBCOMP_MSG, PUBREC_MSG };
+	const unsigned short secondIds[] = { 65535, 8, 65535 };
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	client.setDefaultMessageHandler(recordMessage);
+	bool succeeded = (connectSession(client, network, false) == MQTT::SUCCESS);
+	clearMessages();
+	addPublish(network, "test/qos2", "last", 2, 65535);
+	addPublish(network, "test/qos2", "eight", 2, 8);
+	addPublish(network, "test/qos2", "last again", 2, 65535);
+	addPublish(network, "test/qos2", "nine", 2, 9);
+	network.writtenLength = 0;
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "last|eight|nine|") == 0
+		&& checkAcks(network, pubrecs, firstIds, 4);
+	clearMessages();
+	addAck(network, PUBREL_MSG, 65535);
+	addAck(network, PUBREL_MSG, 8);
+	addPublish(network, "test/qos2", "reused", 2, 65535);
+	network.writtenLength = 0;
+	succeeded = succeeded && client.yield(10) == MQTT::SUCCESS && strcmp(receivedPayloads, "reused|") == 0
+		&& checkAcks(network, pubcomps, secondIds, 3);
+	client.disconnect();
+	reportTest("Deliver each QoS 2 publish once", succeeded);
+}
+
+/**
+* Read an MQTT 5 publish written to the memory network.
+* @param[in] network The network the client wrote to
+* @param[in,out] offset The offset of the packet, moved on to the next one
+* @param[out] topicName The topic name
+* @param[out] alias The topic alias, 0 if there is none
+* @return true if the packet is a publish, false otherwise
+*/
+bool readV5Publish(MemoryNetwork& network, int& offset, MQTTString& topicName, int& alias)
+{
+	MQTTProperty array[4];
+	MQTTProperties properties = { 0, 4, 0, array };
+	unsigned char dup = 0, retained = 0;
+	int qos = 0, remainingLength = 0;
+	unsigned short id = 0;
+	unsigned char* payload = NULL;
+	size_t payloadLength = 0;
+	if (offset >= network.writtenLength)
+		return false;
+	int length = 1 + MQTTPacket_decodeBuf(&network.written[offset + 1], &remainingLength) + remainingLength;
+	int rc = MQTTV5Deserialize_publish(&dup, &qos, &retained, &id, &topicName, &properties, &payload, &payloadLength, &network.written[offset], length);
+	MQTTProperty* property = MQTTProperties_get(&properties, MQTTPROPERTY_CODE_TOPIC_ALIAS);
+	alias = property ? property->value.integer2 : 0;
+	offset += length;
+	return rc == 1;
+}
+
+/**
+* Test an MQTT 5 connection keeps to the limits the server sets in its connack: a topic is sent in full once with an
+* alias and by the alias alone after that, QoS 1 publishes wait once the receive maximum is reached even though the
+* window is bigger, and a publish over the maximum packet size fails with its reason code and keeps the connection.
+*/
+void testMQTT5Limits(void)
+{
+	// receive maximum 2, topic alias maximum 5 and maximum packet size 64
+	const unsigned char connack[] = { 0x20, 0x0E, 0x00, 0x00, 0x0B, 0x21, 0x00, 0x02, 0x22, 0x00, 0x05, 0x27, 0x00, 0x00, 0x00, 0x40 };
+	static char large[101];
+	fillPattern(large, sizeof(large) - 1);
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	data.MQTTVersion = 5;
+	data.clientID.cstring = opts.clientID;
+	MemoryNetwork network;
+	SessionClient client(network, 100);
+	network.addReply(connack, sizeof(connack));
+	bool succeeded = (client.connect(data) == MQTT::SUCCESS);
+
+	network.writtenLength = 0;
+	succeeded = succeeded && client.publish("test/alias", (void*)"1", 1) == MQTT::SUCCESS && client.publish("test/alias", (void*)"2", 1) == MQTT::SUCCESS;
+	MQTTString first = MQTTString_initializer, second = MQTTString_initializer;
+	int offset = 0, firstAlias = 0, secondAlias = 0;
+	succeeded = succeeded && readV5Publish(network, offset, first, firstAlias) && readV5Publish(network, offset, second, secondAlias)
+		&& first.lenstring.len == 10 && memcmp(first.lenstring.data, "test/alias", 10) == 0 && firstAlias > 0
+		&& second.lenstring.len == 0 && secondAlias == firstAlias;
+	reportTest("Send an MQTT 5 topic by its alias", succeeded);
+
+	unsigned short firstId = 0, secondId = 0;
+	client.setPublishWindow(5);
+	succeeded = client.publish("test/limit", (void*)"1", 1, firstId, MQTT::QOS1) == MQTT::SUCCESS && client.getInflightCount() == 1;
+	addAck(network, PUBACK_MSG, firstId);
+	// the second publish reaches the receive maximum, so it waits for the first to be acknowledged
+	succeeded = succeeded && client.publish("test/limit", (void*)"2", 1, secondId, MQTT::QOS1) == MQTT::SUCCESS && client.getInflightCount() == 1;
+	addAck(network, PUBACK_MSG, secondId);
+	succeeded = succeeded && client.waitForAcks(100) == MQTT::SUCCESS;
+	succeeded = succeeded && client.publish("test/limit", large, strlen(large)) == MQTT::FAILURE
+		&& client.getReasonCode() == MQTTREASONCODE_PACKET_TOO_LARGE && client.isConnected();
+	client.disconnect();
+	reportTest("Keep to the MQTT 5 receive maximum and maximum packet size", succeeded);
+}
+
+/**
+* Test the MQTT-SN codec: a publish to a topic id is written byte for byte as the specification lays it out and reads
+* back the same, a short topic name and a payload long enough for the three byte length round trip too, a topic
+* registration reads back, and a truncated packet is rejected.
+*/
+void testSNCodec(void)
+{
+	// length, PUBLISH, flags for QoS 1, retained and a normal topic id, topic id 0x1234, packet id 7, payload
+	const unsigned char expected[] = { 0x0B, 0x0C, 0x30, 0x12, 0x34, 0x00, 0x07, '2', '1', '.', '5' };
+	static unsigned char packet[512];
+	static char large[301];
+	fillPattern(large, sizeof(large) - 1);
+	MQTTSN_topicid topic;
+	topic.type = MQTTSN_TOPIC_TYPE_NORMAL;
+	topic.data.id = 0x1234;
+	int length = MQTTSNSerialize_publish(packet, sizeof(packet), 0, 1, 1, 7, topic, (unsigned char*)"21.5", 4);
+	bool succeeded = length == (int)sizeof(expected) && memcmp(packet, expected, length) == 0 && MQTTSNPacket_type(packet, length) == MQTTSN_PUBLISH;
+
+	unsigned char dup = 1, retained = 0;
+	int qos = 0, payloadLength = 0;
+	unsigned short id = 0;
+	unsigned char* payload = NULL;
+	MQTTSN_topicid read;
+	succeeded = succeeded && MQTTSNDeserialize_publish(&dup, &qos, &retained, &id, &read, &payload, &payloadLength, packet, length) == 1
+		&& dup == 0 && qos == 1 && retained == 1 && id == 7 && read.type == MQTTSN_TOPIC_TYPE_NORMAL && read.data.id == 0x1234
+		&& payloadLength == 4 && memcmp(payload, "21.5", 4) == 0;
+	succeeded = succeeded && MQTTSNPacket_type(packet, length - 1) == MQTTPACKET_READ_ERROR
+		&& MQTTSNDeserialize_publish(&dup, &qos, &retained, &id, &read, &payload, &payloadLength, packet, length - 1) == 0;
+
+	topic.type = MQTTSN_TOPIC_TYPE_SHORT;
+	topic.data.short_name[0] = 't';
+	topic.data.short_name[1] = '1';
+	length = MQTTSNSerialize_publish(packet, sizeof(packet), 0, 0, 0, 0, topic, (unsigned char*)large, strlen(large));
+	succeeded = succeeded && length == MQTTSNSerialize_publishLength(strlen(large)) && packet[0] == 0x01 && (packet[1] << 8) + packet[2] == length
+		&& MQTTSNDeserialize_publish(&dup, &qos, &retained, &id, &read, &payload, &payloadLength, packet, length) == 1
+		&& read.type == MQTTSN_TOPIC_TYPE_SHORT && read.data.short_name[0] == 't' && read.data.short_name[1] == '1'
+		&& payloadLength == (int)strlen(large) && memcmp(payload, large, payloadLength) == 0;
+
+	MQTTString name = MQTTString_initializer, readName = MQTTString_initializer;
+	name.cstring = (char*)"v1/user/things/device/data/1";
+	unsigned short topicId = 0;
+	length = MQTTSNSerialize_register(packet, sizeof(packet), 0, 9, &name);
+	succeeded = succeeded && MQTTSNDeserialize_register(&topicId, &id, &readName, packet, length) == 1 && topicId == 0 && id == 9
+		&& readName.lenstring.len == strlen(name.cstring) && memcmp(readName.lenstring.data, name.cstring, readName.lenstring.len) == 0;
+	unsigned char returnCode = 0xFF;
+	length = MQTTSNSerialize_regack(packet, sizeof(packet), 0x0102, 9, MQTTSN_RC_ACCEPTED);
+	succeeded = succeeded && MQTTSNDeserialize_regack(&topicId, &id, &returnCode, packet, length) == 1 && topicId == 0x0102 && id == 9
+		&& returnCode == MQTTSN_RC_ACCEPTED;
+	reportTest("Encode and decode MQTT-SN packets", succeeded);
+}
+
 /**
 * Main function.
 * @param[in] argc Count of command line arguments.
 * @param[in] argv Command line argument string array.
 * @return Failure count, 0 if no tests failed
 */
+/**
+* Check that a number formats as expected.
+* @param[in] value The number
+* @param[in] precision The most decimal places to write, or CAYENNE_PRECISION_SHORTEST
+* @param[in] expected The expected number string
+* @return true if the number formatted as expected, false otherwise
+*/
+bool checkDouble(double value, int precision, const char* expected)
+{
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	return CayenneFormatDouble(str, &length, value, precision) == CAYENNE_SUCCESS && length == strlen(expected) && strcmp(str, expected) == 0;
+}
+
+/**
+* Count the significant digits of a number string, from the first nonzero digit to the last, leaving out the exponent.
+* @param[in] str The number string
+* @return The number of significant digits
+*/
+int significantDigits(const char* str)
+{
+	int count = 0, zeros = 0;
+	for (; *str && *str != 'e'; ++str) {
+		if (*str >= '1' && *str <= '9') {
+			count += zeros + 1;
+			zeros = 0;
+		}
+		else if (*str == '0' && count)
+			++zeros;
+	}
+	return count;
+}
+
+/**
+* Test number formatting at the edges: fixed precision rounds like printf, shortest numbers read back as the same
+* value whether they are found by trying each length or by Grisu2, and numbers that don't fit are refused.
+*/
+void testNumberFormatting(void)
+{
+	bool succeeded = checkDouble(0.1, CAYENNE_PRECISION_SHORTEST, "0.1") && checkDouble(0.1 + 0.2, CAYENNE_PRECISION_SHORTEST, "0.30000000000000004")
+		&& checkDouble(1e21, CAYENNE_PRECISION_SHORTEST, "1000000000000000000000") && checkDouble(1e-7, CAYENNE_PRECISION_SHORTEST, "0.0000001")
+		&& checkDouble(5e-324, CAYENNE_PRECISION_SHORTEST, "5e-324") && checkDouble(DBL_MAX, CAYENNE_PRECISION_SHORTEST, "1.7976931348623157e+308")
+		&& checkDouble(-0.0, CAYENNE_PRECISION_SHORTEST, "0") && checkDouble(-0.001, 2, "0") && checkDouble(NAN, CAYENNE_PRECISION_SHORTEST, "nan")
+		&& checkDouble(-INFINITY, 2, "-inf") && checkDouble(2.675, 2, "2.67") && checkDouble(0.125, 2, "0.12") && checkDouble(99.9999, 3, "100")
+		&& checkDouble(21.5, 0, "22") && checkDouble(1.5, 20, "1.5");
+
+	char str[CAYENNE_NUMBER_SIZE];
+	size_t length = sizeof(str);
+	succeeded = succeeded && CayenneFormatFloat(str, &length, 7.7f, CAYENNE_PRECISION_SHORTEST) == CAYENNE_SUCCESS && strcmp(str, "7.7") == 0;
+	length = sizeof(str);
+	succeeded = succeeded && CayenneFormatFloat(str, &length, FLT_MAX, CAYENNE_PRECISION_SHORTEST) == CAYENNE_SUCCESS && strcmp(str, "3.4028235e+38") == 0;
+	length = sizeof(str);
+	succeeded = succeeded && CayenneFormatLong(str, &length, LONG_MIN) == CAYENNE_SUCCESS && strtol(str, NULL, 10) == LONG_MIN;
+	length = sizeof(str);
+	succeeded = succeeded && CayenneFormatULong(str, &length, ULONG_MAX) == CAYENNE_SUCCESS && strtoul(str, NULL, 10) == ULONG_MAX;
+
+	// "21.55" and its terminating null need 6 bytes.
+	length = 5;
+	succeeded = succeeded && CayenneFormatDouble(str, &length, 21.55, 2) == CAYENNE_BUFFER_OVERFLOW;
+	length = 6;
+	succeeded = succeeded && CayenneFormatDouble(str, &length, 21.55, 2) == CAYENNE_SUCCESS && length == 5 && strcmp(str, "21.55") == 0;
+	length = 3;
+	succeeded = succeeded && CayenneFormatLong(str, &length, -10) == CAYENNE_BUFFER_OVERFLOW;
+
+	// Random bit patterns cover both the digit search and Grisu2, each must read back as the same value with at most 17 significant digits.
+	srand(1);
+	for (int i = 0; succeeded && i < 100000; ++i) {
+		unsigned long long bits = ((unsigned long long)rand() << 42) ^ ((unsigned long long)rand() << 21) ^ (unsigned long long)rand();
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		if (value != value || value - value != 0)
+			continue;
+		length = sizeof(str);
+		succeeded = CayenneFormatDouble(str, &length, value, CAYENNE_PRECISION_SHORTEST) == CAYENNE_SUCCESS && strtod(str, NULL) == value
+			&& significantDigits(str) <= 17;
+		float single = (float)((rand() % 2000001) - 1000000) / 1000.0f;
+		length = sizeof(str);
+		succeeded = succeeded && CayenneFormatFloat(str, &length, single, CAYENNE_PRECISION_SHORTEST) == CAYENNE_SUCCESS && strtof(str, NULL) == single;
+	}
+	reportTest("Format numbers at the edges of their range and precision", succeeded);
+}
+
+CAYENNE_STATIC_STRING(StaticUsername, "user");
+CAYENNE_STATIC_STRING(StaticClientID, "device");
+
+/**
+* Check that a StaticChannel builds the same topic and payload as CayenneBuildDataPublish.
+* @param[in] topic Cayenne topic
+* @param[in] channel The channel, or CAYENNE_NO_CHANNEL
+* @param[in] type The type string the channel was declared with, NULL for none
+* @param[in] unit The unit string the channel was declared with, NULL for none
+* @param[in] value The data value
+* @return true if the packets match, false otherwise
+*/
+template<class Channel>
+bool checkStaticChannel(CayenneTopic topic, unsigned int channel, const char* type, const char* unit, const char* value)
+{
+	unsigned char built[256], expected[256];
+	size_t builtLength = sizeof(built), expectedLength = sizeof(expected);
+	CayenneValuePair pair = { unit, value };
+	if (Channel::build(built, &builtLength, value) != CAYENNE_SUCCESS
+		|| CayenneBuildDataPublish(expected, &expectedLength, "user", "device", topic, channel, type, &pair, 1) != CAYENNE_SUCCESS)
+		return false;
+	if (builtLength != expectedLength || memcmp(built, expected, builtLength) != 0)
+		return false;
+	// The value is followed by its null, so a buffer one byte short of that is refused.
+	builtLength = Channel::prefixLength + strlen(value);
+	return Channel::build(built, &builtLength, value) == CAYENNE_BUFFER_OVERFLOW;
+}
+
+/**
+* Test that StaticChannel prefixes, built by the compiler, match the ones built at run time for each combination of
+* channel, type and unit, and that publishing to one sends the same packet as publishing the value the usual way.
+*/
+void testStaticChannel(void)
+{
+	bool succeeded = checkStaticChannel<CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, DATA_TOPIC, 5, TEMPERATURE_TYPE, CELSIUS_UNIT> >(
+		DATA_TOPIC, 5, TYPE_TEMPERATURE, UNIT_CELSIUS, "21.5")
+		&& checkStaticChannel<CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, DATA_TOPIC, 1234, LUMINOSITY_TYPE> >(
+		DATA_TOPIC, 1234, TYPE_LUMINOSITY, NULL, "300")
+		&& checkStaticChannel<CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, DATA_TOPIC, 0, NO_TYPE, PERCENT_UNIT> >(
+		DATA_TOPIC, 0, NULL, UNIT_PERCENT, "50")
+		&& checkStaticChannel<CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, SYS_MODEL_TOPIC> >(
+		SYS_MODEL_TOPIC, CAYENNE_NO_CHANNEL, NULL, NULL, "Model");
+
+	const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	unsigned char expected[256];
+	int expectedLength = 0;
+	CayenneMQTT::StaticChannel<StaticUsername, StaticClientID, DATA_TOPIC, 5, TEMPERATURE_TYPE, CELSIUS_UNIT> temperature;
+	MemoryNetwork network;
+	CayenneMQTT::MQTTClient<MemoryNetwork, MQTTTimer> client(network, "user", "password", "device", 100);
+	network.addReply(connack, sizeof(connack));
+	succeeded = succeeded && client.connect() == CAYENNE_SUCCESS;
+	network.writtenLength = 0;
+	succeeded = succeeded && client.publishData(DATA_TOPIC, 5, TYPE_TEMPERATURE, UNIT_CELSIUS, 21.25) == CAYENNE_SUCCESS;
+	expectedLength = network.writtenLength;
+	memcpy(expected, network.written, expectedLength);
+	network.writtenLength = 0;
+	succeeded = succeeded && expectedLength > 0 && client.publishData(temperature, 21.25) == CAYENNE_SUCCESS && network.writtenLength == expectedLength
+		&& memcmp(network.written, expected, expectedLength) == 0;
+	reportTest("Build static channel packets like the ones built at run time", succeeded);
+}
+
 int main(int argc, char** argv)
 {
 #ifdef PARSE_INFO_PAYLOADS // Defined by the makefile so we can receive and check DATA_TOPIC messages.
@@ -584,6 +1517,24 @@ int main(int argc, char** argv)
 	getOptions(argc, argv);
 
 	printf("Cayenne MQTT Test\n");
+	testResendInflight();
+	testSessionSnapshot();
+	testBeginConnect();
+	testSubscribeMany();
+	testAddressCache();
+	testReceiveFraming();
+	testReceiveFragments();
+	testStreamPublish();
+	testPublishWindow();
+	testCoalescedAcks();
+	testQoS2Duplicates();
+	testMQTT5Limits();
+	testSNCodec();
+	testNumberFormatting();
+	testStaticChannel();
+	if (opts.offline)
+		return failureCount;
+
 	mqttClient.init(opts.username, opts.password, opts.clientID);
 	mqttClient.setDefaultMessageHandler(defaultMessageHandler);
 	if (connectClient() != CAYENNE_SUCCESS) {
@@ -93,7 +93,12 @@ public:
 			if (_socket != -1)
 			{
 				if ((rc = ::connect(_socket, (struct sockaddr*)&address, sizeof(address))) == 0)
+				{
+					// Packets are written whole, or gathered by the client, so don't let Nagle hold them back.
+					int noDelay = 1;
+					setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
 					_connected = true;
+				}
 			}
 		}
 
@@ -101,11 +106,11 @@ public:
 	}
 
 	/**
-	* Read data from the network.
+	* Read data from the network. This returns as soon as any data is available, so fewer than len bytes may be read.
 	* @param[out] buffer Buffer that receives the data
 	* @param[in] len Buffer length
 	* @param[in] timeout_ms Timeout for the read operation, in milliseconds
-	* @return Number of bytes read, or a negative value if there was an error
+	* @return Number of bytes read, 0 if the timeout expired before any data arrived, or a negative value if there was an error
 	*/
 	int read(unsigned char* buffer, int len, int timeout_ms)
 	{
@@ -113,22 +118,18 @@ public:
 		DWORD interval = 1;
 		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&interval, sizeof(interval));
 
-		int bytes = 0;
-		while (bytes < len && _connected)
+		int bytes = -1;
+		if (_connected)
 		{
-			int rc = ::recv(_socket, reinterpret_cast<char*>(&buffer[bytes]), (size_t)(len - bytes), 0);
-			if (rc == -1)
-			{
-				if (errno != ENOTCONN && errno != ECONNRESET)
-				{
-					bytes = -1;
-					break;
-				}
-			}
-			else if ((rc == 0 && len != 0) || errno == ENOTCONN || errno == ECONNRESET || errno == EPIPE)
+			int rc = ::recv(_socket, reinterpret_cast<char*>(buffer), (size_t)len, 0);
+			if (rc > 0)
+				bytes = rc;
+			else if (rc == 0 && len != 0)
+				_connected = false;
+			else if (rc == 0 || WSAGetLastError() == WSAETIMEDOUT || WSAGetLastError() == WSAEWOULDBLOCK)
+				bytes = 0;
+			else if (WSAGetLastError() == WSAENOTCONN || WSAGetLastError() == WSAECONNRESET)
 				_connected = false;
-			else
-				bytes += rc;
 		}
 
 		return bytes;